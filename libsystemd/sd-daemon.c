@@ -11,6 +11,8 @@
 
 #define _GNU_SOURCE 1
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <inttypes.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -180,35 +182,125 @@ int sd_pid_notifyf(pid_t pid, int unset_environment, const char *format, ...)
 }
 
 /*
- * Socket activation stub - Finit doesn't support socket activation yet
- * Returns 0 (no file descriptors passed)
+ * Socket activation, Finit passes the sockets of services declared with
+ * socket:SPEC starting at SD_LISTEN_FDS_START, with LISTEN_FDS and
+ * LISTEN_PID set.  The fds are set close-on-exec.
+ *
+ * Returns the number of fds passed to this process, 0 if none, or a
+ * negative errno if the variables are invalid.
  */
 int sd_listen_fds(int unset_environment)
 {
+	const char *s;
+	long pid, n;
+	char *end;
+	int ret = 0;
+	int fd;
+
+	s = getenv("LISTEN_PID");
+	if (!s)
+		goto done;
+
+	errno = 0;
+	pid = strtol(s, &end, 10);
+	if (errno || *end || pid <= 0) {
+		ret = -EINVAL;
+		goto done;
+	}
+
+	/* Not for us, e.g., a child process */
+	if (pid != getpid())
+		goto done;
+
+	s = getenv("LISTEN_FDS");
+	if (!s)
+		goto done;
+
+	errno = 0;
+	n = strtol(s, &end, 10);
+	if (errno || *end || n < 0 || n > INT_MAX - SD_LISTEN_FDS_START) {
+		ret = -EINVAL;
+		goto done;
+	}
+
+	for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + n; fd++) {
+		int flags;
+
+		flags = fcntl(fd, F_GETFD);
+		if (flags < 0) {
+			ret = -errno;
+			goto done;
+		}
+
+		if (!(flags & FD_CLOEXEC) && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0) {
+			ret = -errno;
+			goto done;
+		}
+	}
+
+	ret = (int)n;
+done:
 	if (unset_environment) {
 		unsetenv("LISTEN_PID");
 		unsetenv("LISTEN_FDS");
 		unsetenv("LISTEN_FDNAMES");
 	}
 
-	return 0;
+	return ret;
 }
 
 /*
- * Watchdog stub - Finit doesn't support watchdog yet
- * Returns 0 (no watchdog enabled)
+ * Watchdog support, Finit sets WATCHDOG_USEC and WATCHDOG_PID for
+ * services with notify:systemd and watchdog:SEC.  Send WATCHDOG=1
+ * at least every *usec / 2.
+ *
+ * Returns >0 if the watchdog is enabled for this process, 0 if not,
+ * or a negative errno if the variables are invalid.
  */
 int sd_watchdog_enabled(int unset_environment, uint64_t *usec)
 {
+	const char *s, *p = NULL;
+	unsigned long long u;
+	char *end;
+	int ret = 0;
+
+	s = getenv("WATCHDOG_USEC");
+	if (!s)
+		goto done;
+
+	errno = 0;
+	u = strtoull(s, &end, 10);
+	if (errno || *end || u == 0) {
+		ret = -EINVAL;
+		goto done;
+	}
+
+	p = getenv("WATCHDOG_PID");
+	if (p) {
+		long pid;
+
+		errno = 0;
+		pid = strtol(p, &end, 10);
+		if (errno || *end || pid <= 0) {
+			ret = -EINVAL;
+			goto done;
+		}
+
+		/* Not for us, e.g., a child process */
+		if (pid != getpid())
+			goto done;
+	}
+
+	if (usec)
+		*usec = u;
+	ret = 1;
+done:
 	if (unset_environment) {
 		unsetenv("WATCHDOG_PID");
 		unsetenv("WATCHDOG_USEC");
 	}
 
-	if (usec)
-		*usec = 0;
-
-	return 0;
+	return ret;
 }
 
 /*
@@ -26,10 +26,10 @@ int sd_notifyf(int unset_environment, const char *format, ...);
 int sd_pid_notify(pid_t pid, int unset_environment, const char *state);
 int sd_pid_notifyf(pid_t pid, int unset_environment, const char *format, ...);
 
-/* Socket activation stubs */
+/* Socket activation, LISTEN_FDS and LISTEN_PID set by Finit */
 int sd_listen_fds(int unset_environment);
 
-/* Watchdog stub */
+/* Watchdog, WATCHDOG_USEC and WATCHDOG_PID set by Finit */
 int sd_watchdog_enabled(int unset_environment, uint64_t *usec);
 
 /* System detection */
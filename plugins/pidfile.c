@@ -22,7 +22,6 @@
  * THE SOFTWARE.
  */
 
-#include <fnmatch.h>
 #include <glob.h>
 #include <limits.h>
 #include <paths.h>
@@ -36,8 +35,25 @@
 #include "iwatch.h"
 #include "log.h"
 
+/* Number of inotify events to read at a time */
+#define EV_MAX 64
+
 static struct iwatch iw_pidfile;
 
+/*
+ * Only foo.pid and foo/pid are considered, all other churn in /run, e.g.,
+ * sockets, lock files and state files, is dropped before even looking
+ * up the watch it belongs to.
+ */
+static int is_pidfile(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (!strcmp(name, "pid"))
+		return 1;
+
+	return len > 4 && !strcmp(&name[len - 4], ".pid");
+}
 
 static int pidfile_add_path(struct iwatch *iw, char *path)
 {
@@ -70,9 +86,6 @@ static void pidfile_update_conds(char *dir, char *name, uint32_t mask)
 	char *nm;
 
 	paste(fn, sizeof(fn), dir, name);
-	if (fnmatch("*\\.pid", fn, 0) && fnmatch("*/pid", fn, 0))
-		return;
-
 	dbg("path: %s, mask: %08x", fn, mask);
 
 	svc = svc_find_by_pidfile(fn);
@@ -139,7 +152,7 @@ static void pidfile_update_conds(char *dir, char *name, uint32_t mask)
 			if (pid != svc->pid) {
 				dbg("Forking service %s (cmd %s) changed PID from %d to %d",
 				   svc_ident(svc, NULL, 0), svc->cmd, svc->pid, pid);
-				svc->pid = pid;
+				svc_set_pid(svc, pid);
 
 				/* Complement log in service.c for non-forking services */
 				logit(LOG_CONSOLE | LOG_NOTICE, "Started %s[%d]", svc_ident(svc, NULL, 0), pid);
@@ -209,7 +222,7 @@ static void pidfile_handle_dir(struct iwatch *iw, char *dir, char *name, int mas
 
 static void pidfile_callback(void *arg, int fd, int events)
 {
-	static char ev_buf[8 *(sizeof(struct inotify_event) + NAME_MAX + 1) + 1];
+	static char ev_buf[EV_MAX * (sizeof(struct inotify_event) + NAME_MAX + 1) + 1];
 	struct inotify_event *ev;
 	ssize_t sz;
 	size_t off;
@@ -234,6 +247,9 @@ static void pidfile_callback(void *arg, int fd, int events)
 		if (!ev->mask)
 			continue;
 
+		if (!(ev->mask & IN_ISDIR) && !is_pidfile(ev->name))
+			continue;
+
 		/* Find base path for this event */
 		iwp = iwatch_find_by_wd(&iw_pidfile, ev->wd);
 		if (!iwp)
@@ -275,7 +291,7 @@ static void pidfile_reconf(void *arg)
 		if (cond_get(cond) == COND_ON)
 			continue;
 
-		cond_set_path(cond_path(cond), COND_ON);
+		cond_set_noupdate(cond);
 	}
 
 	/*
@@ -41,9 +41,25 @@ static void usr_cond(char *name, uint32_t mask)
 	char cond[MAX_COND_LEN] = COND_USR;
 
 	strlcat(cond, name, sizeof(cond));
+	cond_sync(cond);
 	cond_update(cond);
 }
 
+static void usr_scandir(const char *dir)
+{
+	char pattern[strlen(dir) + 3];
+	glob_t gl;
+	size_t i;
+
+	snprintf(pattern, sizeof(pattern), "%s/*", dir);
+	if (glob(pattern, GLOB_NOSORT, NULL, &gl))
+		return;
+
+	for (i = 0; i < gl.gl_pathc; i++)
+		usr_cond(basename(gl.gl_pathv[i]), IN_CREATE);
+	globfree(&gl);
+}
+
 static void usr_callback(void *arg, int fd, int events)
 {
 	static char ev_buf[8 *(sizeof(struct inotify_event) + NAME_MAX + 1) + 1];
@@ -100,6 +116,8 @@ static void usr_init(void *arg)
 	if (iwatch_add(&iw_usr, path, IN_ONLYDIR))
 		iwatch_exit(&iw_usr);
 
+	/* pick up any conditions set before we started watching */
+	usr_scandir(path);
 	free(path);
 }
 
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -41,6 +42,7 @@
 #include "finit.h"
 #include "cond.h"
 #include "conf.h"
+#include "graph.h"
 #include "helpers.h"
 #include "log.h"
 #include "plugin.h"
@@ -49,6 +51,7 @@
 #include "service.h"
 #include "sm.h"
 #include "sig.h"
+#include "trace.h"
 #include "util.h"
 
 static uev_t api_watcher;
@@ -139,7 +142,7 @@ static int do_signal_svc(svc_t *svc, void *user_data)
 		return 1;
 
 	signo = *(int *)user_data;
-	return !!kill(svc->pid, signo);
+	return !!svc_kill(svc, signo);
 }
 
 static int do_signal(char *buf, size_t len, int sig)
@@ -321,273 +324,762 @@ ev_t ev_list[] = {
 	{ NULL, NULL }
 };
 
-static void send_svc(int sd, svc_t *svc)
+/* Max number of concurrent API clients */
+#define API_MAX_CONN     64
+
+/* Close idle client connections after this many msec */
+#define API_IDLE_TIMEOUT 30000
+
+/* Max bytes queued per client, a full trace or status dump fits */
+#define API_MAX_QUEUE    (1024 * 1024)
+
+/* Retry accept() after this many msec when out of descriptors */
+#define API_RETRY        2000
+
+/* Outbound message, queued when the client is not reading fast enough */
+struct api_msg {
+	TAILQ_ENTRY(api_msg) link;
+	size_t               len;
+	char                 data[];
+};
+
+/*
+ * Per-client connection state.  Each client has its own socket watcher,
+ * so a slow or misbehaving client cannot block PID 1, and its own
+ * cursor for INIT_CMD_SVC_ITER.  The cursor is the job:id and sequence
+ * number of the next service, not a pointer, since services may be
+ * removed between calls.
+ */
+struct api_conn {
+	LIST_ENTRY(api_conn)   link;
+	uev_t                  io;
+	uev_t                  timer;
+	int                    sd;
+	int                    closing;	/* close when queue is drained */
+	int                    overflow;	/* not reading, drop client */
+
+	int                    iter_job;	/* next service, -1 at end */
+	char                   iter_id[MAX_ID_LEN];
+	unsigned int           iter_seq;
+
+	TAILQ_HEAD(, api_msg)  queue;
+	size_t                 queued;		/* bytes in queue */
+};
+
+enum {
+	API_REPLY = 0,		/* send ACK/NACK */
+	API_DONE,		/* reply already sent */
+	API_CLOSE,		/* reply (if any) sent, close connection */
+};
+
+static LIST_HEAD(, api_conn) api_conns = LIST_HEAD_INITIALIZER(api_conns);
+static int api_num_conns;
+
+static uev_t api_retry;
+static int   api_nofd;		/* Out of descriptors, logged */
+
+static void api_conn_close(struct api_conn *conn)
 {
-	svc_t empty = { 0 };
-	size_t len;
+	struct api_msg *msg;
 
-	if (!svc) {
-		empty.pid = -1;
-		svc = &empty;
+	uev_io_stop(&conn->io);
+	uev_timer_stop(&conn->timer);
+	close(conn->sd);
+
+	while ((msg = TAILQ_FIRST(&conn->queue))) {
+		TAILQ_REMOVE(&conn->queue, msg, link);
+		free(msg);
 	}
 
-	len = write(sd, svc, sizeof(*svc));
-	if (len != sizeof(*svc))
-		dbg("Failed sending svc_t to client");
+	LIST_REMOVE(conn, link);
+	api_num_conns--;
+	free(conn);
 }
 
-static void api_cb(uev_t *w, void *arg, int events)
+/* Drain outbound queue, returns -1 on error, 1 if client is busy */
+static int api_conn_flush(struct api_conn *conn)
 {
-	static svc_t *iter = NULL;
-	struct init_request rq;
-	int sd, lvl;
-	svc_t *svc;
+	struct api_msg *msg;
 
-	(void)arg;
+	while ((msg = TAILQ_FIRST(&conn->queue))) {
+		if (write(conn->sd, msg->data, msg->len) != (ssize_t)msg->len) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 1;
 
-	if (UEV_ERROR == events) {
-		dbg("%s(): api socket %d invalid.", __func__, w->fd);
-		goto error;
+			dbg("Failed sending reply to client: %s", strerror(errno));
+			return -1;
+		}
+
+		TAILQ_REMOVE(&conn->queue, msg, link);
+		conn->queued -= sizeof(*msg) + msg->len;
+		free(msg);
 	}
 
-	/*
-	 * TODO: refactor to use accept4() and a new uev handler for the
-	 * client socket instead of risking blocking PID 1 if the client
-	 * is misbehaving.
-	 */
-//	sd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK);
-	sd = accept(w->fd, NULL, NULL);
-	if (sd < 0) {
-		err(1, "Failed serving API request");
-		goto error;
+	return 0;
+}
+
+/*
+ * Send one message (SOCK_SEQPACKET record) to client.  If the client
+ * is not reading, the message is queued and sent when the socket is
+ * writable again.  Messages are always delivered in order.  A client
+ * that lets more than API_MAX_QUEUE bytes pile up is dropped, see
+ * api_conn_cb(), it is not worth an unbounded amount of PID 1 memory.
+ */
+static int api_send(struct api_conn *conn, const void *buf, size_t len)
+{
+	struct api_msg *msg;
+
+	if (conn->overflow)
+		return -1;
+
+	if (TAILQ_EMPTY(&conn->queue)) {
+		if (write(conn->sd, buf, len) == (ssize_t)len)
+			return 0;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			dbg("Failed sending reply to client: %s", strerror(errno));
+			return -1;
+		}
 	}
 
-	while (1) {
-		int result = 0;
-		ssize_t len;
+	if (conn->queued + sizeof(*msg) + len > API_MAX_QUEUE) {
+		warnx("API client %d not reading replies, dropping connection.", conn->sd);
+		conn->overflow = 1;
+		return -1;
+	}
 
-		len = read(sd, &rq, sizeof(rq));
-		if (len <= 0) {
-			if (-1 == len) {
-				if (EINTR == errno)
-					continue;
+	msg = malloc(sizeof(*msg) + len);
+	if (!msg)
+		return -1;
 
-				if (EAGAIN == errno)
-					break;
+	msg->len = len;
+	memcpy(msg->data, buf, len);
+	TAILQ_INSERT_TAIL(&conn->queue, msg, link);
+	conn->queued += sizeof(*msg) + len;
 
-				/* we get here when client restarts itself */
-				if (ECONNRESET == errno)
-					break;
+	uev_io_set(&conn->io, conn->sd, UEV_READ | UEV_WRITE);
 
-				errx(1, "Failed reading initctl request, error %d: %s", errno, strerror(errno));
-			}
+	return 0;
+}
+
+/* One record per condition, terminated by closing the connection */
+static int send_cond_dep(struct cond_stat *st, void *arg)
+{
+	struct api_conn *conn = arg;
+	char buf[MAX_COND_LEN + 64];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s %zu %u %u %u", st->name,
+		       st->deps, st->updates, st->stepped, st->last);
+	if (len < 0 || (size_t)len >= sizeof(buf))
+		return 0;
+
+	if (api_send(conn, buf, len)) {
+		dbg("Failed sending condition %s to client", st->name);
+		return 1;
+	}
 
+	return 0;
+}
+
+/*
+ * One record per service, terminated by closing the connection.  Times
+ * are in usec, CLOCK_MONOTONIC, 0 if not (yet) reached.  Records must
+ * fit in a struct init_request, so the list of deps may be truncated.
+ */
+static void send_graph(struct api_conn *conn)
+{
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		char buf[sizeof(struct init_request)];
+		char deps[200];
+		int len;
+
+		len = snprintf(buf, sizeof(buf), "%s %d %s %lld %lld %lld %s",
+			       svc_ident(svc, NULL, 0), svc->graph.rank, svc_status(svc),
+			       (long long)svc->graph.eligible, (long long)svc->graph.start,
+			       (long long)svc->graph.ready, graph_deps(svc, deps, sizeof(deps)));
+		if (len < 0 || (size_t)len >= sizeof(buf))
+			continue;
+
+		if (api_send(conn, buf, len)) {
+			dbg("Failed sending graph of %s to client", svc_ident(svc, NULL, 0));
 			break;
 		}
+	}
+}
 
-		if (rq.magic != INIT_MAGIC || len != sizeof(rq)) {
-			errx(1, "Invalid initctl request");
+/* Batches of trace events, terminated by closing the connection */
+static int send_trace(struct trace_event *ev, size_t num, void *arg)
+{
+	struct api_conn *conn = arg;
+
+	if (api_send(conn, ev, num * sizeof(*ev))) {
+		dbg("Failed sending trace events to client");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * filter: 'foo'   should match foo:1 foo:2, etc. but not foobar
+ * filter: 'foo:1' should only match foo:1
+ * filter: ''      matches all services
+ */
+static int svc_match(svc_t *svc, const char *filter)
+{
+	char ident[MAX_IDENT_LEN];
+	char *ptr;
+
+	if (!filter[0])
+		return 1;
+
+	svc_ident(svc, ident, sizeof(ident));
+	ptr = strchr(ident, ':');
+	if (ptr && !strchr(filter, ':'))
+		*ptr = 0;
+
+	return !strcmp(ident, filter);
+}
+
+static size_t pack_str(char *buf, size_t off, size_t len, const char *str)
+{
+	size_t n;
+
+	if (!str)
+		str = "";
+
+	n = strlen(str) + 1;
+	if (off + n > len)
+		return off;
+
+	memcpy(&buf[off], str, n);
+
+	return off + n;
+}
+
+/*
+ * Encode @svc as a compact struct svc_record, a record with pid -1 is
+ * used to signal no match, or end of list.
+ */
+static struct svc_record *pack_svc(svc_t *svc)
+{
+	static char buf[UINT16_MAX];
+	struct svc_record *rec = (struct svc_record *)buf;
+	size_t off, len = sizeof(buf);
+	int i;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->version     = SVC_RECORD_VERSION;
+	if (!svc) {
+		rec->pid = -1;
+		rec->len = offsetof(struct svc_record, strings);
+		return rec;
+	}
+
+	rec->type        = svc->type;
+	rec->state       = svc->state;
+	rec->block       = svc->block;
+	rec->flags       = (svc->forking ? SVC_RECORD_FORKING : 0) |
+			   (svc->manual  ? SVC_RECORD_MANUAL  : 0) |
+			   (svc->started ? SVC_RECORD_STARTED : 0);
+	rec->pid         = svc->pid;
+	rec->status      = svc->status;
+	rec->runlevels   = svc->runlevels;
+	rec->once        = svc->once;
+	rec->restart_tot = svc->restart_tot;
+	rec->restart_cnt = svc->restart_cnt;
+	rec->restart_max = svc->restart_max;
+	rec->watchdog    = svc->watchdog;
+	rec->start_time  = svc->start_time;
+
+	off = offsetof(struct svc_record, strings);
+	off = pack_str(buf, off, len, svc->name);
+	off = pack_str(buf, off, len, svc->id);
+	off = pack_str(buf, off, len, svc->desc);
+	off = pack_str(buf, off, len, svc->cgroup.name);
+	off = pack_str(buf, off, len, svc->file);
+	off = pack_str(buf, off, len, svc->pidfile);
+	off = pack_str(buf, off, len, svc->username);
+	off = pack_str(buf, off, len, svc->group);
+	off = pack_str(buf, off, len, svc->cond);
+	off = pack_str(buf, off, len, svc->env);
+	off = pack_str(buf, off, len, svc->notify_status);
+	off = pack_str(buf, off, len, svc->cmd);
+	for (i = 1; svc->args[0] && svc->args[i]; i++) {
+		size_t next = pack_str(buf, off, len, svc->args[i]);
+
+		if (next == off)
 			break;
-		}
+		off = next;
+		rec->nargs++;
+	}
+	rec->len = off;
 
-		switch (rq.cmd) {
-		case INIT_CMD_RELOAD:
-		case INIT_CMD_START_SVC:
-		case INIT_CMD_RESTART_SVC:
-		case INIT_CMD_STOP_SVC:
-		case INIT_CMD_RELOAD_SVC:
-		case INIT_CMD_REBOOT:
-		case INIT_CMD_HALT:
-		case INIT_CMD_POWEROFF:
-		case INIT_CMD_SUSPEND:
-			if (IS_RESERVED_RUNLEVEL(runlevel)) {
-				strterm(rq.data, sizeof(rq.data));
-				warnx("Unsupported command (cmd: %d, data: %s) in runlevel S and 6/0.",
-				      rq.cmd, rq.data);
-				goto leave;
-			}
-		default:
+	return rec;
+}
+
+static void send_svc(struct api_conn *conn, svc_t *svc)
+{
+	struct svc_record *rec = pack_svc(svc);
+
+	if (api_send(conn, rec, rec->len))
+		dbg("Failed sending svc to client");
+}
+
+/* Stream one compact struct svc_record per matching service */
+static void send_svc_status(struct api_conn *conn, const char *filter)
+{
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		struct svc_record *rec;
+
+		if (!svc_match(svc, filter))
+			continue;
+
+		rec = pack_svc(svc);
+		if (api_send(conn, rec, rec->len)) {
+			dbg("Failed sending %s status to client", svc_ident(svc, NULL, 0));
 			break;
 		}
+	}
+}
 
-		switch (rq.cmd) {
-		case INIT_CMD_RUNLVL:
-			/* Allow changing cfglevel in runlevel S */
-			if (IS_RESERVED_RUNLEVEL(runlevel)) {
-				if (runlevel != INIT_LEVEL) {
-					warnx("Cannot abort runlevel 6/0.");
+/*
+ * Per-connection version of svc_iterator().  If the next service has
+ * been removed, or replaced, since the last call we continue with the
+ * first service registered after it, svc_iterator() order is the same
+ * as registration order.
+ */
+static svc_t *api_iterator(struct api_conn *conn, int first)
+{
+	svc_t *svc, *iter = NULL;
+
+	if (first)
+		svc = svc_iterator(&iter, 1);
+	else if (conn->iter_job < 0)
+		svc = NULL;
+	else {
+		iter = svc_find_by_jobid(conn->iter_job, conn->iter_id);
+		if (!iter || iter->seq != conn->iter_seq) {
+			svc_t *tmp = NULL;
+
+			for (iter = svc_iterator(&tmp, 1); iter; iter = svc_iterator(&tmp, 0)) {
+				if (iter->seq >= conn->iter_seq)
 					break;
-				}
 			}
+		}
+		svc = svc_iterator(&iter, 0);
+	}
 
-			switch (rq.runlevel) {
-			case 's':
-			case 'S':
-				rq.runlevel = '1'; /* Single user mode */
-				/* fallthrough */
-
-			case '0'...'9':
-				dbg("Setting new runlevel %c", rq.runlevel);
-				lvl = rq.runlevel - '0';
-				if (lvl == 0)
-					halt = SHUT_OFF;
-				if (lvl == 6)
-					halt = SHUT_REBOOT;
-
-				/* User requested change in next runlevel */
-				if (runlevel == INIT_LEVEL)
-					cfglevel = lvl;
-				else
-					sm_runlevel(lvl);
-				break;
+	conn->iter_job = -1;
+	if (iter) {
+		conn->iter_job = iter->job;
+		conn->iter_seq = iter->seq;
+		strlcpy(conn->iter_id, iter->id, sizeof(conn->iter_id));
+	}
+
+	return svc;
+}
+
+static int api_request(struct api_conn *conn, struct init_request *rq)
+{
+	int result = 0;
+	svc_t *svc;
+	int lvl;
+
+	switch (rq->cmd) {
+	case INIT_CMD_RELOAD:
+	case INIT_CMD_START_SVC:
+	case INIT_CMD_RESTART_SVC:
+	case INIT_CMD_STOP_SVC:
+	case INIT_CMD_RELOAD_SVC:
+	case INIT_CMD_REBOOT:
+	case INIT_CMD_HALT:
+	case INIT_CMD_POWEROFF:
+	case INIT_CMD_SUSPEND:
+		if (IS_RESERVED_RUNLEVEL(runlevel)) {
+			strterm(rq->data, sizeof(rq->data));
+			warnx("Unsupported command (cmd: %d, data: %s) in runlevel S and 6/0.",
+			      rq->cmd, rq->data);
+			return API_CLOSE;
+		}
+	default:
+		break;
+	}
 
-			default:
-				dbg("Unsupported runlevel: %d", rq.runlevel);
+	switch (rq->cmd) {
+	case INIT_CMD_RUNLVL:
+		/* Allow changing cfglevel in runlevel S */
+		if (IS_RESERVED_RUNLEVEL(runlevel)) {
+			if (runlevel != INIT_LEVEL) {
+				warnx("Cannot abort runlevel 6/0.");
 				break;
 			}
-			break;
+		}
 
-		case INIT_CMD_DEBUG:
-			dbg("debug");
-			log_debug();
+		switch (rq->runlevel) {
+		case 's':
+		case 'S':
+			rq->runlevel = '1'; /* Single user mode */
+			/* fallthrough */
+
+		case '0'...'9':
+			dbg("Setting new runlevel %c", rq->runlevel);
+			lvl = rq->runlevel - '0';
+			if (lvl == 0)
+				halt = SHUT_OFF;
+			if (lvl == 6)
+				halt = SHUT_REBOOT;
+
+			/* User requested change in next runlevel */
+			if (runlevel == INIT_LEVEL)
+				cfglevel = lvl;
+			else
+				sm_runlevel(lvl);
 			break;
 
-		case INIT_CMD_RELOAD: /* 'init q' and 'initctl reload' */
-			dbg("reload");
-			sm_reload();
+		default:
+			dbg("Unsupported runlevel: %d", rq->runlevel);
 			break;
+		}
+		break;
 
-		case INIT_CMD_START_SVC:
-			dbg("start %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_start(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_DEBUG:
+		dbg("debug");
+		log_debug();
+		break;
 
-		case INIT_CMD_RESTART_SVC:
-			dbg("restart %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_restart(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_RELOAD: /* 'init q' and 'initctl reload' */
+		dbg("reload");
+		sm_reload();
+		break;
 
-		case INIT_CMD_STOP_SVC:
-			dbg("stop %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_stop(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_START_SVC:
+		dbg("start %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_start(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_RELOAD_SVC:
-			dbg("reload %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_reload(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_RESTART_SVC:
+		dbg("restart %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_restart(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_GET_PLUGINS:
-			result = plugin_list(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_STOP_SVC:
+		dbg("stop %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_stop(rq->data, sizeof(rq->data));
+		break;
 
-		case INIT_CMD_PLUGIN_DEPS:
-			result = plugin_deps(rq.data, sizeof(rq.data));
-			break;
+	case INIT_CMD_RELOAD_SVC:
+		dbg("reload %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_reload(rq->data, sizeof(rq->data));
+		break;
+
+	case INIT_CMD_GET_PLUGINS:
+		result = plugin_list(rq->data, sizeof(rq->data));
+		break;
+
+	case INIT_CMD_PLUGIN_DEPS:
+		result = plugin_deps(rq->data, sizeof(rq->data));
+		break;
+
+	case INIT_CMD_GET_RUNLEVEL:
+		dbg("get runlevel");
+		rq->runlevel  = runlevel;
+		rq->sleeptime = prevlevel;
+		break;
+
+	case INIT_CMD_REBOOT:
+	case INIT_CMD_HALT:
+	case INIT_CMD_POWEROFF:
+	case INIT_CMD_SUSPEND:
+		result = do_reboot(rq->cmd, rq->sleeptime, rq->data, sizeof(rq->data));
+		break;
+
+	case INIT_CMD_ACK:
+		dbg("Client failed reading ACK");
+		return API_CLOSE;
 
-		case INIT_CMD_GET_RUNLEVEL:
-			dbg("get runlevel");
-			rq.runlevel  = runlevel;
-			rq.sleeptime = prevlevel;
+	case INIT_CMD_WDOG_HELLO:
+		dbg("wdog hello");
+		if (rq->runlevel <= 0) {
+			result = 1;
 			break;
+		}
 
-		case INIT_CMD_REBOOT:
-		case INIT_CMD_HALT:
-		case INIT_CMD_POWEROFF:
-		case INIT_CMD_SUSPEND:
-			result = do_reboot(rq.cmd, rq.sleeptime, rq.data, sizeof(rq.data));
+		dbg("Request to hand-over wdog ... to PID %d", rq->runlevel);
+		svc = svc_find_by_pid(rq->runlevel);
+		if (!svc) {
+			logit(LOG_ERR, "Cannot find PID %d, not registered.", rq->runlevel);
 			break;
+		}
 
-		case INIT_CMD_ACK:
-			dbg("Client failed reading ACK");
-			goto leave;
+		if (wdog && wdog != svc) {
+			char name[32];
 
-		case INIT_CMD_WDOG_HELLO:
-			dbg("wdog hello");
-			if (rq.runlevel <= 0) {
-				result = 1;
-				break;
+			svc_ident(svc, name, sizeof(name));
+			logit(LOG_NOTICE, "Handing over wdog ctrl from %s[%d] to %s[%d]",
+			      svc_ident(wdog, NULL, 0), wdog->pid, name, svc->pid);
+
+			if (wdog->protect) {
+				logit(LOG_NOTICE, "Stopping and deleting built-in watchdog.");
+				stop(wdog, NULL);
+				svc_del(wdog);
 			}
+		}
+		wdog = svc;
+		break;
 
-			dbg("Request to hand-over wdog ... to PID %d", rq.runlevel);
-			svc = svc_find_by_pid(rq.runlevel);
-			if (!svc) {
-				logit(LOG_ERR, "Cannot find PID %d, not registered.", rq.runlevel);
-				break;
+	case INIT_CMD_SVC_ITER:
+//		dbg("svc iter, first: %d", rq->runlevel);
+		send_svc(conn, api_iterator(conn, rq->runlevel));
+		return API_DONE;
+
+	case INIT_CMD_SVC_QUERY:
+		dbg("svc query: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_query(rq->data, sizeof(rq->data));
+		break;
+
+	case INIT_CMD_SVC_FIND:
+		dbg("svc find: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		send_svc(conn, do_find(rq->data, sizeof(rq->data)));
+		return API_CLOSE;
+
+	case INIT_CMD_SVC_FIND_BYC:
+		dbg("svc find by cond: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		send_svc(conn, do_find_byc(rq->data, sizeof(rq->data)));
+		return API_CLOSE;
+
+	case INIT_CMD_COND_DEPS:
+		dbg("cond deps");
+		cond_deps_foreach(send_cond_dep, conn);
+		return API_CLOSE;
+
+	case INIT_CMD_SVC_STATUS:
+		dbg("svc status: %s", rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		send_svc_status(conn, rq->data);
+		return API_CLOSE;
+
+	case INIT_CMD_SVC_GRAPH:
+		dbg("svc graph");
+		send_graph(conn);
+		return API_CLOSE;
+
+	case INIT_CMD_TRACE:
+		dbg("trace");
+		trace_foreach(send_trace, conn);
+		return API_CLOSE;
+
+	case INIT_CMD_SIGNAL:
+		/* runlevel is reused for signal */
+		dbg("svc signal %d: %s", rq->runlevel, rq->data);
+		strterm(rq->data, sizeof(rq->data));
+		result = do_signal(rq->data, sizeof(rq->data), rq->runlevel);
+		break;
+
+	default:
+		dbg("Unsupported cmd: %d", rq->cmd);
+		break;
+	}
+
+
+	if (result)
+		rq->cmd = INIT_CMD_NACK;
+	else
+		rq->cmd = INIT_CMD_ACK;
+
+	return API_REPLY;
+}
+
+static void api_conn_cb(uev_t *w, void *arg, int events)
+{
+	struct api_conn *conn = arg;
+	struct init_request rq;
+	ssize_t len;
+	int result;
+
+	if (UEV_ERROR == events)
+		goto close;
+
+	/* let read() tell us if the client hung up */
+	if (events & UEV_HUP)
+		events |= UEV_READ;
+
+	if (events & UEV_WRITE) {
+		switch (api_conn_flush(conn)) {
+		case -1:
+			goto close;
+		case 0:
+			if (conn->closing)
+				goto close;
+			uev_io_set(w, conn->sd, UEV_READ);
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* no more requests, just waiting for the queue to drain */
+	if (conn->closing) {
+		if (events & UEV_HUP)
+			goto close;
+		return;
+	}
+
+	if (!(events & UEV_READ))
+		return;
+
+	uev_timer_set(&conn->timer, API_IDLE_TIMEOUT, 0);
+
+	while (1) {
+		len = read(conn->sd, &rq, sizeof(rq));
+		if (len <= 0) {
+			if (-1 == len) {
+				if (EINTR == errno)
+					continue;
+				if (EAGAIN == errno || EWOULDBLOCK == errno)
+					return;
+
+				/* we get here when client restarts itself */
+				if (ECONNRESET != errno)
+					dbg("Failed reading initctl request, error %d: %s", errno, strerror(errno));
 			}
+			goto close;
+		}
 
-			if (wdog && wdog != svc) {
-				char name[32];
+		if (rq.magic != INIT_MAGIC || len != sizeof(rq)) {
+			warnx("Invalid initctl request");
+			goto close;
+		}
 
-				svc_ident(svc, name, sizeof(name));
-				logit(LOG_NOTICE, "Handing over wdog ctrl from %s[%d] to %s[%d]",
-				      svc_ident(wdog, NULL, 0), wdog->pid, name, svc->pid);
+		result = api_request(conn, &rq);
+		if (conn->overflow)
+			goto close;
 
-				if (wdog->protect) {
-					logit(LOG_NOTICE, "Stopping and deleting built-in watchdog.");
-					stop(wdog, NULL);
-					svc_del(wdog);
-				}
+		switch (result) {
+		case API_REPLY:
+			if (api_send(conn, &rq, sizeof(rq))) {
+				dbg("Failed sending ACK/NACK back to client");
+				goto close;
 			}
-			wdog = svc;
 			break;
 
-		case INIT_CMD_SVC_ITER:
-//			dbg("svc iter, first: %d", rq.runlevel);
-			/*
-			 * XXX: This severely limits the number of
-			 * simultaneous client connections, but will
-			 * have to do for now.
-			 */
-			svc = svc_iterator(&iter, rq.runlevel);
-			send_svc(sd, svc);
-			goto leave;
-
-		case INIT_CMD_SVC_QUERY:
-			dbg("svc query: %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_query(rq.data, sizeof(rq.data));
+		case API_DONE:
 			break;
 
-		case INIT_CMD_SVC_FIND:
-			dbg("svc find: %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			send_svc(sd, do_find(rq.data, sizeof(rq.data)));
-			goto leave;
-
-		case INIT_CMD_SVC_FIND_BYC:
-			dbg("svc find by cond: %s", rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			send_svc(sd, do_find_byc(rq.data, sizeof(rq.data)));
-			goto leave;
-
-		case INIT_CMD_SIGNAL:
-			/* runlevel is reused for signal */
-			dbg("svc signal %d: %s", rq.runlevel, rq.data);
-			strterm(rq.data, sizeof(rq.data));
-			result = do_signal(rq.data, sizeof(rq.data), rq.runlevel);
-			break;
+		case API_CLOSE:
+			if (!TAILQ_EMPTY(&conn->queue)) {
+				conn->closing = 1;
+				return;
+			}
+			goto close;
+		}
+	}
 
-		default:
-			dbg("Unsupported cmd: %d", rq.cmd);
-			break;
+close:
+	api_conn_close(conn);
+}
+
+static void api_idle_cb(uev_t *w, void *arg, int events)
+{
+	struct api_conn *conn = arg;
+
+	(void)w;
+	(void)events;
+
+	dbg("Closing idle API client connection %d", conn->sd);
+	api_conn_close(conn);
+}
+
+static void api_retry_cb(uev_t *w, void *arg, int events)
+{
+	(void)w;
+	(void)arg;
+	(void)events;
+
+	uev_io_start(&api_watcher);
+}
+
+/*
+ * If we run out of descriptors, or memory, the client stays in the
+ * backlog and our level watcher would fire again immediately, so we
+ * stop watching for API_RETRY msec instead of spinning.
+ */
+static void api_cb(uev_t *w, void *arg, int events)
+{
+	(void)arg;
+
+	if (UEV_ERROR == events) {
+		dbg("%s(): api socket %d invalid.", __func__, w->fd);
+		goto error;
+	}
+
+	while (1) {
+		struct api_conn *conn;
+		int sd;
+
+		sd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (sd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+				break;
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				if (!api_nofd)
+					logit(LOG_WARNING, "Failed accepting API client: %s, retrying.",
+					      strerror(errno));
+				api_nofd = 1;
+				uev_io_stop(w);
+				if (uev_timer_init(w->ctx, &api_retry, api_retry_cb, NULL, API_RETRY, 0))
+					uev_io_start(w);
+				break;
+			}
+
+			err(1, "Failed serving API request");
+			goto error;
 		}
+		api_nofd = 0;
 
-		if (result)
-			rq.cmd = INIT_CMD_NACK;
-		else
-			rq.cmd = INIT_CMD_ACK;
-		len = write(sd, &rq, sizeof(rq));
-		if (len != sizeof(rq))
-			dbg("Failed sending ACK/NACK back to client");
+		if (api_num_conns >= API_MAX_CONN) {
+			warnx("Too many API clients, max %d, dropping connection.", API_MAX_CONN);
+			close(sd);
+			continue;
+		}
+
+		conn = calloc(1, sizeof(*conn));
+		if (!conn) {
+			close(sd);
+			continue;
+		}
+
+		conn->sd = sd;
+		conn->iter_job = -1;
+		TAILQ_INIT(&conn->queue);
+
+		if (uev_io_init(w->ctx, &conn->io, api_conn_cb, conn, sd, UEV_READ) ||
+		    uev_timer_init(w->ctx, &conn->timer, api_idle_cb, conn, API_IDLE_TIMEOUT, 0)) {
+			err(1, "Failed setting up API client connection");
+			uev_io_stop(&conn->io);
+			close(sd);
+			free(conn);
+			continue;
+		}
+
+		LIST_INSERT_HEAD(&api_conns, conn, link);
+		api_num_conns++;
 	}
 
-leave:
-	close(sd);
 	return;
 error:
 	api_exit();
@@ -639,6 +1131,7 @@ error:
 
 int api_exit(void)
 {
+	uev_timer_stop(&api_retry);
 	uev_io_stop(&api_watcher);
 
 	return close(api_watcher.fd);
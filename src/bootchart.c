@@ -0,0 +1,496 @@
+/* initctl trace, boot timeline as text, Chrome trace-event JSON, or SVG
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "initctl.h"
+#include "bootchart.h"
+#include "client.h"
+#include "trace.h"
+
+#define LABEL_W  200		/* SVG width of row labels */
+#define CHART_W  1000		/* SVG width of time line */
+#define ROW_H    16		/* SVG height of each row */
+#define TOP      40		/* SVG space for title and time axis */
+
+/* Row 0 is Finit itself, hooks and runlevel changes, row 1 conditions */
+#define ROW_FINIT 0
+#define ROW_COND  1
+
+struct row {
+	const char *name;	/* Points into events[] */
+	const char *state;	/* Current state of service */
+	int64_t     ts;		/* ... since */
+};
+
+struct span {
+	int         row;
+	int         type;
+	int64_t     ts;
+	int64_t     dur;	/* -1: instant event */
+	const char *name;	/* Points into events[] */
+	const char *state;
+};
+
+static struct trace_event *events;
+static size_t              num_events;
+
+static struct row         *rows;
+static size_t              num_rows;
+
+static struct span        *spans;
+static size_t              num_spans;
+
+static int64_t             t_first;
+static int64_t             t_last;
+
+static int trace_one(char *buf, size_t len, void *arg)
+{
+	struct trace_event *ev;
+	size_t i, num;
+
+	(void)arg;
+
+	num = len / sizeof(*ev);
+	if (!num || len % sizeof(*ev))
+		return 0;	/* unknown format, skip */
+
+	ev = realloc(events, (num_events + num) * sizeof(*ev));
+	if (!ev)
+		return 1;
+	events = ev;
+
+	memcpy(&events[num_events], buf, len);
+	for (i = num_events; i < num_events + num; i++) {
+		events[i].name[sizeof(events[i].name) - 1] = 0;
+		events[i].state[sizeof(events[i].state) - 1] = 0;
+	}
+	num_events += num;
+
+	return 0;
+}
+
+static int row_get(const char *name)
+{
+	struct row *row;
+	size_t i;
+
+	for (i = 0; i < num_rows; i++) {
+		if (!strcmp(rows[i].name, name))
+			return i;
+	}
+
+	row = realloc(rows, (num_rows + 1) * sizeof(*row));
+	if (!row)
+		ERR(1, "Failed allocating memory");
+	rows = row;
+
+	row = &rows[num_rows];
+	memset(row, 0, sizeof(*row));
+	row->name = name;
+
+	return num_rows++;
+}
+
+static void span_add(int row, int type, int64_t ts, int64_t dur, const char *name, const char *state)
+{
+	struct span *span;
+
+	span = realloc(spans, (num_spans + 1) * sizeof(*span));
+	if (!span)
+		ERR(1, "Failed allocating memory");
+	spans = span;
+
+	span = &spans[num_spans++];
+	span->row   = row;
+	span->type  = type;
+	span->ts    = ts;
+	span->dur   = dur;
+	span->name  = name;
+	span->state = state;
+}
+
+/* States not worth drawing, service is not running */
+static int is_idle(const char *state)
+{
+	const char *idle[] = { "halted", "done", "failed", "dead", "stopped", NULL };
+	int i;
+
+	for (i = 0; idle[i]; i++) {
+		if (!strcmp(state, idle[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Close span of previous state, if any, at @ts */
+static void row_close(int r, int64_t ts)
+{
+	struct row *row = &rows[r];
+
+	if (row->state && !is_idle(row->state))
+		span_add(r, TRACE_SVC, row->ts, ts - row->ts, row->name, row->state);
+	row->state = NULL;
+}
+
+/*
+ * Fetch all events from Finit and convert them to one row per service,
+ * with one span per state, and instant events for conditions and the
+ * runlevel state machine.
+ */
+static int trace_load(void)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_TRACE,
+	};
+	size_t i;
+
+	if (client_stream(&rq, trace_one, NULL))
+		return 1;
+	if (!num_events)
+		ERRX(1, "No trace events.");
+
+	row_get("finit");
+	row_get("conditions");
+
+	t_first = events[0].ts;
+	t_last  = events[num_events - 1].ts;
+
+	for (i = 0; i < num_events; i++) {
+		struct trace_event *ev = &events[i];
+		int r;
+
+		switch (ev->type) {
+		case TRACE_SVC:
+			r = row_get(ev->name);
+			row_close(r, ev->ts);
+			rows[r].state = ev->state;
+			rows[r].ts    = ev->ts;
+			break;
+
+		case TRACE_HOOK:
+			span_add(ROW_FINIT, ev->type, ev->ts, ev->dur, ev->name, NULL);
+			if (ev->ts + ev->dur > t_last)
+				t_last = ev->ts + ev->dur;
+			break;
+
+		case TRACE_COND:
+			span_add(ROW_COND, ev->type, ev->ts, -1, ev->name, ev->state);
+			break;
+
+		case TRACE_SM:
+			span_add(ROW_FINIT, ev->type, ev->ts, -1, ev->name, NULL);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	for (i = 0; i < num_rows; i++)
+		row_close(i, t_last);
+
+	return 0;
+}
+
+static void trace_free(void)
+{
+	free(events);
+	free(rows);
+	free(spans);
+}
+
+static const char *type_str(int type)
+{
+	switch (type) {
+	case TRACE_SVC:
+		return "service";
+	case TRACE_HOOK:
+		return "hook";
+	case TRACE_COND:
+		return "condition";
+	case TRACE_SM:
+		return "runlevel";
+	}
+
+	return "unknown";
+}
+
+/* Seconds since boot, with msec resolution */
+static char *trace_time(int64_t usec, char *buf, size_t len)
+{
+	snprintf(buf, len, "%lld.%03lld", (long long)(usec / 1000000), (long long)(usec / 1000 % 1000));
+	return buf;
+}
+
+/**
+ * trace_show - List all trace events, oldest first
+ * @arg: Optional name, or name prefix, to filter on
+ *
+ * Hooks are listed with their duration, in msec.
+ */
+int trace_show(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_TRACE,
+	};
+	size_t i;
+
+	if (client_stream(&rq, trace_one, NULL))
+		return 1;
+
+	if (heading)
+		print_header("%10s  %2s  %-9s  %-40s  %s", "TIME", "RL", "TYPE", "NAME", "STATE");
+
+	for (i = 0; i < num_events; i++) {
+		struct trace_event *ev = &events[i];
+		char ts[24], dur[24];
+
+		if (arg && arg[0] && strncmp(ev->name, arg, strlen(arg)))
+			continue;
+
+		if (ev->type == TRACE_HOOK)
+			snprintf(dur, sizeof(dur), "%u ms", ev->dur / 1000);
+		else
+			strlcpy(dur, ev->state, sizeof(dur));
+
+		printf("%10s  %2c  %-9s  %-40s  %s\n", trace_time(ev->ts, ts, sizeof(ts)),
+		       ev->level, type_str(ev->type), ev->name, dur);
+	}
+
+	free(events);
+	return 0;
+}
+
+/**
+ * trace_json - Boot timeline in Chrome trace-event format
+ * @arg: Not used
+ *
+ * Load the output in chrome://tracing, or https://ui.perfetto.dev, each
+ * service is a thread of the finit process.
+ */
+int trace_json(char *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	if (trace_load())
+		return 1;
+
+	fputs("{\n"
+	      "  \"displayTimeUnit\": \"ms\",\n"
+	      "  \"traceEvents\": [\n"
+	      "    { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": { \"name\": \"finit\" } }", stdout);
+
+	for (i = 0; i < num_rows; i++) {
+		printf(",\n    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, "
+		       "\"args\": { \"name\": \"%s\" } }", i + 1, rows[i].name);
+		printf(",\n    { \"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, "
+		       "\"args\": { \"sort_index\": %zu } }", i + 1, i);
+	}
+
+	for (i = 0; i < num_spans; i++) {
+		struct span *span = &spans[i];
+
+		if (span->dur < 0) {
+			printf(",\n    { \"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"i\", \"s\": \"%s\", "
+			       "\"ts\": %lld, \"pid\": 1, \"tid\": %d, \"args\": { \"state\": \"%s\" } }",
+			       span->name, type_str(span->type), span->type == TRACE_SM ? "g" : "t",
+			       (long long)span->ts, span->row + 1, span->state ?: "");
+			continue;
+		}
+
+		printf(",\n    { \"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+		       "\"ts\": %lld, \"dur\": %lld, \"pid\": 1, \"tid\": %d }",
+		       span->state ?: span->name, type_str(span->type),
+		       (long long)span->ts, (long long)span->dur, span->row + 1);
+	}
+	puts("\n  ]\n}");
+
+	trace_free();
+	return 0;
+}
+
+static void xml(const char *str)
+{
+	for (; *str; str++) {
+		switch (*str) {
+		case '<':
+			fputs("&lt;", stdout);
+			break;
+		case '>':
+			fputs("&gt;", stdout);
+			break;
+		case '&':
+			fputs("&amp;", stdout);
+			break;
+		case '"':
+			fputs("&quot;", stdout);
+			break;
+		default:
+			putchar(*str);
+			break;
+		}
+	}
+}
+
+static const char *color(struct span *span)
+{
+	const struct {
+		const char *state;
+		const char *color;
+	} map[] = {
+		{ "waiting",  "#d0d0d0" },
+		{ "setup",    "#f0c060" },
+		{ "starting", "#f0e040" },
+		{ "running",  "#60c060" },
+		{ "paused",   "#9090f0" },
+		{ "stopping", "#e06060" },
+		{ "active",   "#e06060" },
+		{ "teardown", "#f0a060" },
+		{ "cleanup",  "#f0a060" },
+		{ NULL, NULL }
+	};
+	int i;
+
+	if (span->type == TRACE_HOOK)
+		return "#6090e0";
+
+	for (i = 0; map[i].state; i++) {
+		if (span->state && !strcmp(span->state, map[i].state))
+			return map[i].color;
+	}
+
+	return "#a0a0a0";
+}
+
+/* Pick a grid step, in usec, giving at most 20 ticks */
+static int64_t grid_step(int64_t total)
+{
+	int64_t step = 1000;
+
+	while (total / step > 20) {
+		if (total / (step * 2) <= 20)
+			return step * 2;
+		if (total / (step * 5) <= 20)
+			return step * 5;
+		step *= 10;
+	}
+
+	return step;
+}
+
+/**
+ * trace_svg - Boot timeline as a bootchart-style SVG
+ * @arg: Not used
+ *
+ * One row per service, colored by state, hooks on the first row and
+ * runlevel changes as vertical lines.  Hover for details.
+ */
+int trace_svg(char *arg)
+{
+	int64_t total, step, t;
+	double scale;
+	int width, height;
+	size_t i;
+
+	(void)arg;
+
+	if (trace_load())
+		return 1;
+
+	total = t_last - t_first;
+	if (total < 1000)
+		total = 1000;
+	scale  = (double)CHART_W / total;
+	width  = LABEL_W + CHART_W + 20;
+	height = TOP + num_rows * ROW_H + 20;
+
+	printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	       "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" "
+	       "font-family=\"sans-serif\" font-size=\"11\">\n"
+	       "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n"
+	       "<text x=\"10\" y=\"16\" font-size=\"14\">Finit boot chart, %lld.%03lld sec</text>\n",
+	       width, height, (long long)(total / 1000000), (long long)(total / 1000 % 1000));
+
+	step = grid_step(total);
+	for (t = 0; t <= total; t += step) {
+		double x = LABEL_W + t * scale;
+
+		printf("<line x1=\"%.1f\" y1=\"%d\" x2=\"%.1f\" y2=\"%d\" stroke=\"#eee\"/>\n"
+		       "<text x=\"%.1f\" y=\"%d\" text-anchor=\"middle\" fill=\"#888\">%lld.%03lld</text>\n",
+		       x, TOP - 4, x, height - 20, x, TOP - 8,
+		       (long long)((t_first + t) / 1000000), (long long)((t_first + t) / 1000 % 1000));
+	}
+
+	for (i = 0; i < num_rows; i++) {
+		printf("<text x=\"%d\" y=\"%zu\" text-anchor=\"end\">", LABEL_W - 6, TOP + i * ROW_H + 12);
+		xml(rows[i].name);
+		puts("</text>");
+	}
+
+	for (i = 0; i < num_spans; i++) {
+		struct span *span = &spans[i];
+		double x = LABEL_W + (span->ts - t_first) * scale;
+		int y = TOP + span->row * ROW_H;
+
+		if (span->dur < 0) {
+			if (span->type == TRACE_SM)
+				printf("<line x1=\"%.1f\" y1=\"%d\" x2=\"%.1f\" y2=\"%d\" "
+				       "stroke=\"#c04040\" stroke-dasharray=\"3,3\">",
+				       x, TOP, x, height - 20);
+			else
+				printf("<line x1=\"%.1f\" y1=\"%d\" x2=\"%.1f\" y2=\"%d\" stroke=\"%s\">",
+				       x, y + 2, x, y + ROW_H - 2,
+				       span->state && !strcmp(span->state, "on") ? "#40a040" : "#c04040");
+			fputs("<title>", stdout);
+			xml(span->name);
+			printf(" %s</title></line>\n", span->state ?: "");
+			continue;
+		}
+
+		printf("<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" fill=\"%s\"><title>",
+		       x, y + 2, span->dur * scale < 1 ? 1 : span->dur * scale, ROW_H - 4, color(span));
+		xml(span->name);
+		printf(" %s %lld ms</title></rect>\n", span->state ?: "", (long long)(span->dur / 1000));
+	}
+	puts("</svg>");
+
+	trace_free();
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -21,9 +21,14 @@
  * THE SOFTWARE.
  */
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 # include <libite/queue.h>	/* BSD sys/queue.h API */
@@ -32,6 +37,7 @@
 # include <lite/queue.h>	/* BSD sys/queue.h API */
 #endif
 #include <sys/mount.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>		/* get_nprocs_conf() */
 
 #include "cgroup.h"
@@ -40,6 +46,7 @@
 #include "conf.h"
 #include "service.h"
 #include "log.h"
+#include "spawn.h"
 #include "util.h"
 
 struct cg {
@@ -148,59 +155,218 @@ static void group_init(char *path, int leaf, const char *cfg)
 	}
 }
 
-static int cgroup_leaf_init(char *group, char *name, int pid, const char *cfg)
+/*
+ * Create and initialize leaf group, then open it for cgroup_fork() or
+ * cgroup_move().  The group is removed again when its last process has
+ * exited, see cgroup_handle_event().
+ */
+static int cgroup_leaf_open(char *group, char *name, const char *cfg)
 {
 	char path[256];
+	int fd;
 
-	dbg("group %s, name %s, pid %d, cfg %s", group, name, pid, cfg ?: "NIL");
-	if (pid < 0 || pid == 1) {
-		errno = EINVAL;
-		return 1;
-	}
+	dbg("group %s, name %s, cfg %s", group, name, cfg ?: "NIL");
 
 	/* create and initialize new group */
 	snprintf(path, sizeof(path), "/sys/fs/cgroup/%s/%s", group, name);
 	group_init(path, 1, cfg);
 
-	/* move process to new group */
-	if (fnwrite(str("%d", pid), "%s/cgroup.procs", path))
-		err(1, "Failed moving pid %d to group %s", pid, path);
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) {
+		err(1, "Failed opening cgroup %s", path);
+		return -1;
+	}
 
 	strlcat(path, "/cgroup.events", sizeof(path));
+	iwatch_add(&iw_cgroup, path, 0);
 
-	return iwatch_add(&iw_cgroup, path, 0);
+	return fd;
 }
 
-int cgroup_user(char *name, int pid)
+/* move process to group opened with cgroup_*_open() */
+static int cgroup_move(int fd, int pid)
+{
+	int rc = 0;
+	int procs;
+
+	if (pid < 0 || pid == 1) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	procs = openat(fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+	if (procs == -1 || dprintf(procs, "%d", pid) < 0) {
+		err(1, "Failed moving pid %d to cgroup", pid);
+		rc = 1;
+	}
+	if (procs != -1)
+		close(procs);
+
+	return rc;
+}
+
+/**
+ * cgroup_user_open - Create and open leaf group in user/
+ * @name: Name of leaf group, e.g. getty
+ *
+ * Returns:
+ * An O_DIRECTORY descriptor for cgroup_fork(), or -1 if cgroups are not
+ * available or on error.  The caller must close it.
+ */
+int cgroup_user_open(char *name)
 {
 	if (!avail)
-		return 0;
+		return -1;
 
-	return cgroup_leaf_init("user", name, pid, NULL);
+	return cgroup_leaf_open("user", name, NULL);
 }
 
-int cgroup_service(char *name, int pid, struct cgroup *cg)
+/* Top-level group of a service, default system/ */
+static char *service_group(struct cgroup *cg)
+{
+	char path[256];
+
+	if (cg && cg->name[0]) {
+		snprintf(path, sizeof(path), "/sys/fs/cgroup/%s", cg->name);
+		if (fisdir(path))
+			return cg->name;
+	}
+
+	return "system";
+}
+
+/**
+ * cgroup_service_open - Create and open leaf group for a service
+ * @name: Name of leaf group, e.g. the basename of the .conf file
+ * @cg:   Optional top-level group and settings, default system/
+ *
+ * Returns:
+ * An O_DIRECTORY descriptor for cgroup_fork(), or -1 if cgroups are not
+ * available or on error.  The caller must close it.
+ */
+int cgroup_service_open(char *name, struct cgroup *cg)
 {
-	char *group = "system";
+	if (!avail)
+		return -1;
+
+	if (cg && !strcmp(cg->name, "root"))
+		return open(FINIT_CGPATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (cg && !strcmp(cg->name, "init"))
+		return open(FINIT_CGPATH "/init", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	return cgroup_leaf_open(service_group(cg), name, cg ? cg->cfg : NULL);
+}
+
+/**
+ * cgroup_service_has - Check if a process is in the leaf group of a service
+ * @name: Name of leaf group, same as for cgroup_service_open()
+ * @cg:   Optional top-level group, default system/
+ * @pid:  Process to check
+ *
+ * Services in the root or init/ group do not have a group of their own,
+ * for them this always returns %FALSE(0).
+ *
+ * Returns:
+ * %TRUE(1) if @pid is in the leaf group, otherwise %FALSE(0).
+ */
+int cgroup_service_has(char *name, struct cgroup *cg, pid_t pid)
+{
+	char path[256], line[256];
+	int rc = 0;
+	FILE *fp;
 
 	if (!avail)
 		return 0;
 
-	if (cg && cg->name[0]) {
-		char path[256];
+	if (cg && (!strcmp(cg->name, "root") || !strcmp(cg->name, "init")))
+		return 0;
 
-		if (!strcmp(cg->name, "root"))
-			return fnwrite(str("%d", pid), FINIT_CGPATH "/cgroup.procs");
+	snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
 
-		if (!strcmp(cg->name, "init"))
-			return fnwrite(str("%d", pid), FINIT_CGPATH "/init/cgroup.procs");
+	/* cgroup v2 only, so the one line is 0::/group/name */
+	snprintf(path, sizeof(path), "0::/%s/%s\n", service_group(cg), name);
+	while (!rc && fgets(line, sizeof(line), fp))
+		rc = !strcmp(line, path);
+	fclose(fp);
 
-		snprintf(path, sizeof(path), "/sys/fs/cgroup/%s", cg->name);
-		if (fisdir(path))
-			group = cg->name;
+	return rc;
+}
+
+static int cgroup_close_move(int fd, int pid)
+{
+	int rc;
+
+	if (fd == -1)
+		return avail ? 1 : 0;
+
+	rc = cgroup_move(fd, pid);
+	close(fd);
+
+	return rc;
+}
+
+int cgroup_user(char *name, int pid)
+{
+	return cgroup_close_move(cgroup_user_open(name), pid);
+}
+
+int cgroup_service(char *name, int pid, struct cgroup *cg)
+{
+	return cgroup_close_move(cgroup_service_open(name, cg), pid);
+}
+
+/**
+ * cgroup_fork - Create child process directly in a cgroup
+ * @fd: Descriptor from cgroup_user_open() or cgroup_service_open(), or -1
+ *
+ * Uses clone3() with CLONE_INTO_CGROUP, Linux 5.7, so the child never
+ * runs, or allocates memory, in the cgroup of PID 1, and no cgroup.procs
+ * write is needed.  On older kernels, or if it fails, this falls back to
+ * fork() and moving the child to the cgroup from the parent.
+ *
+ * Note: unlike fork(), the C library does not run any atfork handlers
+ *       in the child.  Finit is single threaded and does not use them.
+ *
+ * Returns:
+ * Same as fork(), the PID of the child in the parent, 0 in the child,
+ * or -1 on error.
+ */
+pid_t cgroup_fork(int fd)
+{
+	static int nosys = 0;
+	pid_t pid;
+
+#ifdef __NR_clone3
+	if (fd >= 0 && !nosys) {
+		struct spawn_clone_args args = {
+			.flags       = CLONE_INTO_CGROUP,
+			.exit_signal = SIGCHLD,
+			.cgroup      = fd,
+		};
+
+		pid = syscall(__NR_clone3, &args, sizeof(args));
+		if (pid >= 0)
+			return pid;
+
+		/* No clone3(), or it does not know about .cgroup */
+		if (errno == ENOSYS || errno == E2BIG)
+			nosys = 1;
+		else
+			dbg("Failed clone3() into cgroup: %s", strerror(errno));
 	}
+#else
+	(void)nosys;
+#endif
+
+	pid = fork();
+	if (pid > 0 && fd >= 0)
+		cgroup_move(fd, pid);
 
-	return cgroup_leaf_init(group, name, pid, cg ? cg->cfg : NULL);
+	return pid;
 }
 
 static void append_ctrl(char *ctrl)
@@ -467,6 +633,94 @@ void cgroup_config(void)
 	}
 }
 
+static int cgroup_procs(const char *path, int (*cb)(int, void *), void *arg)
+{
+	int rc = 0;
+	FILE *fp;
+	int pid;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	while (!rc && fscanf(fp, "%d", &pid) == 1)
+		rc = cb(pid, arg);
+	fclose(fp);
+
+	return rc;
+}
+
+static int cgroup_walk(char *path, size_t len, int (*cb)(int, void *), void *arg)
+{
+	size_t end = strlen(path);
+	struct dirent *d;
+	int rc;
+	DIR *dir;
+
+	snprintf(&path[end], len - end, "/cgroup.procs");
+	rc = cgroup_procs(path, cb, arg);
+	path[end] = 0;
+	if (rc)
+		return rc;
+
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	while (!rc && (d = readdir(dir))) {
+		if (d->d_type != DT_DIR || d->d_name[0] == '.')
+			continue;
+
+		snprintf(&path[end], len - end, "/%s", d->d_name);
+		rc = cgroup_walk(path, len, cb, arg);
+		path[end] = 0;
+	}
+	closedir(dir);
+
+	return rc;
+}
+
+/**
+ * cgroup_foreach_pid - Call a function for each process in our cgroups
+ * @cb:  Callback, return non-zero to stop
+ * @arg: Argument to callback
+ *
+ * Reads cgroup.procs of the root group and all groups below it.  This
+ * is a lot cheaper than scanning /proc for the processes left at
+ * shutdown.  The root group holds kernel threads, but also services
+ * with cgroup.root and anything started before PID 1 moved itself to
+ * init/, so the callback must skip PID 1 and kernel threads.
+ *
+ * Returns:
+ * Return value of the last callback, or -1 if cgroups are not in use.
+ */
+int cgroup_foreach_pid(int (*cb)(int pid, void *arg), void *arg)
+{
+	struct dirent *d;
+	char path[512];
+	DIR *dir;
+	int rc;
+
+	if (!avail)
+		return -1;
+
+	dir = opendir(FINIT_CGPATH);
+	if (!dir)
+		return -1;
+
+	rc = cgroup_procs(FINIT_CGPATH "/cgroup.procs", cb, arg);
+	while (!rc && (d = readdir(dir))) {
+		if (d->d_type != DT_DIR || d->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), FINIT_CGPATH "/%s", d->d_name);
+		rc = cgroup_walk(path, sizeof(path), cb, arg);
+	}
+	closedir(dir);
+
+	return rc;
+}
+
 /*
  * Called by Finit at early boot to mount initial cgroups
  */
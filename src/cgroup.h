@@ -24,6 +24,7 @@
 #ifndef FINIT_CGROUP_H_
 #define FINIT_CGROUP_H_
 
+#include <sys/types.h>
 #include <uev/uev.h>
 
 struct cgroup {
@@ -43,4 +44,11 @@ void cgroup_init    (uev_ctx_t *ctx);
 int  cgroup_user    (char *name, int pid);
 int  cgroup_service (char *name, int pid, struct cgroup *cg);
 
+int  cgroup_user_open    (char *name);
+int  cgroup_service_open (char *name, struct cgroup *cg);
+int  cgroup_service_has  (char *name, struct cgroup *cg, pid_t pid);
+pid_t cgroup_fork        (int fd);
+
+int  cgroup_foreach_pid  (int (*cb)(int pid, void *arg), void *arg);
+
 #endif /* FINIT_CGROUP_H_ */
@@ -23,6 +23,7 @@
 
 #include <errno.h>
 #include <poll.h>
+#include <stddef.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -33,26 +34,41 @@
 
 static int sd = -1;
 
-int client_connect(void)
+/* Decoded struct svc_record, see unpack_svc() */
+struct svc_buf {
+	svc_t  svc;
+	char  *args[MAX_NUM_SVC_ARGS + 1];
+	char   buf[UINT16_MAX];
+};
+
+static int do_connect(void)
 {
 	struct sockaddr_un sun = {
 		.sun_family = AF_UNIX,
 		.sun_path   = INIT_SOCKET,
 	};
+	int fd;
 
-	sd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-	if (-1 == sd) {
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (-1 == fd) {
 		warn("Failed creating UNIX domain socket");
 		return -1;
 	}
 
-	if (connect(sd, (struct sockaddr*)&sun, sizeof(sun)) == -1) {
+	if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == -1) {
 		if (errno != ENOENT)
 			warnx("Failed connecting to finit");
-		close(sd);
-		sd = -1;
+		close(fd);
+		fd = -1;
 	}
 
+	return fd;
+}
+
+int client_connect(void)
+{
+	sd = do_connect();
+
 	return sd;
 }
 
@@ -143,36 +159,270 @@ int client_command(int cmd)
 	return client_request(&rq, sizeof(rq));
 }
 
+/**
+ * client_stream - Send request and read records until Finit hangs up
+ * @rq:  Request to send
+ * @cb:  Callback for each record, return non-zero to stop reading
+ * @arg: Optional argument to @cb
+ *
+ * For commands where Finit replies with a stream of records, one per
+ * message, instead of an ACK/NACK.  Record data is NUL terminated.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int client_stream(struct init_request *rq, int (*cb)(char *, size_t, void *), void *arg)
+{
+	char buf[sizeof(*rq) + 1];
+	int rc = 0;
+
+	if (client_connect() == -1)
+		return -1;
+
+	if (write(sd, rq, sizeof(*rq)) != sizeof(*rq))
+		goto error;
+
+	while (1) {
+		struct pollfd pfd = { .fd = sd, .events = POLLIN };
+		ssize_t len;
+
+		if (poll(&pfd, 1, REQUEST_TIMEOUT) <= 0) {
+			if (errno == EINTR)
+				continue;
+			warnx("Timed out waiting for reply from Finit.");
+			rc = -1;
+			break;
+		}
+
+		len = read(sd, buf, sizeof(buf) - 1);
+		if (len <= 0) {
+			if (len == -1)
+				goto error;
+			break;	/* EOF, done */
+		}
+
+		buf[len] = 0;
+		if (cb(buf, len, arg))
+			break;
+	}
+
+	client_disconnect();
+	return rc;
+error:
+	warn("Failed communicating with finit, error %d", errno);
+	client_disconnect();
+
+	return -1;
+}
+
+static char *unpack_str(char **ptr, char *end)
+{
+	static char none[1];
+	char *str = *ptr;
+	size_t len;
+
+	if (str >= end)
+		return none;
+
+	len = strnlen(str, end - str);
+	if (str + len == end)
+		return none;	/* not terminated, corrupt record */
+	*ptr = str + len + 1;
+
+	return str;
+}
+
+/*
+ * Decode struct svc_record in sb->buf into sb->svc, all strings and
+ * args point into sb->buf.  Returns -1 on bad or unknown record.
+ */
+static int unpack_svc(struct svc_buf *sb, size_t len)
+{
+	const struct svc_record *rec = (const struct svc_record *)sb->buf;
+	svc_t *svc = &sb->svc;
+	char *ptr, *end;
+	uint32_t i;
+
+	if (len < sizeof(*rec) || rec->version != SVC_RECORD_VERSION || rec->len != len)
+		return -1;
+
+	memset(svc, 0, sizeof(*svc));
+	svc->type                     = rec->type;
+	*((svc_state_t *)&svc->state) = rec->state;
+	svc->block                    = rec->block;
+	svc->forking                  = !!(rec->flags & SVC_RECORD_FORKING);
+	svc->manual                   = !!(rec->flags & SVC_RECORD_MANUAL);
+	svc->started                  = !!(rec->flags & SVC_RECORD_STARTED);
+	*((pid_t *)&svc->pid)         = rec->pid;
+	svc->status                   = rec->status;
+	svc->runlevels                = rec->runlevels;
+	svc->once                     = rec->once;
+	svc->restart_tot              = rec->restart_tot;
+	*((char *)&svc->restart_cnt)  = rec->restart_cnt;
+	svc->restart_max              = rec->restart_max;
+	svc->watchdog                 = rec->watchdog;
+	svc->start_time               = rec->start_time;
+
+	ptr = &sb->buf[offsetof(struct svc_record, strings)];
+	end = &sb->buf[len];
+	strlcpy(svc->name,        unpack_str(&ptr, end), sizeof(svc->name));
+	strlcpy(svc->id,          unpack_str(&ptr, end), sizeof(svc->id));
+	strlcpy(svc->desc,        unpack_str(&ptr, end), sizeof(svc->desc));
+	strlcpy(svc->cgroup.name, unpack_str(&ptr, end), sizeof(svc->cgroup.name));
+	strlcpy(svc->file,        unpack_str(&ptr, end), sizeof(svc->file));
+	svc->pidfile            = unpack_str(&ptr, end);
+	strlcpy(svc->username,    unpack_str(&ptr, end), sizeof(svc->username));
+	strlcpy(svc->group,       unpack_str(&ptr, end), sizeof(svc->group));
+	strlcpy(svc->cond,        unpack_str(&ptr, end), sizeof(svc->cond));
+	svc->env                = unpack_str(&ptr, end);
+	svc->notify_status      = unpack_str(&ptr, end);
+	strlcpy(svc->cmd,         unpack_str(&ptr, end), sizeof(svc->cmd));
+
+	svc->args    = sb->args;
+	svc->args[0] = svc->cmd;
+	for (i = 0; i < rec->nargs && i + 1 < MAX_NUM_SVC_ARGS; i++)
+		svc->args[i + 1] = unpack_str(&ptr, end);
+	svc->args[i + 1] = NULL;
+
+	/* Not sent, but never NULL in Finit */
+	svc->pre_script = svc->post_script = svc->ready_script = "";
+	svc->cleanup_script = svc->reload_script = svc->stop_script = "";
+
+	return 0;
+}
+
+/* Read one struct svc_record reply, returns -1 on error */
+static int read_svc(int fd, struct svc_buf *sb)
+{
+	ssize_t len;
+
+	len = read(fd, sb->buf, sizeof(sb->buf));
+	if (len <= 0)
+		return -1;
+
+	return unpack_svc(sb, len);
+}
+
+/*
+ * The iterator has its own connection, Finit keeps the iterator cursor
+ * per connection.  It is closed at the end of the list, or when a new
+ * iteration is started.
+ */
 svc_t *client_svc_iterator(int first)
 {
 	struct init_request rq = {
 		.magic = INIT_MAGIC,
 		.cmd   = INIT_CMD_SVC_ITER,
 	};
-	static svc_t svc;
+	static struct svc_buf sb;
+	static int iter_sd = -1;
 
-	if (client_connect() == -1)
-		return NULL;
+	if (first && iter_sd != -1) {
+		close(iter_sd);
+		iter_sd = -1;
+	}
+
+	if (iter_sd == -1) {
+		if (!first)
+			return NULL;
+
+		iter_sd = do_connect();
+		if (iter_sd == -1)
+			return NULL;
+	}
 
 	if (first)
 		rq.runlevel = 1;
 	else
 		rq.runlevel = 0;
 
-	if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+	if (write(iter_sd, &rq, sizeof(rq)) != sizeof(rq))
 		goto error;
-	if (read(sd, &svc, sizeof(svc)) != sizeof(svc))
+	if (read_svc(iter_sd, &sb))
 		goto error;
 
-	client_disconnect();
-	if (svc.pid < 0)
+	if (sb.svc.pid < 0) {
+		close(iter_sd);
+		iter_sd = -1;
 		return NULL;
+	}
 
-	return &svc;
+	return &sb.svc;
 error:
 	warn("Failed communicating with finit, error %d", errno);
-	client_disconnect();
-	sd = -1;
+	close(iter_sd);
+	iter_sd = -1;
+
+	return NULL;
+}
+
+/**
+ * client_svc_status - Iterate over compact status of services
+ * @filter: Optional NAME or NAME:ID, NULL for all services
+ * @first:  Set to start (over), clear to get next service
+ *
+ * Like client_svc_iterator(), but Finit streams all matching services
+ * as compact records (struct svc_record) in a single response.  Only
+ * the status related fields, identity, and command line are set in the
+ * returned &svc_t.
+ *
+ * Returns:
+ * Pointer to static &svc_t, or %NULL at the end of the list.
+ */
+svc_t *client_svc_status(const char *filter, int first)
+{
+	static struct svc_buf sb;
+	static int stream_sd = -1;
+
+	if (first) {
+		struct init_request rq = {
+			.magic = INIT_MAGIC,
+			.cmd   = INIT_CMD_SVC_STATUS,
+		};
+
+		if (stream_sd != -1)
+			close(stream_sd);
+
+		stream_sd = do_connect();
+		if (stream_sd == -1)
+			return NULL;
+
+		if (filter)
+			strlcpy(rq.data, filter, sizeof(rq.data));
+		if (write(stream_sd, &rq, sizeof(rq)) != sizeof(rq))
+			goto error;
+	}
+
+	while (stream_sd != -1) {
+		struct pollfd pfd = { .fd = stream_sd, .events = POLLIN };
+		ssize_t len;
+
+		if (poll(&pfd, 1, REQUEST_TIMEOUT) <= 0) {
+			if (errno == EINTR)
+				continue;
+			warnx("Timed out waiting for reply from Finit.");
+			break;
+		}
+
+		len = read(stream_sd, sb.buf, sizeof(sb.buf));
+		if (len == -1)
+			goto error;
+		if (len == 0)
+			break;	/* EOF, done */
+
+		if (!unpack_svc(&sb, len))
+			return &sb.svc;
+	}
+
+	if (stream_sd != -1)
+		close(stream_sd);
+	stream_sd = -1;
+
+	return NULL;
+error:
+	warn("Failed communicating with finit, error %d", errno);
+	close(stream_sd);
+	stream_sd = -1;
 
 	return NULL;
 }
@@ -183,7 +433,7 @@ static svc_t *do_find(int cmd, const char *arg)
 		.magic = INIT_MAGIC,
 		.cmd   = cmd,
 	};
-	static svc_t svc;
+	static struct svc_buf sb;
 
 	if (client_connect() == -1)
 		return NULL;
@@ -191,14 +441,14 @@ static svc_t *do_find(int cmd, const char *arg)
 	strlcpy(rq.data, arg, sizeof(rq.data));
 	if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
 		goto error;
-	if (read(sd, &svc, sizeof(svc)) != sizeof(svc))
+	if (read_svc(sd, &sb))
 		goto error;
 
 	client_disconnect();
-	if (svc.pid < 0)
+	if (sb.svc.pid < 0)
 		return NULL;
 
-	return &svc;
+	return &sb.svc;
 error:
 	client_disconnect();
 	warn("Failed communicating with finit, error %d", errno);
@@ -34,8 +34,10 @@ int    client_socket           (void);
 int    client_request          (struct init_request *rq, ssize_t len);
 int    client_send             (struct init_request *rq, ssize_t len);
 int    client_command          (int cmd);
+int    client_stream           (struct init_request *rq, int (*cb)(char *, size_t, void *), void *arg);
 
 svc_t *client_svc_iterator     (int first);
+svc_t *client_svc_status       (const char *filter, int first);
 svc_t *client_svc_find         (const char *arg);
 svc_t *client_svc_find_by_cond (const char *arg);
 
@@ -25,6 +25,7 @@
 #include <ftw.h>
 #include <libgen.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
 #else
@@ -34,8 +35,11 @@
 #include "finit.h"
 #include "cond.h"
 #include "pid.h"
+#include "private.h"
+#include "schedule.h"
 #include "service.h"
 #include "sm.h"
+#include "trace.h"
 
 struct cond_boot {
 	TAILQ_ENTRY(cond_boot) link;
@@ -43,6 +47,66 @@ struct cond_boot {
 };
 static TAILQ_HEAD(, cond_boot) cond_boot_list = TAILQ_HEAD_INITIALIZER(cond_boot_list);
 
+/* Initial number of buckets in the condition table, must be power of two */
+#define COND_HASH_MIN 64
+
+/*
+ * In-memory condition store, the authoritative state of all conditions
+ * in Finit.  The /run/finit/cond tree is only a mirror for external
+ * readers, e.g., initctl and scripts, written from the event loop when
+ * a condition changes, see cond_mirror().
+ *
+ * External writers, i.e., initctl and keventd through the usr/ and sys/
+ * inotify plugins, are read back in to the store with cond_sync().
+ *
+ * Each condition also keeps track of the services that reference it,
+ * used by cond_update() to step only those services.  Built from
+ * svc->cond when it is parsed by conf_parse_cond(), and dropped again
+ * in svc_del().  A service dropped while its condition is being updated
+ * is only marked as stale, the node is cleaned up when cond_update() is
+ * done with it.
+ */
+struct cond_dep {
+	TAILQ_ENTRY(cond_dep) link;	/* on node->deps */
+	struct cond_dep   *next;	/* on svc->cond_deps */
+	struct cond_node  *node;
+	svc_t             *svc;		/* NULL if stale */
+};
+
+struct cond_node {
+	TAILQ_ENTRY(cond_node) link;
+	TAILQ_ENTRY(cond_node) dlink;	/* on cond_dirty, pending mirror */
+	LIST_ENTRY(cond_node)  hash;
+	TAILQ_HEAD(, cond_dep) deps;
+	size_t                 ndeps;
+	int                    busy;
+	int                    stale;
+	int                    dirty;
+
+	unsigned int           gen;	/* 0: off, otherwise reconf gen when set */
+	int                    oneshot;	/* on regardless of reconf gen */
+
+	unsigned int           updates;	/* calls to cond_update() */
+	unsigned int           stepped;	/* services stepped, in total */
+	unsigned int           last;	/* services stepped, last update */
+
+	char                   name[];
+};
+
+LIST_HEAD(cond_bucket, cond_node);
+static struct cond_bucket *cond_hash;
+static size_t cond_hash_size, cond_hash_count;
+static TAILQ_HEAD(, cond_node) cond_nodes = TAILQ_HEAD_INITIALIZER(cond_nodes);
+static TAILQ_HEAD(, cond_node) cond_dirty = TAILQ_HEAD_INITIALIZER(cond_dirty);
+
+static unsigned int cond_rgen;		/* reconf generation, see cond_reload() */
+
+static void cond_mirror(void *arg);
+static struct wq cond_mirror_work = {
+	.cb    = cond_mirror,
+	.delay = 0
+};
+
 
 /*
  * Parse finit.cond=cond[,cond[,...]] from command line.  It creates a
@@ -145,6 +209,123 @@ char *mkcond(svc_t *svc, char *buf, size_t len)
 	return buf;
 }
 
+static struct cond_node *cond_node_find(const char *name)
+{
+	struct cond_node *node;
+
+	if (!cond_hash_size)
+		return NULL;
+
+	LIST_FOREACH(node, &cond_hash[hash_str(HASH_SEED, name) & (cond_hash_size - 1)], hash) {
+		if (!strcmp(node->name, name))
+			return node;
+	}
+
+	return NULL;
+}
+
+static int cond_hash_grow(void)
+{
+	struct cond_bucket *hash;
+	struct cond_node *node;
+	size_t size;
+
+	size = cond_hash_size ? cond_hash_size * 2 : COND_HASH_MIN;
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+
+	TAILQ_FOREACH(node, &cond_nodes, link)
+		LIST_INSERT_HEAD(&hash[hash_str(HASH_SEED, node->name) & (size - 1)], node, hash);
+
+	free(cond_hash);
+	cond_hash      = hash;
+	cond_hash_size = size;
+
+	return 0;
+}
+
+static struct cond_node *cond_node_get(const char *name)
+{
+	struct cond_node *node;
+
+	node = cond_node_find(name);
+	if (node)
+		return node;
+
+	/* on failure to grow we can still use the old, smaller, table */
+	if (cond_hash_count >= cond_hash_size && cond_hash_grow() && !cond_hash_size)
+		return NULL;
+
+	node = calloc(1, sizeof(*node) + strlen(name) + 1);
+	if (!node)
+		return NULL;
+
+	strcpy(node->name, name);
+	TAILQ_INIT(&node->deps);
+	TAILQ_INSERT_TAIL(&cond_nodes, node, link);
+	LIST_INSERT_HEAD(&cond_hash[hash_str(HASH_SEED, name) & (cond_hash_size - 1)], node, hash);
+	cond_hash_count++;
+
+	return node;
+}
+
+static void cond_node_purge(struct cond_node *node)
+{
+	struct cond_dep *dep, *tmp;
+
+	TAILQ_FOREACH_SAFE(dep, &node->deps, link, tmp) {
+		if (dep->svc)
+			continue;
+
+		TAILQ_REMOVE(&node->deps, dep, link);
+		free(dep);
+	}
+	node->stale = 0;
+}
+
+static enum cond_state cond_node_state(struct cond_node *node)
+{
+	if (node->oneshot)
+		return COND_ON;
+	if (!node->gen)
+		return COND_OFF;
+
+	return (node->gen == cond_rgen) ? COND_ON : COND_FLUX;
+}
+
+/* Strip leading /run/finit/cond/ from a condition path */
+static const char *cond_name(const char *path)
+{
+	const char *ptr;
+
+	ptr = strstr(path, COND_BASE);
+	if (!ptr)
+		return NULL;
+
+	return ptr + strlen(COND_BASE) + 1;
+}
+
+/**
+ * cond_get_mem - Get state of condition from the in-memory store
+ * @name: Condition name, without leading /run/finit/cond/
+ *
+ * This is what cond_get() resolves to in Finit, no file system access.
+ *
+ * Returns:
+ * The state of the condition, %COND_OFF if unknown.
+ */
+enum cond_state cond_get_mem(const char *name)
+{
+	struct cond_node *node;
+
+	node = cond_node_find(name);
+	if (!node)
+		return COND_OFF;
+
+	return cond_node_state(node);
+}
+
 static int cond_set_gen(const char *file, unsigned int gen)
 {
 	char *ptr, path[256];
@@ -172,11 +353,12 @@ static void cond_bump_reconf(void)
 	 * If %_PATH_RECONF does not exist, cond_get_gen() returns 0
 	 * meaning that rgen++ is always what we want.
 	 */
-	rgen = cond_get_gen(_PATH_RECONF);
+	rgen = cond_rgen ?: cond_get_gen(_PATH_RECONF);
 	rgen++;
 
 	if (cond_set_gen(_PATH_RECONF, rgen))
 		err(1, "Failed setting %s to gen %d", _PATH_RECONF, rgen);
+	cond_rgen = rgen;
 }
 
 static int cond_checkpath(const char *path)
@@ -198,82 +380,165 @@ static int cond_checkpath(const char *path)
 	return 0;
 }
 
-static int do_delete(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftw)
+/* Drop empty parent directory, e.g. service/foo/, but not service/ */
+static void cond_prune(const char *name, const char *path)
 {
-	const char *cond, *ptr;
+	char buf[MAX_ARG_LEN];
+	const char *ptr;
 
-	(void)sb;
-	(void)tflag;
+	ptr = strchr(name, '/');
+	if (!ptr || !strchr(ptr + 1, '/'))
+		return;
 
-	if (ftw->level == 0)
-		return 1;
+	strlcpy(buf, path, sizeof(buf));
+	if (rmdir(dirname(buf)) && errno != ENOTEMPTY && errno != EEXIST && errno != ENOENT)
+		dbg("Failed removing %s: %s", buf, strerror(errno));
+}
 
-	ptr = strstr(fpath, COND_BASE);
-	if (!ptr) {
-		warnx("%s does not seem to be a Finit condition, skipping", fpath);
-		return 0;
+/* Write in-memory state of condition to /run/finit/cond */
+static void cond_mirror_node(struct cond_node *node)
+{
+	const char *path = cond_path(node->name);
+	struct stat st;
+
+	if (node->oneshot) {
+		if (cond_checkpath(path))
+			return;
+		if (!lstat(path, &st) && !S_ISLNK(st.st_mode))
+			unlink(path);
+		if (symlink(_PATH_RECONF, path) && errno != EEXIST)
+			err(1, "Failed creating oneshot cond %s", node->name);
+	} else if (node->gen) {
+		if (cond_checkpath(path))
+			return;
+		/* never write through a oneshot symlink to reconf */
+		if (!lstat(path, &st) && S_ISLNK(st.st_mode))
+			unlink(path);
+		if (cond_set_gen(path, node->gen))
+			err(1, "Failed setting condition %s", node->name);
+	} else {
+		if (unlink(path)) {
+			switch (errno) {
+			case ENOENT:
+			case EISDIR:
+				break;
+			default:
+				err(1, "Failed removing condition '%s'", node->name);
+				break;
+			}
+			return;
+		}
+		cond_prune(node->name, path);
 	}
+}
 
-	if (remove(fpath))
-		err(1, "Failed removing condition %s", fpath);
+static void cond_mirror(void *arg)
+{
+	struct cond_node *node;
 
-	cond = ptr + strlen(COND_BASE) + 1;
-	if (sm_in_reload())
-		cond_clear_noupdate(cond);
-	else
-		cond_update(cond);
+	(void)arg;
 
-	return 0;
+	while ((node = TAILQ_FIRST(&cond_dirty))) {
+		TAILQ_REMOVE(&cond_dirty, node, dlink);
+		node->dirty = 0;
+		cond_mirror_node(node);
+	}
 }
 
-static void cond_delpath(const char *path)
+static void cond_node_dirty(struct cond_node *node)
 {
-	nftw(path, do_delete, 20, FTW_DEPTH);
-	if (remove(path)) {
-		switch (errno) {
-		case ENOENT:	/* Ignore */
-		case ENOTEMPTY:	/* Only at shutdown and for directories */
-			break;
-		default:
-			err(1, "Failed removing condition path %s", path);
-			break;
-		}
+	trace_cond(node->name, condstr(cond_node_state(node)));
+
+	if (node->dirty)
+		return;
+
+	if (TAILQ_EMPTY(&cond_dirty))
+		schedule_work(&cond_mirror_work);
+
+	TAILQ_INSERT_TAIL(&cond_dirty, node, dlink);
+	node->dirty = 1;
+}
+
+static void cond_node_clean(struct cond_node *node)
+{
+	if (!node->dirty)
+		return;
+
+	TAILQ_REMOVE(&cond_dirty, node, dlink);
+	node->dirty = 0;
+}
+
+/*
+ * Clear all conditions in a "directory", e.g., service/foo/, like the
+ * recursive removal of the same directory in the file system.
+ */
+static void cond_clear_dir(const char *name)
+{
+	struct cond_node *node;
+	char dir[MAX_COND_LEN];
+	size_t len;
+
+	len = strlen(name);
+	if (len && name[len - 1] == '/')
+		strlcpy(dir, name, sizeof(dir));
+	else
+		snprintf(dir, sizeof(dir), "%s/", name);
+	len = strlen(dir);
+
+	TAILQ_FOREACH(node, &cond_nodes, link) {
+		if (strncmp(node->name, dir, len))
+			continue;
+		if (cond_node_state(node) == COND_OFF)
+			continue;
+
+		node->gen = 0;
+		node->oneshot = 0;
+		cond_node_dirty(node);
+
+		if (!sm_in_reload())
+			cond_update(node->name);
 	}
 }
 
-int cond_set_path(const char *path, enum cond_state next)
+static int cond_set_state(const char *name, enum cond_state next)
 {
+	struct cond_node *node;
 	enum cond_state prev;
-	unsigned int rgen;
 
-	dbg("%s <= %d", path, next);
-	prev = cond_get_path(path);
+	dbg("%s <= %d", name, next);
 
 	switch (next) {
 	case COND_ON:
-		if (cond_checkpath(path))
-		    return 0;
-
-		rgen = cond_get_gen(_PATH_RECONF);
-		if (!rgen) {
-			errx(1, "Unable to read configuration generation (%s)", path);
+		if (!cond_rgen) {
+			errx(1, "Unable to read configuration generation (%s)", name);
 			return -1;
 		}
-		cond_set_gen(path, rgen);
+
+		node = cond_node_get(name);
+		if (!node) {
+			errx(1, "Failed creating condition %s", name);
+			return 0;
+		}
+
+		prev = cond_node_state(node);
+		if (!node->oneshot && node->gen != cond_rgen) {
+			node->gen = cond_rgen;
+			cond_node_dirty(node);
+		}
 		break;
 
 	case COND_OFF:
-		if (unlink(path)) {
-			switch (errno) {
-			case ENOENT:
-				break;
-			case EISDIR:
-				cond_delpath(path);
-				break;
-			default:
-				err(1, "Failed removing condition '%s'", path);
-				break;
-			}
+		node = cond_node_find(name);
+		if (!node || name[strlen(name) - 1] == '/') {
+			cond_clear_dir(name);
+			return 0;
+		}
+
+		prev = cond_node_state(node);
+		if (prev != COND_OFF) {
+			node->gen = 0;
+			node->oneshot = 0;
+			cond_node_dirty(node);
 		}
 		break;
 
@@ -285,28 +550,280 @@ int cond_set_path(const char *path, enum cond_state next)
 	return next != prev;
 }
 
+int cond_set_path(const char *path, enum cond_state next)
+{
+	const char *name;
+
+	name = cond_name(path);
+	if (!name) {
+		errx(1, "Invalid condition path %s", path);
+		return 0;
+	}
+
+	return cond_set_state(name, next);
+}
+
+/**
+ * cond_sync - Read back externally written condition to in-memory store
+ * @name: Condition name, e.g. usr/foo
+ *
+ * Used by the usr/ and sys/ plugins to update the store when initctl or
+ * keventd have created, or removed, a condition in the file system.
+ *
+ * Returns:
+ * Non-zero if the state of the condition changed.
+ */
+int cond_sync(const char *name)
+{
+	const char *path = cond_path(name);
+	struct cond_node *node;
+	enum cond_state prev;
+	struct stat st;
+
+	node = cond_node_get(name);
+	if (!node)
+		return 0;
+
+	/* file system wins, drop any pending write of our own */
+	cond_node_clean(node);
+	prev = cond_node_state(node);
+
+	if (lstat(path, &st)) {
+		node->gen = 0;
+		node->oneshot = 0;
+	} else if (S_ISLNK(st.st_mode)) {
+		node->gen = 0;
+		node->oneshot = 1;
+	} else {
+		node->gen = cond_get_gen(path);
+		node->oneshot = 0;
+	}
+
+	return cond_node_state(node) != prev;
+}
+
+/* Map hook/ condition to its hook point, for svc->cond_hooks */
+static int cond_hook(const char *name)
+{
+	int i;
+
+	if (strncmp(name, "hook/", 5))
+		return -1;
+
+	for (i = 0; i < HOOK_MAX_NUM; i++) {
+		if (!strcmp(name, plugin_hook_str(i)))
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * cond_deps_add - Compile svc->cond and add service to dependents index
+ * @svc: Pointer to &svc_t object with parsed svc->cond
+ *
+ * Called by conf_parse_cond() when (re)parsing the conditions of a
+ * service.  Any previous entries for @svc are dropped first.
+ *
+ * The result, svc->cond_deps, is the list of interned conditions the
+ * service depends on, used by cond_get_agg_svc() instead of splitting
+ * svc->cond on every call.  Conditions that are hook points are also
+ * recorded in the svc->cond_hooks bitmask.
+ */
+void cond_deps_add(svc_t *svc)
+{
+	char conds[MAX_COND_LEN];
+	char *cond;
+
+	cond_deps_del(svc);
+
+	strlcpy(conds, svc->cond, sizeof(conds));
+	for (cond = strtok(conds, ","); cond; cond = strtok(NULL, ",")) {
+		struct cond_node *node;
+		struct cond_dep *dep;
+		int hook;
+
+		hook = cond_hook(cond);
+		if (hook >= 0)
+			svc->cond_hooks |= 1 << hook;
+
+		node = cond_node_get(cond);
+		if (!node)
+			goto oom;
+
+		/* skip duplicates, e.g. <net/eth0/up,net/eth0/up> */
+		for (dep = svc->cond_deps; dep; dep = dep->next) {
+			if (dep->node == node)
+				break;
+		}
+		if (dep)
+			continue;
+
+		dep = calloc(1, sizeof(*dep));
+		if (!dep)
+			goto oom;
+
+		dep->node = node;
+		dep->svc  = svc;
+		dep->next = svc->cond_deps;
+		svc->cond_deps = dep;
+
+		TAILQ_INSERT_TAIL(&node->deps, dep, link);
+		node->ndeps++;
+	}
+
+	return;
+oom:
+	logit(LOG_ERR, "%s: out of memory indexing condition %s", svc_ident(svc, NULL, 0), cond);
+}
+
+/**
+ * cond_deps_del - Drop service from dependents index
+ * @svc: Pointer to &svc_t object
+ *
+ * Called when (re)parsing the conditions of a service, and when the
+ * service is deleted.  Does not use svc->cond, which may have changed.
+ */
+void cond_deps_del(svc_t *svc)
+{
+	struct cond_dep *dep, *next;
+
+	for (dep = svc->cond_deps; dep; dep = next) {
+		struct cond_node *node = dep->node;
+
+		next = dep->next;
+		node->ndeps--;
+
+		if (node->busy) {
+			dep->svc = NULL;
+			node->stale = 1;
+			continue;
+		}
+
+		TAILQ_REMOVE(&node->deps, dep, link);
+		free(dep);
+	}
+
+	svc->cond_deps  = NULL;
+	svc->cond_hooks = 0;
+}
+
+/**
+ * cond_get_agg_svc - Get aggregate state of all conditions for a service
+ * @svc: Pointer to &svc_t object
+ *
+ * Same as cond_get_agg(svc->cond) but using the compiled list of
+ * conditions from cond_deps_add(), no string parsing or lookups.
+ *
+ * Returns:
+ * The lowest state of all conditions, %COND_ON if there are none.
+ */
+enum cond_state cond_get_agg_svc(svc_t *svc)
+{
+	enum cond_state s = COND_ON;
+	struct cond_dep *dep;
+
+	/* not compiled, e.g. out of memory in cond_deps_add() */
+	if (!svc->cond_deps)
+		return cond_get_agg(svc->cond);
+
+	for (dep = svc->cond_deps; s && dep; dep = dep->next)
+		s = min(s, cond_node_state(dep->node));
+
+	return s;
+}
+
+/**
+ * cond_affects_svc - Check if condition is one of the service's conditions
+ * @name: Condition name
+ * @svc:  Pointer to &svc_t object
+ *
+ * Returns:
+ * %TRUE(1) or %FALSE(0)
+ */
+int cond_affects_svc(const char *name, svc_t *svc)
+{
+	struct cond_node *node;
+	struct cond_dep *dep;
+
+	if (!svc->cond_deps)
+		return cond_affects(name, svc->cond);
+
+	node = cond_node_find(name);
+	if (!node)
+		return 0;
+
+	for (dep = svc->cond_deps; dep; dep = dep->next) {
+		if (dep->node == node)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * cond_deps_foreach - Call @cb with statistics for each indexed condition
+ * @cb:  Callback, return non-zero to stop iterating
+ * @arg: Optional argument to @cb
+ */
+void cond_deps_foreach(int (*cb)(struct cond_stat *, void *), void *arg)
+{
+	struct cond_node *node;
+
+	TAILQ_FOREACH(node, &cond_nodes, link) {
+		struct cond_stat st = {
+			.name    = node->name,
+			.deps    = node->ndeps,
+			.updates = node->updates,
+			.stepped = node->stepped,
+			.last    = node->last,
+		};
+
+		if (cb(&st, arg))
+			break;
+	}
+}
+
 /* Should only be used by cond_set*(), cond_clear(), and usr/sys plugins! */
 int cond_update(const char *name)
 {
-	svc_t *svc, *iter = NULL;
+	struct cond_node *node;
+	struct cond_dep *dep;
 	int affects = 0;
 
 //	dbg("%s", name);
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		if (!svc_has_cond(svc) || !cond_affects(name, svc->cond))
+	if (!name)
+		return 0;
+
+	node = cond_node_find(name);
+	if (!node)
+		return 0;	/* no service depends on this condition */
+
+	node->busy++;
+	TAILQ_FOREACH(dep, &node->deps, link) {
+		svc_t *svc = dep->svc;
+
+		if (!svc || !svc_has_cond(svc))
 			continue;
 
 		affects++;
-		dbg("%s: match <%s> %s(%s)", name ?: "nil", svc->cond, svc->desc, svc->cmd);
+		dbg("%s: match <%s> %s(%s)", name, svc->cond, svc->desc, svc->cmd);
 		/* Fix bug #314: race condition between crashing services and conditions */
-		if (svc_is_restart(svc) && cond_get_agg(svc->cond) == COND_OFF) {
-			dbg("%s: cancel timer & unblock => WAITING state.", name ?: "nil");
+		if (svc_is_restart(svc) && cond_get_agg_svc(svc) == COND_OFF) {
+			dbg("%s: cancel timer & unblock => WAITING state.", name);
 			service_timeout_cancel(svc);
 			svc_unblock(svc);
 		}
 		service_step(svc);
 	}
 
+	node->updates++;
+	node->stepped += affects;
+	node->last     = affects;
+
+	if (--node->busy == 0 && node->stale)
+		cond_node_purge(node);
+
 	return affects;
 }
 
@@ -316,7 +833,7 @@ int cond_set_noupdate(const char *name)
 	if (string_compare(name, "nop"))
 		return 1;
 
-	if (!cond_set_path(cond_path(name), COND_ON))
+	if (!cond_set_state(name, COND_ON))
 		return 1;
 
 	return 0;
@@ -333,20 +850,22 @@ void cond_set(const char *name)
 
 int cond_set_oneshot_noupdate(const char *name)
 {
-	const char *path;
+	struct cond_node *node;
 
 	if (string_compare(name, "nop"))
 		return 1;
 
-	path = cond_path(name);
-	dbg("%s => %s", name, path);
-
-	if (cond_checkpath(path))
+	dbg("%s", name);
+	node = cond_node_get(name);
+	if (!node) {
+		errx(1, "Failed creating onshot cond %s", name);
 		return 1;
+	}
 
-	if (symlink(_PATH_RECONF, path) && errno != EEXIST) {
-		err(1, "Failed creating onshot cond %s", name);
-		return 1;
+	/* like symlink() w/ EEXIST, an already set condition is kept as-is */
+	if (!node->gen && !node->oneshot) {
+		node->oneshot = 1;
+		cond_node_dirty(node);
 	}
 
 	return 0;
@@ -367,7 +886,7 @@ int cond_clear_noupdate(const char *name)
 	if (string_compare(name, "nop"))
 		return 1;
 
-	if (!cond_set_path(cond_path(name), COND_OFF))
+	if (!cond_set_state(name, COND_OFF))
 		return 1;
 
 	return 0;
@@ -389,42 +908,23 @@ void cond_reload(void)
 	cond_bump_reconf();
 }
 
-static int do_assert(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw, int set)
+static void cond_assert(const char *pat, int set)
 {
-	char *nm;
+	struct cond_node *node;
+	size_t len = strlen(pat);
 
-	(void)sb;
-
-	if (ftw->level == 0)
-		return 1;
-
-	if (tflg != FTW_F)
-		return 0;
+	TAILQ_FOREACH(node, &cond_nodes, link) {
+		if (strncmp(node->name, pat, len))
+			continue;
+		if (cond_node_state(node) == COND_OFF)
+			continue;
 
-	nm = strstr((char *)fpath, COND_BASE);
-	if (!nm) {
-		errx(1, "Incorrect condition path %s, cannot %sassert", fpath, set ? "re" : "de");
-		return 1;
+		dbg("%sasserting %s", set ? "Re" : "De", node->name);
+		if (set)
+			cond_set(node->name);
+		else
+			cond_clear_noupdate(node->name); /* important, see netlink plugin! */
 	}
-
-	nm += strlen(COND_BASE);
-	dbg("%sasserting %s => %s", set ? "Re" : "De", fpath, nm);
-	if (set)
-		cond_set(nm);
-	else
-		cond_clear_noupdate(nm); /* important, see netlink plugin! */
-
-	return 0;
-}
-
-static int reassert(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw)
-{
-	return do_assert(fpath, sb, tflg, ftw, 1);
-}
-
-static int deassert(const char *fpath, const struct stat *sb, int tflg, struct FTW *ftw)
-{
-	return do_assert(fpath, sb, tflg, ftw, 0);
 }
 
 /*
@@ -434,7 +934,7 @@ static int deassert(const char *fpath, const struct stat *sb, int tflg, struct F
 void cond_reassert(const char *pat)
 {
 	dbg("%s", pat);
-	nftw(cond_path(pat), reassert, 20, FTW_DEPTH);
+	cond_assert(pat, 1);
 }
 
 /*
@@ -443,7 +943,7 @@ void cond_reassert(const char *pat)
 void cond_deassert(const char *pat)
 {
 	dbg("%s", pat);
-	nftw(cond_path(pat), deassert, 20, FTW_DEPTH);
+	cond_assert(pat, 0);
 }
 
 /*
@@ -468,9 +968,45 @@ void cond_init(void)
 	cond_boot_strap();
 }
 
+static int do_delete(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftw)
+{
+	struct cond_node *node;
+	const char *cond;
+
+	(void)sb;
+	(void)tflag;
+
+	if (ftw->level == 0)
+		return 1;
+
+	cond = cond_name(fpath);
+	if (!cond) {
+		warnx("%s does not seem to be a Finit condition, skipping", fpath);
+		return 0;
+	}
+
+	if (remove(fpath))
+		err(1, "Failed removing condition %s", fpath);
+
+	node = cond_node_find(cond);
+	if (node) {
+		node->gen = 0;
+		node->oneshot = 0;
+	}
+	if (!sm_in_reload())
+		cond_update(cond);
+
+	return 0;
+}
+
 void cond_exit(void)
 {
-	cond_delpath(_PATH_COND);
+	/* Flush any pending changes before tearing down the mirror */
+	cond_mirror(NULL);
+
+	nftw(_PATH_COND, do_delete, 20, FTW_DEPTH);
+	if (remove(_PATH_COND) && errno != ENOENT && errno != ENOTEMPTY)
+		err(1, "Failed removing condition path %s", _PATH_COND);
 }
 
 /**
@@ -91,7 +91,12 @@ enum cond_state cond_get_path(const char *path)
 
 enum cond_state cond_get(const char *name)
 {
+#ifdef __FINIT__
+	/* Finit keeps all conditions in memory, the files are a mirror */
+	return cond_get_mem(name);
+#else
 	return cond_get_path(cond_path(name));
+#endif
 }
 
 enum cond_state cond_get_agg(const char *names)
@@ -24,17 +24,31 @@ typedef enum cond_state {
 	COND_ON
 } cond_state_t;
 
+/* Dependents index statistics, see cond_deps_foreach() */
+struct cond_stat {
+	const char     *name;
+	size_t          deps;		/* services depending on cond */
+	unsigned int    updates;	/* calls to cond_update() */
+	unsigned int    stepped;	/* services stepped, in total */
+	unsigned int    last;		/* services stepped, last update */
+};
+
 char           *mkcond       (svc_t *svc, char *buf, size_t len);
 const char     *condstr      (enum cond_state s);
 const char     *cond_path    (const char *name);
 unsigned int    cond_get_gen (const char *path);
 enum cond_state cond_get_path(const char *path);
 enum cond_state cond_get     (const char *name);
+enum cond_state cond_get_mem (const char *name);
 enum cond_state cond_get_agg (const char *names);
 int             cond_affects (const char *name, const char *names);
 
+enum cond_state cond_get_agg_svc(svc_t *svc);
+int             cond_affects_svc(const char *name, svc_t *svc);
+
 void cond_boot_parse  (char *arg);
 int  cond_update      (const char *name);
+int  cond_sync        (const char *name);
 int  cond_set_path    (const char *path, enum cond_state new);
 void cond_set         (const char *name);
 void cond_set_oneshot (const char *name);
@@ -45,6 +59,10 @@ int  cond_set_noupdate(const char *name);
 int  cond_set_oneshot_noupdate(const char *name);
 int  cond_clear_noupdate(const char *name);
 
+void cond_deps_add    (svc_t *svc);
+void cond_deps_del    (svc_t *svc);
+void cond_deps_foreach(int (*cb)(struct cond_stat *, void *), void *arg);
+
 void cond_reassert    (const char *pat);
 void cond_deassert    (const char *pat);
 
@@ -26,7 +26,9 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
@@ -41,6 +43,7 @@
 #include "finit.h"
 #include "cond.h"
 #include "devmon.h"
+#include "graph.h"
 #include "iwatch.h"
 #include "private.h"
 #include "service.h"
@@ -81,6 +84,14 @@ static TAILQ_HEAD(, env_entry) env_list = TAILQ_HEAD_INITIALIZER(env_list);
 struct rlimit initial_rlimit[RLIMIT_NLIMITS];
 struct rlimit global_rlimit[RLIMIT_NLIMITS];
 
+/*
+ * PID 1 holds a pidfd, PTY, log file, and timers for each service, so
+ * the default 1024 descriptors are not enough on large systems.  This
+ * is only for PID 1, services still get initial_rlimit.
+ */
+#define NOFILE_MAX 65536
+static struct rlimit nofile;
+
 /*
  * --enable-fastboot => fsck_mode: NULL => no fsck by default
  * --enable-fsckfix  => fsck_mode: "-f" + fsck_repair: "y"
@@ -100,6 +111,7 @@ char *fsck_mode = "";
 # endif
 char *fsck_repair = "-p";
 #endif
+int   fsck_parallel = 0;	/* 0: number of online CPUs */
 
 char *runparts = NULL;
 int   runparts_progress;
@@ -118,11 +130,96 @@ static uev_t etcw;
 
 static TAILQ_HEAD(, conf_change) conf_change_list = TAILQ_HEAD_INITIALIZER(conf_change_list);
 
+/*
+ * Parse results of each .conf file, used by conf_reload() to reparse
+ * only files that have been added, changed, or removed since the last
+ * reload.  Files with global settings, e.g., environment variables or
+ * cgroups, cannot be reparsed on their own and require a full reload.
+ */
+struct conf_file {
+	TAILQ_ENTRY(conf_file) link;
+	char           *name;
+	dev_t           dev;
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+	struct timespec ctime;
+
+	int             global;	/* Has global settings, e.g. env or cgroup */
+	int             lines;	/* Number of service/task/run/sysv/tty lines */
+	int             count;	/* Number of services loaded from this file */
+	int             partial;/* Not all lines loaded, e.g., if: or [S] */
+	int             reparse;
+	int             seen;
+};
+
+static TAILQ_HEAD(, conf_file) conf_file_list = TAILQ_HEAD_INITIALIZER(conf_file_list);
+static struct conf_file *conf_parsing;	/* File currently in parse_conf() */
+static int conf_cached;			/* Set after first full reload */
+static int conf_cached_boot;		/* Set if cache is from bootstrap */
+static int conf_dups;			/* Same service in more than one file */
+
+/*
+ * Compiled snapshot of the .conf files parsed at bootstrap, used by the
+ * next boot to skip globbing and reading the files, see conf_snap_load().
+ * It holds the preprocessed lines of each file, keyed by the inode, size,
+ * and timestamps of the files and directories they were read from, and
+ * the rank of each service loaded from them, see graph_update().
+ */
+#define CONF_SNAP       FINIT_CACHEPATH "/conf.snap"
+#define CONF_SNAP_MAGIC "FINITCS1"
+
+enum {
+	CONF_SNAP_DIR = 1,	/* Directory globbed for .conf files */
+	CONF_SNAP_ORDER,	/* Globbed file, for conf.order */
+	CONF_SNAP_FILE,		/* Parsed file, followed by its lines */
+	CONF_SNAP_GRAPH,	/* Rank and identity of each service */
+};
+
+struct conf_snap_hdr {
+	char     magic[8];
+	char     version[24];
+	uint32_t size;		/* Size of snapshot, including header */
+	uint32_t count;		/* Number of records */
+};
+
+struct conf_snap_rec {
+	uint32_t type;
+	uint32_t is_rcsd;
+	uint32_t lines;		/* Number of lines after the name */
+	uint32_t len;		/* Size of name and lines, padded */
+	uint64_t ino;
+	int64_t  size;
+	int64_t  mtime[2];
+	int64_t  ctime[2];
+};
+
+static struct {
+	FILE    *fp;		/* Snapshot being recorded, or NULL */
+	char    *buf;
+	size_t   len;
+	uint32_t count;
+
+	FILE    *lines;		/* Lines of file being parsed */
+	char    *lbuf;
+	size_t   llen;
+	uint32_t num;
+
+	int      skip;		/* Not possible to snapshot, e.g., include */
+	int      replay;	/* Replaying lines from snapshot */
+} snap;
+
+struct conf_dirty {
+	svc_t *svc;
+	int    args;
+};
+
 static char *path;
 static char *shell;
 
 static int  parse_conf(char *file, int is_rcsd);
 static void drop_changes(void);
+int         conf_changed(const char *file);
 
 static int get_bool(char *arg, int default_value)
 {
@@ -245,6 +342,22 @@ static void parse_fsck_opts(char *opt)
 
 		return;
 	}
+
+	if (string_compare(opt, "parallel")) {
+		const char *err = NULL;
+		int num;
+
+		if (validate_arg(arg, "fsck.parallel"))
+			return;
+
+		num = strtonum(arg, 0, 64, &err);
+		if (err)
+			logit(LOG_WARNING, "Invalid fsck.parallel=%s, %s", arg, err);
+		else
+			fsck_parallel = num;
+
+		return;
+	}
 }
 
 /*
@@ -585,16 +698,16 @@ char *conf_parse_env(char *line, char **value)
 /*
  * Sets, and makes a note of, all KEY=VALUE lines in a given .conf line
  * from finit.conf, or other .conf file.  Note, PATH is always reset in
- * the conf_reset_env() function.
+ * the conf_reset_env() function.  Returns 0 if a variable was set.
  */
-static void parse_env(char *line)
+static int parse_env(char *line)
 {
 	struct env_entry *node;
 	char *key, *val;
 
 	key = conf_parse_env(line, &val);
 	if (!key)
-		return;
+		return 1;
 
 	dbg("Global env '%s'='%s'", key, val);
 	setenv(key, val, 1);
@@ -603,7 +716,7 @@ static void parse_env(char *line)
 	if (!node) {
 	nomem:
 		err(1, "Out of memory cannot track env vars");
-		return;
+		return 0;
 	}
 
 	node->name = strdup(key);
@@ -613,6 +726,8 @@ static void parse_env(char *line)
 	}
 
 	TAILQ_INSERT_HEAD(&env_list, node, link);
+
+	return 0;
 }
 
 static int kmod_exists(char *mod)
@@ -712,6 +827,7 @@ void conf_parse_cond(svc_t *svc, char *cond)
 
 	if (!cond) {
 		memset(svc->cond, 0, sizeof(svc->cond));
+		cond_deps_del(svc);
 		return;
 	}
 
@@ -749,6 +865,8 @@ void conf_parse_cond(svc_t *svc, char *cond)
 			strlcat(svc->cond, ",", sizeof(svc->cond));
 		strlcat(svc->cond, c, sizeof(svc->cond));
 	}
+
+	cond_deps_add(svc);
 }
 
 struct rlimit_name {
@@ -969,6 +1087,9 @@ static int parse_static(char *line, int is_rcsd)
 			return 1;
 		}
 
+		/* Not keyed in the snapshot, nor are nested lines replayable */
+		snap.skip = 1;
+
 		return parse_conf(cmd, is_rcsd);
 	}
 
@@ -1054,34 +1175,68 @@ static int parse_static(char *line, int is_rcsd)
 		return 0;
 	}
 
+	/*
+	 * Max number of services starting in parallel, 0: unlimited
+	 */
+	if (MATCH_CMD(line, "parallel ", x)) {
+		char *token = strip_line(x);
+		const char *err = NULL;
+		int val;
+
+		val = strtonum(token, 0, 1024, &err);
+		if (err)
+			logit(LOG_WARNING, "Invalid parallel %s, %s", token, err);
+		else
+			graph_set_max(val);
+		return 0;
+	}
+
 	return 1;
 }
 
+/*
+ * Note global settings and number of service lines in the file being
+ * parsed, used to decide what to reparse in conf_reload().
+ */
+static void conf_global(void)
+{
+	if (conf_parsing)
+		conf_parsing->global = 1;
+}
+
+static void conf_register(int type, char *cfg, struct rlimit rlimit[], char *file)
+{
+	if (conf_parsing)
+		conf_parsing->lines++;
+
+	service_register(type, cfg, rlimit, file);
+}
+
 static int parse_dynamic(char *line, struct rlimit rlimit[], char *file)
 {
 	char *x;
 
 	/* Monitored daemon, will be respawned on exit */
 	if (MATCH_CMD(line, "service ", x)) {
-		service_register(SVC_TYPE_SERVICE, x, rlimit, file);
+		conf_register(SVC_TYPE_SERVICE, x, rlimit, file);
 		return 0;
 	}
 
 	/* One-shot task, will not be respawned */
 	if (MATCH_CMD(line, "task ", x)) {
-		service_register(SVC_TYPE_TASK, x, rlimit, file);
+		conf_register(SVC_TYPE_TASK, x, rlimit, file);
 		return 0;
 	}
 
 	/* Like task but waits for completion, useful w/ [S] */
 	if (MATCH_CMD(line, "run ", x)) {
-		service_register(SVC_TYPE_RUN, x, rlimit, file);
+		conf_register(SVC_TYPE_RUN, x, rlimit, file);
 		return 0;
 	}
 
 	/* Similar to task but is treated like a SysV init script */
 	if (MATCH_CMD(line, "sysv ", x)) {
-		service_register(SVC_TYPE_SYSV, x, rlimit, file);
+		conf_register(SVC_TYPE_SYSV, x, rlimit, file);
 		return 0;
 	}
 
@@ -1094,6 +1249,7 @@ static int parse_dynamic(char *line, struct rlimit rlimit[], char *file)
 	/* Read control group limits */
 	if (MATCH_CMD(line, "cgroup ", x)) {
 		conf_parse_cgroup(x);
+		conf_global();
 		return 0;
 	}
 
@@ -1105,7 +1261,7 @@ static int parse_dynamic(char *line, struct rlimit rlimit[], char *file)
 
 	/* Regular or serial TTYs to run getty */
 	if (MATCH_CMD(line, "tty ", x)) {
-		service_register(SVC_TYPE_TTY, strip_line(x), rlimit, file);
+		conf_register(SVC_TYPE_TTY, strip_line(x), rlimit, file);
 		return 0;
 	}
 
@@ -1171,6 +1327,16 @@ static int is_template(const char *file, char *name, size_t len)
 	return 1;		/* instantiated template */
 }
 
+static void parse_line(char *line, int is_rcsd, struct rlimit rlimit[], char *file)
+{
+	if (!parse_static(line, is_rcsd))
+		conf_global();
+	else if (!parse_dynamic(line, is_rcsd ? rlimit : global_rlimit, file))
+		;
+	else if (!parse_env(line))
+		conf_global();
+}
+
 static int parse_conf(char *file, int is_rcsd)
 {
 	struct rlimit rlimit[RLIMIT_NLIMITS];
@@ -1208,13 +1374,13 @@ static int parse_conf(char *file, int is_rcsd)
 		line = instantiate(line, name);
 //		dbg("ins: %s", line);
 
-		if (!parse_static(line, is_rcsd))
-			;
-		else if (!parse_dynamic(line, is_rcsd ? rlimit : global_rlimit, file))
-			;
-		else
-			parse_env(line);
+		/* Record before parsing, the parser modifies the line */
+		if (snap.lines && line[0]) {
+			fwrite(line, strlen(line) + 1, 1, snap.lines);
+			snap.num++;
+		}
 
+		parse_line(line, is_rcsd, rlimit, file);
 		free(line);
 	}
 
@@ -1247,224 +1413,1059 @@ static void glob_append(glob_t *gl, int append, const char *fmt, ...)
 	glob(path, append ? GLOB_APPEND : 0, NULL, gl);
 }
 
-/*
- * Reload /etc/finit.conf and all *.conf in /etc/finit.d/
- */
-int conf_reload(void)
+static struct conf_file *conf_file_find(const char *file)
 {
-	glob_t gl;
-	size_t i;
-
-	/* Set time according to current time zone */
-	tzset();
-	dbg("Set time  daylight: %d  timezone: %ld  tzname: %s %s",
-	   daylight, timezone, tzname[0], tzname[1]);
-
-	/* Mark and sweep */
-	cgroup_mark_all();
-	svc_mark_dynamic();
-	conf_reset_env();
+	struct conf_file *cf;
 
-	/*
-	 * Reset global rlimit to bootstrap values from conf_init().
-	 */
-	memcpy(global_rlimit, initial_rlimit, sizeof(global_rlimit));
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		if (!strcmp(cf->name, file))
+			return cf;
+	}
 
-	/*
-	 * When built with --disable-rescue mode many other 'if (rescue)'
-	 * code paths are #ifdeffed out.  This one, and the ones in the
-	 * plugins, are not because a hook or plugin can still trigger
-	 * the alternative rescue.conf instead of finit.conf.  This for
-	 * very advanced use-cases where files on /etc are generated at
-	 * bootstrap, including users and passwords, from other sources.
-	 */
-	if (rescue) {
-		int rc;
-		char line[80] = "tty [12345789] rescue";
+	return NULL;
+}
 
-		/* If rescue.conf is missing, fall back to a root shell */
-		rc = parse_conf(RESCUE_CONF, 0);
-		if (rc)
-			service_register(SVC_TYPE_TTY, line, global_rlimit, NULL);
+/*
+ * Find .conf file a service was loaded from, svc->file may be truncated
+ * so this only compares as many characters as fit.  Such long file names
+ * are always reparsed, see conf_file_sweep().
+ */
+static struct conf_file *conf_file_owner(svc_t *svc)
+{
+	struct conf_file *cf;
 
-		print(rc, "Entering rescue mode");
-		goto done;
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		if (!strncmp(cf->name, svc->file, sizeof(svc->file) - 1))
+			return cf;
 	}
 
-	/* First, read /etc/finit.conf */
-	parse_conf(finit_conf, 0);
-
-	/* Set global limits */
-	for (int i = 0; i < RLIMIT_NLIMITS; i++) {
-		if (setrlimit(i, &global_rlimit[i]) == -1)
-			logit(LOG_WARNING, "rlimit: Failed setting %s: %s",
-			      rlim2str(i), lim2str(&global_rlimit[i]));
-	}
+	return NULL;
+}
 
-	/*
-	 * Next, read all *.conf in /lib/finit/system and /etc/finit.d/
-	 * The system files were previously created at runtime by plugins
-	 * but are now regular files that can be overridden by files in
-	 * /etc/finit.d -- similar to how tmfiles.d(5) work.  E.g., add
-	 * an override .conf, or an ignore by symlinking to /dev/null
-	 *
-	 * The .conf files (and run/task/service stanzas) are parsed and
-	 * started in order.  Each directory is sorted alphanumerically
-	 * and then the result is appended to the overall order:
-	 *
-	 *     /lib/finit/system/10-hotplug.conf
-	 *     /lib/finit/system/90-testserv.conf
-	 *     /run/finit/system/dbus.conf
-	 *     /run/finit/system/tty.conf
-	 *     /etc/finit.d/10-abc.conf
-	 *     /etc/finit.d/20-abc.conf
-	 *     /etc/finit.d/enabled/1-aaa.conf
-	 *     /etc/finit.d/enabled/1-abc.conf
-	 *     /etc/finit.d/enabled/2-aaa.conf
-	 */
-	glob_append(&gl, 0, "%s/*.conf", FINIT_SYSPATH_);
-	glob_append(&gl, 1, "%s/*.conf", FINIT_RUNPATH_);
-	glob_append(&gl, 1, "%s/*.conf", finit_rcsd);
-	glob_append(&gl, 1, "%s/enabled/*.conf", finit_rcsd);
-
-	if (bootstrap) {
-		const char *fn = _PATH_VARRUN "finit/conf.order";
-		FILE *fp;
-
-		fp = fopen(fn, "w");
-		if (!fp) {
-			err(1, "failed creating %s", fn);
-		} else {
-			fprintf(fp, "# Evaluation & execution order of .conf files\n");
-			for (i = 0; i < gl.gl_pathc; i++)
-				fprintf(fp, "%s\n", gl.gl_pathv[i]);
-			fclose(fp);
-		}
-	}
+static void conf_file_drop(struct conf_file *cf)
+{
+	TAILQ_REMOVE(&conf_file_list, cf, link);
+	free(cf->name);
+	free(cf);
+}
 
-	for (i = 0; i < gl.gl_pathc; i++) {
-		char *path = gl.gl_pathv[i];
-		char *rp = NULL;
-		struct stat st;
-		size_t j, len;
+static void conf_file_flush(void)
+{
+	struct conf_file *cf, *tmp;
 
-		/* check for FINIT_SYSPATH_ or FINIT_RUNPATH_ overrides */
-		for (j = i + 1; j < gl.gl_pathc; j++) {
-			if (strncmp(path, FINIT_SYSPATH_, strlen(FINIT_SYSPATH_)) &&
-			    strncmp(path, FINIT_RUNPATH_, strlen(FINIT_RUNPATH_)))
-				continue;
-			if (strcmp(basenm(path), basenm(gl.gl_pathv[j])))
-				continue;
-			path = NULL; /* replacement later in list, skip this */
-			break;
-		}
+	TAILQ_FOREACH_SAFE(cf, &conf_file_list, link, tmp)
+		conf_file_drop(cf);
+	conf_cached = 0;
+}
 
-		if (!path)
-			continue; /* skip, override exists */
+/*
+ * Check if file has changed since we last parsed it, either reported
+ * by inotify or, e.g., on file systems without inotify, by stat().
+ */
+static int conf_file_stale(struct conf_file *cf)
+{
+	struct stat st;
 
-		/* Check that it's an actual file ... beyond any symlinks */
-		if (lstat(path, &st)) {
-			dbg("Skipping %s, cannot access: %s", path, strerror(errno));
-			continue;
-		}
+	if (conf_changed(cf->name))
+		return 1;
 
-		/* Skip directories */
-		if (S_ISDIR(st.st_mode)) {
-			dbg("Skipping directory %s", path);
-			continue;
-		}
+	/* Missing finit.conf is the same as an empty one */
+	if (stat(cf->name, &st))
+		memset(&st, 0, sizeof(st));
 
-		/* Check for dangling symlinks */
-		if (S_ISLNK(st.st_mode)) {
-			rp = realpath(path, NULL);
-			if (!rp) {
-				logit(LOG_WARNING, "Skipping %s, dangling symlink: %s", path, strerror(errno));
-				continue;
-			}
-		}
+	return st.st_dev != cf->dev || st.st_ino != cf->ino ||
+		st.st_size != cf->size ||
+		st.st_mtim.tv_sec  != cf->mtime.tv_sec  ||
+		st.st_mtim.tv_nsec != cf->mtime.tv_nsec ||
+		st.st_ctim.tv_sec  != cf->ctime.tv_sec  ||
+		st.st_ctim.tv_nsec != cf->ctime.tv_nsec;
+}
 
-		/* Check that file ends with '.conf' */
-		len = strlen(path);
-		if (len < 6 || strcmp(&path[len - 5], ".conf"))
-			dbg("Skipping %s, not a Finit .conf file ... ", path);
-		else
-			parse_conf(path, 1);
+static int conf_snap_runtime(const char *file)
+{
+	return !strncmp(file, FINIT_RUNPATH_ "/", strlen(FINIT_RUNPATH_) + 1);
+}
 
-		if (rp)
-			free(rp);
-	}
+/* 64-bit FNV-1a of the contents of a file */
+static uint64_t conf_snap_hash(const char *file)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	char buf[BUF_SIZE];
+	size_t len, i;
+	FILE *fp;
 
-	globfree(&gl);
+	fp = fopen(file, "r");
+	if (!fp)
+		return 0;
 
-	/* Mark any reverse deps as chenaged. */
-	service_update_rdeps();
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		for (i = 0; i < len; i++) {
+			hash ^= (unsigned char)buf[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	fclose(fp);
 
-	/* Prune according to if:[!]ident or if:<[!]cond> */
-	service_mark_unavail();
+	return hash;
+}
 
-	/* Set up top-level cgroups */
-	cgroup_config();
-done:
-	/* Remove all unused top-level cgroups */
-	cgroup_cleanup();
+static void conf_snap_key(struct conf_snap_rec *rec, const char *name, struct stat *st)
+{
+	/* Recreated every boot, e.g., by conf_save_service(), use contents */
+	if (st->st_size && conf_snap_runtime(name)) {
+		rec->ino  = conf_snap_hash(name);
+		rec->size = st->st_size;
+		return;
+	}
 
-	/* Drop record of all .conf changes */
-	drop_changes();
+	/* Not st_dev, may differ between boots, e.g., on overlayfs */
+	rec->ino      = st->st_ino;
+	rec->size     = st->st_size;
+	rec->mtime[0] = st->st_mtim.tv_sec;
+	rec->mtime[1] = st->st_mtim.tv_nsec;
+	rec->ctime[0] = st->st_ctim.tv_sec;
+	rec->ctime[1] = st->st_ctim.tv_nsec;
+}
 
-	if (bootstrap)
-		wdog = svc_find("watchdog", "finit");
+static void conf_snap_add(int type, int is_rcsd, const char *name, struct stat *st,
+			  const char *lines, size_t len, uint32_t num)
+{
+	static const char pad[8];
+	struct conf_snap_rec rec = {
+		.type    = type,
+		.is_rcsd = is_rcsd,
+		.lines   = num,
+	};
+	size_t sz;
+
+	if (!snap.fp)
+		return;
 
-	/* Override configured runlevel, user said 'S' on /proc/cmdline */
-	if (BOOTSTRAP && single)
-		cfglevel = 1;
+	if (st)
+		conf_snap_key(&rec, name, st);
 
-	/*
-	 * Set host name, from %DEFHOST, *.conf or /etc/hostname.  The
-	 * latter wins, if neither exists we default to "noname"
-	 */
-	set_hostname(&hostname);
+	sz = strlen(name) + 1 + len;
+	rec.len = (sz + 7) & ~7;
 
-	return 0;
+	fwrite(&rec, sizeof(rec), 1, snap.fp);
+	fwrite(name, strlen(name) + 1, 1, snap.fp);
+	if (len)
+		fwrite(lines, len, 1, snap.fp);
+	fwrite(pad, rec.len - sz, 1, snap.fp);
+	snap.count++;
 }
 
-static struct conf_change *conf_find(char *file)
+/* Find or add file, and update it from stat() taken before parsing */
+static struct conf_file *conf_file_get(char *file, struct stat *st)
 {
-	struct conf_change *node, *tmp;
-
-	TAILQ_FOREACH_SAFE(node, &conf_change_list, link, tmp) {
-		if (string_compare(node->name, file))
-			return node;
+	struct conf_file *cf;
+
+	cf = conf_file_find(file);
+	if (!cf) {
+		cf = calloc(1, sizeof(*cf));
+		if (!cf || !(cf->name = strdup(file))) {
+			free(cf);
+			conf_file_flush();
+			return NULL;
+		}
+		TAILQ_INSERT_TAIL(&conf_file_list, cf, link);
 	}
 
-	return NULL;
+	cf->dev     = st->st_dev;
+	cf->ino     = st->st_ino;
+	cf->size    = st->st_size;
+	cf->mtime   = st->st_mtim;
+	cf->ctime   = st->st_ctim;
+	cf->global  = 0;
+	cf->lines   = 0;
+	cf->seen    = 1;
+
+	return cf;
 }
 
-static void drop_change(struct conf_change *node)
+static struct conf_file *conf_file_parse(char *file, int is_rcsd)
 {
-	if (!node)
-		return;
+	struct conf_file *cf;
+	struct stat st;
 
-	TAILQ_REMOVE(&conf_change_list, node, link);
-	free(node->name);
-	free(node);
-}
+	/* Stat before parsing, if it changes meanwhile we reparse next time */
+	if (stat(file, &st))
+		memset(&st, 0, sizeof(st));
 
+	if (snap.fp) {
+		snap.num = 0;
+		snap.lines = open_memstream(&snap.lbuf, &snap.llen);
+		if (!snap.lines)
+			snap.skip = 1;
+	}
 
-static void drop_changes(void)
-{
-	struct conf_change *node, *tmp;
+	cf = conf_file_get(file, &st);
+	conf_parsing = cf;
+	parse_conf(file, is_rcsd);
+	conf_parsing = NULL;
 
-	TAILQ_FOREACH_SAFE(node, &conf_change_list, link, tmp)
-		drop_change(node);
+	if (snap.lines) {
+		fclose(snap.lines);
+		snap.lines = NULL;
+		conf_snap_add(CONF_SNAP_FILE, is_rcsd, file, &st, snap.lbuf, snap.llen, snap.num);
+		free(snap.lbuf);
+	}
+
+	return cf;
 }
 
-static int conf_change_act(char *dir, char *name, uint32_t mask)
+/*
+ * Drop files that no longer exist and find files where not all service
+ * lines resulted in a loaded service.  E.g., 'if:' statements, missing
+ * commands, or bootstrap-only [S] services.  Such files depend on more
+ * than their own contents so they are always reparsed on reload.
+ */
+static void conf_file_sweep(void)
 {
-	char fn[strlen(dir) + strlen(name) + 2];
-	struct conf_change *node;
-	char *rp = NULL;
+	struct conf_file *cf, *tmp;
+	svc_t *svc, *iter = NULL;
 
-	/* Check for actual printable characters, sometimes STX */
+	TAILQ_FOREACH_SAFE(cf, &conf_file_list, link, tmp) {
+		if (!cf->seen) {
+			conf_file_drop(cf);
+			continue;
+		}
+		cf->count = 0;
+	}
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc_is_removed(svc) || !svc->file[0])
+			continue;
+
+		cf = conf_file_owner(svc);
+		if (cf)
+			cf->count++;
+	}
+
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		cf->partial = cf->count != cf->lines ||
+			strlen(cf->name) >= sizeof(svc->file) - 1;
+		if (cf->partial)
+			dbg("%s: %d lines, %d services, always reparse", cf->name, cf->lines, cf->count);
+	}
+
+	conf_cached = 1;
+	conf_cached_boot = BOOTSTRAP;
+}
+
+/*
+ * Incremental reload, reparse only added and changed .conf files, and
+ * drop services from changed and removed files.  Services loaded from
+ * other files are kept as-is, after the same checks a full reparse would
+ * do, e.g., for changes to their /etc/default/ env file.
+ *
+ * Returns 0 when done, or non-zero when a full reload is required, 2 if
+ * some files have already been reparsed, see conf_dirty_save().
+ */
+static int conf_reparse(char **files, size_t num)
+{
+	svc_t *svc, *iter = NULL;
+	struct conf_file *cf;
+	size_t i;
+
+	/* After bootstrap [S] services must be dropped, see service_register() */
+	if (!conf_cached || conf_dups || (conf_cached_boot && !BOOTSTRAP))
+		return 1;
+
+	TAILQ_FOREACH(cf, &conf_file_list, link)
+		cf->seen = cf->reparse = 0;
+
+	/* Global settings, always reparse everything */
+	cf = conf_file_find(finit_conf);
+	if (!cf || conf_file_stale(cf))
+		return 1;
+	cf->seen = 1;
+
+	for (i = 0; i < num; i++) {
+		cf = conf_file_find(files[i]);
+		if (!cf) {
+			cf = calloc(1, sizeof(*cf));
+			if (!cf || !(cf->name = strdup(files[i]))) {
+				free(cf);
+				return 1;
+			}
+			TAILQ_INSERT_TAIL(&conf_file_list, cf, link);
+			cf->reparse = 1;
+		} else if (cf->partial || conf_file_stale(cf)) {
+			cf->reparse = 1;
+		}
+		cf->seen = 1;
+	}
+
+	/*
+	 * Services in unchanged files may still fail to load on a full
+	 * reparse, e.g., TTYs without a device or a removed command.
+	 */
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->protect || !svc->file[0])
+			continue;
+
+		cf = conf_file_owner(svc);
+		if (!cf)
+			return 1;
+		if (cf->reparse || !cf->seen)
+			continue;
+
+		if (svc_is_tty(svc) || !whichp(svc->cmd))
+			cf->reparse = 1;
+	}
+
+	TAILQ_FOREACH(cf, &conf_file_list, link) {
+		if ((cf->reparse || !cf->seen) && cf->global)
+			return 1;
+	}
+
+	/* Mark and sweep, only services from changed and removed files */
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->protect || !svc->file[0] || svc_is_removed(svc))
+			continue;
+
+		cf = conf_file_owner(svc);
+		if (cf->reparse || !cf->seen) {
+			svc_mark(svc);
+			continue;
+		}
+
+		/* Same as service_register() does for an unmodified service */
+		if (conf_changed(svc_getenv(svc))) {
+			svc->args_dirty = 1;
+			svc_mark_dirty(svc);
+		} else
+			svc_mark_clean(svc);
+	}
+
+	for (i = 0; i < num; i++) {
+		cf = conf_file_find(files[i]);
+		if (!cf->reparse)
+			continue;
+
+		/* New global settings, or service also in another file */
+		cf = conf_file_parse(files[i], 1);
+		if (!cf || cf->global || conf_dups)
+			return 2;
+	}
+
+	return 0;
+}
+
+/*
+ * An aborted incremental reload may already have reparsed some files.
+ * Save the services it found modified, a second reparse would not.
+ */
+static struct conf_dirty *conf_dirty_save(void)
+{
+	svc_t *svc, *iter = NULL;
+	struct conf_dirty *list;
+	size_t num = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0))
+		num++;
+
+	list = calloc(num + 1, sizeof(*list));
+	if (!list)
+		return NULL;
+
+	num = 0;
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (!svc_is_changed(svc) || svc_is_removed(svc))
+			continue;
+
+		list[num].svc  = svc;
+		list[num].args = svc->args_dirty;
+		num++;
+	}
+
+	return list;
+}
+
+static void conf_dirty_restore(struct conf_dirty *list)
+{
+	size_t i;
+
+	if (!list)
+		return;
+
+	for (i = 0; list[i].svc; i++) {
+		list[i].svc->args_dirty |= list[i].args;
+		svc_mark_dirty(list[i].svc);
+	}
+	free(list);
+}
+
+/*
+ * Called by service_register() when a service is declared in more than
+ * one .conf file.  The last one wins, so from now on only full reloads.
+ */
+void conf_duplicate(svc_t *svc, const char *file)
+{
+	dbg("%s also declared in %s", svc_ident(svc, NULL, 0), file);
+	conf_dups = 1;
+}
+
+/*
+ * Filter globbed .conf files, in order, skipping any file overridden by
+ * a file later in the list, directories, dangling symlinks, and files
+ * not ending in '.conf'.  Returns number of files to parse.
+ */
+static size_t conf_files(glob_t *gl, char **files)
+{
+	size_t i, num = 0;
+
+	for (i = 0; i < gl->gl_pathc; i++) {
+		char *path = gl->gl_pathv[i];
+		char *rp = NULL;
+		struct stat st;
+		size_t j, len;
+
+		/* check for FINIT_SYSPATH_ or FINIT_RUNPATH_ overrides */
+		for (j = i + 1; j < gl->gl_pathc; j++) {
+			if (strncmp(path, FINIT_SYSPATH_, strlen(FINIT_SYSPATH_)) &&
+			    strncmp(path, FINIT_RUNPATH_, strlen(FINIT_RUNPATH_)))
+				continue;
+			if (strcmp(basenm(path), basenm(gl->gl_pathv[j])))
+				continue;
+			path = NULL; /* replacement later in list, skip this */
+			break;
+		}
+
+		if (!path)
+			continue; /* skip, override exists */
+
+		/* Check that it's an actual file ... beyond any symlinks */
+		if (lstat(path, &st)) {
+			dbg("Skipping %s, cannot access: %s", path, strerror(errno));
+			continue;
+		}
+
+		/* Skip directories */
+		if (S_ISDIR(st.st_mode)) {
+			dbg("Skipping directory %s", path);
+			continue;
+		}
+
+		/* Check for dangling symlinks */
+		if (S_ISLNK(st.st_mode)) {
+			rp = realpath(path, NULL);
+			if (!rp) {
+				logit(LOG_WARNING, "Skipping %s, dangling symlink: %s", path, strerror(errno));
+				snap.skip = 1; /* target may appear on next boot */
+				continue;
+			}
+		}
+
+		/* Check that file ends with '.conf' */
+		len = strlen(path);
+		if (len < 6 || strcmp(&path[len - 5], ".conf"))
+			dbg("Skipping %s, not a Finit .conf file ... ", path);
+		else
+			files[num++] = path;
+
+		if (rp)
+			free(rp);
+	}
+
+	return num;
+}
+
+static void conf_order(char **files, size_t num)
+{
+	const char *fn = _PATH_VARRUN "finit/conf.order";
+	size_t i;
+	FILE *fp;
+
+	fp = fopen(fn, "w");
+	if (!fp) {
+		err(1, "failed creating %s", fn);
+		return;
+	}
+
+	fprintf(fp, "# Evaluation & execution order of .conf files\n");
+	for (i = 0; i < num; i++)
+		fprintf(fp, "%s\n", files[i]);
+	fclose(fp);
+}
+
+/* Directories globbed for .conf files, except FINIT_RUNPATH_ on tmpfs */
+static char *conf_snap_dir(int i, char *buf, size_t len)
+{
+	switch (i) {
+	case 0:
+		strlcpy(buf, FINIT_SYSPATH_, len);
+		break;
+	case 1:
+		strlcpy(buf, finit_rcsd, len);
+		break;
+	case 2:
+		snprintf(buf, len, "%s/enabled", finit_rcsd);
+		break;
+	default:
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void conf_glob(glob_t *gl)
+{
+	char dir[PATH_MAX];
+	struct stat st;
+	size_t i;
+
+	/* Stat before globbing, if they change meanwhile the snapshot is stale */
+	for (i = 0; snap.fp && conf_snap_dir(i, dir, sizeof(dir)); i++) {
+		if (stat(dir, &st))
+			memset(&st, 0, sizeof(st));
+		conf_snap_add(CONF_SNAP_DIR, 0, dir, &st, NULL, 0, 0);
+	}
+
+	/*
+	 * Find all *.conf in /lib/finit/system and /etc/finit.d/
+	 * The system files were previously created at runtime by plugins
+	 * but are now regular files that can be overridden by files in
+	 * /etc/finit.d -- similar to how tmfiles.d(5) work.  E.g., add
+	 * an override .conf, or an ignore by symlinking to /dev/null
+	 *
+	 * The .conf files (and run/task/service stanzas) are parsed and
+	 * started in order.  Each directory is sorted alphanumerically
+	 * and then the result is appended to the overall order:
+	 *
+	 *     /lib/finit/system/10-hotplug.conf
+	 *     /lib/finit/system/90-testserv.conf
+	 *     /run/finit/system/dbus.conf
+	 *     /run/finit/system/tty.conf
+	 *     /etc/finit.d/10-abc.conf
+	 *     /etc/finit.d/20-abc.conf
+	 *     /etc/finit.d/enabled/1-aaa.conf
+	 *     /etc/finit.d/enabled/1-abc.conf
+	 *     /etc/finit.d/enabled/2-aaa.conf
+	 */
+	glob_append(gl, 0, "%s/*.conf", FINIT_SYSPATH_);
+	glob_append(gl, 1, "%s/*.conf", FINIT_RUNPATH_);
+	glob_append(gl, 1, "%s/*.conf", finit_rcsd);
+	glob_append(gl, 1, "%s/enabled/*.conf", finit_rcsd);
+
+	if (bootstrap)
+		conf_order(gl->gl_pathv, gl->gl_pathc);
+
+	for (i = 0; snap.fp && i < gl->gl_pathc; i++)
+		conf_snap_add(CONF_SNAP_ORDER, 0, gl->gl_pathv[i], NULL, NULL, 0, 0);
+}
+
+/* Start recording a snapshot of all .conf files parsed */
+static void conf_snap_begin(void)
+{
+	struct conf_snap_hdr hdr = { 0 };
+
+	memset(&snap, 0, sizeof(snap));
+	snap.fp = open_memstream(&snap.buf, &snap.len);
+	if (!snap.fp)
+		return;
+
+	fwrite(&hdr, sizeof(hdr), 1, snap.fp);
+}
+
+/* Rank of all services, in order, to skip graph_update() next boot */
+static void conf_snap_graph(void)
+{
+	svc_t *svc, *iter = NULL;
+	uint32_t num = 0;
+	size_t len;
+	char *buf;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp)
+		return;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		fprintf(fp, "%d %s", svc->graph.rank, svc_ident(svc, NULL, 0));
+		fputc(0, fp);
+		num++;
+	}
+
+	if (!fclose(fp))
+		conf_snap_add(CONF_SNAP_GRAPH, 0, "graph", NULL, buf, len, num);
+	free(buf);
+}
+
+/*
+ * Write snapshot for next boot, unless some .conf file prevents it.
+ * Ranks are left out if there is a dependency cycle, so graph_update()
+ * runs, and warns, every boot until it is fixed.
+ */
+static void conf_snap_save(int cycle)
+{
+	const char *tmp = CONF_SNAP "+";
+	struct conf_snap_hdr *hdr;
+	FILE *fp;
+
+	if (!snap.fp)
+		return;
+
+	if (!cycle)
+		conf_snap_graph();
+	fclose(snap.fp);
+	snap.fp = NULL;
+
+	if (snap.skip || snap.len > UINT32_MAX) {
+		dbg("Cannot snapshot .conf files, include or dangling symlink.");
+		unlink(CONF_SNAP);
+		goto done;
+	}
+
+	hdr = (struct conf_snap_hdr *)snap.buf;
+	memcpy(hdr->magic, CONF_SNAP_MAGIC, sizeof(hdr->magic));
+	strlcpy(hdr->version, PACKAGE_VERSION, sizeof(hdr->version));
+	hdr->size  = snap.len;
+	hdr->count = snap.count;
+
+	mkpath(FINIT_CACHEPATH, 0755);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		dbg("Cannot save %s: %s", CONF_SNAP, strerror(errno));
+		goto done;
+	}
+
+	if (fwrite(snap.buf, snap.len, 1, fp) != 1 || fclose(fp) || rename(tmp, CONF_SNAP)) {
+		dbg("Failed saving %s: %s", CONF_SNAP, strerror(errno));
+		unlink(tmp);
+	}
+done:
+	free(snap.buf);
+	snap.buf = NULL;
+}
+
+/*
+ * Next record in snapshot, or NULL if it is truncated.  The name and
+ * all lines must be NUL terminated within the record.
+ */
+static struct conf_snap_rec *conf_snap_next(char **ptr, char *end)
+{
+	struct conf_snap_rec *rec = (struct conf_snap_rec *)*ptr;
+	char *data, *pos;
+	uint32_t i;
+
+	if ((size_t)(end - *ptr) < sizeof(*rec))
+		return NULL;
+
+	data = (char *)(rec + 1);
+	if (!rec->len || rec->len % 8 || rec->len > (size_t)(end - data))
+		return NULL;
+
+	if (data[rec->len - 1])
+		return NULL;
+
+	for (pos = data, i = 0; i <= rec->lines; i++) {
+		if (pos >= data + rec->len)
+			return NULL;
+		pos += strlen(pos) + 1;
+	}
+
+	*ptr = data + rec->len;
+
+	return rec;
+}
+
+static int conf_snap_stale(struct conf_snap_rec *rec, const char *name, struct stat *st)
+{
+	struct conf_snap_rec cur = { 0 };
+
+	if (stat(name, st))
+		memset(st, 0, sizeof(*st));
+	conf_snap_key(&cur, name, st);
+
+	return cur.ino != rec->ino || cur.size != rec->size ||
+		cur.mtime[0] != rec->mtime[0] || cur.mtime[1] != rec->mtime[1] ||
+		cur.ctime[0] != rec->ctime[0] || cur.ctime[1] != rec->ctime[1];
+}
+
+/* Same as conf_file_parse(), but with the lines from the snapshot */
+static void conf_file_replay(char *file, int is_rcsd, uint32_t num, struct stat *st)
+{
+	struct rlimit rlimit[RLIMIT_NLIMITS];
+	char *line = file + strlen(file) + 1;
+	uint32_t i;
+
+	if (is_rcsd) {
+		memcpy(rlimit, global_rlimit, sizeof(rlimit));
+		cgroup_current[0] = 0;
+	}
+
+	dbg("*** Replaying %s", file);
+	conf_parsing = conf_file_get(file, st);
+	for (i = 0; i < num; i++) {
+		char *next = line + strlen(line) + 1;
+
+		parse_line(line, is_rcsd, rlimit, file);
+		line = next;
+	}
+	conf_parsing = NULL;
+}
+
+/*
+ * Restore ranks saved by conf_snap_graph(), unless the services loaded
+ * differ from last boot, e.g., a command is missing.  Returns non-zero
+ * if graph_update() must be called.
+ */
+static int conf_snap_rank(struct conf_snap_rec *rec)
+{
+	char *line = (char *)(rec + 1);
+	svc_t *svc, *iter = NULL;
+	uint32_t i = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0), i++) {
+		char *ident;
+
+		if (i >= rec->lines)
+			return 1;
+
+		line += strlen(line) + 1;
+		svc->graph.rank = strtol(line, &ident, 10);
+		if (*ident != ' ' || strcmp(&ident[1], svc_ident(svc, NULL, 0)))
+			return 1;
+	}
+
+	return i != rec->lines;
+}
+
+static void conf_set_rlimit(void)
+{
+	for (int i = 0; i < RLIMIT_NLIMITS; i++) {
+		struct rlimit rlim = global_rlimit[i];
+
+		if (i == RLIMIT_NOFILE) {
+			rlim.rlim_cur = max(rlim.rlim_cur, nofile.rlim_cur);
+			rlim.rlim_max = max(rlim.rlim_max, nofile.rlim_max);
+		}
+
+		if (setrlimit(i, &rlim) == -1)
+			logit(LOG_WARNING, "rlimit: Failed setting %s: %s",
+			      rlim2str(i), lim2str(&rlim));
+	}
+}
+
+/*
+ * Replay the snapshot saved at the previous boot, unless finit.conf, a
+ * .conf file, or a directory with .conf files has changed since then.
+ * All records are verified before replaying, so on failure nothing has
+ * been parsed.  Returns non-zero if the .conf files must be parsed, and
+ * sets @ranked if the services have been ranked from the snapshot.
+ */
+static int conf_snap_load(int *ranked)
+{
+	struct conf_snap_rec *rec, *graph = NULL;
+	struct conf_snap_hdr *hdr;
+	struct stat st, *sts = NULL;
+	char dir[PATH_MAX];
+	char *map, *ptr, *end;
+	size_t norder = 0, nrun = 0;
+	int ndir = 0, nfile = 0;
+	glob_t gl = { 0 };
+	char **order;
+	uint32_t i;
+	int fd;
+
+	fd = open(CONF_SNAP, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return 1;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr) || st.st_size > UINT32_MAX) {
+		close(fd);
+		return 1;
+	}
+
+	/* Private writable mapping, the parser modifies lines in place */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 1;
+
+	hdr = (struct conf_snap_hdr *)map;
+	if (memcmp(hdr->magic, CONF_SNAP_MAGIC, sizeof(hdr->magic)) ||
+	    strncmp(hdr->version, PACKAGE_VERSION, sizeof(hdr->version)) ||
+	    hdr->size != st.st_size)
+		goto stale;
+
+	sts = calloc(hdr->count, sizeof(*sts));
+	if (!sts)
+		goto stale;
+
+	/* Not keyed by directory, files in FINIT_RUNPATH_ are new every boot */
+	glob_append(&gl, 0, "%s/*.conf", FINIT_RUNPATH_);
+
+	end = map + hdr->size;
+	ptr = map + sizeof(*hdr);
+	for (i = 0; i < hdr->count; i++) {
+		char *name;
+
+		rec = conf_snap_next(&ptr, end);
+		if (!rec)
+			goto stale;
+
+		name = (char *)(rec + 1);
+		switch (rec->type) {
+		case CONF_SNAP_DIR:
+			if (!conf_snap_dir(ndir++, dir, sizeof(dir)) || strcmp(name, dir))
+				goto stale;
+			break;
+
+		case CONF_SNAP_ORDER:
+			if (conf_snap_runtime(name) &&
+			    (nrun >= gl.gl_pathc || strcmp(name, gl.gl_pathv[nrun++])))
+				goto stale;
+			norder++;
+			continue;
+
+		case CONF_SNAP_FILE:
+			if (!nfile++ && strcmp(name, finit_conf))
+				goto stale;
+			break;
+
+		case CONF_SNAP_GRAPH:
+			continue;
+
+		default:
+			goto stale;
+		}
+
+		if (conf_snap_stale(rec, name, &sts[i])) {
+			dbg("%s changed since last boot, parsing all .conf files.", name);
+			goto stale;
+		}
+	}
+
+	if (conf_snap_dir(ndir, dir, sizeof(dir)) || !nfile || nrun != gl.gl_pathc)
+		goto stale;
+
+	dbg("No .conf file changed since last boot, replaying %s", CONF_SNAP);
+	order = alloca((norder + 1) * sizeof(char *));
+	norder = nfile = 0;
+
+	ptr = map + sizeof(*hdr);
+	for (i = 0; i < hdr->count; i++) {
+		char *name;
+
+		rec = conf_snap_next(&ptr, end);
+		name = (char *)(rec + 1);
+
+		if (rec->type == CONF_SNAP_ORDER)
+			order[norder++] = name;
+		if (rec->type == CONF_SNAP_GRAPH)
+			graph = rec;
+		if (rec->type != CONF_SNAP_FILE)
+			continue;
+
+		snap.replay = 1;
+		conf_file_replay(name, rec->is_rcsd, rec->lines, &sts[i]);
+		snap.replay = 0;
+
+		/* Global limits from finit.conf, set before all *.conf */
+		if (!nfile++)
+			conf_set_rlimit();
+	}
+	conf_order(order, norder);
+
+	/* Skipped by service_register() when replaying */
+	svc_validate_all();
+
+	if (graph && !conf_snap_rank(graph))
+		*ranked = 1;
+
+	globfree(&gl);
+	free(sts);
+	munmap(map, st.st_size);
+
+	return 0;
+stale:
+	globfree(&gl);
+	free(sts);
+	munmap(map, st.st_size);
+
+	return 1;
+}
+
+/*
+ * Reload /etc/finit.conf and all *.conf in /etc/finit.d/
+ *
+ * Only added, changed, and removed .conf files are reparsed, unless
+ * finit.conf or a file with global settings has changed, then all of
+ * them are reparsed.  The result is the same in both cases.
+ */
+int conf_reload(void)
+{
+	struct conf_dirty *dirty = NULL;
+	struct conf_file *cf;
+	int ranked = 0, cycle;
+	size_t i, num;
+	int rc;
+	char **files;
+	glob_t gl;
+
+	/* Set time according to current time zone */
+	tzset();
+	dbg("Set time  daylight: %d  timezone: %ld  tzname: %s %s",
+	   daylight, timezone, tzname[0], tzname[1]);
+
+	if (!rescue && conf_cached) {
+		conf_glob(&gl);
+		files = alloca((gl.gl_pathc + 1) * sizeof(char *));
+		num = conf_files(&gl, files);
+
+		rc = conf_reparse(files, num);
+		globfree(&gl);
+		if (!rc) {
+			dbg("Incremental reload, unchanged files not reparsed.");
+			goto sweep;
+		}
+		if (rc == 2)
+			dirty = conf_dirty_save();
+	}
+
+	/* Mark and sweep */
+	cgroup_mark_all();
+	svc_mark_dynamic();
+	conf_reset_env();
+
+	/*
+	 * Reset global rlimit to bootstrap values from conf_init().
+	 */
+	memcpy(global_rlimit, initial_rlimit, sizeof(global_rlimit));
+
+	/* Reset to default, in case 'parallel' has been removed */
+	graph_max = GRAPH_MAX_DEFAULT;
+
+	/*
+	 * When built with --disable-rescue mode many other 'if (rescue)'
+	 * code paths are #ifdeffed out.  This one, and the ones in the
+	 * plugins, are not because a hook or plugin can still trigger
+	 * the alternative rescue.conf instead of finit.conf.  This for
+	 * very advanced use-cases where files on /etc are generated at
+	 * bootstrap, including users and passwords, from other sources.
+	 */
+	if (rescue) {
+		char line[80] = "tty [12345789] rescue";
+
+		conf_file_flush();
+
+		/* If rescue.conf is missing, fall back to a root shell */
+		rc = parse_conf(RESCUE_CONF, 0);
+		if (rc)
+			service_register(SVC_TYPE_TTY, line, global_rlimit, NULL);
+
+		print(rc, "Entering rescue mode");
+		goto done;
+	}
+
+	/* First, read /etc/finit.conf */
+	TAILQ_FOREACH(cf, &conf_file_list, link)
+		cf->seen = 0;
+	conf_dups = 0;
+
+	/* At boot, unless any .conf file has changed, replay last boot's */
+	if (BOOTSTRAP && !conf_cached) {
+		if (!conf_snap_load(&ranked))
+			goto sweep;
+		conf_snap_begin();
+	}
+
+	conf_file_parse(finit_conf, 0);
+
+	/* Set global limits, but never lower descriptors of PID 1 */
+	conf_set_rlimit();
+
+	/* Next, all *.conf files, in order */
+	conf_glob(&gl);
+	files = alloca((gl.gl_pathc + 1) * sizeof(char *));
+	num = conf_files(&gl, files);
+	for (i = 0; i < num; i++)
+		conf_file_parse(files[i], 1);
+	conf_dirty_restore(dirty);
+	globfree(&gl);
+sweep:
+
+	/* Mark any reverse deps as chenaged. */
+	service_update_rdeps();
+
+	/* Prune according to if:[!]ident or if:<[!]cond> */
+	service_mark_unavail();
+
+	/* Rank services for the start scheduler, unless already done */
+	cycle = ranked ? 0 : graph_update();
+
+	/* Save snapshot for next boot, if recording */
+	conf_snap_save(cycle);
+
+	/* Update parse results for next reload */
+	conf_file_sweep();
+
+	/* Set up top-level cgroups */
+	cgroup_config();
+done:
+	/* Remove all unused top-level cgroups */
+	cgroup_cleanup();
+
+	/* Drop record of all .conf changes */
+	drop_changes();
+
+	if (bootstrap)
+		wdog = svc_find("watchdog", "finit");
+
+	/* Override configured runlevel, user said 'S' on /proc/cmdline */
+	if (BOOTSTRAP && single)
+		cfglevel = 1;
+
+	/*
+	 * Set host name, from %DEFHOST, *.conf or /etc/hostname.  The
+	 * latter wins, if neither exists we default to "noname"
+	 */
+	set_hostname(&hostname);
+
+	return 0;
+}
+
+static struct conf_change *conf_find(char *file)
+{
+	struct conf_change *node, *tmp;
+
+	TAILQ_FOREACH_SAFE(node, &conf_change_list, link, tmp) {
+		if (string_compare(node->name, file))
+			return node;
+	}
+
+	return NULL;
+}
+
+static void drop_change(struct conf_change *node)
+{
+	if (!node)
+		return;
+
+	TAILQ_REMOVE(&conf_change_list, node, link);
+	free(node->name);
+	free(node);
+}
+
+
+static void drop_changes(void)
+{
+	struct conf_change *node, *tmp;
+
+	TAILQ_FOREACH_SAFE(node, &conf_change_list, link, tmp)
+		drop_change(node);
+}
+
+static int conf_change_act(char *dir, char *name, uint32_t mask)
+{
+	char fn[strlen(dir) + strlen(name) + 2];
+	struct conf_change *node;
+	char *rp = NULL;
+
+	/* Check for actual printable characters, sometimes STX */
 	if (name[0] && name[0] >= ' ')
 		paste(fn, sizeof(fn), dir, name);
 	else
@@ -1517,7 +2518,13 @@ int conf_any_change(void)
 	return 1;
 }
 
-int conf_changed(char *file)
+/* Set while replaying the snapshot of last boot, see conf_snap_load() */
+int conf_replaying(void)
+{
+	return snap.replay;
+}
+
+int conf_changed(const char *file)
 {
 	int rc = 0;
 	char *rp;
@@ -1642,6 +2649,28 @@ int conf_monitor(void)
 	return rc;
 }
 
+/*
+ * Raise descriptor limit of PID 1 to NOFILE_MAX, or as close as the
+ * hard limit allows if we may not raise it, e.g., in a container.
+ */
+static void nofile_raise(void)
+{
+	struct rlimit rlim = initial_rlimit[RLIMIT_NOFILE];
+
+	rlim.rlim_max = max(rlim.rlim_max, (rlim_t)NOFILE_MAX);
+	rlim.rlim_cur = NOFILE_MAX;
+	if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+		rlim = initial_rlimit[RLIMIT_NOFILE];
+		rlim.rlim_cur = min(rlim.rlim_max, (rlim_t)NOFILE_MAX);
+		if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+			logit(LOG_WARNING, "rlimit: Failed raising nofile: %s", strerror(errno));
+			rlim = initial_rlimit[RLIMIT_NOFILE];
+		}
+	}
+
+	nofile = rlim;
+}
+
 /*
  * Prepare .conf parser and load /etc/finit.conf for global settings
  */
@@ -1663,6 +2692,7 @@ int conf_init(uev_ctx_t *ctx)
 
 	/* Initialize global rlimits, e.g. for built-in services */
 	memcpy(global_rlimit, initial_rlimit, sizeof(global_rlimit));
+	nofile_raise();
 
 	/*
 	 * Start built-in watchdogd as soon as possible, if enabled
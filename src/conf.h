@@ -57,13 +57,15 @@ char *rlim2str(int rlim);
 int  conf_init            (uev_ctx_t *ctx);
 void conf_reload          (void);
 int  conf_any_change      (void);
-int  conf_changed         (char *file);
+int  conf_changed         (const char *file);
 int  conf_monitor         (void);
+int  conf_replaying       (void);
 
 void conf_reset_env       (void);
 void conf_saverc          (void);
 void conf_save_exec_order (svc_t *svc, char *cmdline, int result);
 void conf_save_service    (int type, char *cfg, char *file);
+void conf_duplicate       (svc_t *svc, const char *file);
 void conf_parse_cmdline   (int argc, char *argv[]);
 char *conf_parse_env      (char *line, char **val);
 int  conf_parse_runlevels (char *runlevels);
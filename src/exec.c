@@ -281,7 +281,7 @@ int exec_runtask(char *cmd, char *args[])
 	return execvp(_PATH_BSHELL, argv);
 }
 
-static void prepare_tty(char *tty, speed_t speed, const char *procname, struct rlimit rlimit[])
+static void prepare_tty(char *tty, speed_t speed, const char *procname, const struct rlimit rlimit[])
 {
 	char name[80];
 	int fd, dummy;
@@ -387,7 +387,7 @@ static int activate_console(int noclear, int nowait)
  * since /bin/login usually only disables ECHO until a password line has
  * been entered.  Upon starting the user's $SHELL the ISIG flag is reset
  */
-pid_t run_getty(char *tty, char *cmd, char *args[], int noclear, int nowait, struct rlimit rlimit[])
+pid_t run_getty(char *tty, char *cmd, char *args[], int noclear, int nowait, const struct rlimit rlimit[])
 {
 	int rc = 1;
 
@@ -431,7 +431,7 @@ int sh(char *tty)
 	return execv(_PATH_BSHELL, args);
 }
 
-pid_t run_sh(char *tty, int noclear, int nowait, struct rlimit rlimit[])
+pid_t run_sh(char *tty, int noclear, int nowait, const struct rlimit rlimit[])
 {
 	int rc = 1;
 
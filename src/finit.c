@@ -181,16 +181,105 @@ char *fs_root_dev(char *real, size_t len)
 	return real;
 }
 
+/* A device to check in the current pass */
+struct fsck_job {
+	char   dev[192];
+	int    nofail;
+	pid_t  pid;
+	FILE  *fp;		/* Output from fsck, shown when done */
+	int    rc;
+};
+
+#define FSCK_POLL 10000		/* usec between checking running jobs */
+
 /*
- * Check all filesystems in /etc/fstab with a fs_passno > 0
+ * Start fsck of a device in the background.  Like run_interactive(),
+ * any output is collected in a tempfile and shown after the result.
  */
-static int fsck(int pass)
+static int fsck_start(struct fsck_job *job, int pass)
+{
+	char cmd[256];
+
+	snprintf(cmd, sizeof(cmd), "fsck %s %s %s", fsck_mode, fsck_repair, job->dev);
+	dbg("Running pass %d fsck command %s", pass, cmd);
+	print(-1, "Checking filesystem %s", job->dev);
+
+	job->fp = tempfile();
+	job->pid = fork();
+	if (job->pid == 0) {
+		if (job->fp && !debug) {
+			dup2(fileno(job->fp), STDOUT_FILENO);
+			dup2(fileno(job->fp), STDERR_FILENO);
+		}
+		_exit(run(cmd, ""));
+	}
+
+	if (job->pid == -1) {
+		logit(LOG_CONSOLE | LOG_ERR, "Failed starting fsck of %s: %s", job->dev, strerror(errno));
+		job->rc = EX_OSERR;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Show result, and any output, of a completed fsck job */
+static void fsck_done(struct fsck_job *job, int status)
+{
+	if (status == -1 || !WIFEXITED(status))
+		job->rc = EX_OSERR;
+	else
+		job->rc = WEXITSTATUS(status);
+	job->pid = 0;
+
+	print(!!job->rc, "Checking filesystem %s", job->dev);
+
+	if (job->fp) {
+		char line[LINE_SIZE];
+		size_t len;
+
+		if (!debug) {
+			rewind(job->fp);
+			while ((len = fread(line, 1, sizeof(line), job->fp)) > 0) {
+				if (fwrite(line, 1, len, stderr) != len)
+					break;
+			}
+		}
+		fclose(job->fp);
+		job->fp = NULL;
+	}
+}
+
+/*
+ * "failure" is defined as exiting with a return code of 2 or larger.
+ * A return code of 1 indicates that filesystem errors were corrected
+ * but that the boot may proceed.  Returns non-zero on failure.
+ */
+static int fsck_failed(struct fsck_job *job)
+{
+	if (job->rc <= 1)
+		return 0;
+
+	if (job->nofail) {
+		logit(LOG_CONSOLE | LOG_WARNING, "Ignoring failed fsck %s because of nofail option", job->dev);
+		job->rc = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Collect all devices in /etc/fstab with the given fs_passno, returns
+ * the number of devices to check, or -1 on error.
+ */
+static int fsck_jobs(int pass, struct fsck_job **jobs)
 {
 	struct mntent mount;
 	struct mntent *mnt;
 	char real[192];
 	char buf[256];
-	int rc = 0;
+	int num = 0;
 	FILE *fp;
 
 	fp = setmntent(fstab, "r");
@@ -200,9 +289,8 @@ static int fsck(int pass)
 	}
 	dbg("Opened %s, pass %d", fstab, pass);
 	while ((mnt = getmntent_r(fp, &mount, buf, sizeof(buf)))) {
-		int fsck_rc = 0;
+		struct fsck_job *job;
 		struct stat st;
-		char cmd[256];
 		char *dev;
 
 		dbg("got: fsname '%s' dir '%s' type '%s' opts '%s' freq '%d' passno '%d'",
@@ -245,28 +333,111 @@ static int fsck(int pass)
 			continue;
 		}
 
-		snprintf(cmd, sizeof(cmd), "fsck %s %s %s", fsck_mode, fsck_repair, dev);
-		dbg("Running pass %d fsck command %s", pass, cmd);
-		fsck_rc = run_interactive(cmd, "Checking filesystem %s", dev);
-		/*
-		 * "failure" is defined as exiting with a return code of
-		 * 2 or larger.  A return code of 1 indicates that filesystem
-		 * errors were corrected but that the boot may proceed.
-		 */
-		if (fsck_rc > 1) {
-			if (hasmntopt(mnt,"nofail")) {
-                        	logit(LOG_CONSOLE | LOG_WARNING, "Ignoring failed fsck %s because of nofail option", dev);
-                        	fsck_rc = 0;
-			} else {
-				logit(LOG_CONSOLE | LOG_ALERT, "Failed fsck %s, attempting sulogin ...", dev);
-				sulogin(1);
-			}
+		job = realloc(*jobs, (num + 1) * sizeof(*job));
+		if (!job) {
+			logit(LOG_CONSOLE | LOG_ERR, "Failed allocating memory for fsck of %s", dev);
+			num = -1;
+			break;
 		}
-		rc |= fsck_rc;
+		*jobs = job;
+
+		job = &job[num++];
+		memset(job, 0, sizeof(*job));
+		strlcpy(job->dev, dev, sizeof(job->dev));
+		job->nofail = hasmntopt(mnt, "nofail") != NULL;
 	}
 
 	endmntent(fp);
 
+	return num;
+}
+
+/*
+ * Check all filesystems in /etc/fstab with a fs_passno > 0
+ *
+ * Devices in the same pass are checked in parallel, at most
+ * fsck.parallel=N at a time, default the number of online CPUs.
+ * Results, and any fsck output, are shown in order of completion.
+ */
+static int fsck(int pass)
+{
+	struct fsck_job *jobs = NULL;
+	struct fsck_job *fail = NULL;
+	int num, max, next = 0, running = 0;
+	int rc = 0;
+
+	num = fsck_jobs(pass, &jobs);
+	if (num <= 0) {
+		free(jobs);
+		return num < 0;
+	}
+
+	max = fsck_parallel;
+	if (max <= 0)
+		max = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max <= 0)
+		max = 1;
+
+	while (next < num || running) {
+		int i, reaped = 0;
+
+		/* Stop starting new jobs after a failure, wait for running */
+		while (!fail && running < max && next < num) {
+			struct fsck_job *job = &jobs[next++];
+
+			if (!fsck_start(job, pass)) {
+				running++;
+				continue;
+			}
+
+			print(1, "Checking filesystem %s", job->dev);
+			if (fsck_failed(job) && !fail)
+				fail = job;
+			rc |= job->rc;
+		}
+		if (!running)
+			break;
+
+		for (i = 0; i < next; i++) {
+			struct fsck_job *job = &jobs[i];
+			int status;
+			pid_t pid;
+
+			if (job->pid <= 0)
+				continue;
+
+			pid = waitpid(job->pid, &status, WNOHANG);
+			if (!pid || (pid == -1 && errno == EINTR))
+				continue;
+
+			fsck_done(job, pid == -1 ? -1 : status);
+			if (fsck_failed(job) && !fail)
+				fail = job;
+			rc |= job->rc;
+			running--;
+			reaped++;
+		}
+
+		if (!reaped) {
+			do_usleep(FSCK_POLL);
+			continue;
+		}
+
+		/* Restore progress of jobs still running */
+		for (i = 0; running && i < next; i++) {
+			if (jobs[i].pid > 0) {
+				print(-1, "Checking filesystem %s", jobs[i].dev);
+				break;
+			}
+		}
+	}
+
+	if (fail) {
+		logit(LOG_CONSOLE | LOG_ALERT, "Failed fsck %s, attempting sulogin ...", fail->dev);
+		sulogin(1);
+	}
+	free(jobs);
+
 	return rc;
 }
 
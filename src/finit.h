@@ -50,6 +50,11 @@
 #define _PATH_VARRUN            "/var/run/"
 #endif
 
+/* Persistent cache, e.g., compiled snapshot of all .conf files */
+#ifndef FINIT_CACHEPATH
+#define FINIT_CACHEPATH         "/var/cache/finit"
+#endif
+
 #ifndef FINIT_CGPATH
 #define FINIT_CGPATH            "/sys/fs/cgroup"
 #endif
@@ -104,6 +109,10 @@
 #define INIT_CMD_SVC_FIND       131
 #define INIT_CMD_SVC_FIND_BYC   132
 #define INIT_CMD_SIGNAL         133
+#define INIT_CMD_COND_DEPS      134  /* Stream condition dependents index */
+#define INIT_CMD_SVC_STATUS     135  /* Stream struct svc_record, data[] filter */
+#define INIT_CMD_SVC_GRAPH      136  /* Stream dependency graph, one svc per message */
+#define INIT_CMD_TRACE          137  /* Stream struct trace_event, oldest first */
 #define INIT_CMD_NACK           254
 #define INIT_CMD_ACK            255
 
@@ -0,0 +1,609 @@
+/* Dependency graph and start scheduler
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The edges of the graph are the conditions of each service: a pid/foo
+ * or service/foo/ready condition is provided by foo, which must be up
+ * before the dependent can start.  Conditions without a provider, e.g.
+ * net/ and usr/, are leaves.  The graph is not stored separately, the
+ * edges are resolved from svc->cond, so it is always in sync with the
+ * .conf files.
+ *
+ * The state machine still decides when a service may start, i.e., when
+ * its conditions are satisfied.  Here we only decide how many may start
+ * at the same time, see graph_max, and in which order.  Services that
+ * are waiting for a start slot are queued by rank, the longest chain of
+ * services depending on them, so the critical path starts first.  A
+ * slot is held until the service is ready, or the run/task is done.
+ *
+ * On runlevel change, and shutdown, it is the other way around.  All
+ * services are stepped in reverse dependency order, lowest rank first,
+ * so dependents are signaled before the services they depend on.  They
+ * all share one deadline, the longest kill delay, after which any that
+ * have not been collected are sent SIGKILL at the same time.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "finit.h"
+#include "graph.h"
+#include "log.h"
+#include "private.h"
+#include "schedule.h"
+#include "service.h"
+
+int graph_max = GRAPH_MAX_DEFAULT;
+
+/* Services waiting for a start slot, highest rank first */
+static TAILQ_HEAD(, svc) queue  = TAILQ_HEAD_INITIALIZER(queue);
+
+/* Services with a reserved start slot, to be stepped by graph_worker() */
+static TAILQ_HEAD(, svc) kicked = TAILQ_HEAD_INITIALIZER(kicked);
+
+static int inflight;
+static int armed;
+
+/* Stop of all services on runlevel change */
+static struct {
+	int      active;
+	int64_t  start;
+	int64_t  deadline;
+	void   (*kill)(svc_t *svc);
+} bulk;
+
+static void graph_worker (void *arg);
+static void graph_reclaim(void *arg);
+static void graph_expire (void *arg);
+
+static struct wq work = {
+	.cb    = graph_worker,
+};
+
+static struct wq stall = {
+	.cb    = graph_reclaim,
+	.delay = 1000
+};
+
+static struct wq expire = {
+	.cb    = graph_expire,
+};
+
+static int64_t graph_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void enqueue(svc_t *svc)
+{
+	svc_t *s;
+
+	TAILQ_FOREACH(s, &queue, graph.link) {
+		if (s->graph.rank < svc->graph.rank)
+			break;
+	}
+
+	if (s)
+		TAILQ_INSERT_BEFORE(s, svc, graph.link);
+	else
+		TAILQ_INSERT_TAIL(&queue, svc, graph.link);
+	svc->graph.queued = 1;
+}
+
+static void dequeue(svc_t *svc)
+{
+	if (svc->graph.queued == 1)
+		TAILQ_REMOVE(&queue, svc, graph.link);
+	else if (svc->graph.queued == 2)
+		TAILQ_REMOVE(&kicked, svc, graph.link);
+	svc->graph.queued = 0;
+}
+
+static void slot_get(svc_t *svc)
+{
+	svc->graph.inflight = 1;
+	svc->graph.slot = graph_now();
+	inflight++;
+}
+
+static void slot_put(svc_t *svc)
+{
+	if (!svc->graph.inflight)
+		return;
+
+	svc->graph.inflight = 0;
+	inflight--;
+}
+
+/*
+ * Hand out free slots to queued services, they are stepped from the
+ * event loop, where it is safe to call service_step().
+ */
+static void graph_kick(void)
+{
+	svc_t *svc;
+
+	while ((svc = TAILQ_FIRST(&queue))) {
+		if (graph_max && inflight >= graph_max)
+			break;
+
+		TAILQ_REMOVE(&queue, svc, graph.link);
+		slot_get(svc);
+
+		TAILQ_INSERT_TAIL(&kicked, svc, graph.link);
+		svc->graph.queued = 2;
+	}
+
+	if (!TAILQ_EMPTY(&kicked))
+		schedule_work(&work);
+}
+
+static void graph_worker(void *arg)
+{
+	svc_t *svc;
+
+	(void)arg;
+
+	while ((svc = TAILQ_FIRST(&kicked))) {
+		service_step(svc);
+
+		/* Still waiting, e.g. reload in progress, try again later */
+		if (svc->graph.queued == 2) {
+			dequeue(svc);
+			slot_put(svc);
+		}
+	}
+
+	graph_kick();
+}
+
+/*
+ * Reclaim slots from services that never signal readiness, e.g., a
+ * pidfile that is never created, so they cannot stall the queue.
+ */
+static void graph_reclaim(void *arg)
+{
+	svc_t *svc, *iter = NULL;
+	int64_t now;
+
+	(void)arg;
+	armed = 0;
+
+	now = graph_now();
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (!svc->graph.inflight || svc->graph.queued)
+			continue;
+		if (now - svc->graph.slot < GRAPH_STALL)
+			continue;
+
+		dbg("%s not ready after %d sec, releasing start slot",
+		    svc_ident(svc, NULL, 0), GRAPH_STALL / 1000000);
+		slot_put(svc);
+	}
+
+	graph_kick();
+	if (!TAILQ_EMPTY(&queue)) {
+		armed = 1;
+		schedule_work(&stall);
+	}
+}
+
+/**
+ * graph_set_max - Set max number of services starting in parallel
+ * @max: Number of start slots, 0: unlimited
+ */
+void graph_set_max(int max)
+{
+	graph_max = max;
+	graph_kick();
+}
+
+/**
+ * graph_provider - Find the service providing a condition
+ * @cond: Condition, e.g. pid/foo, service/foo/ready, or task/bar/success
+ *
+ * Returns:
+ * A pointer to an &svc_t object, or %NULL if @cond is not provided by
+ * a service, e.g., net/ or usr/ conditions.
+ */
+svc_t *graph_provider(const char *cond)
+{
+	char ident[MAX_IDENT_LEN], *ptr;
+
+	if (!cond)
+		return NULL;
+
+	if (!strncmp(cond, "pid/", 4))
+		return svc_find_by_cond(cond);
+
+	if (strncmp(cond, "service/", 8) && strncmp(cond, "run/", 4) && strncmp(cond, "task/", 5))
+		return NULL;
+
+	strlcpy(ident, strchr(cond, '/') + 1, sizeof(ident));
+	ptr = strchr(ident, '/');
+	if (ptr)
+		*ptr = 0;
+
+	return svc_find_by_str(ident);
+}
+
+/* Call @cb for each condition of @svc, with its provider, if any */
+static int graph_foreach(svc_t *svc, int (*cb)(svc_t *, const char *, svc_t *, void *), void *arg)
+{
+	char buf[MAX_COND_LEN], *cond, *ptr;
+	int rc = 0;
+
+	strlcpy(buf, svc->cond, sizeof(buf));
+	for (cond = strtok_r(buf, ",", &ptr); cond; cond = strtok_r(NULL, ",", &ptr)) {
+		svc_t *prov;
+
+		prov = graph_provider(cond);
+		if (prov == svc)
+			prov = NULL;
+
+		rc += cb(svc, cond, prov, arg);
+	}
+
+	return rc;
+}
+
+static int relax(svc_t *svc, const char *cond, svc_t *prov, void *arg)
+{
+	(void)cond;
+	(void)arg;
+
+	if (!prov || prov->graph.rank > svc->graph.rank)
+		return 0;
+
+	prov->graph.rank = svc->graph.rank + 1;
+	return 1;
+}
+
+/**
+ * graph_update - Rank services by their longest chain of dependents
+ *
+ * Called on conf_reload(), when the graph, or graph_max, may have
+ * changed.  Relaxes all edges until no rank changes, at most once per
+ * service, any more than that and there is a dependency cycle.
+ *
+ * Returns:
+ * %TRUE(1) if there is a dependency cycle, otherwise %FALSE(0).
+ */
+int graph_update(void)
+{
+	TAILQ_HEAD(, svc) tmp = TAILQ_HEAD_INITIALIZER(tmp);
+	svc_t *svc, *iter = NULL;
+	int changed = 1, pass;
+	int num = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		svc->graph.rank = 0;
+		num++;
+	}
+
+	for (pass = 0; changed && pass <= num; pass++) {
+		changed = 0;
+		for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0))
+			changed += graph_foreach(svc, relax, NULL);
+	}
+
+	if (changed)
+		logit(LOG_WARNING, "Circular service dependencies, see 'initctl graph'");
+
+	/* Rank may have changed, sort queue */
+	while ((svc = TAILQ_FIRST(&queue))) {
+		TAILQ_REMOVE(&queue, svc, graph.link);
+		TAILQ_INSERT_TAIL(&tmp, svc, graph.link);
+	}
+	while ((svc = TAILQ_FIRST(&tmp))) {
+		TAILQ_REMOVE(&tmp, svc, graph.link);
+		enqueue(svc);
+	}
+	graph_kick();
+
+	return changed ? 1 : 0;
+}
+
+/**
+ * graph_defer - Check if service may start now
+ * @svc: Service with all conditions satisfied
+ *
+ * Called from service_step() when @svc is about to leave the waiting
+ * state.  If all slots are busy, @svc is queued and stepped again when
+ * it is its turn.
+ *
+ * Returns:
+ * %TRUE(1) if @svc must wait, otherwise %FALSE(0).
+ */
+int graph_defer(svc_t *svc)
+{
+	if (svc->graph.queued == 2) {
+		dequeue(svc);
+		return 0;
+	}
+	if (svc->graph.inflight)
+		return 0;
+	if (svc->graph.queued)
+		return 1;
+
+	svc->graph.eligible = graph_now();
+	svc->graph.start = svc->graph.ready = 0;
+
+	if (graph_max && inflight >= graph_max) {
+		dbg("%s waiting for start slot, %d in progress", svc_ident(svc, NULL, 0), inflight);
+		enqueue(svc);
+		if (!armed) {
+			armed = 1;
+			schedule_work(&stall);
+		}
+		return 1;
+	}
+
+	slot_get(svc);
+	return 0;
+}
+
+/**
+ * graph_cancel - Drop service from queue, or release its slot
+ * @svc: Service that will not start now, or has been removed
+ */
+void graph_cancel(svc_t *svc)
+{
+	if (!svc->graph.queued && !svc->graph.inflight)
+		return;
+
+	dequeue(svc);
+	if (!svc->graph.start)
+		svc->graph.eligible = 0;
+
+	slot_put(svc);
+	graph_kick();
+}
+
+/**
+ * graph_ready - Service is ready, or run/task is done
+ * @svc: Service to record ready time for
+ */
+void graph_ready(svc_t *svc)
+{
+	if (svc->graph.start && !svc->graph.ready)
+		svc->graph.ready = graph_now();
+
+	if (!svc->graph.inflight)
+		return;
+
+	slot_put(svc);
+	graph_kick();
+}
+
+/**
+ * graph_state - Track start and readiness of a service
+ * @svc:       Service that changed state
+ * @old_state: Previous state
+ *
+ * Called by the state machine on every state change of @svc.
+ */
+void graph_state(svc_t *svc, svc_state_t old_state)
+{
+	switch (svc->state) {
+	case SVC_WAITING_STATE:
+	case SVC_SETUP_STATE:
+	case SVC_STARTING_STATE:
+	case SVC_PAUSED_STATE:
+		break;
+
+	case SVC_RUNNING_STATE:
+		if (old_state == SVC_PAUSED_STATE)
+			break;
+
+		if (svc->graph.eligible && !svc->graph.start)
+			svc->graph.start = graph_now();
+
+		/* No readiness notification for TTYs */
+		if (svc_is_tty(svc))
+			graph_ready(svc);
+		break;
+
+	case SVC_STOPPING_STATE:
+		if (svc_is_runtask(svc) && old_state == SVC_RUNNING_STATE) {
+			graph_ready(svc);
+			break;
+		}
+		/* fallthrough */
+	default:
+		graph_cancel(svc);
+		break;
+	}
+}
+
+struct deps {
+	char   *buf;
+	size_t  len;
+};
+
+static int append(svc_t *svc, const char *cond, svc_t *prov, void *arg)
+{
+	struct deps *deps = arg;
+	char dep[MAX_COND_LEN + 2];
+
+	(void)svc;
+
+	if (prov)
+		svc_ident(prov, dep, sizeof(dep));
+	else
+		snprintf(dep, sizeof(dep), "<%s>", cond);
+
+	if (deps->buf[0])
+		strlcat(deps->buf, ",", deps->len);
+	strlcat(deps->buf, dep, deps->len);
+
+	return 0;
+}
+
+/**
+ * graph_deps - Format the edges of a service
+ * @svc: Service to list the dependencies of
+ * @buf: Buffer to write to
+ * @len: Size of @buf
+ *
+ * Providers are listed by identity, conditions without a provider are
+ * listed within angle brackets, e.g. "foo,bar:1,<net/eth0/up>".
+ *
+ * Returns:
+ * Always @buf, which is "-" if @svc does not have any conditions.
+ */
+char *graph_deps(svc_t *svc, char *buf, size_t len)
+{
+	struct deps deps = { buf, len };
+
+	buf[0] = 0;
+	graph_foreach(svc, append, &deps);
+	if (!buf[0])
+		strlcpy(buf, "-", len);
+
+	return buf;
+}
+
+/**
+ * graph_stop_begin - Start stopping services, on runlevel change
+ * @kill: Callback to forcefully kill a service after the deadline
+ *
+ * Until graph_stop_end(), services entering stopping state share one
+ * deadline instead of each starting its own kill delay timer.
+ */
+void graph_stop_begin(void (*kill)(svc_t *svc))
+{
+	bulk.active   = 1;
+	bulk.start    = graph_now();
+	bulk.deadline = 0;
+	bulk.kill     = kill;
+}
+
+/**
+ * graph_stop_end - All services have been stopped and collected
+ */
+void graph_stop_end(void)
+{
+	if (bulk.active && bulk.deadline)
+		dbg("All services stopped in %lld msec.", (long long)(graph_now() - bulk.start) / 1000);
+	bulk.active = 0;
+}
+
+/**
+ * graph_stop_all - Step all services in reverse dependency order
+ * @cb: Callback, e.g., service_step()
+ *
+ * Services with the lowest rank, i.e., that no other service depends
+ * on, are stepped first, the services they depend on last.
+ */
+void graph_stop_all(int (*cb)(svc_t *svc))
+{
+	svc_t *svc, *iter = NULL;
+	int rank, max = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->graph.rank > max)
+			max = svc->graph.rank;
+	}
+
+	for (rank = 0; rank <= max; rank++) {
+		for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+			if (svc->graph.rank == rank)
+				cb(svc);
+		}
+	}
+}
+
+/**
+ * graph_stop_deadline - Service is stopping, use shared deadline
+ * @svc: Service that has been signaled to stop
+ *
+ * Extends the deadline to the kill delay of @svc, counted from now, so
+ * all services get at least their own kill delay, also those that enter
+ * the deadline late, e.g., after a stop:script, and all that remain are
+ * killed at the same time.
+ *
+ * Returns:
+ * %TRUE(1) if @svc is covered by the deadline, otherwise %FALSE(0) and
+ * the caller should start the kill delay timer of @svc.
+ */
+int graph_stop_deadline(svc_t *svc)
+{
+	int64_t deadline, now;
+
+	if (!bulk.active)
+		return 0;
+
+	now = graph_now();
+	deadline = now + (int64_t)svc->killdelay * 1000;
+
+	if (deadline > bulk.deadline) {
+		bulk.deadline = deadline;
+		expire.delay  = (deadline - now) / 1000 + 1;
+		schedule_work(&expire);
+	}
+
+	return 1;
+}
+
+/* Deadline passed, kill all services that are still stopping */
+static void graph_expire(void *arg)
+{
+	svc_t *svc, *iter = NULL;
+	int64_t now = graph_now();
+	int num = 0;
+
+	(void)arg;
+	if (!bulk.active)
+		return;
+
+	if (now < bulk.deadline) {
+		expire.delay = (bulk.deadline - now) / 1000 + 1;
+		schedule_work(&expire);
+		return;
+	}
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->state != SVC_STOPPING_STATE || svc->pid <= 1)
+			continue;
+
+		bulk.kill(svc);
+		num++;
+	}
+
+	if (num)
+		logit(LOG_NOTICE, "Stop deadline passed, killed %d service(s).", num);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
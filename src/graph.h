@@ -0,0 +1,57 @@
+/* Dependency graph and start scheduler
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_GRAPH_H_
+#define FINIT_GRAPH_H_
+
+#include "svc.h"
+
+#define GRAPH_MAX_DEFAULT  0		/* Unlimited parallel starts */
+#define GRAPH_STALL        5000000	/* usec before a slot is reclaimed */
+
+extern int graph_max;
+
+void   graph_set_max (int max);
+int    graph_update  (void);
+
+int    graph_defer   (svc_t *svc);
+void   graph_cancel  (svc_t *svc);
+void   graph_state   (svc_t *svc, svc_state_t old_state);
+void   graph_ready   (svc_t *svc);
+
+void   graph_stop_begin   (void (*kill)(svc_t *svc));
+void   graph_stop_end     (void);
+void   graph_stop_all     (int (*cb)(svc_t *svc));
+int    graph_stop_deadline(svc_t *svc);
+
+svc_t *graph_provider(const char *cond);
+char  *graph_deps    (svc_t *svc, char *buf, size_t len);
+
+#endif /* FINIT_GRAPH_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -77,8 +77,8 @@ int     complete        (char *cmd, int pid);
 int     run             (char *cmd, char *log);
 int     run_interactive (char *cmd, char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 int     exec_runtask    (char *cmd, char *args[]);
-pid_t   run_getty       (char *tty, char *cmd, char *args[], int noclear, int nowait, struct rlimit rlimit[]);
-pid_t   run_sh          (char *tty, int noclear, int nowait, struct rlimit rlimit[]);
+pid_t   run_getty       (char *tty, char *cmd, char *args[], int noclear, int nowait, const struct rlimit rlimit[]);
+pid_t   run_sh          (char *tty, int noclear, int nowait, const struct rlimit rlimit[]);
 pid_t   run_bg          (char *cmd, char *args[]);
 int     run_parts       (char *dir, char *cmd, const char *env[], int progress, int sysv);
 
@@ -40,8 +40,10 @@
 #endif
 
 #include "initctl.h"
+#include "bootchart.h"
 #include "client.h"
 #include "cond.h"
+#include "logstore.h"
 #include "serv.h"
 #include "service.h"
 #include "cgutil.h"
@@ -161,13 +163,26 @@ static int toggle_debug(char *arg)
 	return client_send(&rq, sizeof(rq));
 }
 
-static int do_log(svc_t *svc, char *tail)
+/* Log store of service, if it has log:store */
+static int has_logstore(svc_t *svc, char *dir, size_t len)
+{
+	snprintf(dir, len, "%s/%s", LOGSTORE_PATH, svc_ident(svc, NULL, 0));
+	return fisdir(dir);
+}
+
+static int do_log(svc_t *svc, struct logstore_query *q)
 {
 	const char *logfile = "/var/log/syslog";
+	char tail[20] = "";
 	pid_t pid;
 	char *nm;
 
 	if (svc) {
+		char dir[sizeof(LOGSTORE_PATH) + MAX_IDENT_LEN + 1];
+
+		if (has_logstore(svc, dir, sizeof(dir)))
+			return logstore_show(dir, q, stdout);
+
 		nm = svc_ident(svc, NULL, 0);
 		pid = svc->pid;
 		if (!pid)
@@ -183,20 +198,72 @@ static int do_log(svc_t *svc, char *tail)
 			return 0; /* bail out, maybe in container */
 	}
 
+	if (q->tail > 0)
+		snprintf(tail, sizeof(tail), "| tail -%d", q->tail);
+
 	return systemf("cat %s | grep '\\[%d\\]\\|%s' %s", logfile, pid, nm, tail);
 }
 
-static int show_log(char *arg)
+/*
+ * log [NAME] [since TIME] [until TIME] [prio LEVEL] [tail NUM] [follow]
+ *
+ * Everything but NAME requires log:store, see logstore.c
+ */
+static int show_log(int argc, char *argv[])
 {
+	struct logstore_query q = { 0 };
 	svc_t *svc = NULL;
+	char *name = NULL;
+	int i;
 
-	if (arg) {
-		svc = client_svc_find(arg);
+	for (i = 0; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (!strcmp(arg, "follow")) {
+			q.follow = 1;
+			continue;
+		}
+
+		if (strcmp(arg, "since") && strcmp(arg, "until") && strcmp(arg, "prio") &&
+		    strcmp(arg, "tail")) {
+			if (name)
+				ERRX(2, "too many arguments to log: %s", arg);
+			name = arg;
+			continue;
+		}
+
+		if (++i == argc)
+			ERRX(2, "missing argument to log %s", arg);
+
+		if (!strcmp(arg, "since") || !strcmp(arg, "until")) {
+			int64_t t = logstore_time(argv[i]);
+
+			if (t < 0)
+				ERRX(65, "invalid time: %s", argv[i]);
+			if (arg[0] == 's')
+				q.since = t;
+			else
+				q.until = t;
+		} else if (!strcmp(arg, "prio")) {
+			q.levels = logstore_level(argv[i]);
+			if (!q.levels)
+				ERRX(65, "invalid log level: %s", argv[i]);
+		} else {
+			const char *errstr = NULL;
+
+			q.tail = (int)strtonum(argv[i], 1, INT32_MAX, &errstr);
+			if (errstr)
+				ERRX(65, "%s tail: %s", errstr, argv[i]);
+		}
+	}
+
+	if (name) {
+		svc = client_svc_find(name);
 		if (!svc)
-			ERRX(noerr ? 0 : 69, "no such task or service(s): %s", arg);
+			ERRX(noerr ? 0 : 69, "no such task or service(s): %s", name);
 	}
 
-	return do_log(svc, "");
+	return do_log(svc, &q);
 }
 
 static int do_runlevel(char *arg)
@@ -414,6 +481,68 @@ static int do_cond_dump(char *arg)
 	return 0;
 }
 
+static int deps_one_cond(char *buf, size_t len, void *arg)
+{
+	unsigned int updates, stepped, last;
+	char *name = buf, *ptr;
+	size_t deps;
+
+	(void)len;
+	(void)arg;
+
+	ptr = strchr(buf, ' ');
+	if (!ptr)
+		return 0;
+	*ptr++ = 0;
+
+	if (sscanf(ptr, "%zu %u %u %u", &deps, &updates, &stepped, &last) != 4)
+		return 0;
+
+	if (dump_filter && dump_filter[0] && strncmp(name, dump_filter, strlen(dump_filter)))
+		return 0;
+
+	if (json) {
+		if (!dump_once)
+			puts("[");
+
+		printf("%s  {\n"
+		       "    \"condition\": \"%s\",\n"
+		       "    \"deps\": %zu,\n"
+		       "    \"updates\": %u,\n"
+		       "    \"stepped\": %u,\n"
+		       "    \"last\": %u\n"
+		       "  }",
+		       dump_once ? ",\n" : "",
+		       name, deps, updates, stepped, last);
+
+		dump_once++;
+	} else
+		printf("%-40s  %6zu  %8u  %8u  %6u\n", name, deps, updates, stepped, last);
+
+	return 0;
+}
+
+static int do_cond_deps(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_COND_DEPS,
+	};
+
+	if (heading && !json)
+		print_header("%-40s  %6s  %8s  %8s  %6s", "CONDITION", "DEPS",
+			     "UPDATES", "STEPPED", "LAST");
+
+	dump_once = 0;
+	dump_filter = arg;
+	if (client_stream(&rq, deps_one_cond, NULL))
+		return 1;
+	if (dump_once)
+		puts("\n]");
+
+	return 0;
+}
+
 typedef enum { COND_CLR, COND_SET, COND_GET } condop_t;
 
 static cond_state_t cond_read(char *path)
@@ -626,6 +755,261 @@ static int do_cond_show(char *arg)
 	return 0;
 }
 
+/* One node per service, from INIT_CMD_SVC_GRAPH */
+struct node {
+	char      ident[MAX_IDENT_LEN];
+	char      state[16];
+	char      deps[200];
+	int       rank;
+	long long eligible;
+	long long start;
+	long long ready;
+};
+
+static struct node *nodes;
+static size_t       num_nodes;
+
+static int graph_one(char *buf, size_t len, void *arg)
+{
+	struct node *node;
+
+	(void)len;
+	(void)arg;
+
+	node = realloc(nodes, (num_nodes + 1) * sizeof(*nodes));
+	if (!node)
+		return 1;
+	nodes = node;
+
+	node = &nodes[num_nodes];
+	if (sscanf(buf, "%129s %d %15s %lld %lld %lld %199s", node->ident, &node->rank,
+		   node->state, &node->eligible, &node->start, &node->ready, node->deps) != 7)
+		return 0;
+	num_nodes++;
+
+	return 0;
+}
+
+static int graph_load(void)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_SVC_GRAPH,
+	};
+
+	num_nodes = 0;
+	if (client_stream(&rq, graph_one, NULL))
+		return 1;
+	if (!num_nodes)
+		ERRX(1, "No services.");
+
+	return 0;
+}
+
+static struct node *graph_find(const char *ident)
+{
+	size_t i;
+
+	for (i = 0; i < num_nodes; i++) {
+		if (!strcmp(nodes[i].ident, ident))
+			return &nodes[i];
+	}
+
+	return NULL;
+}
+
+/* Seconds since boot, with msec resolution */
+static char *graph_time(long long usec, char *buf, size_t len)
+{
+	if (!usec)
+		strlcpy(buf, "-", len);
+	else
+		snprintf(buf, len, "%lld.%03lld", usec / 1000000, usec / 1000 % 1000);
+
+	return buf;
+}
+
+/* Duration in msec, between two points in time */
+static char *graph_msec(long long from, long long to, char *buf, size_t len)
+{
+	if (!from || !to)
+		strlcpy(buf, "-", len);
+	else
+		snprintf(buf, len, "%lld", (to - from) / 1000);
+
+	return buf;
+}
+
+static int do_graph_show(char *arg)
+{
+	size_t i;
+	int once = 0;
+
+	if (graph_load())
+		return 1;
+
+	col_widths();
+	if (heading && !json)
+		print_header("%-*s  %4s  %-8s  %10s  %10s  %10s  %s", iw, "IDENT", "RANK",
+			     "STATE", "ELIGIBLE", "START", "READY", "DEPENDS");
+
+	for (i = 0; i < num_nodes; i++) {
+		struct node *node = &nodes[i];
+		char eligible[24], start[24], ready[24];
+
+		if (arg && arg[0] && strncmp(node->ident, arg, strlen(arg)))
+			continue;
+
+		if (json) {
+			char *dep, *ptr;
+			int first = 1;
+
+			printf("%s  {\n"
+			       "    \"identity\": \"%s\",\n"
+			       "    \"rank\": %d,\n"
+			       "    \"state\": \"%s\",\n"
+			       "    \"eligible\": %lld,\n"
+			       "    \"start\": %lld,\n"
+			       "    \"ready\": %lld,\n"
+			       "    \"depends\": [",
+			       once ? ",\n" : "[\n",
+			       node->ident, node->rank, node->state,
+			       node->eligible, node->start, node->ready);
+
+			for (dep = strtok_r(node->deps, ",", &ptr); dep; dep = strtok_r(NULL, ",", &ptr)) {
+				if (!strcmp(dep, "-"))
+					break;
+				printf("%s\"%s\"", first ? " " : ", ", dep);
+				first = 0;
+			}
+			printf("%s]\n  }", first ? "" : " ");
+
+			once++;
+			continue;
+		}
+
+		printf("%-*s  %4d  %-8s  %10s  %10s  %10s  %s\n", iw, node->ident, node->rank,
+		       node->state, graph_time(node->eligible, eligible, sizeof(eligible)),
+		       graph_time(node->start, start, sizeof(start)),
+		       graph_time(node->ready, ready, sizeof(ready)), node->deps);
+	}
+
+	if (json && once)
+		puts("\n]");
+
+	free(nodes);
+	return 0;
+}
+
+static int do_graph_dot(char *arg)
+{
+	size_t i;
+
+	(void)arg;
+
+	if (graph_load())
+		return 1;
+
+	puts("digraph finit {\n"
+	     "\trankdir=LR;\n"
+	     "\tnode [shape=box];");
+
+	for (i = 0; i < num_nodes; i++) {
+		struct node *node = &nodes[i];
+		char *dep, *ptr;
+		char msec[24];
+
+		if (node->start && node->ready)
+			printf("\t\"%s\" [label=\"%s\\n%s ms\"];\n", node->ident, node->ident,
+			       graph_msec(node->start, node->ready, msec, sizeof(msec)));
+		else
+			printf("\t\"%s\";\n", node->ident);
+
+		for (dep = strtok_r(node->deps, ",", &ptr); dep; dep = strtok_r(NULL, ",", &ptr)) {
+			if (!strcmp(dep, "-"))
+				break;
+
+			/* Condition without a provider, e.g. <net/eth0/up> */
+			if (dep[0] == '<') {
+				dep[strlen(dep) - 1] = 0;
+				dep++;
+				printf("\t\"%s\" [shape=ellipse, style=dashed];\n", dep);
+			}
+			printf("\t\"%s\" -> \"%s\";\n", dep, node->ident);
+		}
+	}
+	puts("}");
+
+	free(nodes);
+	return 0;
+}
+
+/*
+ * Walk back from NAME, or the last service to become ready, through
+ * the provider that was ready last, i.e., the one that gated its start.
+ */
+static int do_graph_critical(char *arg)
+{
+	struct node *node = NULL, **path;
+	size_t i, num = 0;
+
+	if (graph_load())
+		return 1;
+
+	if (arg && arg[0]) {
+		node = graph_find(arg);
+		if (!node)
+			ERRX(noerr ? 0 : 69, "no such task or service(s): %s", arg);
+	} else {
+		for (i = 0; i < num_nodes; i++) {
+			if (!node || nodes[i].ready > node->ready)
+				node = &nodes[i];
+		}
+	}
+	if (!node->ready)
+		ERRX(1, "%s has not started, or is not ready yet.", node->ident);
+
+	path = calloc(num_nodes, sizeof(*path));
+	if (!path)
+		ERR(1, "Failed allocating memory");
+
+	while (node && num < num_nodes) {
+		struct node *next = NULL;
+		char *dep, *ptr;
+
+		path[num++] = node;
+		for (dep = strtok_r(node->deps, ",", &ptr); dep; dep = strtok_r(NULL, ",", &ptr)) {
+			struct node *prov = graph_find(dep);
+
+			if (!prov || !prov->ready || prov->ready > node->eligible)
+				continue;
+			if (!next || prov->ready > next->ready)
+				next = prov;
+		}
+		node = next;
+	}
+
+	if (heading)
+		print_header("%-*s  %10s  %10s  %10s  %8s  %8s", iw, "IDENT",
+			     "ELIGIBLE", "START", "READY", "WAIT", "STARTUP");
+
+	while (num--) {
+		char eligible[24], start[24], ready[24], wait[24], startup[24];
+
+		node = path[num];
+		printf("%-*s  %10s  %10s  %10s  %8s  %8s\n", iw, node->ident,
+		       graph_time(node->eligible, eligible, sizeof(eligible)),
+		       graph_time(node->start, start, sizeof(start)),
+		       graph_time(node->ready, ready, sizeof(ready)),
+		       graph_msec(node->eligible, node->start, wait, sizeof(wait)),
+		       graph_msec(node->start, node->ready, startup, sizeof(startup)));
+	}
+
+	free(path);
+	free(nodes);
+	return 0;
+}
+
 static int do_cmd(int cmd)
 {
 	struct init_request rq = {
@@ -845,10 +1229,7 @@ static char *svc_command(svc_t *svc, char *buf, size_t len, int ansi)
 	strlcpy(buf, bold ? "\e[1m" : "", len);
 	strlcat(buf, svc->cmd, len);
 
-	for (int i = 1; i < MAX_NUM_SVC_ARGS; i++) {
-		if (!svc->args[i][0])
-			break;
-
+	for (int i = 1; svc->args[0] && svc->args[i]; i++) {
 		strlcat(buf, " ", len);
 		strlcat(buf, svc->args[i], len);
 	}
@@ -967,32 +1348,10 @@ static void show_cgroup_tree(char *group, char *pfx)
 	cgroup_tree(path, pfx, 0, 0);
 }
 
-/*
- * arg: 'foo'   should match foo:1 foo:2, etc. but not foobar
- * arg: 'foo:1' should only match foo:1
- * arg: 'foo:'  is allowed to fail, unsupported syntax atm
- * arg: 'foo:*' is allowed to fail, unsupported syntax atm
- */
-static int svc_compare(svc_t *svc, char *arg)
-{
-	char ident[MAX_IDENT_LEN];
-	char *ptr;
-
-	svc_ident(svc, ident, sizeof(ident));
-	ptr = strchr(ident, ':');
-	if (ptr && !strchr(arg, ':'))
-		*ptr = 0;
-
-	if (!strcmp(ident, arg))
-		return 1;
-
-	return 0;
-}
-
 static int json_status_one(FILE *fp, svc_t *svc, char *indent, int prev)
 {
 	long now = jiffies();
-	char *pidfn = NULL;
+	const char *pidfn = NULL;
 	char buf[512];
 
 	pidfn = svc->pidfile;
@@ -1015,6 +1374,9 @@ static int json_status_one(FILE *fp, svc_t *svc, char *indent, int prev)
 		indent, svc_typestr(svc),
 		indent, svc->forking ? "true" : "false",
 		indent, svc_status(svc));
+	if (svc->notify_status[0])
+		fprintf(fp,
+			"%s  \"message\": \"%s\",\n", indent, svc->notify_status);
 	if (svc->state != SVC_RUNNING_STATE) {
 		int rc, sig;
 
@@ -1048,6 +1410,9 @@ static int json_status_one(FILE *fp, svc_t *svc, char *indent, int prev)
 			"%s  \"starts\": %d,\n", indent, svc->once);
 	fprintf(fp,
 		"%s  \"restarts\": %d,\n", indent, svc->restart_tot); /* XXX: add restart_cnt and restart_max */
+	if (svc->watchdog)
+		fprintf(fp,
+			"%s  \"watchdog\": %d,\n", indent, svc->watchdog / 1000);
 	fprintf(fp,
 		"%s  \"pidfile\": \"%s\",\n"
 		"%s  \"pid\": %d,\n"
@@ -1079,10 +1444,10 @@ static int show_status(char *arg)
 	while (arg && arg[0]) {
 		long now = jiffies();
 		char uptm[42] = "N/A";
-		char *pidfn = NULL;
+		const char *pidfn = NULL;
 
-		for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0))
-			num += svc_compare(svc, arg);
+		for (svc = client_svc_status(arg, 1); svc; svc = client_svc_status(arg, 0))
+			num++;
 
 		if (num > 1)
 			break;
@@ -1115,6 +1480,8 @@ static int show_status(char *arg)
 			pidfn = "none";
 
 		printf("     Status : %s\n", status(svc, 1));
+		if (svc->notify_status[0])
+			printf("              %s\n", svc->notify_status);
 		printf("   Identity : %s\n", svc_ident(svc, ident, sizeof(ident)));
 		printf("Description : %s\n", svc->desc);
 		printf("     Origin : %s\n", svc->file[0] ? svc->file : "built-in");
@@ -1133,6 +1500,8 @@ static int show_status(char *arg)
 		if (svc->manual)
 			printf("     Starts : %d\n", svc->once);
 		printf("   Restarts : %d (%d/%d)\n", svc->restart_tot, svc->restart_cnt, svc->restart_max);
+		if (svc->watchdog)
+			printf("   Watchdog : %d sec\n", svc->watchdog / 1000);
 		printf("  Runlevels : %s\n", runlevel_string(runlevel, svc->runlevels));
 		if (cgrp && svc->pid > 1) {
 			const struct cg *cg;
@@ -1157,17 +1526,13 @@ static int show_status(char *arg)
 	no_cgroup:
 		printf("\n");
 
-		return do_log(svc, "| tail -10");
+		return do_log(svc, &(struct logstore_query){ .tail = 10 });
 	}
 
 	if (json) {
 		int prev = 0;
 
-		for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
-			svc_ident(svc, ident, sizeof(ident));
-			if (num && !svc_compare(svc, arg))
-				continue;
-
+		for (svc = client_svc_status(arg, 1); svc; svc = client_svc_status(arg, 0)) {
 			if (!prev)
 				fputs("[\n", stdout);
 			json_status_one(stdout, svc, "  ", prev++);
@@ -1192,12 +1557,10 @@ static int show_status(char *arg)
 		print_header("%s", title);
 	}
 
-	for (svc = client_svc_iterator(1); svc; svc = client_svc_iterator(0)) {
+	for (svc = client_svc_status(arg, 1); svc; svc = client_svc_status(arg, 0)) {
 		char *lvls;
 
 		svc_ident(svc, ident, sizeof(ident));
-		if (num && !svc_compare(svc, arg))
-			continue;
 
 		printf("%-*d  ", pw, svc->pid);
 		printf("%-*s  %s ", iw, ident, status(svc, 0));
@@ -1286,7 +1649,7 @@ static int usage(int rc)
 		"  -c, --create              Create missing paths (and files) as needed\n"
 		"  -f, --force               Ignore missing files and arguments, never prompt\n"
 		"  -h, --help                This help text\n"
-		"  -j, --json                JSON output in 'status' and 'cond' commands\n"
+		"  -j, --json                JSON output in 'status', 'cond', and 'graph' commands\n"
 		"  -n, --noerr               Ignore error, e.g., already started/enabled/...\n"
 		"  -1, --once                Only one lap in commands like 'top'\n"
 		"  -p, --plain               Use plain table headings, no ctrl chars\n"
@@ -1334,8 +1697,19 @@ static int usage(int rc)
 		"  cond     clear <COND>     Clear (deassert) user-defined conditions -usr/COND\n"
 		"  cond     status           Show condition status, default cond command\n"
 		"  cond     dump  [TYPE]     Dump all, or a type of, conditions and their status\n"
+		"  cond     deps  [COND]     Show services depending on, and updates of, conditions\n"
 		"\n"
-		"  log      [NAME]           Show ten last Finit, or NAME, messages from syslog\n"
+		"  graph    show  [NAME]     Show dependency graph, rank and start times, default\n"
+		"  graph    dot              Dependency graph in Graphviz dot format\n"
+		"  graph    critical [NAME]  Show critical path to NAME, or last service ready\n"
+		"\n"
+		"  trace    show  [NAME]     Show boot timeline events, oldest first, default\n"
+		"  trace    json             Boot timeline in Chrome trace-event JSON format\n"
+		"  trace    svg              Boot timeline as a bootchart-style SVG image\n"
+		"\n"
+		"  log      [NAME]           Show Finit, or NAME, messages from syslog or log:store\n"
+		"  log      NAME [since TIME] [until TIME] [prio LEVEL] [tail NUM] [follow]\n"
+		"                            Search NAME log:store by time, level, or wait for more\n"
 		"  start    <NAME>[:ID]      Start service by name, with optional ID\n"
 		"  stop     <NAME>[:ID]      Stop/Pause a running service by name\n"
 		"  reload   <NAME>[:ID]      Reload service as if .conf changed (SIGHUP or restart)\n"
@@ -1493,12 +1867,25 @@ int main(int argc, char *argv[])
 	struct cmd cond[] = {
 		{ "status",   NULL, do_cond_show, NULL, NULL }, /* default cmd */
 		{ "dump",     NULL, do_cond_dump, NULL, NULL  },
+		{ "deps",     NULL, do_cond_deps, NULL, NULL  },
 		{ "set",      NULL, do_cond_set,  NULL, NULL  },
 		{ "get",      NULL, do_cond_get,  NULL, NULL  },
 		{ "clr",      NULL, do_cond_clr,  NULL, NULL  },
 		{ "clear",    NULL, do_cond_clr,  NULL, NULL  },
 		{ NULL, NULL, NULL, NULL, NULL  }
 	};
+	struct cmd graph[] = {
+		{ "show",     NULL, do_graph_show,     NULL, NULL }, /* default cmd */
+		{ "dot",      NULL, do_graph_dot,      NULL, NULL },
+		{ "critical", NULL, do_graph_critical, NULL, NULL },
+		{ NULL, NULL, NULL, NULL, NULL  }
+	};
+	struct cmd trace[] = {
+		{ "show",     NULL, trace_show,        NULL, NULL }, /* default cmd */
+		{ "json",     NULL, trace_json,        NULL, NULL },
+		{ "svg",      NULL, trace_svg,         NULL, NULL },
+		{ NULL, NULL, NULL, NULL, NULL  }
+	};
 	struct cmd command[] = {
 		{ "status",   NULL, show_status,  NULL, NULL  }, /* default cmd */
 		{ "ident",    NULL, show_ident,   NULL, NULL  },
@@ -1521,8 +1908,10 @@ int main(int argc, char *argv[])
 		{ "reload",   NULL, do_reload,    NULL, NULL  },
 
 		{ "cond",     cond, NULL, NULL, NULL          },
+		{ "graph",    graph, NULL, NULL, NULL         },
+		{ "trace",    trace, NULL, NULL, NULL         },
 
-		{ "log",      NULL, show_log,     NULL, NULL  },
+		{ "log",      NULL, NULL,         NULL, show_log  },
 		{ "start",    NULL, do_start,     NULL, NULL  },
 		{ "stop",     NULL, do_stop,      NULL, NULL  },
 		{ "restart",  NULL, do_restart,   NULL, NULL  },
@@ -28,7 +28,10 @@
 #include <string.h>
 #define SYSLOG_NAMES
 #include <syslog.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/stat.h>
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
@@ -36,58 +39,218 @@
 # include <lite/lite.h>
 #endif
 
-#define LOG_MAX (200 * 1024)
-#define LOG_NUM 5
+#include "logrotate.h"
+
+#define LOG_MAX   (200 * 1024)
+#define LOG_NUM   5
+#define LOG_LINE  512
+#define LOG_BUFSZ 4096
+#define LOG_FLUSH 1000
 
 static const char version_info[] = PACKAGE_NAME " v" PACKAGE_VERSION;
-extern int logrotate(char *file, int num, off_t sz);
+static int compressing;		/* Rotated file to compress, see logrotate_mode() */
+
+
+/*
+ * Log file state.  Lines are written to a stdio buffer that is flushed
+ * when it holds @bufsz bytes, or @interval msec after the first unflushed
+ * line, whichever comes first.  The file size is tracked here, instead of
+ * calling fstat() for each line, to know when it's time to rotate.
+ */
+struct flog {
+	char   *file;
+	int     num;		/* Rotated files to keep */
+	off_t   sz;		/* Rotate when file is larger */
+
+	size_t  bufsz;		/* Flush at this many bytes, 0: every line */
+	int     interval;	/* Flush at most this many msec after write */
+	int     sync;		/* 1: fdatasync() on flush, 2: fsync() every line */
+
+	FILE   *fp;
+	off_t   size;
+	size_t  pending;	/* Bytes written but not flushed */
+	long    deadline;	/* When pending must be flushed */
+};
+
+static long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-static int checksz(FILE *fp, off_t sz)
+static int flog_open(struct flog *fl)
 {
 	struct stat st;
 
-	if (sz <= 0)
+	fl->fp = fopen(fl->file, "a");
+	if (!fl->fp) {
+		syslog(LOG_ERR | LOG_PERROR, "Failed opening %s: %s", fl->file, strerror(errno));
+		return 1;
+	}
+
+	/* Never let stdio flush behind our back, we may need to sync */
+	setvbuf(fl->fp, NULL, _IOFBF, fl->bufsz + LOG_LINE);
+
+	fl->size = fstat(fileno(fl->fp), &st) ? 0 : st.st_size;
+	fl->pending = 0;
+
+	return 0;
+}
+
+static int flog_flush(struct flog *fl)
+{
+	int rc;
+
+	if (!fl->pending)
 		return 0;
 
-	if (!fstat(fileno(fp), &st) && st.st_size > sz) {
-		fclose(fp);
+	rc = fflush(fl->fp);
+	if (!rc && fl->sync == 1)
+		rc = fdatasync(fileno(fl->fp));
+	else if (!rc && fl->sync > 1)
+		rc = fsync(fileno(fl->fp));
+	fl->pending = 0;
+
+	return rc;
+}
+
+static int flog_close(struct flog *fl)
+{
+	int rc;
+
+	rc = flog_flush(fl);
+	if (fclose(fl->fp))
+		rc = 1;
+	fl->fp = NULL;
+
+	return rc;
+}
+
+/*
+ * Called by logrotate() when a rotated file is queued for compression,
+ * which we do in the poll loop of flogit(), between reads of stdin.
+ */
+static void flog_queued(void)
+{
+	compressing = 1;
+}
+
+/* Close log file and finish compressing any rotated file before exit */
+static int flog_done(struct flog *fl)
+{
+	int rc;
+
+	rc = flog_close(fl);
+	while (compressing)
+		compressing = logrotate_work(LOGROTATE_CHUNK);
+
+	return rc;
+}
+
+static int flog_write(struct flog *fl, const char *buf, size_t len)
+{
+	if (!fl->fp || fwrite(buf, len, 1, fl->fp) != 1)
 		return 1;
+
+	if (!fl->pending)
+		fl->deadline = now() + fl->interval;
+	fl->pending += len;
+	fl->size += len;
+
+	if (fl->sync > 1 || fl->pending >= fl->bufsz)
+		flog_flush(fl);
+
+	if (fl->sz > 0 && fl->size > fl->sz) {
+		flog_close(fl);
+		logrotate(fl->file, fl->num, fl->sz);
+		return flog_open(fl);
 	}
 
 	return 0;
 }
 
-static int flogit(char *logfile, int num, off_t sz, char *buf, size_t len)
+/* Write all complete lines in buf, returns length of remaining partial line */
+static size_t flog_lines(struct flog *fl, char *buf, size_t len, int eof)
 {
-	FILE *fp;
+	char *line = buf, *nl;
+	size_t rest;
+
+	while ((nl = memchr(line, '\n', &buf[len] - line))) {
+		flog_write(fl, line, nl - line + 1);
+		line = nl + 1;
+	}
+
+	rest = &buf[len] - line;
+	if (rest && (eof || rest == LOG_LINE)) {
+		flog_write(fl, line, rest);
+		rest = 0;
+	}
+	memmove(buf, line, rest);
+
+	return rest;
+}
 
-reopen:
-	fp = fopen(logfile, "a");
-	if (!fp) {
-		syslog(LOG_ERR | LOG_PERROR, "Failed opening %s: %s", logfile, strerror(errno));
+static int flogit(struct flog *fl, char *msg)
+{
+	char buf[LOG_LINE];
+	size_t len = 0;
+
+	if (flog_open(fl))
 		return 1;
+
+	if (msg[0]) {
+		flog_write(fl, msg, strlen(msg));
+		flog_write(fl, "\n", 1);
+		return flog_done(fl);
 	}
 
-	if (buf[0]) {
-		fprintf(fp, "%s\n", buf);
-		fsync(fileno(fp));
-		if (checksz(fp, sz))
-			return logrotate(logfile, num, sz);
-	} else {
-		while ((fgets(buf, len, stdin))) {
-			fputs(buf, fp);
-			fsync(fileno(fp));
-
-			if (checksz(fp, sz)) {
-				logrotate(logfile, num, sz);
-				buf[0] = 0;
-				goto reopen;
-			}
+	while (1) {
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+		int timeout = -1;
+		ssize_t num;
+
+		if (fl->pending) {
+			timeout = fl->deadline - now();
+			if (timeout < 0)
+				timeout = 0;
+		}
+		if (compressing)
+			timeout = 0;
+
+		num = poll(&pfd, 1, timeout);
+		if (num == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
 		}
+		if (num == 0) {
+			if (fl->pending && now() >= fl->deadline)
+				flog_flush(fl);
+			if (compressing)
+				compressing = logrotate_work(LOGROTATE_CHUNK);
+			continue;
+		}
+
+		num = read(STDIN_FILENO, &buf[len], sizeof(buf) - len);
+		if (num == -1 && errno == EINTR)
+			continue;
+		if (num <= 0)
+			break;
+
+		len = flog_lines(fl, buf, len + num, 0);
+		if (!fl->fp)
+			return 1;
+
+		/* Never idle at high line rates, compress a bit per read */
+		if (compressing)
+			compressing = logrotate_work(sizeof(buf) * 16);
 	}
+	flog_lines(fl, buf, len, 1);
 
-	return fclose(fp);
+	return flog_done(fl);
 }
 
 /*
@@ -209,6 +372,11 @@ static int usage(int code)
 		"  -f FILE  File to write log messages to, instead of syslog\n"
 		"  -n SIZE  Number of bytes before rotating, default: 200 kB\n"
 		"  -r NUM   Number of rotated files to keep, default: 5\n"
+		"  -c       Compress rotated files in a low priority background process\n"
+		"  -b SIZE  Flush file when SIZE bytes are buffered, default: 4096\n"
+		"  -i MSEC  Flush file at most MSEC after a write, default: 1000\n"
+		"  -S       Call fdatasync() on every flush of the file\n"
+		"  -y       Durable, write and fsync() every line, no buffering\n"
 		"  -v       Show program version\n"
 		"\n"
 		"This version of logit is distributed as part of Finit.\n"
@@ -219,26 +387,42 @@ static int usage(int code)
 
 int main(int argc, char *argv[])
 {
-	char *ident = NULL, *logfile = NULL;
+	struct flog fl = {
+		.num      = LOG_NUM,
+		.sz       = LOG_MAX,
+		.bufsz    = LOG_BUFSZ,
+		.interval = LOG_FLUSH,
+	};
 	int log_opts = LOG_NOWAIT;
 	int facility = LOG_USER;
+	char buf[LOG_LINE] = "";
 	int level = LOG_INFO;
-	off_t size = LOG_MAX;
-	char buf[512] = "";
-	int num = LOG_NUM;
-	int c, rc;
+	char *ident = NULL;
+	int c, rc, bg = 0;
 
-	while ((c = getopt(argc, argv, "f:hn:p:r:st:v")) != EOF) {
+	while ((c = getopt(argc, argv, "b:cf:hi:n:p:r:sSt:vy")) != EOF) {
 		switch (c) {
+		case 'b':
+			fl.bufsz = atoi(optarg);
+			break;
+
+		case 'c':
+			bg = 1;
+			break;
+
 		case 'f':
-			logfile = optarg;
+			fl.file = optarg;
 			break;
 
 		case 'h':
 			return usage(0);
 
+		case 'i':
+			fl.interval = atoi(optarg);
+			break;
+
 		case 'n':
-			size = atoi(optarg);
+			fl.sz = atoi(optarg);
 			break;
 
 		case 'p':
@@ -247,13 +431,17 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'r':
-			num = atoi(optarg);
+			fl.num = atoi(optarg);
 			break;
 
 		case 's':
 			log_opts |= LOG_PERROR;
 			break;
 
+		case 'S':
+			fl.sync = 1;
+			break;
+
 		case 't':
 			ident = optarg;
 			break;
@@ -262,6 +450,10 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "%s\n", version_info);
 			return 0;
 
+		case 'y':
+			fl.sync = 2;
+			break;
+
 		default:
 			return usage(1);
 		}
@@ -289,10 +481,18 @@ int main(int argc, char *argv[])
 
 	openlog(ident, log_opts, facility);
 
-	if (logfile)
-		rc = flogit(logfile, num, size, buf, sizeof(buf));
-	else
+	if (fl.file) {
+		if (bg) {
+			/* Let the kernel reap the worker, see logrotate.c */
+			signal(SIGCHLD, SIG_IGN);
+			logrotate_mode(LOGROTATE_BG, NULL);
+		} else {
+			logrotate_mode(LOGROTATE_INCR, flog_queued);
+		}
+		rc = flogit(&fl, buf);
+	} else {
 		rc = logit(level, buf, sizeof(buf));
+	}
 
 	closelog();
 
@@ -0,0 +1,571 @@
+/* In-process log multiplexer for service output
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Services with log:syslog, or log:/path/to/file, used to get a logger
+ * (or logit) process each, reading the other end of a PTY.  Now PID 1
+ * holds the PTY master of every such service in the event loop, splits
+ * the output in lines, and sends each line to syslogd, or appends it to
+ * the log file, on behalf of the service.  Only the PTY is held for the
+ * lifetime of a service, log files and log stores of the least recently
+ * logging services are closed to save descriptors in PID 1.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "conf.h"
+#include "helpers.h"
+#include "log.h"
+#include "logmux.h"
+#include "logrotate.h"
+#include "logstore.h"
+#include "private.h"
+#include "schedule.h"
+
+#define LOGMUX_LINE  1024
+#define LOGMUX_BURST 16		/* Max read() per event, be fair to others */
+#define LOGMUX_OBUF  4096	/* Buffered log file output, flushed per event */
+#define LOGMUX_FILES 64		/* Max services with log files open */
+
+struct logmux {
+	TAILQ_ENTRY(logmux) link;
+	TAILQ_ENTRY(logmux) lru;	/* Has log file, or log store, open */
+	int      open;
+
+	uev_t    watcher;
+	int      fd;			/* PTY master, our end */
+	int      peer;			/* PTY slave, until started */
+	pid_t    pid;			/* Of service, faked in syslog */
+
+	int      prio;			/* Default facility.level */
+	char     ident[MAX_IDENT_LEN];
+	char     file[sizeof(((svc_t *)0)->log.file)];
+	int      logfd;			/* log:/path/to/file */
+	off_t    size;
+	char    *obuf;			/* Lines not yet written to logfd */
+	size_t   olen;
+	struct logstore *store;		/* log:store */
+	unsigned dropped;		/* Lines lost, syslogd busy */
+
+	size_t   len;
+	char     buf[LOGMUX_LINE];
+};
+
+static TAILQ_HEAD(, logmux) logmux_list = TAILQ_HEAD_INITIALIZER(logmux_list);
+static TAILQ_HEAD(, logmux) logmux_lru  = TAILQ_HEAD_INITIALIZER(logmux_lru);
+static int logmux_num_open;
+static int syslog_sd = -1;
+static int kmsg_fd = -1;
+
+static void logmux_compress(void *arg);
+static struct wq compress_work = {
+	.cb    = logmux_compress,
+	.delay = 0
+};
+
+static int syslog_connect(void)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+	if (syslog_sd != -1)
+		return 0;
+
+	syslog_sd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (syslog_sd == -1)
+		return -1;
+
+	strlcpy(sun.sun_path, _PATH_LOG, sizeof(sun.sun_path));
+	if (connect(syslog_sd, (struct sockaddr *)&sun, sizeof(sun))) {
+		close(syslog_sd);
+		syslog_sd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Same as log.c, log to /dev/kmsg until syslogd is up */
+static void logmux_kmsg(struct logmux *lm, int prio, const char *msg)
+{
+	if (kmsg_fd == -1) {
+		if (in_container())
+			return;
+		kmsg_fd = open("/dev/kmsg", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if (kmsg_fd == -1)
+			return;
+	}
+
+	if (dprintf(kmsg_fd, "<%d>%s[%d]: %s", prio, lm->ident, lm->pid, msg) < 0) {
+		close(kmsg_fd);
+		kmsg_fd = -1;
+	}
+}
+
+/*
+ * Send in the same format as syslog(3), but with the ident and PID of
+ * the service.  We never block, if syslogd cannot keep up lines are
+ * dropped and reported when the service stops.
+ */
+static void logmux_syslog(struct logmux *lm, int prio, const char *msg)
+{
+	char buf[LOGMUX_LINE + 128], ts[20];
+	time_t now = time(NULL);
+	int retry = 1;
+	struct tm tm;
+	size_t len;
+
+	strftime(ts, sizeof(ts), "%b %e %H:%M:%S", localtime_r(&now, &tm));
+	len = snprintf(buf, sizeof(buf), "<%d>%s %s[%d]: %s", prio, ts, lm->ident, lm->pid, msg);
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	while (!syslog_connect()) {
+		if (send(syslog_sd, buf, len, MSG_NOSIGNAL) != -1)
+			return;
+
+		if (errno == EAGAIN || errno == ENOBUFS) {
+			lm->dropped++;
+			return;
+		}
+
+		/* syslogd restarted, reconnect once */
+		close(syslog_sd);
+		syslog_sd = -1;
+		if (!retry--)
+			break;
+	}
+
+	logmux_kmsg(lm, prio, msg);
+}
+
+static void logmux_flush(struct logmux *lm)
+{
+	size_t off = 0;
+	ssize_t num;
+
+	while (off < lm->olen) {
+		num = write(lm->logfd, &lm->obuf[off], lm->olen - off);
+		if (num == -1) {
+			if (errno == EINTR)
+				continue;
+			break;		/* e.g., disk full, lines are lost */
+		}
+		off += num;
+	}
+	lm->olen = 0;
+}
+
+/* Close log file, and log store, of @lm until its next line */
+static void logmux_idle(struct logmux *lm)
+{
+	if (!lm->open)
+		return;
+
+	TAILQ_REMOVE(&logmux_lru, lm, lru);
+	logmux_num_open--;
+	lm->open = 0;
+
+	if (lm->logfd != -1) {
+		logmux_flush(lm);
+		close(lm->logfd);
+		lm->logfd = -1;
+	}
+	logstore_idle(lm->store);
+}
+
+/*
+ * Keep at most LOGMUX_FILES services with their log file, or log store,
+ * open.  The least recently used one is closed to make room for @lm.
+ */
+static void logmux_touch(struct logmux *lm)
+{
+	if (lm->open) {
+		TAILQ_REMOVE(&logmux_lru, lm, lru);
+		TAILQ_INSERT_TAIL(&logmux_lru, lm, lru);
+		return;
+	}
+
+	if (logmux_num_open >= LOGMUX_FILES)
+		logmux_idle(TAILQ_FIRST(&logmux_lru));
+
+	TAILQ_INSERT_TAIL(&logmux_lru, lm, lru);
+	logmux_num_open++;
+	lm->open = 1;
+}
+
+/*
+ * Out of descriptors, close the least recently used log file, but not
+ * our own.  Returns non-zero if there was nothing to close.
+ */
+static int logmux_reclaim(struct logmux *lm)
+{
+	struct logmux *oldest = TAILQ_FIRST(&logmux_lru);
+
+	if (!oldest || oldest == lm)
+		return -1;
+
+	logmux_idle(oldest);
+	return 0;
+}
+
+static int logmux_fopen(struct logmux *lm)
+{
+	struct stat st;
+
+	do {
+		lm->logfd = open(lm->file, O_WRONLY | O_APPEND | O_CREAT | O_NOCTTY | O_CLOEXEC, 0644);
+		if (lm->logfd != -1)
+			break;
+	} while ((errno == EMFILE || errno == ENFILE) && !logmux_reclaim(lm));
+
+	if (lm->logfd == -1) {
+		/* Try again on the next line, this one goes to syslog */
+		if (errno == EMFILE || errno == ENFILE)
+			return -1;
+
+		logit(LOG_ERR, "Failed opening %s: %s", lm->file, strerror(errno));
+		lm->file[0] = 0; /* fall back to syslog */
+		return -1;
+	}
+	lm->size = fstat(lm->logfd, &st) ? 0 : st.st_size;
+
+	return 0;
+}
+
+/*
+ * Lines are collected in lm->obuf and written when it is full, or at
+ * the end of each logmux_cb(), so a chatty service costs one write()
+ * per event rather than one per line.  A rotation is postponed while
+ * the previous one is still being compressed, logrotate() would else
+ * wait for it to finish.
+ */
+static int logmux_file(struct logmux *lm, const char *msg)
+{
+	char buf[LOGMUX_LINE + 128], ts[20];
+	time_t now = time(NULL);
+	struct tm tm;
+	size_t len;
+
+	if (lm->logfd == -1 && logmux_fopen(lm))
+		return -1;
+
+	if (!lm->obuf) {
+		lm->obuf = malloc(LOGMUX_OBUF);
+		if (!lm->obuf) {
+			logit(LOG_ERR, "Failed allocating log buffer for %s", lm->file);
+			return -1;
+		}
+	}
+
+	strftime(ts, sizeof(ts), "%b %e %H:%M:%S", localtime_r(&now, &tm));
+	len = snprintf(buf, sizeof(buf), "%s %s[%d]: %s\n", ts, lm->ident, lm->pid, msg);
+	if (len >= sizeof(buf)) {
+		len = sizeof(buf) - 1;
+		buf[len - 1] = '\n';
+	}
+
+	if (lm->olen + len > LOGMUX_OBUF)
+		logmux_flush(lm);
+	memcpy(&lm->obuf[lm->olen], buf, len);
+	lm->olen += len;
+	lm->size += len;
+
+	if (logfile_size_max > 0 && lm->size > logfile_size_max && !logrotate_busy(lm->file)) {
+		logmux_flush(lm);
+		close(lm->logfd);
+		lm->logfd = -1;
+		logrotate(lm->file, logfile_count_max, logfile_size_max);
+	}
+
+	return 0;
+}
+
+/*
+ * Parse possible systemd style log <level> prefix from message, same
+ * as parse_level() in logit.c, see libsystemd/sd-daemon.h for details.
+ */
+static int logmux_level(char **msg, int prio)
+{
+	char *ptr = *msg;
+
+	if (ptr[0] != '<' || ptr[1] < '0' || ptr[1] > '7' || ptr[2] != '>')
+		return prio;
+
+	*msg = ptr + 3;
+
+	return (prio & ~LOG_PRIMASK) | (ptr[1] - '0');
+}
+
+static void logmux_line(struct logmux *lm, char *line)
+{
+	size_t len = strlen(line);
+	int prio;
+
+	/* PTY line endings, and blank lines, are not logged */
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+		line[--len] = 0;
+	if (!len)
+		return;
+
+	prio = logmux_level(&line, lm->prio);
+	if (debug)
+		fprintf(stderr, "%s[%d]: %s\n", lm->ident, lm->pid, line);
+
+	if (lm->store || lm->file[0] == '/')
+		logmux_touch(lm);
+	if (lm->store && !logstore_write(lm->store, prio, lm->pid, line, strlen(line)))
+		return;
+	if (lm->file[0] != '/' || logmux_file(lm, line))
+		logmux_syslog(lm, prio, line);
+}
+
+/* Log all complete lines in buffer, and any remaining partial line on flush */
+static void logmux_lines(struct logmux *lm, int flush)
+{
+	char *line = lm->buf, *nl;
+	size_t rest;
+
+	while ((nl = memchr(line, '\n', &lm->buf[lm->len] - line))) {
+		*nl = 0;
+		logmux_line(lm, line);
+		line = nl + 1;
+	}
+
+	rest = &lm->buf[lm->len] - line;
+	if (rest && (flush || rest == sizeof(lm->buf) - 1)) {
+		line[rest] = 0;
+		logmux_line(lm, line);
+		rest = 0;
+	}
+
+	memmove(lm->buf, line, rest);
+	lm->len = rest;
+}
+
+static void logmux_close(struct logmux *lm)
+{
+	if (lm->dropped)
+		logit(LOG_WARNING, "%s[%d]: %u log messages dropped, syslogd busy",
+		      lm->ident, lm->pid, lm->dropped);
+
+	logmux_idle(lm);
+	TAILQ_REMOVE(&logmux_list, lm, link);
+	uev_io_stop(&lm->watcher);
+	close(lm->fd);
+	if (lm->peer != -1)
+		close(lm->peer);
+	logstore_close(lm->store);
+	free(lm->obuf);
+	free(lm);
+}
+
+/*
+ * At most LOGMUX_BURST reads per event, a service flooding its output
+ * must not keep PID 1 here.  The watcher is level triggered, so we are
+ * called again on the next loop round if there is more to read.
+ */
+static void logmux_cb(uev_t *w, void *arg, int events)
+{
+	struct logmux *lm = arg;
+	ssize_t num;
+	int i;
+
+	for (i = 0; i < LOGMUX_BURST; i++) {
+		num = read(w->fd, &lm->buf[lm->len], sizeof(lm->buf) - lm->len - 1);
+		if (num > 0) {
+			lm->len += num;
+			logmux_lines(lm, 0);
+			continue;
+		}
+
+		if (num == -1 && (errno == EINTR || errno == EAGAIN))
+			break;
+
+		/* EIO when the last process holding the PTY slave has exited */
+		logmux_lines(lm, 1);
+		logmux_close(lm);
+		return;
+	}
+
+	if (lm->olen)
+		logmux_flush(lm);
+}
+
+/*
+ * Compress rotated log files one chunk per event loop round, so PID 1
+ * never stalls on a rotation, regardless of the log file size.
+ */
+static void logmux_compress(void *arg)
+{
+	if (logrotate_work(LOGROTATE_CHUNK))
+		schedule_work(&compress_work);
+}
+
+static void logmux_compress_queued(void)
+{
+	schedule_work(&compress_work);
+}
+
+/**
+ * logmux_init - Set up log multiplexer
+ *
+ * Switches logrotate() to incremental compression, driven from the
+ * event loop.  Any file rotated before this is compressed in place.
+ */
+void logmux_init(void)
+{
+	logrotate_mode(LOGROTATE_INCR, logmux_compress_queued);
+}
+
+/**
+ * logmux_open - Set up log multiplexing for a service about to start
+ * @svc: Service with log:syslog or log:/path/to/file
+ *
+ * Creates a PTY, not a pipe, so the service's stdio is line buffered.
+ * We keep the master in the event loop and the caller hands the slave
+ * to the child as stdout and stderr.  Call logmux_started() in the
+ * parent when the child has been created, or failed to.
+ *
+ * Returns:
+ * The PTY slave, with %O_CLOEXEC set, or -1 on error.
+ */
+int logmux_open(svc_t *svc)
+{
+	int facility = LOG_DAEMON, level = LOG_INFO;
+	struct logmux *lm;
+	struct termios tc;
+	char pts[32];
+
+	lm = calloc(1, sizeof(*lm));
+	if (!lm)
+		goto fail;
+
+	lm->fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (lm->fd == -1)
+		goto fail;
+	if (grantpt(lm->fd) || unlockpt(lm->fd) || ptsname_r(lm->fd, pts, sizeof(pts)))
+		goto fail_master;
+
+	lm->peer = open(pts, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (lm->peer == -1)
+		goto fail_master;
+
+	/* No echo, no line editing, and no \n -> \r\n */
+	if (!tcgetattr(lm->peer, &tc)) {
+		cfmakeraw(&tc);
+		tcsetattr(lm->peer, TCSANOW, &tc);
+	}
+
+	fcntl(lm->fd, F_SETFL, fcntl(lm->fd, F_GETFL) | O_NONBLOCK);
+	if (uev_io_init(ctx, &lm->watcher, logmux_cb, lm, lm->fd, UEV_READ)) {
+		close(lm->peer);
+		goto fail_master;
+	}
+
+	if (svc->log.prio[0]) {
+		char buf[sizeof(svc->log.prio)];
+
+		strlcpy(buf, svc->log.prio, sizeof(buf));
+		log_parse(buf, &facility, &level);
+	}
+	lm->prio = facility | level;
+
+	if (svc->log.ident[0])
+		strlcpy(lm->ident, svc->log.ident, sizeof(lm->ident));
+	else
+		svc_ident(svc, lm->ident, sizeof(lm->ident));
+	strlcpy(lm->file, svc->log.file, sizeof(lm->file));
+	lm->logfd = -1;
+
+	if (svc->log.store) {
+		char dir[sizeof(LOGSTORE_PATH) + MAX_IDENT_LEN + 1];
+
+		snprintf(dir, sizeof(dir), "%s/%s", LOGSTORE_PATH, svc_ident(svc, NULL, 0));
+		lm->store = logstore_open(dir, lm->ident, logfile_size_max, logfile_count_max);
+	}
+
+	TAILQ_INSERT_TAIL(&logmux_list, lm, link);
+
+	return lm->peer;
+
+fail_master:
+	close(lm->fd);
+fail:
+	logit(LOG_WARNING, "%s: failed setting up log: %s", svc_ident(svc, NULL, 0), strerror(errno));
+	free(lm);
+
+	return -1;
+}
+
+/**
+ * logmux_started - Child has been forked, or failed to
+ * @fd:  PTY slave, from logmux_open()
+ * @pid: PID of child, or -1 if fork failed
+ *
+ * Closes our copy of the PTY slave, so the multiplexer can detect when
+ * the child, and any process it forks, has exited.
+ */
+void logmux_started(int fd, pid_t pid)
+{
+	struct logmux *lm;
+
+	TAILQ_FOREACH(lm, &logmux_list, link) {
+		if (lm->peer != fd)
+			continue;
+
+		close(lm->peer);
+		lm->peer = -1;
+		lm->pid = pid;
+
+		if (pid <= 0)
+			logmux_close(lm);
+		return;
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -20,17 +20,57 @@
  * THE SOFTWARE.
  */
 
+#include "config.h"
+
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <syslog.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #ifdef _LIBITE_LITE
 # include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
 #else
 # include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
 #endif
 
+#include "logrotate.h"
+
+#define IOPRIO_CLASS_IDLE    3
+#define IOPRIO_CLASS_SHIFT   13
+#define IOPRIO_WHO_PROCESS   1
+
+/*
+ * A rotated .2 file waiting to be compressed.  With zlib this is done
+ * a chunk at a time, so the caller can interleave it with other work.
+ */
+struct lzjob {
+	TAILQ_ENTRY(lzjob) link;
+
+	char   *base;		/* Log file name, for finding our job */
+	char   *path;		/* base.2 */
+	pid_t   pid;		/* Background worker, or 0 */
+
+	int     fd;		/* Source, -1 until first chunk */
+	ino_t   ino;
+#ifdef HAVE_ZLIB
+	gzFile  gz;
+#endif
+};
+
+static TAILQ_HEAD(, lzjob) jobs = TAILQ_HEAD_INITIALIZER(jobs);
+static enum logrotate_mode mode = LOGROTATE_SYNC;
+static void (*queued)(void);
+
 static int recreate(char *path, mode_t mode, uid_t uid, gid_t gid)
 {
 	if (mknod(path, S_IFREG | mode, 0) || chown(path, uid, gid)) {
@@ -41,11 +81,285 @@ static int recreate(char *path, mode_t mode, uid_t uid, gid_t gid)
 	return 0;
 }
 
+#ifdef HAVE_ZLIB
+static int lz_open(struct lzjob *job)
+{
+	char dst[strlen(job->path) + 4];
+	struct stat st;
+	int fd;
+
+	job->fd = open(job->path, O_RDONLY | O_CLOEXEC);
+	if (job->fd == -1 || fstat(job->fd, &st))
+		return -1;
+	job->ino = st.st_ino;
+
+	snprintf(dst, sizeof(dst), "%s.gz", job->path);
+	fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+	if (fd == -1)
+		return -1;
+	if (fchown(fd, st.st_uid, st.st_gid))
+		syslog(LOG_WARNING, "Failed chown(%s): %s", dst, strerror(errno));
+
+	/* Logs compress well also at level 1, at a third of the cost */
+	job->gz = gzdopen(fd, "wb1");
+	if (!job->gz) {
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Compress at most @budget bytes of @job.  Returns 1 while there is
+ * more to do, 0 when done.  On error the uncompressed file is kept.
+ */
+static int lz_step(struct lzjob *job, size_t budget)
+{
+	char buf[8192];
+	ssize_t len = 0;
+
+	if (!budget)
+		budget = LOGROTATE_CHUNK;
+	if (job->fd == -1 && lz_open(job))
+		goto fail;
+
+	while (budget > 0) {
+		len = read(job->fd, buf, budget < sizeof(buf) ? budget : sizeof(buf));
+		if (len <= 0)
+			break;
+		if (gzwrite(job->gz, buf, len) != len)
+			goto fail;
+		budget -= len;
+	}
+
+	if (len > 0 || (len == -1 && errno == EINTR))
+		return 1;
+	if (len == -1)
+		goto fail;
+
+	if (gzclose(job->gz) != Z_OK) {
+		job->gz = NULL;
+		goto fail;
+	}
+	job->gz = NULL;
+
+	/* Only remove what we compressed, the file may have moved on */
+	{
+		struct stat st;
+
+		if (!stat(job->path, &st) && st.st_ino == job->ino)
+			(void)remove(job->path);
+	}
+
+	return 0;
+fail:
+	syslog(LOG_ERR, "Failed compressing %s: %s", job->path, strerror(errno));
+	if (job->gz) {
+		char dst[strlen(job->path) + 4];
+
+		gzclose(job->gz);
+		job->gz = NULL;
+		snprintf(dst, sizeof(dst), "%s.gz", job->path);
+		(void)remove(dst);
+	}
+
+	return 0;
+}
+#else
+static int lz_step(struct lzjob *job, size_t budget)
+{
+	(void)budget;
+
+	if (!systemf("gzip %s 2>/dev/null", job->path))
+		(void)remove(job->path);
+	/* else: no gzip, probably */
+
+	return 0;
+}
+#endif
+
+static void lz_free(struct lzjob *job)
+{
+	TAILQ_REMOVE(&jobs, job, link);
+	if (job->fd != -1)
+		close(job->fd);
+	free(job->base);
+	free(job->path);
+	free(job);
+}
+
+/*
+ * The background worker compresses at idle CPU and I/O priority and
+ * exits.  Unless SIGCHLD is ignored the caller must reap it, or leave
+ * that to the next rotation of the same file.
+ */
+static pid_t lz_worker(struct lzjob *job)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	(void)setpriority(PRIO_PROCESS, 0, 19);
+	(void)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		      IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+	while (lz_step(job, LOGROTATE_CHUNK))
+		;
+	_exit(0);
+}
+
+/*
+ * Queue compression of @path, rotated from @base.  In sync mode, and
+ * if the job or background worker cannot be set up, this is done
+ * before returning.
+ */
+static void lz_queue(char *base, char *path)
+{
+	struct lzjob *job;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		goto sync;
+	job->fd   = -1;
+	job->base = strdup(base);
+	job->path = strdup(path);
+	if (!job->base || !job->path) {
+		free(job->base);
+		free(job->path);
+		free(job);
+		goto sync;
+	}
+	TAILQ_INSERT_TAIL(&jobs, job, link);
+
+	switch (mode) {
+	case LOGROTATE_INCR:
+		if (queued)
+			queued();
+		return;
+
+	case LOGROTATE_BG:
+		job->pid = lz_worker(job);
+		if (job->pid > 0)
+			return;
+		job->pid = 0;
+		/* fallthrough */
+	default:
+		while (lz_step(job, LOGROTATE_CHUNK))
+			;
+		lz_free(job);
+		return;
+	}
+sync:
+	{
+		struct lzjob tmp = { .path = path, .fd = -1 };
+
+		while (lz_step(&tmp, LOGROTATE_CHUNK))
+			;
+		if (tmp.fd != -1)
+			close(tmp.fd);
+	}
+}
+
+/*
+ * Finish any pending compression of @base.2 before the files are
+ * renamed again.  Only happens if the log rotates faster than we
+ * compress, in which case the writer has to wait.
+ */
+static void finish(char *base)
+{
+	struct lzjob *job, *tmp;
+
+	TAILQ_FOREACH_SAFE(job, &jobs, link, tmp) {
+		if (strcmp(job->base, base))
+			continue;
+
+		if (job->pid > 0) {
+			while (waitpid(job->pid, NULL, 0) == -1 && errno == EINTR)
+				;
+		} else {
+			while (lz_step(job, LOGROTATE_CHUNK))
+				;
+		}
+		lz_free(job);
+	}
+}
+
+/**
+ * logrotate_mode - Set how rotated log files are compressed
+ * @mode:   One of %LOGROTATE_SYNC, %LOGROTATE_INCR, or %LOGROTATE_BG
+ * @queued: Called in %LOGROTATE_INCR mode when new work is queued
+ *
+ * The default, %LOGROTATE_SYNC, compresses in logrotate(), blocking
+ * the writer.  With %LOGROTATE_INCR the caller is expected to call
+ * logrotate_work() from its event loop until it returns zero.  With
+ * %LOGROTATE_BG a low priority child process does the compression.
+ */
+void logrotate_mode(enum logrotate_mode m, void (*cb)(void))
+{
+	mode   = m;
+	queued = cb;
+}
+
+/**
+ * logrotate_work - Compress a chunk of pending rotated log files
+ * @budget: Max number of (uncompressed) bytes to process
+ *
+ * Returns:
+ * Non-zero while there is more work pending, otherwise zero.
+ */
+int logrotate_work(size_t budget)
+{
+	struct lzjob *job;
+
+	TAILQ_FOREACH(job, &jobs, link) {
+		if (job->pid)
+			continue;	/* background worker */
+
+		if (!lz_step(job, budget))
+			lz_free(job);
+		break;
+	}
+
+	TAILQ_FOREACH(job, &jobs, link) {
+		if (!job->pid)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * logrotate_busy - Check if rotated files of @file are being compressed
+ * @file: Log file name, same as given to logrotate()
+ *
+ * A caller that must not block can use this to postpone the next
+ * rotation, since logrotate() waits for any pending compression of
+ * @file to finish before renaming the files again.
+ *
+ * Returns:
+ * %TRUE(1) if compression of @file.2 is still pending, otherwise %FALSE(0).
+ */
+int logrotate_busy(const char *file)
+{
+	struct lzjob *job;
+
+	TAILQ_FOREACH(job, &jobs, link) {
+		if (!strcmp(job->base, file))
+			return 1;
+	}
+
+	return 0;
+}
+
 /*
  * This function triggers a log rotates of @file when size >= @sz bytes
  * At most @num old versions are kept and by default it starts gzipping
- * .2 and older log files.  If gzip is not available in $PATH then @num
- * files are kept uncompressed.
+ * .2 and older log files.  With zlib this is done in-process, otherwise
+ * using gzip, and if that is not available in $PATH then @num files are
+ * kept uncompressed.  See logrotate_mode() for how to avoid blocking.
  */
 int logrotate(char *file, int num, off_t sz)
 {
@@ -61,6 +375,8 @@ int logrotate(char *file, int num, off_t sz)
 			char   nfile[len];
 			int    cnt;
 
+			finish(file);
+
 			/* First age zipped log files */
 			for (cnt = num; cnt > 2; cnt--) {
 				snprintf(ofile, len, "%s.%d.gz", file, cnt - 1);
@@ -83,12 +399,8 @@ int logrotate(char *file, int num, off_t sz)
 					continue;
 				}
 
-				if (cnt == 2 && fexist(nfile)) {
-					if (systemf("gzip %s 2>/dev/null", nfile))
-						continue; /* no gzip, probably */
-
-					(void)remove(nfile);
-				}
+				if (cnt == 2 && fexist(nfile))
+					lz_queue(file, nfile);
 			}
 
 			if (rename(file, nfile))
@@ -103,3 +415,4 @@ int logrotate(char *file, int num, off_t sz)
 
 	return 0;
 }
+
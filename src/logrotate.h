@@ -0,0 +1,50 @@
+/* Simple log rotation, with in-process compression
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_LOGROTATE_H_
+#define FINIT_LOGROTATE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LOGROTATE_CHUNK  (64 * 1024)
+
+enum logrotate_mode {
+	LOGROTATE_SYNC = 0,	/* Compress before logrotate() returns */
+	LOGROTATE_INCR,		/* Caller drives logrotate_work() */
+	LOGROTATE_BG,		/* Low priority background process */
+};
+
+int  logrotate      (char *file, int num, off_t sz);
+int  logrotate_busy (const char *file);
+void logrotate_mode (enum logrotate_mode mode, void (*queued)(void));
+int  logrotate_work (size_t budget);
+
+#endif /* FINIT_LOGROTATE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
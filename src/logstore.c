@@ -0,0 +1,1119 @@
+/* Indexed binary log store for service output
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Each service has a directory of append-only segments, NNNNNNNN.seg,
+ * numbered in the order they were created.  A segment is a header
+ * followed by records: timestamp, priority, PID, and the message.  For
+ * every LOGSTORE_STRIDE bytes of records an entry is appended to the
+ * sparse index, NNNNNNNN.idx, with the time span, position, number of
+ * records, and a bit mask of the log levels in that block.
+ *
+ * Records are stamped with CLOCK_REALTIME.  If the clock is stepped back,
+ * e.g., by NTP, or at boot on a system without RTC, the writer starts a
+ * new segment, so records in each segment are always in time order, and
+ * notes its number in the file "stepped".
+ *
+ * Readers find the segment, and the block, to start from with binary
+ * search, and skip blocks without any of the requested log levels, so
+ * only a few blocks are read.  While segments written before the clock
+ * stepped back remain, the time span of each segment is checked instead,
+ * and if segments, or blocks, overlap in time, all are read.  Records
+ * after the last index entry, e.g., after a crash, are read sequentially.
+ * Everything is in host byte order.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef _LIBITE_LITE
+# include <libite/lite.h>
+# include <libite/queue.h>	/* BSD sys/queue.h API */
+#else
+# include <lite/lite.h>
+# include <lite/queue.h>	/* BSD sys/queue.h API */
+#endif
+
+#include "logstore.h"
+
+#define LOGSTORE_MAGIC   0x474f4c46	/* "FLOG" */
+#define LOGSTORE_VERSION 1
+#define LOGSTORE_STRIDE  4096		/* Bytes of records per index entry */
+#define LOGSTORE_SEGMAX  (1 << 30)	/* Offsets in the index are 32-bit */
+#define LOGSTORE_RETRY   1000000	/* usec before retrying a failed open */
+#define LOGSTORE_POLL    250000		/* usec between checks when following */
+
+struct seghdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdrlen;		/* sizeof(struct seghdr) */
+	int64_t  start;			/* When segment was created */
+	char     ident[112];		/* For the text export */
+};
+
+struct rechdr {
+	int64_t  time;
+	int32_t  pid;
+	uint16_t len;			/* Of message, follows header */
+	uint8_t  prio;			/* facility | level */
+	uint8_t  pad;
+};
+
+struct idxent {
+	int64_t  first;			/* Time of first record in block */
+	int64_t  last;			/* Time of last record in block */
+	uint32_t off;			/* Of block in segment */
+	uint32_t len;
+	uint32_t count;			/* Records in block, 0: unknown */
+	uint8_t  levels;		/* Bit mask of log levels in block */
+	uint8_t  pad[3];
+};
+
+/* Writer state, shared by all processes of a service */
+struct logstore {
+	TAILQ_ENTRY(logstore) link;
+	int           refcnt;
+
+	char         *dir;
+	char          ident[sizeof(((struct seghdr *)0)->ident)];
+	off_t         segsz;		/* Start new segment at this size */
+	int           count;		/* Old segments to keep */
+
+	uint32_t      seq;
+	int           fd;		/* Segment, -1 until first write */
+	int           ifd;		/* Index */
+	off_t         size;
+	int64_t       last;		/* Time of last record in segment */
+	int64_t       failed;		/* Time of last failed open */
+	struct idxent blk;		/* Block being written */
+};
+
+/* Reader view of one segment */
+struct segment {
+	uint32_t       seq;
+	int            fd;
+	off_t          size;
+	struct seghdr  hdr;
+	struct idxent *idx;
+	size_t         num;
+	int            ordered;		/* Blocks in time order, no overlap */
+};
+
+static TAILQ_HEAD(, logstore) stores = TAILQ_HEAD_INITIALIZER(stores);
+
+static const char *level_names[] = {
+	"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static char *seg_path(char *buf, size_t len, const char *dir, uint32_t seq, const char *ext)
+{
+	snprintf(buf, len, "%s/%08x.%s", dir, seq, ext);
+	return buf;
+}
+
+static int seg_filter(const struct dirent *d)
+{
+	size_t len = strlen(d->d_name);
+
+	return len == 12 && !strcmp(&d->d_name[8], ".seg") &&
+		strspn(d->d_name, "0123456789abcdef") == 8;
+}
+
+/*
+ * List segments in @dir, oldest first.  Returns number of segments,
+ * with a malloc'ed array of sequence numbers in @seqs, or -1 on error.
+ */
+static int seg_list(const char *dir, uint32_t **seqs)
+{
+	struct dirent **d;
+	int i, num;
+
+	num = scandir(dir, &d, seg_filter, alphasort);
+	if (num <= 0) {
+		*seqs = NULL;
+		return num;
+	}
+
+	*seqs = malloc(num * sizeof(uint32_t));
+	for (i = 0; i < num; i++) {
+		if (*seqs)
+			(*seqs)[i] = strtoul(d[i]->d_name, NULL, 16);
+		free(d[i]);
+	}
+	free(d);
+
+	return *seqs ? num : -1;
+}
+
+static int rec_valid(const struct rechdr *rec, size_t avail)
+{
+	return avail >= sizeof(*rec) && rec->len <= avail - sizeof(*rec) &&
+		rec->pad == 0 && rec->time > 0;
+}
+
+/*
+ * Writer
+ */
+
+static void idx_flush(struct logstore *ls)
+{
+	if (!ls->blk.len)
+		return;
+
+	if (write(ls->ifd, &ls->blk, sizeof(ls->blk)) != sizeof(ls->blk))
+		syslog(LOG_WARNING, "Failed updating log index in %s: %s", ls->dir, strerror(errno));
+	memset(&ls->blk, 0, sizeof(ls->blk));
+}
+
+static void seg_close(struct logstore *ls)
+{
+	if (ls->fd == -1)
+		return;
+
+	idx_flush(ls);
+	close(ls->ifd);
+	close(ls->fd);
+	ls->fd = ls->ifd = -1;
+}
+
+/* Remove the oldest segments, keeping the current and @count more */
+static void seg_prune(struct logstore *ls)
+{
+	uint32_t *seqs;
+	char path[PATH_MAX];
+	int i, num;
+
+	num = seg_list(ls->dir, &seqs);
+	for (i = 0; i < num - ls->count - 1; i++) {
+		unlink(seg_path(path, sizeof(path), ls->dir, seqs[i], "idx"));
+		unlink(seg_path(path, sizeof(path), ls->dir, seqs[i], "seg"));
+	}
+	free(seqs);
+}
+
+/*
+ * Segments from the current one were started after the clock stepped
+ * back, older ones may overlap them in time, see seek_segment().
+ */
+static void seg_stepped(struct logstore *ls)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/stepped", ls->dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return;
+
+	dprintf(fd, "%08x\n", ls->seq);
+	close(fd);
+}
+
+static int seg_new(struct logstore *ls)
+{
+	struct seghdr hdr = {
+		.magic   = LOGSTORE_MAGIC,
+		.version = LOGSTORE_VERSION,
+		.hdrlen  = sizeof(hdr),
+		.start   = now(),
+	};
+	char path[PATH_MAX];
+
+	strlcpy(hdr.ident, ls->ident, sizeof(hdr.ident));
+
+	ls->seq++;
+	ls->fd = open(seg_path(path, sizeof(path), ls->dir, ls->seq, "seg"),
+		      O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+	if (ls->fd == -1)
+		return -1;
+
+	ls->ifd = open(seg_path(path, sizeof(path), ls->dir, ls->seq, "idx"),
+		       O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (ls->ifd == -1 || write(ls->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		if (ls->ifd != -1)
+			close(ls->ifd);
+		close(ls->fd);
+		ls->fd = ls->ifd = -1;
+		return -1;
+	}
+
+	ls->size = sizeof(hdr);
+	ls->last = 0;
+	memset(&ls->blk, 0, sizeof(ls->blk));
+	seg_prune(ls);
+
+	return 0;
+}
+
+/*
+ * Continue writing to the latest segment, after a restart of Finit or
+ * the service.  Records after the last index entry are scanned to get
+ * the block state back, anything after a torn write is cut off.
+ */
+static int seg_resume(struct logstore *ls)
+{
+	struct seghdr hdr;
+	struct idxent ent;
+	char path[PATH_MAX];
+	off_t end, isz;
+	struct stat st;
+
+	ls->fd = open(seg_path(path, sizeof(path), ls->dir, ls->seq, "seg"), O_RDWR | O_APPEND | O_CLOEXEC);
+	if (ls->fd == -1)
+		return -1;
+	ls->ifd = open(seg_path(path, sizeof(path), ls->dir, ls->seq, "idx"), O_RDWR | O_APPEND | O_CLOEXEC);
+	if (ls->ifd == -1)
+		goto fail;
+
+	if (pread(ls->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != LOGSTORE_MAGIC ||
+	    hdr.version != LOGSTORE_VERSION || hdr.hdrlen != sizeof(hdr) || fstat(ls->fd, &st) ||
+	    st.st_size >= ls->segsz)
+		goto fail;
+
+	end = sizeof(hdr);
+	ls->last = 0;
+	isz = lseek(ls->ifd, 0, SEEK_END);
+	isz -= isz % sizeof(ent);
+	while (isz > 0) {
+		if (pread(ls->ifd, &ent, sizeof(ent), isz - sizeof(ent)) != sizeof(ent))
+			goto fail;
+		if (ent.off + ent.len <= st.st_size) {
+			end = ent.off + ent.len;
+			ls->last = ent.last;
+			break;
+		}
+		isz -= sizeof(ent);
+	}
+	if (ftruncate(ls->ifd, isz))
+		goto fail;
+
+	memset(&ls->blk, 0, sizeof(ls->blk));
+	while (end < st.st_size) {
+		struct rechdr rec;
+		off_t avail = st.st_size - end;
+
+		if (pread(ls->fd, &rec, sizeof(rec), end) != sizeof(rec) || !rec_valid(&rec, avail))
+			break;
+
+		if (!ls->blk.len) {
+			ls->blk.first = rec.time;
+			ls->blk.off   = end;
+		}
+		ls->blk.last    = rec.time;
+		ls->blk.len    += sizeof(rec) + rec.len;
+		ls->blk.count++;
+		ls->blk.levels |= 1 << LOG_PRI(rec.prio);
+		ls->last        = rec.time;
+		end += sizeof(rec) + rec.len;
+	}
+	if (end < st.st_size && ftruncate(ls->fd, end))
+		goto fail;
+	ls->size = end;
+
+	return 0;
+fail:
+	if (ls->ifd != -1)
+		close(ls->ifd);
+	close(ls->fd);
+	ls->fd = ls->ifd = -1;
+
+	return -1;
+}
+
+static int store_open(struct logstore *ls)
+{
+	uint32_t *seqs;
+	int num;
+
+	if (ls->failed && now() - ls->failed < LOGSTORE_RETRY)
+		return -1;
+
+	if (mkpath(ls->dir, 0755) && errno != EEXIST)
+		goto fail;
+
+	num = seg_list(ls->dir, &seqs);
+	if (num < 0)
+		goto fail;
+
+	ls->seq = num > 0 ? seqs[num - 1] : 0;
+	free(seqs);
+
+	if (ls->seq > 0 && !seg_resume(ls))
+		return 0;
+	if (!seg_new(ls))
+		return 0;
+fail:
+	ls->failed = now();
+	return -1;
+}
+
+/**
+ * logstore_open - Get log store writer for a service
+ * @dir:   Directory of the store, one per service
+ * @ident: Name of service, for the text export
+ * @segsz: Start a new segment when this size is reached, 0: no limit
+ * @count: Number of old segments to keep
+ *
+ * Nothing is created until the first logstore_write(), so this can be
+ * called before the file system is writable.  All processes of the
+ * same service share the same writer.
+ *
+ * Returns:
+ * A handle to release with logstore_close(), or %NULL on error.
+ */
+struct logstore *logstore_open(const char *dir, const char *ident, off_t segsz, int count)
+{
+	struct logstore *ls;
+
+	TAILQ_FOREACH(ls, &stores, link) {
+		if (!strcmp(ls->dir, dir)) {
+			ls->refcnt++;
+			return ls;
+		}
+	}
+
+	ls = calloc(1, sizeof(*ls));
+	if (!ls)
+		return NULL;
+
+	ls->dir = strdup(dir);
+	if (!ls->dir) {
+		free(ls);
+		return NULL;
+	}
+
+	strlcpy(ls->ident, ident, sizeof(ls->ident));
+	if (segsz <= 0 || segsz > LOGSTORE_SEGMAX)
+		segsz = LOGSTORE_SEGMAX;
+	ls->segsz  = segsz;
+	ls->count  = count;
+	ls->fd     = -1;
+	ls->ifd    = -1;
+	ls->refcnt = 1;
+	TAILQ_INSERT_TAIL(&stores, ls, link);
+
+	return ls;
+}
+
+/**
+ * logstore_write - Append a log message to the store
+ * @ls:   Handle from logstore_open()
+ * @prio: Facility and level of message
+ * @pid:  PID of the process that logged the message
+ * @msg:  Message, not necessarily NUL terminated
+ * @len:  Length of message, truncated to 64 kiB
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if the message could not be stored.
+ */
+int logstore_write(struct logstore *ls, int prio, pid_t pid, const char *msg, size_t len)
+{
+	struct rechdr rec = {
+		.time = now(),
+		.pid  = pid,
+		.len  = len > UINT16_MAX ? UINT16_MAX : len,
+		.prio = prio,
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &rec,        .iov_len = sizeof(rec) },
+		{ .iov_base = (char *)msg, .iov_len = rec.len     },
+	};
+	size_t num = sizeof(rec) + rec.len;
+
+	if (ls->fd == -1 && store_open(ls))
+		return -1;
+
+	/* Clock stepped back, keep records in each segment in time order */
+	if (rec.time < ls->last) {
+		seg_close(ls);
+		if (seg_new(ls)) {
+			ls->failed = now();
+			return -1;
+		}
+		seg_stepped(ls);
+	}
+
+	if (writev(ls->fd, iov, 2) != (ssize_t)num) {
+		seg_close(ls);
+		ls->failed = now();
+		return -1;
+	}
+
+	if (!ls->blk.len) {
+		ls->blk.first = rec.time;
+		ls->blk.off   = ls->size;
+	}
+	ls->blk.last    = rec.time;
+	ls->blk.len    += num;
+	ls->blk.count++;
+	ls->blk.levels |= 1 << LOG_PRI(prio);
+	ls->size       += num;
+	ls->last        = rec.time;
+
+	if (ls->blk.len >= LOGSTORE_STRIDE)
+		idx_flush(ls);
+	if (ls->size >= ls->segsz) {
+		seg_close(ls);
+		seg_new(ls);
+	}
+
+	return 0;
+}
+
+/**
+ * logstore_idle - Close descriptors of a writer, e.g., when out of them
+ * @ls: Handle from logstore_open(), or %NULL
+ *
+ * The current segment is resumed on the next logstore_write().
+ */
+void logstore_idle(struct logstore *ls)
+{
+	if (ls)
+		seg_close(ls);
+}
+
+/**
+ * logstore_close - Release log store writer
+ * @ls: Handle from logstore_open()
+ */
+void logstore_close(struct logstore *ls)
+{
+	if (!ls || --ls->refcnt > 0)
+		return;
+
+	seg_close(ls);
+	TAILQ_REMOVE(&stores, ls, link);
+	free(ls->dir);
+	free(ls);
+}
+
+/*
+ * Reader
+ */
+
+static void seg_unload(struct segment *seg)
+{
+	if (seg->fd != -1)
+		close(seg->fd);
+	free(seg->idx);
+	memset(seg, 0, sizeof(*seg));
+	seg->fd = -1;
+}
+
+/*
+ * Time span, count, and levels of records after the last index entry.
+ * Usually less than LOGSTORE_STRIDE, so cheap to read.
+ */
+static void seg_tail(struct segment *seg, struct idxent *ent)
+{
+	char *buf, *ptr;
+
+	ent->last   = INT64_MAX;	/* Unknown, if it cannot be read */
+	ent->levels = 0xff;
+
+	buf = malloc(ent->len);
+	if (!buf)
+		return;
+	if (pread(seg->fd, buf, ent->len, ent->off) != (ssize_t)ent->len) {
+		free(buf);
+		return;
+	}
+
+	ent->last   = ent->first;
+	ent->levels = 0;
+	for (ptr = buf; ptr < buf + ent->len; ) {
+		struct rechdr rec;
+
+		memcpy(&rec, ptr, sizeof(rec));
+		if (!rec_valid(&rec, buf + ent->len - ptr))
+			break;	/* torn write */
+
+		if (!ent->count)
+			ent->first = rec.time;
+		ent->last    = rec.time;
+		ent->levels |= 1 << LOG_PRI(rec.prio);
+		ent->count++;
+		ptr += sizeof(rec) + rec.len;
+	}
+	free(buf);
+}
+
+/*
+ * Load header and index of a segment.  Records after the last index
+ * entry get a block of their own, see seg_tail().
+ */
+static int seg_load(const char *dir, uint32_t seq, struct segment *seg)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	off_t end;
+	size_t i;
+	int fd;
+
+	memset(seg, 0, sizeof(*seg));
+	seg->seq = seq;
+	seg->fd = open(seg_path(path, sizeof(path), dir, seq, "seg"), O_RDONLY | O_CLOEXEC);
+	if (seg->fd == -1 || fstat(seg->fd, &st))
+		goto fail;
+	if (pread(seg->fd, &seg->hdr, sizeof(seg->hdr), 0) != sizeof(seg->hdr) ||
+	    seg->hdr.magic != LOGSTORE_MAGIC || seg->hdr.version != LOGSTORE_VERSION)
+		goto fail;
+	seg->size = st.st_size;
+
+	end = seg->hdr.hdrlen;
+	fd = open(seg_path(path, sizeof(path), dir, seq, "idx"), O_RDONLY | O_CLOEXEC);
+	if (fd != -1) {
+		if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(struct idxent)) {
+			seg->idx = malloc(st.st_size + sizeof(struct idxent));
+			if (seg->idx && read(fd, seg->idx, st.st_size) == st.st_size)
+				seg->num = st.st_size / sizeof(struct idxent);
+		}
+		close(fd);
+	}
+
+	/* Skip entries beyond the end, torn write before a crash */
+	while (seg->num > 0 && seg->idx[seg->num - 1].off + seg->idx[seg->num - 1].len > seg->size)
+		seg->num--;
+	if (seg->num > 0)
+		end = seg->idx[seg->num - 1].off + seg->idx[seg->num - 1].len;
+
+	if (end < seg->size) {
+		struct idxent *ent;
+
+		if (!seg->idx)
+			seg->idx = malloc(sizeof(struct idxent));
+		if (!seg->idx)
+			goto fail;
+
+		ent = &seg->idx[seg->num++];
+		memset(ent, 0, sizeof(*ent));
+		ent->first  = seg->num > 1 ? ent[-1].last : seg->hdr.start;
+		ent->off    = end;
+		ent->len    = seg->size - end;
+		seg_tail(seg, ent);
+	}
+
+	/* Written before a clock step was detected, or a corrupt index */
+	seg->ordered = 1;
+	for (i = 0; i < seg->num; i++) {
+		if (seg->idx[i].first > seg->idx[i].last ||
+		    (i > 0 && seg->idx[i].first < seg->idx[i - 1].last))
+			seg->ordered = 0;
+	}
+
+	return 0;
+fail:
+	seg_unload(seg);
+	return -1;
+}
+
+static void show_rec(FILE *fp, const char *ident, const struct rechdr *rec, const char *msg)
+{
+	time_t sec = rec->time / 1000000;
+	struct tm tm;
+	char ts[20];
+
+	strftime(ts, sizeof(ts), "%b %e %H:%M:%S", localtime_r(&sec, &tm));
+	fprintf(fp, "%s %s[%d]: %.*s\n", ts, ident, rec->pid, rec->len, msg);
+}
+
+static int match(struct logstore_query *q, const struct rechdr *rec)
+{
+	if (q->since && rec->time < q->since)
+		return 0;
+	if (q->until && rec->time > q->until)
+		return 0;
+
+	return (q->levels >> LOG_PRI(rec->prio)) & 1;
+}
+
+/* Check if block can be skipped, its time span is only used if ordered */
+static int skip(struct segment *seg, struct idxent *ent, struct logstore_query *q)
+{
+	if (!(ent->levels & q->levels))
+		return 1;
+	if (!seg->ordered)
+		return 0;
+
+	return (q->since && ent->last < q->since) || (q->until && ent->first > q->until);
+}
+
+/*
+ * Walk all records in a block, calling @cb for each match.  Returns
+ * number of matching records, or -1 on read error.
+ */
+static int walk(struct segment *seg, struct idxent *ent, struct logstore_query *q,
+		void (*cb)(void *, struct segment *, struct rechdr *, char *), void *arg)
+{
+	char *buf, *ptr;
+	int num = 0;
+
+	if (skip(seg, ent, q))
+		return 0;
+
+	buf = malloc(ent->len);
+	if (!buf)
+		return -1;
+	if (pread(seg->fd, buf, ent->len, ent->off) != (ssize_t)ent->len) {
+		free(buf);
+		return -1;
+	}
+
+	for (ptr = buf; ptr < buf + ent->len; ) {
+		struct rechdr rec;
+
+		memcpy(&rec, ptr, sizeof(rec));
+		if (!rec_valid(&rec, buf + ent->len - ptr))
+			break;	/* torn write */
+
+		if (match(q, &rec)) {
+			if (cb)
+				cb(arg, seg, &rec, ptr + sizeof(rec));
+			num++;
+		}
+		ptr += sizeof(rec) + rec.len;
+	}
+	free(buf);
+
+	return num;
+}
+
+/* Number of matching records in block, without reading it if possible */
+static int count(struct segment *seg, struct idxent *ent, struct logstore_query *q)
+{
+	if (skip(seg, ent, q))
+		return 0;
+
+	if (seg->ordered && ent->count && !(ent->levels & ~q->levels) &&
+	    (!q->since || ent->first >= q->since) && (!q->until || ent->last <= q->until))
+		return ent->count;
+
+	return walk(seg, ent, q, NULL, NULL);
+}
+
+/*
+ * Binary search for the first block that may have records from @since,
+ * only if the segment is ordered, see seg_load().
+ */
+static size_t seek_block(struct segment *seg, int64_t since)
+{
+	size_t lo = 0, hi = seg->num;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (seg->idx[mid].last < since)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* First segment started after the clock last stepped back, or 0 */
+static uint32_t seg_stepped_seq(const char *dir)
+{
+	char path[PATH_MAX], buf[16];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/stepped", dir);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return 0;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	return strtoul(buf, NULL, 16);
+}
+
+/* Creation time of a segment, from its header, or -1 if it is gone */
+static int64_t seg_start(const char *dir, uint32_t seq)
+{
+	char path[PATH_MAX];
+	struct seghdr hdr;
+	ssize_t len;
+	int fd;
+
+	fd = open(seg_path(path, sizeof(path), dir, seq, "seg"), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	len = pread(fd, &hdr, sizeof(hdr), 0);
+	close(fd);
+	if (len != sizeof(hdr) || hdr.magic != LOGSTORE_MAGIC)
+		return -1;
+
+	return hdr.start;
+}
+
+/*
+ * Like seek_segment(), but by the time span of each segment, for when
+ * the clock has stepped back.  Only if all segments are ordered, and do
+ * not overlap in time, otherwise all must be read.
+ */
+static int seek_stepped(const char *dir, uint32_t *seqs, int num, int64_t since)
+{
+	int64_t prev = INT64_MIN;
+	int i, first = 0;
+
+	for (i = 0; i < num; i++) {
+		struct segment seg;
+
+		if (seg_load(dir, seqs[i], &seg))
+			continue;	/* pruned while we look, skip */
+		if (!seg.num) {
+			seg_unload(&seg);
+			continue;
+		}
+
+		if (!seg.ordered || seg.idx[0].first < prev) {
+			seg_unload(&seg);
+			return 0;
+		}
+		if (seg.idx[0].first <= since)
+			first = i;
+		prev = seg.idx[seg.num - 1].last;
+		seg_unload(&seg);
+	}
+
+	return first;
+}
+
+/*
+ * Binary search for the last segment created before @since.  Segments
+ * written before the clock last stepped back may overlap later ones in
+ * time, while any of them remain we check all, see seek_stepped().
+ */
+static int seek_segment(const char *dir, uint32_t *seqs, int num, int64_t since)
+{
+	int lo = 0, hi = num - 1;
+
+	if (seqs[0] < seg_stepped_seq(dir))
+		return seek_stepped(dir, seqs, num, since);
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+		int64_t start;
+
+		start = seg_start(dir, seqs[mid]);
+		if (start == -1) {
+			hi = mid - 1;	/* pruned while we look, skip */
+			continue;
+		}
+
+		if (start <= since)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+struct output {
+	FILE *fp;
+	int   skip;
+};
+
+static void output(void *arg, struct segment *seg, struct rechdr *rec, char *msg)
+{
+	struct output *out = arg;
+
+	if (out->skip > 0) {
+		out->skip--;
+		return;
+	}
+
+	show_rec(out->fp, seg->hdr.ident, rec, msg);
+}
+
+/*
+ * Find where to start for the last @q->tail matching records, walking
+ * backwards from the end, at most down to segment @first.  Returns the
+ * segment and block to start from, and the number of matches to skip.
+ */
+static int seek_tail(const char *dir, uint32_t *seqs, int first, int num,
+		     struct logstore_query *q, int *segno, size_t *blkno)
+{
+	int i, total = 0;
+
+	for (i = num - 1; i >= first; i--) {
+		struct segment seg;
+		size_t j;
+
+		if (seg_load(dir, seqs[i], &seg))
+			continue;
+
+		for (j = seg.num; j > 0; j--) {
+			int n = count(&seg, &seg.idx[j - 1], q);
+
+			if (n < 0)
+				continue;
+			total += n;
+			if (total >= q->tail) {
+				seg_unload(&seg);
+				*segno = i;
+				*blkno = j - 1;
+				return total - q->tail;
+			}
+		}
+		seg_unload(&seg);
+	}
+
+	*segno = first;
+	*blkno = 0;
+
+	return 0;
+}
+
+/* Wait for, and show, new records until interrupted */
+static int follow(const char *dir, uint32_t seq, off_t off, struct logstore_query *q, FILE *fp)
+{
+	struct segment seg;
+
+	if (seg_load(dir, seq, &seg))
+		return 1;
+	if (off < seg.hdr.hdrlen)
+		off = seg.hdr.hdrlen;
+
+	while (1) {
+		char path[PATH_MAX];
+		struct stat st;
+
+		if (!fstat(seg.fd, &st) && st.st_size > off) {
+			struct output out = { .fp = fp };
+			size_t len = st.st_size - off;
+			char *buf;
+
+			/* Only complete records, writer may be half-way */
+			buf = malloc(len);
+			if (buf && pread(seg.fd, buf, len, off) == (ssize_t)len) {
+				char *ptr = buf;
+
+				while (ptr < buf + len) {
+					struct rechdr rec;
+
+					memcpy(&rec, ptr, sizeof(rec));
+					if (!rec_valid(&rec, buf + len - ptr))
+						break;
+					if (match(q, &rec))
+						output(&out, &seg, &rec, ptr + sizeof(rec));
+					ptr += sizeof(rec) + rec.len;
+				}
+				off += ptr - buf;
+			}
+			free(buf);
+			fflush(fp);
+
+			if (buf && off < st.st_size)
+				usleep(LOGSTORE_POLL);
+			continue;
+		}
+
+		/* Writer moved on to the next segment? */
+		if (!access(seg_path(path, sizeof(path), dir, seq + 1, "seg"), F_OK)) {
+			seg_unload(&seg);
+			if (seg_load(dir, ++seq, &seg))
+				return 1;
+			off = seg.hdr.hdrlen;
+			continue;
+		}
+
+		usleep(LOGSTORE_POLL);
+	}
+
+	return 0;
+}
+
+/**
+ * logstore_show - Export log records from store as plain text
+ * @dir: Directory of the store
+ * @q:   Query, which records to show
+ * @fp:  Where to write the text
+ *
+ * Records are written in the same format as log files, with the time,
+ * service name, and PID of each record.  With @q->follow set this
+ * function does not return, it waits for new records to be written.
+ *
+ * Returns:
+ * POSIX OK(0), or non-zero if the store cannot be read.
+ */
+int logstore_show(const char *dir, struct logstore_query *q, FILE *fp)
+{
+	struct output out = { .fp = fp };
+	uint32_t *seqs;
+	int i, num, first = 0;
+	size_t blk = 0;
+	off_t end = 0;
+
+	if (!q->levels)
+		q->levels = 0xff;
+
+	num = seg_list(dir, &seqs);
+	if (num <= 0)
+		return num < 0;
+
+	if (q->since)
+		first = seek_segment(dir, seqs, num, q->since);
+	if (q->tail > 0)
+		out.skip = seek_tail(dir, seqs, first, num, q, &first, &blk);
+
+	for (i = first; i < num; i++) {
+		struct segment seg;
+		size_t j;
+
+		if (seg_load(dir, seqs[i], &seg))
+			continue;
+
+		if (i > first || !q->tail)
+			blk = q->since && seg.ordered ? seek_block(&seg, q->since) : 0;
+		for (j = blk; j < seg.num; j++) {
+			if (q->until && seg.ordered && seg.idx[j].first > q->until)
+				break;
+			walk(&seg, &seg.idx[j], q, output, &out);
+		}
+
+		end = seg.size;
+		seg_unload(&seg);
+	}
+
+	if (q->follow) {
+		fflush(fp);
+		follow(dir, seqs[num - 1], end, q, fp);
+	}
+	free(seqs);
+
+	return 0;
+}
+
+/**
+ * logstore_time - Parse time for a log query
+ * @arg: Absolute or relative time
+ *
+ * Understands "YYYY-MM-DD [HH:MM[:SS]]", "HH:MM[:SS]" today, "@SEC"
+ * since the epoch, and "-N[smhd]" relative to now.
+ *
+ * Returns:
+ * Microseconds since the epoch, or -1 on error.
+ */
+int64_t logstore_time(const char *arg)
+{
+	const char *fmt[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d",
+		"%H:%M:%S", "%H:%M",
+	};
+	time_t t = time(NULL);
+	struct tm tm;
+	char *end;
+	size_t i;
+
+	if (arg[0] == '@') {
+		long long sec = strtoll(&arg[1], &end, 10);
+
+		return *end ? -1 : sec * 1000000;
+	}
+
+	if (arg[0] == '-') {
+		long long num = strtoll(&arg[1], &end, 10);
+
+		switch (*end) {
+		case 'd': num *= 24;	/* fallthrough */
+		case 'h': num *= 60;	/* fallthrough */
+		case 'm': num *= 60;	/* fallthrough */
+		case 's':
+		case 0:
+			break;
+		default:
+			return -1;
+		}
+
+		return now() - num * 1000000;
+	}
+
+	for (i = 0; i < NELEMS(fmt); i++) {
+		localtime_r(&t, &tm);
+		tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+
+		end = strptime(arg, fmt[i], &tm);
+		if (end && !*end) {
+			tm.tm_isdst = -1;
+			return (int64_t)mktime(&tm) * 1000000;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * logstore_level - Parse log level for a log query
+ * @arg: Level name, e.g. "err", or number 0-7
+ *
+ * Returns:
+ * Bit mask of @arg and all more severe log levels, or 0 on error.
+ */
+int logstore_level(const char *arg)
+{
+	int i;
+
+	if (arg[0] >= '0' && arg[0] <= '7' && !arg[1])
+		return (2 << (arg[0] - '0')) - 1;
+
+	for (i = 0; i < (int)NELEMS(level_names); i++) {
+		if (!strcmp(arg, level_names[i]))
+			return (2 << i) - 1;
+	}
+	if (!strcmp(arg, "error"))
+		return (2 << LOG_ERR) - 1;
+	if (!strcmp(arg, "warn"))
+		return (2 << LOG_WARNING) - 1;
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,64 @@
+/* Indexed binary log store for service output
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_LOGSTORE_H_
+#define FINIT_LOGSTORE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define LOGSTORE_PATH  "/var/log/finit"
+
+struct logstore;
+
+/*
+ * Selects records for logstore_show().  Times are in microseconds
+ * since the epoch, see logstore_time() for parsing user input.
+ */
+struct logstore_query {
+	int64_t  since;		/* From this time, 0: from the start */
+	int64_t  until;		/* Up to this time, 0: to the end */
+	uint8_t  levels;	/* Bit mask of log levels, 0: all */
+	int      tail;		/* Only the last N matching records, 0: all */
+	int      follow;	/* Wait for new records, like tail -f */
+};
+
+struct logstore *logstore_open  (const char *dir, const char *ident, off_t segsz, int count);
+int              logstore_write (struct logstore *ls, int prio, pid_t pid, const char *msg, size_t len);
+void             logstore_idle  (struct logstore *ls);
+void             logstore_close (struct logstore *ls);
+
+int              logstore_show  (const char *dir, struct logstore_query *q, FILE *fp);
+
+int64_t          logstore_time  (const char *arg);
+int              logstore_level (const char *arg);
+
+#endif /* FINIT_LOGSTORE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -100,7 +100,37 @@ char *pid_get_name(pid_t pid, char *name, size_t len)
 	return pname;
 }
 
-char *pid_file(svc_t *svc)
+/**
+ * pid_get_ppid - Find parent of a process
+ * @pid: PID of process to find parent of.
+ *
+ * Returns:
+ * PID of parent process, or -1 if @pid does not exist (anymore).
+ */
+pid_t pid_get_ppid(pid_t pid)
+{
+	char path[32], line[128];
+	pid_t ppid = -1;
+	char *ptr;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	/* pid (comm) state ppid ..., where comm may contain anything */
+	if (fgets(line, sizeof(line), fp)) {
+		ptr = strrchr(line, ')');
+		if (ptr && sscanf(ptr + 1, " %*c %d", &ppid) != 1)
+			ppid = -1;
+	}
+	fclose(fp);
+
+	return ppid;
+}
+
+const char *pid_file(svc_t *svc)
 {
 	if (svc->pidfile[0]) {
 		if (svc->pidfile[0] == '!')
@@ -147,9 +177,9 @@ int pid_file_create(svc_t *svc)
 	return fclose(fp);
 }
 
-int pid_file_set(svc_t *svc, char *file, int not)
+int pid_file_set(svc_t *svc, const char *file, int not)
 {
-	char buf[sizeof(svc->pidfile)];
+	char path[MAX_CMD_LEN], buf[MAX_CMD_LEN];
 
 	if (!file) {
 		file = pid_file(svc);
@@ -167,11 +197,12 @@ int pid_file_set(svc_t *svc, char *file, int not)
 		not = 1;
 	}
 
-	de_dotdot(file);
-	pid_runpath(file, buf, sizeof(buf));
-	strlcpy(&svc->pidfile[not], buf, sizeof(svc->pidfile) - not);
-	if (not)
-		svc->pidfile[0] = '!';
+	strlcpy(path, file, sizeof(path));
+	de_dotdot(path);
+	buf[0] = '!';
+	pid_runpath(path, &buf[not], sizeof(buf) - not);
+	if (svc_set_pidfile(svc, buf) < 0)
+		return -1;
 
 	return 0;
 }
@@ -25,14 +25,20 @@
 #ifndef FINIT_PID_H_
 #define FINIT_PID_H_
 
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
 #include "svc.h"
 #include "util.h"
 
 int   pid_alive       (pid_t pid);
 char *pid_get_name    (pid_t pid, char *name, size_t len);
+pid_t pid_get_ppid    (pid_t pid);
 
-char *pid_file        (svc_t *svc);
-int   pid_file_set    (svc_t *svc, char *file, int not);
+const char *pid_file  (svc_t *svc);
+int   pid_file_set    (svc_t *svc, const char *file, int not);
 pid_t pid_file_read   (const char *fn);
 int   pid_file_create (svc_t *svc);
 int   pid_file_parse  (svc_t *svc, char *arg);
@@ -71,6 +77,51 @@ static inline char *pid_runpath(const char *file, char *path, size_t len)
 	return path;
 }
 
+/**
+ * pid_fd_open - Get a pidfd for a process
+ * @pid: Process ID
+ *
+ * Wrapper for pidfd_open(2), Linux 5.3, the C library may not have it.
+ * The returned descriptor is always close-on-exec.
+ *
+ * Returns:
+ * A pidfd on success, otherwise -1 with errno set, %ENOSYS on older
+ * kernels.
+ */
+static inline int pid_fd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+	return syscall(__NR_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/**
+ * pid_fd_kill - Send signal to process using its pidfd
+ * @pidfd: Process file descriptor, from pid_fd_open()
+ * @signo: Signal to send
+ *
+ * Wrapper for pidfd_send_signal(2), Linux 5.1.  Unlike kill(2) this can
+ * never hit a recycled PID.
+ *
+ * Returns:
+ * POSIX OK(0) on success, otherwise -1 with errno set.
+ */
+static inline int pid_fd_kill(int pidfd, int signo)
+{
+#ifdef __NR_pidfd_send_signal
+	return syscall(__NR_pidfd_send_signal, pidfd, signo, NULL, 0);
+#else
+	(void)pidfd;
+	(void)signo;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 #endif /* FINIT_PID_H_ */
 
 /**
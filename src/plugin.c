@@ -43,6 +43,7 @@
 #include "private.h"
 #include "service.h"
 #include "sig.h"
+#include "trace.h"
 #include "util.h"
 
 #define is_io_plugin(p) ((p)->io.cb && (p)->io.fd > 0)
@@ -246,6 +247,7 @@ void plugin_script_run(hook_point_t no)
 /* Some hooks are called with a fixed argument */
 void plugin_run_hook(hook_point_t no, void *arg)
 {
+	int64_t start = trace_now();
 	plugin_t *p, *tmp;
 
 #ifdef HAVE_HOOK_SCRIPTS_PLUGIN
@@ -261,6 +263,7 @@ void plugin_run_hook(hook_point_t no, void *arg)
 			p->hook[no].cb(arg ? arg : p->hook[no].arg);
 		}
 	}
+	trace_hook(no, start);
 
 	/*
 	 * Conditions are stored in /run, so don't try to signal
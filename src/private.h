@@ -40,6 +40,7 @@ extern svc_t *wdog;
 extern int   service_interval;
 extern char *fsck_mode;
 extern char *fsck_repair;
+extern int   fsck_parallel;
 
 extern uev_ctx_t *ctx;
 
@@ -28,7 +28,6 @@
 #include <sched.h>		/* sched_yield() */
 #include <string.h>
 #include <sys/reboot.h>
-#include <sys/prctl.h>
 #include <sys/resource.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -46,18 +45,24 @@
 #include "cond.h"
 #include "devmon.h"
 #include "finit.h"
+#include "graph.h"
 #include "helpers.h"
+#include "logmux.h"
 #include "pid.h"
 #include "private.h"
 #include "sig.h"
 #include "service.h"
 #include "sm.h"
+#include "sock.h"
+#include "spawn.h"
+#include "trace.h"
 #include "tty.h"
 #include "util.h"
 #include "utmp-api.h"
 #include "schedule.h"
 
 #define NOTIFY_PATH "@run/finit/notify/%d"
+#define NOTIFY_MAX  4096	/* Max size of sd_notify() datagram */
 
 
 /*
@@ -66,6 +71,9 @@
  */
 static pid_t run_block_pid;
 
+/* PTY from logmux_open(), for redirect() in child of service_fork() */
+static int logmux_fd = -1;
+
 static struct wq work = {
 	.cb = service_worker,
 };
@@ -73,6 +81,7 @@ int service_interval = SERVICE_INTERVAL_DEFAULT;
 
 static void svc_set_state(svc_t *svc, svc_state_t new_state);
 static void service_notify_cb(uev_t *w, void *arg, int events);
+static void service_kill(svc_t *svc);
 
 
 /**
@@ -143,31 +152,219 @@ int service_timeout_cancel(svc_t *svc)
 	return err;
 }
 
+/*
+ * Watchdog timeout, the service has not sent WATCHDOG=1 in time.  Like
+ * systemd we send SIGABRT, for a core dump, followed by SIGKILL after
+ * the kill delay.  The service is then restarted like any crash.
+ */
+static void service_watchdog_cb(uev_t *w, void *arg, int events)
+{
+	svc_t *svc = arg;
+
+	if (UEV_ERROR == events) {
+		dbg("%s: spurious problem with watchdog timer", svc_ident(svc, NULL, 0));
+		uev_timer_start(w);
+		return;
+	}
+
+	if (svc->pid <= 1 || svc->state != SVC_RUNNING_STATE)
+		return;
+
+	logit(LOG_CONSOLE | LOG_WARNING, "%s[%d], watchdog timeout, sending SIGABRT ...",
+	      svc_ident(svc, NULL, 0), svc->pid);
+	svc_kill(svc, SIGABRT);
+
+	service_timeout_cancel(svc);
+	service_timeout_after(svc, svc->killdelay, service_kill);
+}
+
+/**
+ * service_watchdog_kick - Restart watchdog timer of a service
+ * @svc: Service that sent WATCHDOG=1, or has just been started
+ *
+ * Starts the timer the first time, after that the timer is only reset,
+ * so the cost of a keep-alive message is one timerfd_settime().
+ */
+static void service_watchdog_kick(svc_t *svc)
+{
+	if (!svc->watchdog_tmo)
+		return;
+
+	if (svc->watchdog_armed && uev_timer_active(&svc->watchdog_timer)) {
+		uev_timer_set(&svc->watchdog_timer, svc->watchdog_tmo, 0);
+		return;
+	}
+
+	if (svc->watchdog_armed)
+		uev_timer_stop(&svc->watchdog_timer);
+
+	svc->watchdog_armed = !uev_timer_init(ctx, &svc->watchdog_timer, service_watchdog_cb,
+					      svc, svc->watchdog_tmo, 0);
+	if (!svc->watchdog_armed)
+		err(1, "%s: failed starting watchdog timer", svc_ident(svc, NULL, 0));
+}
+
+static void service_watchdog_stop(svc_t *svc)
+{
+	if (!svc->watchdog_armed)
+		return;
+
+	uev_timer_stop(&svc->watchdog_timer);
+	svc->watchdog_armed = 0;
+}
+
 struct assoc {
 	TAILQ_ENTRY(assoc) link;
 
 	pid_t  pid;		/* script pid */
 	svc_t *svc;		/* associated svc_t */
+	const char *type;	/* "ready", "stop", or "reload" */
+
+	int    pidfd;		/* pidfd of script, or -1 */
+	uev_t  watcher;		/* script exit */
+
+	int    tmo;		/* msec before script is killed, or 0 */
+	uev_t  timer;
+
+	/* Called when script is collected, status -1 on timeout */
+	void (*done)(svc_t *svc, int status);
 };
 
 static TAILQ_HEAD(, assoc) svc_assoc_list = TAILQ_HEAD_INITIALIZER(svc_assoc_list);
+static TAILQ_HEAD(, assoc) svc_assoc_gc   = TAILQ_HEAD_INITIALIZER(svc_assoc_gc);
+
+static void assoc_gc(void *arg)
+{
+	struct assoc *ptr, *next;
+
+	(void)arg;
+	TAILQ_FOREACH_SAFE(ptr, &svc_assoc_gc, link, next) {
+		TAILQ_REMOVE(&svc_assoc_gc, ptr, link);
+		free(ptr);
+	}
+}
+
+static struct wq assoc_gc_work = {
+	.cb    = assoc_gc,
+	.delay = 0
+};
+
+/*
+ * The pidfd watcher may have an event pending in the current round of
+ * the event loop, so the entry is freed from the next round.
+ */
+static void assoc_del(struct assoc *ptr)
+{
+	if (ptr->pidfd >= 0) {
+		uev_io_stop(&ptr->watcher);
+		close(ptr->pidfd);
+		ptr->pidfd = -1;
+	}
+	if (ptr->tmo) {
+		uev_timer_stop(&ptr->timer);
+		ptr->tmo = 0;
+	}
+
+	TAILQ_REMOVE(&svc_assoc_list, ptr, link);
+	TAILQ_INSERT_TAIL(&svc_assoc_gc, ptr, link);
+	schedule_work(&assoc_gc_work);
+}
+
+/* Remove assoc and call its done callback, if any */
+static void assoc_done(struct assoc *ptr, int status)
+{
+	void (*done)(svc_t *svc, int status) = ptr->done;
+	svc_t *svc = ptr->svc;
+
+	assoc_del(ptr);
+	if (done)
+		done(svc, status);
+}
 
-static void service_script_kill(svc_t *svc)
+/* Script timed out, kill it and any children in its process group */
+static void service_script_tmo(uev_t *w, void *arg, int events)
+{
+	struct assoc *ptr = (struct assoc *)arg;
+
+	if (UEV_ERROR == events) {
+		uev_timer_start(w);
+		return;
+	}
+
+	logit(LOG_WARNING, "Timeout, killing service %s %s:script PID %d.",
+	      svc_ident(ptr->svc, NULL, 0), ptr->type, ptr->pid);
+	if (ptr->pidfd < 0 || pid_fd_kill(ptr->pidfd, SIGKILL))
+		kill(ptr->pid, SIGKILL);
+	kill(-ptr->pid, SIGKILL);
+
+	ptr->tmo = 0;
+	assoc_done(ptr, -1);
+}
+
+/*
+ * Stop tracking any scripts of a service that is being removed, they
+ * are left to complete on their own and are collected as unknown PIDs.
+ */
+static void service_script_drop(svc_t *svc)
 {
 	struct assoc *ptr, *next;
 
 	TAILQ_FOREACH_SAFE(ptr, &svc_assoc_list, link, next) {
-		if (ptr->svc != svc || ptr->pid <= 1)
+		if (ptr->svc != svc)
 			continue;
 
-		dbg("Killing service %s script PID %d.", svc_ident(svc, NULL, 0), ptr->pid);
-		kill(ptr->pid, SIGKILL);
-		TAILQ_REMOVE(&svc_assoc_list, ptr, link);
-		free(ptr);
+		dbg("Dropping service %s %s:script PID %d.", svc_ident(svc, NULL, 0), ptr->type, ptr->pid);
+		assoc_del(ptr);
+	}
+}
+
+/* Check if a script of @type is running for @svc */
+static int service_script_busy(svc_t *svc, const char *type)
+{
+	struct assoc *ptr;
+
+	TAILQ_FOREACH(ptr, &svc_assoc_list, link) {
+		if (ptr->svc == svc && !strcmp(ptr->type, type))
+			return 1;
 	}
+
+	return 0;
+}
+
+static void service_script_done(struct assoc *ptr, int status)
+{
+	dbg("Collected service %s %s:script PID %d, killing process group.",
+	    svc_ident(ptr->svc, NULL, 0), ptr->type, ptr->pid);
+	kill(-ptr->pid, SIGKILL);
+	assoc_done(ptr, status);
+}
+
+/* Script has exited, collect it directly, no PID lookup */
+static void service_script_cb(uev_t *w, void *arg, int events)
+{
+	struct assoc *ptr = (struct assoc *)arg;
+	int status = 0;
+	pid_t rc;
+
+	if (ptr->pidfd != w->fd)
+		return;		/* stale, already collected */
+
+	do
+		rc = waitpid(ptr->pid, &status, WNOHANG);
+	while (rc == -1 && errno == EINTR);
+	if (rc == 0 && UEV_ERROR != events)
+		return;
+
+	service_script_done(ptr, status);
 }
 
-static int service_script_add(svc_t *svc, pid_t pid, int tmo)
+/*
+ * Track a script of @svc, @type is one of ready, stop, or reload.  If
+ * not collected within @tmo msec it is killed.  The @done callback is
+ * called when the script has been collected, or killed.
+ */
+static int service_script_add(svc_t *svc, pid_t pid, const char *type, int tmo,
+			      void (*done)(svc_t *svc, int status))
 {
 	struct assoc *ptr;
 
@@ -177,16 +374,28 @@ static int service_script_add(svc_t *svc, pid_t pid, int tmo)
 		return 1;
 	}
 
-	ptr->svc = svc;
-	ptr->pid = pid;
-	TAILQ_INSERT_TAIL(&svc_assoc_list, ptr, link);
+	ptr->svc  = svc;
+	ptr->pid  = pid;
+	ptr->type = type;
+	ptr->done = done;
+	ptr->pidfd = pid_fd_open(pid);
+	if (ptr->pidfd >= 0 &&
+	    uev_io_init(ctx, &ptr->watcher, service_script_cb, ptr, ptr->pidfd, UEV_READ)) {
+		close(ptr->pidfd);
+		ptr->pidfd = -1;
+	}
 
-	service_timeout_after(svc, tmo, service_script_kill);
+	ptr->tmo = tmo;
+	if (ptr->tmo && uev_timer_init(ctx, &ptr->timer, service_script_tmo, ptr, tmo, 0))
+		ptr->tmo = 0;
+
+	TAILQ_INSERT_TAIL(&svc_assoc_list, ptr, link);
 
 	return 0;
 }
 
-static int service_script_del(pid_t pid)
+/* Fallback for SIGCHLD, or if pidfd is not supported */
+static int service_script_del(pid_t pid, int status)
 {
 	struct assoc *ptr, *next;
 
@@ -194,12 +403,7 @@ static int service_script_del(pid_t pid)
 		if (ptr->pid != pid)
 			continue;
 
-		dbg("Collected service %s script PID %d, killing process group.", svc_ident(ptr->svc, NULL, 0), pid);
-		service_timeout_cancel(ptr->svc);
-		kill(-ptr->pid, SIGKILL);
-		TAILQ_REMOVE(&svc_assoc_list, ptr, link);
-		free(ptr);
-
+		service_script_done(ptr, status);
 		return 0;
 	}
 
@@ -243,174 +447,54 @@ static int fredirect(const char *file)
 	return -1;
 }
 
-/*
- * Fallback in case we don't even have logger on the system.
- * XXX: we should parse 'prio' here to get facility.level
- */
-static void fallback_logger(char *ident, char *prio)
+/* log:syslog, log:store, and log:/path/to/file are handled by logmux.c */
+static int has_logmux(svc_t *svc)
 {
-	int facility = LOG_DAEMON;
-	int level = LOG_NOTICE;
-	char buf[256];
-
-	strlcpy(buf, prio, sizeof(buf));
-	log_parse(buf, &facility, &level);
-
-	prctl(PR_SET_NAME, "finitlog", 0, 0, 0);
-	openlog(ident, LOG_NOWAIT | LOG_PID, facility);
-	while ((fgets(buf, sizeof(buf), stdin)))
-		syslog(level, "%s", buf);
-
-	closelog();
+	return svc->log.enabled && !svc->log.null && !svc->log.console;
 }
 
 /*
- * Redirect output to syslog using the command line logit tool
+ * File to redirect process output to, if any.  Not for has_logmux(),
+ * the PTY from logmux_open() is used instead.
  */
-static int lredirect(svc_t *svc)
+static const char *redirect_file(svc_t *svc)
 {
-	static int have_sysklogd = -1;
-	pid_t svc_pid = getpid();
-	pid_t pid;
-	int fd;
-
-	/*
-	 * Open PTY to connect to logger.  A pty isn't buffered
-	 * like a pipe, and it eats newlines so they aren't logged
-	 */
-	fd = posix_openpt(O_RDWR);
-	if (fd == -1) {
-		dbg("Failed posix_openpt(), errno %d: %s", errno, strerror(errno));
-		svc->log.enabled = 0;
-		return -1;
-	}
-	if (grantpt(fd) == -1 || unlockpt(fd) == -1) {
-		dbg("Failed grantpt()|unlockpt(), errno %d: %s", errno, strerror(errno));
-		close(fd);
-		svc->log.enabled = 0;
-		return -1;
-	}
-
-	/*
-	 * First time, check if we have sysklogd logger tool.
-	 * It supports logging the actual PID of the service.
-	 */
-	if (have_sysklogd == -1) {
-		FILE *pp;
-
-		have_sysklogd = 0;
-
-		pp = popen("logger -h 2>/dev/null", "r");
-		if (pp) {
-			char buf[128];
-
-			while (fgets(buf, sizeof(buf), pp)) {
-				if (strstr(buf, "-I PID")) {
-					have_sysklogd = 1;
-					break;
-				}
-			}
-			pclose(pp);
-		}
-	}
-
-	pid = fork();
-	if (pid == 0) {
-		char *prio = "daemon.info";
-		char buf[MAX_IDENT_LEN];
-		char *tag;
-		int fds;
-
-		sched_yield();
-
-		fds = open(ptsname(fd), O_RDONLY);
-		close(fd);
-		if (fds == -1) {
-			logit(LOG_WARNING, "failed open() ptsname(%d), errno %d", fd, errno);
-			_exit(0);
-		}
-		dup2(fds, STDIN_FILENO);
-
-		/* Reset signals */
-		sig_unblock();
-
-		/* Default syslog identity name[:id] */
-		tag = svc_ident(svc, buf, sizeof(buf));
-
-		if (svc->log.ident[0])
-			tag = svc->log.ident;
-		if (svc->log.prio[0])
-			prio = svc->log.prio;
-
-		/* Neither sysklogd logger or native logit tool available */
-		if (!have_sysklogd && !whichp(_PATH_LOGIT)) {
-			logit(LOG_INFO, _PATH_LOGIT " missing, using syslog for %s instead", svc->name);
-			fallback_logger(tag, prio);
-			_exit(0);
-		}
-
-		if (svc->log.file[0] == '/') {
-			if (have_sysklogd) {
-				char rot[25], pid[16];
-
-				snprintf(rot, sizeof(rot), "%d:%d", logfile_size_max, logfile_count_max);
-				snprintf(pid, sizeof(pid), "%d", svc_pid);
-				execlp("logger", "logger", "-f", svc->log.file, "-b", "-t", tag, "-p", prio, "-I", pid, "-r", rot, debug ? "-s" : NULL, NULL);
-			} else {
-				char sz[20], num[3];
-
-				snprintf(sz, sizeof(sz), "%d", logfile_size_max);
-				snprintf(num, sizeof(num), "%d", logfile_count_max);
-
-				execlp(_PATH_LOGIT, "logit", "-f", svc->log.file, "-n", sz, "-r", num, debug ? "-s" : NULL, NULL);
-
-			}
-			_exit(1);
-		}
-
-		/*
-		 * For now, let systemd programs go via our native logit
-		 * tool.  It supports systemd logging defines for stderr
-		 * parsing.  The only real downside is that it cannot do
-		 * PID faking, like sysklogd's logger tool.
-		 */
-		if (have_sysklogd && svc->notify != SVC_NOTIFY_SYSTEMD) {
-			char pid[16];
-
-			snprintf(pid, sizeof(pid), "%d", svc_pid);
-			execlp("logger", "logger", "-t", tag, "-p", prio, "-I", pid, debug ? "-s" : NULL, NULL);
-		} else {
-			execlp(_PATH_LOGIT, "logit", "-t", tag, "-p", prio, debug ? "-s" : NULL, NULL);
-		}
-		_exit(1);
-	}
-
-	dup2(fd, STDOUT_FILENO);
-	dup2(fd, STDERR_FILENO);
+	if (svc->log.enabled) {
+		if (svc->log.null)
+			return "/dev/null";
+		if (svc->log.console)
+			return console();
+	} else if (debug)
+		return console();
+#ifdef REDIRECT_OUTPUT
+	else
+		return "/dev/null";
+#endif
 
-	return close(fd);
+	return NULL;
 }
 
 /*
- * Handle redirection of process output, if enabled
+ * Handle redirection of process output, if enabled.  Called in the
+ * child of service_fork(), which has set up logmux_fd if needed.
  */
 static int redirect(svc_t *svc)
 {
+	const char *file;
+
 	stdin_redirect();
 
-	if (svc->log.enabled) {
-		if (svc->log.null)
-			return fredirect("/dev/null");
-		if (svc->log.console)
-			return fredirect(console());
+	if (logmux_fd != -1) {
+		dup2(logmux_fd, STDOUT_FILENO);
+		dup2(logmux_fd, STDERR_FILENO);
+		return close(logmux_fd);
+	}
+	if (has_logmux(svc))
+		return -1;	/* logmux_open() failed, leave as-is */
 
-		return lredirect(svc);
-	} else if (debug)
-		return fredirect(console());
-#ifdef REDIRECT_OUTPUT
-	else
-		return fredirect("/dev/null");
-#endif
+	file = redirect_file(svc);
+	if (file)
+		return fredirect(file);
 
 	return 0;
 }
@@ -421,7 +505,8 @@ static int redirect(svc_t *svc)
  */
 static void source_env(svc_t *svc)
 {
-	char *buf, *val, *line, *fn;
+	char *buf, *val, *line;
+	const char *fn;
 	FILE *fp;
 
 	fn = svc_getenv(svc);
@@ -512,20 +597,37 @@ static void compose_cmdline(svc_t *svc, char *buf, size_t len)
 	size_t i;
 
 	strlcpy(buf, svc->cmd, len);
-	for (i = 1; i < MAX_NUM_SVC_ARGS; i++) {
-		if (!strlen(svc->args[i]))
-			break;
-
+	for (i = 1; svc->args[0] && svc->args[i]; i++) {
 		strlcat(buf, " ", len);
 		strlcat(buf, svc->args[i], len);
 	}
 }
 
-static pid_t service_fork(svc_t *svc)
+/* Create leaf cgroup first, the child is started directly in it */
+static int service_cgroup(svc_t *svc)
+{
+	char grnam[80];
+
+	if (svc_is_tty(svc))
+		return cgroup_user_open("getty");
+
+	return cgroup_service_open(group_name(svc, grnam, sizeof(grnam)), &svc->cgroup);
+}
+
+/*
+ * Set @redir if the child calls redirect(), then the PTY for log:syslog
+ * or log:/path/to/file is set up here, before fork.
+ */
+static pid_t service_fork(svc_t *svc, int redir)
 {
 	pid_t pid;
+	int cgfd;
 
-	pid = fork();
+	if (redir && has_logmux(svc))
+		logmux_fd = logmux_open(svc);
+
+	cgfd = service_cgroup(svc);
+	pid = cgroup_fork(cgfd);
 	if (pid == 0) {
 		char *home = NULL;
 #ifdef ENABLE_STATIC
@@ -539,7 +641,7 @@ static pid_t service_fork(svc_t *svc)
 		sched_yield();
 
 		/* Set configured limits */
-		for (int i = 0; i < RLIMIT_NLIMITS; i++) {
+		for (int i = 0; svc->rlimit && i < RLIMIT_NLIMITS; i++) {
 			if (setrlimit(i, &svc->rlimit[i]) == -1)
 				logit(LOG_WARNING, "%s: rlimit: failed setting %s",
 				      svc_ident(svc, NULL, 0), rlim2str(i));
@@ -571,14 +673,129 @@ static pid_t service_fork(svc_t *svc)
 		source_env(svc);
 	}
 
-	if (pid > 1) {
-		char grnam[80];
+	if (cgfd >= 0)
+		close(cgfd);
+	if (pid && logmux_fd != -1) {
+		logmux_started(logmux_fd, pid);
+		logmux_fd = -1;
+	}
+
+	return pid;
+}
+
+/*
+ * A service is simple if its child needs nothing more than privileges
+ * dropped, rlimits, cwd, and output redirected to a file before exec.
+ * I.e., no TTY, env file, readiness notification setup, and no command
+ * line that needs wordexp() to run in the child.
+ */
+static int service_is_simple(svc_t *svc)
+{
+	const char *meta = " \t\n$`'\"\\*?[]~{}()|&;<>";
+	size_t i;
+
+	if (svc_is_tty(svc) || svc_is_sysv(svc) || svc_is_runtask(svc))
+		return 0;
+	if (svc_getenv(svc))
+		return 0;
+	if (svc->notify == SVC_NOTIFY_S6 || svc->notify == SVC_NOTIFY_SYSTEMD)
+		return 0;
+	if (svc_is_sockact(svc))
+		return 0;
+
+	if (strpbrk(svc->cmd, meta))
+		return 0;
+	for (i = 0; svc->args[i]; i++) {
+		if (strpbrk(svc->args[i], meta))
+			return 0;
+	}
 
-		if (svc_is_tty(svc))
-			cgroup_user("getty", pid);
+	return 1;
+}
+
+/*
+ * Fast path of service_fork() + exec for simple services.  Everything
+ * the child would look up is resolved here, and the child is started
+ * with spawn(), which does not copy our page tables.  Same as with the
+ * fork() child, a failed exec is collected and handled as a crash.
+ *
+ * Also used for per-connection instances of accept services, then @conn
+ * is the connection, used for stdin, stdout and stderr, and @extra has
+ * any variables to add to the environment, see sock.c
+ */
+static pid_t service_spawn(svc_t *svc, int conn, char *const extra[])
+{
+	struct spawn sp = {
+		.cmd    = svc->cmd,
+		.argv   = svc->args,
+		.rlimit = svc->rlimit,
+		.input  = conn,
+	};
+	const char *file = NULL;
+	char homeenv[PATH_MAX + 5];
+	char *home = NULL;
+	char **env;
+	size_t i, n, m;
+	pid_t pid;
+
+#ifdef ENABLE_STATIC
+	sp.uid = 0; /* XXX: Fix better warning that dropprivs is disabled. */
+	sp.gid = 0;
+#else
+	sp.uid = getuser(svc->username, &home);
+	sp.gid = getgroup(svc->group);
+#endif
+
+	for (n = 0; environ[n]; n++)
+		;
+	for (m = 0; extra && extra[m]; m++)
+		;
+	env = calloc(n + m + 3, sizeof(char *));
+	if (!env)
+		return -1;
+
+	for (i = n = 0; environ[i]; i++) {
+		if (sp.uid > 0 && !strncmp(environ[i], "PATH=", 5))
+			continue;
+		if (sp.uid >= 0 && home && !strncmp(environ[i], "HOME=", 5))
+			continue;
+		env[n++] = environ[i];
+	}
+	for (i = 0; i < m; i++)
+		env[n++] = extra[i];
+	if (sp.uid > 0)
+		env[n++] = "PATH=" _PATH_DEFPATH;
+	if (sp.uid >= 0 && home) {
+		snprintf(homeenv, sizeof(homeenv), "HOME=%s", home);
+		env[n++] = homeenv;
+		sp.cwd = home;
+	}
+	sp.env = env;
+
+	if (conn >= 0)
+		sp.output = conn;
+	else if (has_logmux(svc))
+		sp.output = logmux_open(svc);
+	else if ((file = redirect_file(svc)))
+		sp.output = open(file, O_WRONLY | O_APPEND | O_NOCTTY | O_CLOEXEC);
+	else
+		sp.output = -1;
+
+	sp.cgfd = service_cgroup(svc);
+	pid = spawn(&sp);
+	if (sp.cgfd >= 0)
+		close(sp.cgfd);
+	if (sp.output >= 0 && sp.output != conn) {
+		if (file)
+			close(sp.output);
 		else
-			cgroup_service(group_name(svc, grnam, sizeof(grnam)), pid, &svc->cgroup);
+			logmux_started(sp.output, pid);
 	}
+	free(env);
+
+	if (pid > 0 && sp.failed)
+		logit(LOG_ERR, "%s: failed %s: %s", svc_ident(svc, NULL, 0),
+		      sp.failed, strerror(sp.error));
 
 	return pid;
 }
@@ -661,6 +878,10 @@ static int service_start(svc_t *svc)
 			svc_missing(svc);
 			return 1;
 		}
+
+		/* Sender credentials, see service_notify_cb() */
+		if (setsockopt(sd, SOL_SOCKET, SO_PASSCRED, &(int){ 1 }, sizeof(int)))
+			err(1, "%s: failed enabling notify credentials", svc_ident(svc, NULL, 0));
 		break;
 	default:
 		break;
@@ -690,7 +911,10 @@ static int service_start(svc_t *svc)
 	sigaddset(&nmask, SIGCHLD);
 	sigprocmask(SIG_BLOCK, &nmask, &omask);
 
-	pid = service_fork(svc);
+	if (service_is_simple(svc))
+		pid = service_spawn(svc, -1, NULL);
+	else
+		pid = service_fork(svc, !svc_is_tty(svc));
 	if (pid < 0) {
 		if (sd != -1)
 			close(sd);
@@ -703,8 +927,9 @@ static int service_start(svc_t *svc)
 		size_t len;
 
 		dbg("Starting %s as PID %d", svc_ident(svc, NULL, 0), pid);
-		svc->pid = pid;
+		svc_set_pid(svc, pid);
 		svc->start_time = jiffies();
+		sock_started(svc);
 
 		switch (svc->notify) {
 		case SVC_NOTIFY_SYSTEMD:
@@ -730,6 +955,12 @@ static int service_start(svc_t *svc)
 				close(sd);
 				break;
 			}
+
+			/* Started here, restarted by each WATCHDOG=1 */
+			if (svc->notify == SVC_NOTIFY_SYSTEMD) {
+				svc->watchdog_tmo = svc->watchdog;
+				service_watchdog_kick(svc);
+			}
 		default:
 			break;
 		}
@@ -741,10 +972,26 @@ static int service_start(svc_t *svc)
 		if (!svc_is_tty(svc))
 			redirect(svc);
 
+		/* s6 notify fd must not be in the way of LISTEN_FDS */
+		if (svc->notify == SVC_NOTIFY_S6 && svc_is_sockact(svc) &&
+		    fd < SOCK_FDS_START + SOCK_MAX) {
+			int nfd = fcntl(fd, F_DUPFD, SOCK_FDS_START + SOCK_MAX);
+
+			close(fd);
+			fd = nfd;
+		}
+		sock_child(svc);
+
 		switch (svc->notify) {
 		case SVC_NOTIFY_SYSTEMD:
 			snprintf(str, sizeof(str), NOTIFY_PATH, getpid());
 			setenv("NOTIFY_SOCKET", str, 1);
+			if (svc->watchdog) {
+				snprintf(str, sizeof(str), "%lld", (long long)svc->watchdog * 1000);
+				setenv("WATCHDOG_USEC", str, 1);
+				snprintf(str, sizeof(str), "%d", getpid());
+				setenv("WATCHDOG_PID", str, 1);
+			}
 			/* fallthrough */
 		case SVC_NOTIFY_S6:
 			close(sd);
@@ -764,15 +1011,12 @@ static int service_start(svc_t *svc)
 				_exit(1);
 			}
 
-			for (i = 0; i < MAX_NUM_SVC_ARGS; i++) {
+			for (i = 0; svc->args[i]; i++) {
 				char *arg = svc->args[i];
 				size_t len = strlen(arg);
 				char str[len + 2];
 				char ch = *arg;
 
-				if (len == 0)
-					break;
-
 				if (svc->notify == SVC_NOTIFY_S6) {
 					char *ptr = strstr(arg, "%n");
 
@@ -809,29 +1053,17 @@ static int service_start(svc_t *svc)
 				goto nomem;
 			}
 
-			for (i = 0; i < we.we_wordc; i++) {
-				if (strlen(we.we_wordv[i]) >= sizeof(svc->args[i])) {
-					logit(LOG_ERR, "%s: expanded %s arg. '%s' too long", svc_ident(svc, NULL, 0), svc->cmd, we.we_wordv[i]);
-					rc = WRDE_NOSPACE;
-					goto nomem;
-				}
-
-				/* overwrite the child's svc with expanded args */
-				strlcpy(svc->args[i], we.we_wordv[i], sizeof(svc->args[i]));
-				args[i] = svc->args[i];
-			}
-			wordfree(&we);
+			/* we is not freed, exec replaces the child */
+			for (i = 0; i < we.we_wordc; i++)
+				args[i] = we.we_wordv[i];
 		} else {
 			size_t j;
 
 			i = 0;
 			args[i++] = svc->cmd;
 			/* this handles, e.g., bridge-stop br0 start */
-			for (j = 0; j < MAX_NUM_SVC_ARGS; j++) {
-				if (!strlen(svc->args[j]))
-					break;
+			for (j = 0; j < MAX_NUM_SVC_ARGS - 1 && svc->args[j]; j++)
 				args[i++] = svc->args[j];
-			}
 			args[i++] = "start";
 		}
 		args[i] = NULL;
@@ -848,9 +1080,7 @@ static int service_start(svc_t *svc)
 		buf[0] = 0;
 		strlcat(buf, svc->cmd, sizeof(buf));
 		strlcat(buf, " ", sizeof(buf));
-		for (i = 1; i < MAX_NUM_SVC_ARGS; i++) {
-			if (!strlen(svc->args[i]))
-				break;
+		for (i = 1; svc->args[0] && svc->args[i]; i++) {
 			strlcat(buf, svc->args[i], sizeof(buf));
 			strlcat(buf, " ", sizeof(buf));
 		}
@@ -941,25 +1171,60 @@ static void service_kill(svc_t *svc)
 	if (runlevel != 1)
 		print_desc("Killing ", svc->desc);
 
-	kill(svc->pid, SIGKILL);
+	svc_kill(svc, SIGKILL);
 
 	/* Let SIGKILLs stand out, show result as [WARN] */
 	if (runlevel != 1)
 		print(2, NULL);
 }
 
+/*
+ * Start kill delay timer of a stopping service, on runlevel change all
+ * services instead share the same deadline, see graph_stop_deadline().
+ */
+static void service_kill_after(svc_t *svc)
+{
+	if (graph_stop_deadline(svc))
+		return;
+
+	dbg("%s is stopping, wait %d sec before sending SIGKILL ...",
+	    svc_ident(svc, NULL, 0), svc->killdelay / 1000);
+	service_timeout_cancel(svc);
+	service_timeout_after(svc, svc->killdelay, service_kill);
+}
+
+/* Exit code of a stop:/reload: script, a signal is reported as 1 */
+static int script_status(svc_t *svc, const char *type, int status)
+{
+	const char *id = svc_ident(svc, NULL, 0);
+	int rc = WEXITSTATUS(status);
+
+	if (WIFEXITED(status)) {
+		dbg("%s: %s:script exited without signal, status: %d", id, type, rc);
+	} else if (WIFSIGNALED(status)) {
+		dbg("%s: %s:script terminated by signal %d", id, type, WTERMSIG(status));
+		if (!rc)
+			rc = 1;
+	} else {
+		dbg("%s: %s:script exited with status: %d", id, type, rc);
+	}
+
+	return rc;
+}
+
 /*
  * Call script with MAINPID environment set, and any environment specified
- * by env:file, wait for completion before resuming operation.
+ * by env:file.  The script runs in the background, when it has completed,
+ * or has been killed after @tmo msec, @done is called.
  *
  * Called by service_stop() and service_reload() when alternate mechanisms
  * for stopping and reloading have been specified by the user.
  */
-static int service_run_script(svc_t *svc, char *script)
+static int service_run_script(svc_t *svc, const char *type, const char *script, int tmo,
+			      void (*done)(svc_t *svc, int status))
 {
 	const char *id = svc_ident(svc, NULL, 0);
-	pid_t pid = service_fork(svc);
-	int status, rc;
+	pid_t pid = service_fork(svc, 0);
 
 	if (pid < 0) {
 		err(1, "%s: failed forking off script %s", id, script);
@@ -970,7 +1235,7 @@ static int service_run_script(svc_t *svc, char *script)
 		char *argv[4] = {
 			"sh",
 			"-c",
-			script,
+			(char *)script,
 			NULL
 		};
 		char pidbuf[16];
@@ -983,29 +1248,14 @@ static int service_run_script(svc_t *svc, char *script)
 		_exit(EX_OSERR);
 	}
 
-	dbg("%s: script '%s' started as PID %d", id, script, pid);
-	if (waitpid(pid, &status, 0) == -1) {
-		warn("%s: failed calling script %s", id, script);
-		return -1;
-	}
-
-	rc = WEXITSTATUS(status);
-	if (WIFEXITED(status)) {
-		dbg("%s: script '%s' exited without signal, status: %d", id, script, rc);
-	} else if (WIFSIGNALED(status)) {
-		dbg("%s: script '%s' terminated by signal %d", id, script, WTERMSIG(status));
-		if (!rc)
-			rc = 1;
-	} else {
-		dbg("%s: script '%s' exited with status: %d", id, script, rc);
-	}
-
-	return rc;
+	dbg("%s: %s:script '%s' started as PID %d", id, type, script, pid);
+	return service_script_add(svc, pid, type, tmo, done);
 }
 
 /* Ensure we don't have any notify socket lingering */
 static void service_notify_stop(svc_t *svc)
 {
+	service_watchdog_stop(svc);
 	if (svc->notify != SVC_NOTIFY_SYSTEMD && svc->notify != SVC_NOTIFY_S6)
 		return;
 
@@ -1021,7 +1271,7 @@ static void service_notify_stop(svc_t *svc)
  */
 static void service_cleanup(svc_t *svc)
 {
-	char *fn;
+	const char *fn;
 
 	/* PID collected, cancel any pending SIGKILL */
 	service_timeout_cancel(svc);
@@ -1032,13 +1282,71 @@ static void service_cleanup(svc_t *svc)
 		      svc_ident(svc, NULL, 0), fn);
 
 	service_notify_stop(svc);
+	svc_set_str(&svc->notify_status, NULL);
 
 	/* No longer running, update books. */
 	if (svc_is_tty(svc) && svc->pid > 1)
 		utmp_set_dead(svc->pid); /* Set DEAD_PROCESS UTMP entry */
 
 	svc->oldpid = svc->pid;
-	svc->starting = svc->start_time = svc->pid = 0;
+	svc->starting = svc->start_time = 0;
+	svc_set_pid(svc, 0);
+}
+
+/*
+ * The stop:script has completed, or timed out and been killed.  The
+ * service stays in STOPPING state until now, from here the main PID,
+ * if still running, gets the regular kill delay before SIGKILL.
+ */
+static void service_stop_done(svc_t *svc, int status)
+{
+	if (status == -1) {
+		logit(LOG_CONSOLE | LOG_WARNING, "%s[%d], stop:%s timed out.",
+		      svc_ident(svc, NULL, 0), svc->pid, svc->stop_script);
+		service_kill(svc);
+	} else if (script_status(svc, "stop", status) == 1) {
+		service_cleanup(svc);
+		svc_set_state(svc, SVC_HALTED_STATE);
+	} else if (svc->pid > 1) {
+		service_kill_after(svc);
+	}
+
+	service_step(svc);
+	sm_step();
+}
+
+/*
+ * The reload:script has completed, or timed out and been killed.  On
+ * success we wait for the service to re-assert its pidfile.
+ */
+static void service_reload_done(svc_t *svc, int status)
+{
+	const char *id = svc_ident(svc, NULL, 0);
+	int rc;
+
+	if (status == -1) {
+		logit(LOG_CONSOLE | LOG_WARNING, "%s[%d], reload:%s timed out.", id, svc->pid, svc->reload_script);
+		return;
+	}
+
+	rc = script_status(svc, "reload", status);
+	if (rc) {
+		logit(LOG_CONSOLE | LOG_WARNING, "%s[%d], reload:%s failed, exit code %d.",
+		      id, svc->pid, svc->reload_script, rc);
+		return;
+	}
+
+	if (svc->pid <= 1)
+		return;
+
+	/* Declare we're waiting for svc to re-assert/touch its pidfile */
+	svc_starting(svc);
+
+	/* Service does not maintain a PID file on its own */
+	if (svc_has_pidfile(svc)) {
+		sched_yield();
+		touch(pid_file(svc));
+	}
 }
 
 /**
@@ -1100,7 +1408,7 @@ int service_stop(svc_t *svc)
 	 * Verify there's still something there before we send the reaper.
 	 */
 	if (svc->pid > 1 && !pid_alive(svc->pid)) {
-		svc->pid = 0;
+		svc_set_pid(svc, 0);
 		return 0;
 	}
 
@@ -1115,7 +1423,7 @@ int service_stop(svc_t *svc)
 		print_desc("Stopping ", svc->desc);
 
 	if (svc->stop_script[0]) {
-		rc = service_run_script(svc, svc->stop_script);
+		rc = service_run_script(svc, "stop", svc->stop_script, svc->stop_tmo, service_stop_done);
 	} else if (!svc_is_sysv(svc)) {
 		if (svc->pid > 1) {
 			/*
@@ -1124,7 +1432,7 @@ int service_stop(svc_t *svc)
 			 * and/or forward TERM to its children.  If it does not respond
 			 * in within a reasonable timeout we SIGKILL the entire group.
 			 */
-			rc = kill(svc->pid, svc->sighalt);
+			rc = svc_kill(svc, svc->sighalt);
 			dbg("kill(%d, %d) => rc %d, errno %d", svc->pid, svc->sighalt, rc, errno);
 			/* PID lost or forking process never really started */
 			if (rc == -1 && (errno == ESRCH || errno == ENOENT))
@@ -1139,15 +1447,12 @@ int service_stop(svc_t *svc)
 
 		args[i++] = svc->cmd;
 		/* this handles, e.g., bridge-stop br0 stop */
-		for (j = 0; j < MAX_NUM_SVC_ARGS - 2; j++) {
-			if (!strlen(svc->args[j]))
-				break;
+		for (j = 0; j < MAX_NUM_SVC_ARGS - 2 && svc->args[j]; j++)
 			args[i++] = svc->args[j];
-		}
 		args[i++] = "stop";
 		args[i] = NULL;
 
-		switch (service_fork(svc)) {
+		switch (service_fork(svc, 1)) {
 		case 0:
 			redirect(svc);
 			setsid();
@@ -1207,16 +1512,20 @@ static int service_reload(svc_t *svc)
 
 	if (svc->reload_script[0]) {
 		logit(LOG_CONSOLE | LOG_NOTICE, "%s[%d], calling reload:%s ...", id, svc->pid, svc->reload_script);
-		rc = service_run_script(svc, svc->reload_script);
+		rc = service_run_script(svc, "reload", svc->reload_script, svc->reload_tmo,
+					service_reload_done);
+		if (!rc)
+			goto done;	/* pidfile handled in service_reload_done() */
 	} else 	if (svc->sighup) {
 		if (svc->pid <= 1) {
 			dbg("%s[%d]: bad PID, cannot reload service", id, svc->pid);
-			svc->start_time = svc->pid = 0;
+			svc->start_time = 0;
+			svc_set_pid(svc, 0);
 			goto done;
 		}
 		dbg("%s[%d], sending SIGHUP", id, svc->pid);
 		logit(LOG_CONSOLE | LOG_NOTICE, "%s[%d], sending SIGHUP ...", id, svc->pid);
-		rc = kill(svc->pid, SIGHUP);
+		rc = svc_kill(svc, SIGHUP);
 		if (rc == -1 && (errno == ESRCH || errno == ENOENT)) {
 			/* nobody home, reset internal state machine */
 			lost = svc->pid;
@@ -1337,6 +1646,8 @@ static void parse_log(svc_t *svc, char *arg)
 			svc->log.null = 1;
 		else if (!strcmp(tok, "console") || !strcmp(tok, "/dev/console"))
 			svc->log.console = 1;
+		else if (!strcmp(tok, "store"))
+			svc->log.store = 1;
 		else if (tok[0] == '/')
 			strlcpy(svc->log.file, tok, sizeof(svc->log.file));
 		else if (!strcmp(tok, "priority") || !strcmp(tok, "prio"))
@@ -1364,12 +1675,13 @@ static void parse_env(svc_t *svc, char *env)
 	if (!env)
 		return;
 
-	if (strlen(env) >= sizeof(svc->env)) {
-		errx(1, "%s: env file is too long (>%zu chars)", svc_ident(svc, NULL, 0), sizeof(svc->env));
+	if (strlen(env) >= MAX_CMD_LEN) {
+		errx(1, "%s: env file is too long (>%d chars)", svc_ident(svc, NULL, 0), MAX_CMD_LEN);
 		return;
 	}
 
-	strlcpy(svc->env, env, sizeof(svc->env));
+	if (svc_set_str(&svc->env, env) < 0)
+		errx(1, "%s: out of memory setting env file %s", svc_ident(svc, NULL, 0), env);
 }
 
 /*
@@ -1431,10 +1743,38 @@ static void parse_killdelay(svc_t *svc, char *delay)
 	svc->killdelay = (int)(sec * 1000);
 }
 
+/*
+ * watchdog:SEC, only for notify:systemd, 0 disables
+ */
+static void parse_watchdog(svc_t *svc, char *arg)
+{
+	const char *errstr;
+	long long sec;
+
+	svc->watchdog = 0;
+	if (!arg)
+		return;
+
+	sec = strtonum(arg, 0, 3600, &errstr);
+	if (errstr) {
+		errx(1, "%s: watchdog %s is %s (0-3600)", svc_ident(svc, NULL, 0), arg, errstr);
+		return;
+	}
+
+	if (sec && svc->notify != SVC_NOTIFY_SYSTEMD) {
+		logit(LOG_WARNING, "%s: watchdog:%s requires notify:systemd, ignoring.",
+		      svc_ident(svc, NULL, 0), arg);
+		return;
+	}
+
+	/* convert to msec */
+	svc->watchdog = (int)(sec * 1000);
+}
+
 /*
  * pre:[0-3600,]/path/to/script
  */
-static void parse_script(svc_t *svc, char *type, char *script, int *tmo, char *buf, size_t len)
+static void parse_script(svc_t *svc, char *type, char *script, int *tmo, const char **str)
 {
 	char *found, *path;
 
@@ -1470,15 +1810,15 @@ static void parse_script(svc_t *svc, char *type, char *script, int *tmo, char *b
 	}
 	free(found);
 
-	if (strlen(path) >= len) {
+	if (strlen(path) >= MAX_CMD_LEN) {
 		errx(1, "Command too long in %s:%s", type, path);
 		goto err;
 	}
 
-	strlcpy(buf, path, len);
-	return;
+	if (svc_set_str(str, path) >= 0)
+		return;
 err:
-	memset(buf, 0, len);
+	svc_set_str(str, NULL);
 }
 
 /*
@@ -1516,36 +1856,37 @@ static char *parse_name(char *cmd, char *arg)
  */
 static void parse_cmdline_args(svc_t *svc, char *cmd, char **args)
 {
-	char prev[MAX_CMD_LEN];
+	char *argv[MAX_NUM_SVC_ARGS];
+	char *arg, *end = NULL;
 	int diff = 0;
 	char sep = 0;
-	char *arg;
-	int i = 0;
+	int argc = 0;
 
-	if (strcmp(svc->args[i], cmd))
-		diff++;
-	strlcpy(svc->args[i++], cmd, sizeof(svc->args[0]));
+	argv[argc++] = cmd;
 
 	/*
-	 * Copy supplied args. Stop at MAX_NUM_SVC_ARGS-1 to allow the args
-	 * array to be zero-terminated.
+	 * Collect supplied args, at most MAX_NUM_SVC_ARGS-1 to allow the
+	 * args array to be zero-terminated.
 	 */
-	while ((arg = strtok_r(NULL, " ", args)) && i < (MAX_NUM_SVC_ARGS - 1)) {
+	while ((arg = strtok_r(NULL, " ", args)) && argc < (MAX_NUM_SVC_ARGS - 1)) {
 		char ch = arg[0];
 		size_t len;
 
-		if (!sep) {
-			strlcpy(prev, svc->args[i], sizeof(prev));
-			svc->args[i][0] = 0;
+		/*
+		 * XXX: ugly string arg re-concatenation, fixme
+		 *      Joined in place, tokens are in the same buffer.
+		 */
+		if (sep) {
+			len = strlen(arg);
+			*end++ = ' ';
+			memmove(end, arg, len + 1);
+			arg = argv[argc];
+		} else {
+			if (ch == '"' || ch == '\'')
+				sep = ch;
+			argv[argc] = arg;
 		}
-
-		/* XXX: ugly string arg re-concatenation, fixme */
-		if (ch == '"' || ch == '\'')
-			sep = ch;
-		else if (sep)
-			strlcat(svc->args[i], " ", sizeof(svc->args[0]));
-
-		strlcat(svc->args[i], arg, sizeof(svc->args[0]));
+		end = arg + strlen(arg);
 
 		/* string arg contained already? */
 		len = strlen(arg);
@@ -1556,25 +1897,17 @@ static void parse_cmdline_args(svc_t *svc, char *cmd, char **args)
 		}
 
 		/* replace any @console arg with the expanded device name */
-		if (svc_is_tty(svc) && tty_isatcon(svc->args[i]))
-			strlcpy(svc->args[i], svc->dev, sizeof(svc->args[i]));
-
-		if (strcmp(svc->args[i], prev))
-			diff++;
+		if (svc_is_tty(svc) && tty_isatcon(argv[argc]))
+			argv[argc] = svc->dev;
 
 		sep = 0;
-		i++;
+		argc++;
 	}
 
-	/*
-	 * Clear remaining args in case they were set earlier.
-	 * This also zero-terminates the args array.
-	 */
-	while (i < MAX_NUM_SVC_ARGS) {
-		if (svc->args[i++][0]) {
-			svc->args[i-1][0] = 0;
-			diff++;
-		}
+	diff = svc_set_args(svc, argv, argc);
+	if (diff < 0) {
+		logit(LOG_ERR, "%s: out of memory setting args", svc_ident(svc, NULL, 0));
+		diff = 0;
 	}
 
 	/*
@@ -1585,10 +1918,9 @@ static void parse_cmdline_args(svc_t *svc, char *cmd, char **args)
 
 	if (diff) {
 		char buf[256];
+		int i;
 
-		for (buf[0] = 0, i = 0; i < MAX_NUM_SVC_ARGS; i++) {
-			if (!strlen(svc->args[i]))
-				break;
+		for (buf[0] = 0, i = 0; svc->args[i]; i++) {
 			strlcat(buf, " ", sizeof(buf));
 			strlcat(buf, svc->args[i], sizeof(buf));
 		}
@@ -1666,6 +1998,9 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	char *ready_script = NULL, *conflict = NULL;
 	char *reload_script = NULL, *stop_script = NULL;
 	char *cleanup_script = NULL;
+	char *watchdog = NULL;
+	char *sock = NULL, *idle = NULL;
+	char *accept = NULL, *rate = NULL;
 	char ident[MAX_IDENT_LEN];
 	char *ifstmt = NULL;
 	char *notify = NULL;
@@ -1767,6 +2102,16 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			halt = arg;
 		else if (MATCH_CMD(cmd, "kill:", arg))
 			delay = arg;
+		else if (MATCH_CMD(cmd, "watchdog:", arg))
+			watchdog = arg;
+		else if (MATCH_CMD(cmd, "socket:", arg))
+			sock = arg;
+		else if (MATCH_CMD(cmd, "idle:", arg))
+			idle = arg;
+		else if (MATCH_CMD(cmd, "accept", arg))
+			accept = arg;
+		else if (MATCH_CMD(cmd, "rate:", arg))
+			rate = arg;
 		else if (MATCH_CMD(cmd, "pre:", arg))
 			pre_script = arg;
 		else if (MATCH_CMD(cmd, "post:", arg))
@@ -1895,8 +2240,13 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	} else {
 		dbg("Found existing svc for %s name %s id %s type %d", cmd, name, id, type);
 
+		/* Already loaded from another .conf file, last one wins */
+		if (!svc_is_removed(svc) && file && strncmp(svc->file, file, sizeof(svc->file) - 1))
+			conf_duplicate(svc, file);
+
 		/* update type, may have changed from service -> task */
 		svc->type = type;
+		svc_set_dev(svc, NULL);
 
 		/* update path, may have changed on reload */
 		strlcpy(svc->cmd, cmd, sizeof(svc->cmd));
@@ -1925,8 +2275,7 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	conf_parse_cond(svc, cond);
 
 	if (type == SVC_TYPE_TTY) {
-		if (dev)
-			strlcpy(svc->dev, dev, sizeof(svc->dev));
+		svc_set_dev(svc, dev);
 		if (tty.baud)
 			strlcpy(svc->baud, tty.baud, sizeof(svc->baud));
 		if (tty.term)
@@ -1945,9 +2294,11 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 
 	/*
 	 * Warn if svc generates same condition (based on name:id)
-	 * as an existing service.
+	 * as an existing service.  When replaying the snapshot of
+	 * last boot all services are checked at once afterwards.
 	 */
-	svc_validate(svc);
+	if (!conf_replaying())
+		svc_validate(svc);
 
 	if (halt)
 		parse_sighalt(svc, halt);
@@ -1958,31 +2309,31 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	else
 		svc->killdelay = SVC_TERM_TIMEOUT;
 	if (pre_script)
-		parse_script(svc, "pre", pre_script, &svc->pre_tmo, svc->pre_script, sizeof(svc->pre_script));
+		parse_script(svc, "pre", pre_script, &svc->pre_tmo, &svc->pre_script);
 	else
-		memset(svc->pre_script, 0, sizeof(svc->pre_script));
+		svc_set_str(&svc->pre_script, NULL);
 	if (post_script)
-		parse_script(svc, "post", post_script, &svc->post_tmo, svc->post_script, sizeof(svc->post_script));
+		parse_script(svc, "post", post_script, &svc->post_tmo, &svc->post_script);
 	else
-		memset(svc->post_script, 0, sizeof(svc->post_script));
+		svc_set_str(&svc->post_script, NULL);
 	if (ready_script)
-		parse_script(svc, "ready", ready_script, &svc->ready_tmo, svc->ready_script, sizeof(svc->ready_script));
+		parse_script(svc, "ready", ready_script, &svc->ready_tmo, &svc->ready_script);
 	else
-		memset(svc->ready_script, 0, sizeof(svc->ready_script));
+		svc_set_str(&svc->ready_script, NULL);
 	if (cleanup_script)
-		parse_script(svc, "cleanup", cleanup_script, &svc->cleanup_tmo, svc->cleanup_script, sizeof(svc->cleanup_script));
+		parse_script(svc, "cleanup", cleanup_script, &svc->cleanup_tmo, &svc->cleanup_script);
 	else
-		memset(svc->cleanup_script, 0, sizeof(svc->cleanup_script));
+		svc_set_str(&svc->cleanup_script, NULL);
 
 	if (reload_script)
-		parse_script(svc, "reload", reload_script, NULL, svc->reload_script, sizeof(svc->reload_script));
+		parse_script(svc, "reload", reload_script, &svc->reload_tmo, &svc->reload_script);
 	else
-		memset(svc->reload_script, 0, sizeof(svc->reload_script));
+		svc_set_str(&svc->reload_script, NULL);
 
 	if (stop_script)
-		parse_script(svc, "stop", stop_script, NULL, svc->stop_script, sizeof(svc->stop_script));
+		parse_script(svc, "stop", stop_script, &svc->stop_tmo, &svc->stop_script);
 	else
-		memset(svc->stop_script, 0, sizeof(svc->stop_script));
+		svc_set_str(&svc->stop_script, NULL);
 
 	if (!svc_is_tty(svc)) {
 		if (log)
@@ -1995,6 +2346,14 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		svc->notify = parse_notify(notify);
 	  else
 		svc->notify = readiness;
+	parse_watchdog(svc, watchdog);
+
+	/* New or modified sockets, service must be restarted to get them */
+	if (sock_parse(svc, sock, idle, accept, rate))
+		svc->args_dirty = 1;
+	if (sock && accept && (env || svc->notify == SVC_NOTIFY_SYSTEMD || svc->notify == SVC_NOTIFY_S6))
+		logit(LOG_WARNING, "%s: env: and notify: not supported with accept, ignoring.",
+		      svc_ident(svc, NULL, 0));
 
 	if (desc)
 		strlcpy(svc->desc, desc, sizeof(svc->desc));
@@ -2003,7 +2362,7 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 	if (env)
 		parse_env(svc, env);
 	else
-		memset(svc->env, 0, sizeof(svc->env));
+		svc_set_str(&svc->env, NULL);
 	if (file)
 		strlcpy(svc->file, file, sizeof(svc->file));
 	else
@@ -2050,8 +2409,9 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		}
 	}
 
-	/* Set configured limits */
-	memcpy(svc->rlimit, rlimit, sizeof(svc->rlimit));
+	/* Set configured limits, shared with other services */
+	if (svc_set_rlimit(svc, rlimit) < 0)
+		logit(LOG_WARNING, "%s: out of memory setting rlimits", svc_ident(svc, NULL, 0));
 
 	/* Seed with currently active group, may be empty */
 	strlcpy(svc->cgroup.name, cgroup_current, sizeof(svc->cgroup.name));
@@ -2099,6 +2459,8 @@ void service_unregister(svc_t *svc)
 
 	service_stop(svc);
 	service_timeout_cancel(svc);
+	service_script_drop(svc);
+	sock_del(svc);
 
 	for (c = strtok(svc->cond, ","); c; c = strtok(NULL, ","))
 		devmon_del_cond(c);
@@ -2106,24 +2468,15 @@ void service_unregister(svc_t *svc)
 	svc_del(svc);
 }
 
-void service_monitor(pid_t lost, int status)
+/*
+ * Process @lost of @svc, svc->pid, has been collected with @status.
+ * The main process as well as pre: and post: scripts use svc->pid.
+ */
+static void service_collect(svc_t *svc, pid_t lost, int status)
 {
 	int sig = WIFSIGNALED(status);
 	int rc = WEXITSTATUS(status);
 	int ok = WIFEXITED(status);
-	svc_t *svc;
-
-	if (lost <= 1)
-		return;
-
-	/* main process as well as pre: and post: scripts use svc->pid */
-	svc = svc_find_by_pid(lost);
-	if (!svc) {
-		/* Check if ready: script in assoc list */
-		if (service_script_del(lost))
-			dbg("collected unknown PID %d", lost);
-		return;
-	}
 
 	switch (svc->state) {
 	case SVC_SETUP_STATE:
@@ -2158,7 +2511,7 @@ void service_monitor(pid_t lost, int status)
 	if (svc_is_forking(svc)) {
 		/* Likely start script exiting */
 		if (svc_is_starting(svc)) {
-			svc->pid = 0;	/* Expect no more activity from this one */
+			svc_set_pid(svc, 0);	/* Expect no more activity from this one */
 			goto cont;
 		}
 
@@ -2179,7 +2532,8 @@ void service_monitor(pid_t lost, int status)
 
 done:
 	/* No longer running, update books. */
-	svc->start_time = svc->pid = 0;
+	svc->start_time = 0;
+	svc_set_pid(svc, 0);
 cont:
 	if (lost == run_block_pid) {
 		int result = ok ? rc : 1;
@@ -2201,6 +2555,61 @@ cont:
 	sm_step();
 }
 
+/*
+ * Called from the pidfd watcher of svc->pid when it has exited, so no
+ * lookup by PID is needed.  A process that is not our child, e.g., a
+ * forking daemon that has not been reparented to us, cannot be reaped
+ * but its exit is still handled.
+ */
+static void service_pidfd_exit(svc_t *svc)
+{
+	pid_t pid = svc->pid;
+	int status = 0;
+	pid_t rc;
+
+	do
+		rc = waitpid(pid, &status, WNOHANG);
+	while (rc == -1 && errno == EINTR);
+	if (rc == 0)
+		return;		/* Still running, stale event */
+	if (rc == -1) {
+		if (errno != ECHILD)
+			return;
+		dbg("%s: PID %d exited, not our child, cannot get exit status.",
+		    svc_ident(svc, NULL, 0), pid);
+		status = 0;
+	}
+
+	dbg("Collected %s PID %d via pidfd, status: %d", svc_ident(svc, NULL, 0), pid, status);
+	service_collect(svc, pid, status);
+}
+
+/*
+ * Called from the SIGCHLD handler, processes with a pidfd are usually
+ * collected by service_pidfd_exit() first, this handles the rest.
+ */
+void service_monitor(pid_t lost, int status)
+{
+	svc_t *svc;
+
+	if (lost <= 1)
+		return;
+
+	svc = svc_find_by_pid(lost);
+	if (!svc) {
+		/* Instance of an accept service, see sock.c */
+		if (sock_reap(lost, status))
+			return;
+
+		/* Check if ready: script in assoc list */
+		if (service_script_del(lost, status))
+			dbg("collected unknown PID %d", lost);
+		return;
+	}
+
+	service_collect(svc, lost, status);
+}
+
 static void svc_mark_affected(char *cond)
 {
 	svc_t *svc, *iter = NULL;
@@ -2209,7 +2618,7 @@ static void svc_mark_affected(char *cond)
 		if (!svc_has_cond(svc))
 			continue;
 
-		if (cond_affects(cond, svc->cond))
+		if (cond_affects_svc(cond, svc))
 			svc_mark_dirty(svc);
 	}
 }
@@ -2266,7 +2675,7 @@ static void service_kill_script(svc_t *svc)
 		return;
 
 	dbg("Timeout, killing service %s script PID %d", svc_ident(svc, NULL, 0), svc->pid);
-	kill(svc->pid, SIGKILL);
+	svc_kill(svc, SIGKILL);
 }
 
 /*
@@ -2292,7 +2701,7 @@ static void set_pre_post_envs(svc_t *svc, const char *type)
 
 static void service_pre_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
+	svc_set_pid(svc, service_fork(svc, 1));
 	if (svc->pid < 0) {
 		err(1, "Failed forking off %s pre:script %s", svc_ident(svc, NULL, 0), svc->pre_script);
 		return;
@@ -2306,7 +2715,7 @@ static void service_pre_script(svc_t *svc)
 			buf,
 			NULL
 		};
-		char *env_file;
+		const char *env_file;
 
 		redirect(svc);
 
@@ -2330,7 +2739,7 @@ static void service_pre_script(svc_t *svc)
 
 static void service_post_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
+	svc_set_pid(svc, service_fork(svc, 0));
 	if (svc->pid < 0) {
 		err(1, "Failed forking off %s post:script %s", svc_ident(svc, NULL, 0), svc->post_script);
 		return;
@@ -2344,7 +2753,7 @@ static void service_post_script(svc_t *svc)
 			buf,
 			NULL
 		};
-		char *env_file;
+		const char *env_file;
 		int rc, sig;
 
 		rc = WEXITSTATUS(svc->status);
@@ -2395,7 +2804,7 @@ void service_ready_script(svc_t *svc)
 	if (access(svc->ready_script, X_OK))
 		return;
 
-	pid = service_fork(svc);
+	pid = service_fork(svc, 0);
 	if (pid < 0) {
 		err(1, "Failed forking off %s ready-script %s", svc_ident(svc, NULL, 0), svc->ready_script);
 		return;
@@ -2409,7 +2818,7 @@ void service_ready_script(svc_t *svc)
 			buf,
 			NULL
 		};
-		char *env_file;
+		const char *env_file;
 
 		/* Warning in service_start() after svc_checkenv() */
 		env_file = svc_getenv(svc);
@@ -2426,12 +2835,12 @@ void service_ready_script(svc_t *svc)
 	}
 
 	dbg("%s: ready:script %s started as PID %d", svc_ident(svc, NULL, 0), svc->ready_script, pid);
-	service_script_add(svc, pid, svc->ready_tmo);
+	service_script_add(svc, pid, "ready", svc->ready_tmo, NULL);
 }
 
 static void service_cleanup_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
+	svc_set_pid(svc, service_fork(svc, 1));
 	if (svc->pid < 0) {
 		err(1, "Failed forking off %s cleanup:script %s", svc_ident(svc, NULL, 0), svc->cleanup_script);
 		return;
@@ -2445,7 +2854,7 @@ static void service_cleanup_script(svc_t *svc)
 			buf,
 			NULL
 		};
-		char *env_file;
+		const char *env_file;
 
 		redirect(svc);
 
@@ -2547,17 +2956,21 @@ static void svc_set_state(svc_t *svc, svc_state_t new_state)
 	svc_state_t *state = (svc_state_t *)&svc->state;
 	const svc_state_t old_state = svc->state;
 
-	/* if PID isn't collected within SVC_TERM_TIMEOUT msec, kill it! */
+	/*
+	 * If PID isn't collected within SVC_TERM_TIMEOUT msec, kill it!
+	 * With a stop:script, the delay starts when the script is done.
+	 */
 	if (new_state == SVC_STOPPING_STATE) {
-		dbg("%s is stopping, wait %d sec before sending SIGKILL ...",
-		    svc_ident(svc, NULL, 0), svc->killdelay / 1000);
+		service_watchdog_stop(svc);
 		service_timeout_cancel(svc);
-		service_timeout_after(svc, svc->killdelay, service_kill);
+		if (!service_script_busy(svc, "stop"))
+			service_kill_after(svc);
 	}
 
 	if (svc->state == new_state)
 		return;
 	*state = new_state;
+	trace_svc(svc);
 
 	if (svc_is_runtask(svc)) {
 		char success[MAX_COND_LEN], failure[MAX_COND_LEN];
@@ -2604,6 +3017,8 @@ static void svc_set_state(svc_t *svc, svc_state_t new_state)
 			break;
 		}
 	}
+
+	graph_state(svc, old_state);
 }
 
 /*
@@ -2631,6 +3046,7 @@ void service_ready(svc_t *svc, int ready)
 
 	snprintf(buf, sizeof(buf), "service/%s/ready", svc_ident(svc, NULL, 0));
 	if (ready) {
+		graph_ready(svc);
 		cond_set(buf);
 
 		if (svc_has_ready(svc))
@@ -2659,13 +3075,16 @@ restart:
 
 	dbg("%20s(%4d): %8s %3sabled/%-7s cond:%-4s", svc_ident(svc, NULL, 0), svc->pid,
 	   svc_status(svc), enabled ? "en" : "dis", svc_dirtystr(svc),
-	   condstr(cond_get_agg(svc->cond)));
+	   condstr(cond_get_agg_svc(svc)));
 
 	switch (svc->state) {
 	case SVC_HALTED_STATE:
 		if (enabled) {
 			svc_set_state(svc, SVC_WAITING_STATE);
 		} else {
+			/* Keep sockets, and any pending connections, over a restart */
+			if (svc->block != SVC_BLOCK_RESTARTING)
+				sock_close(svc);
 			if (svc_is_removed(svc)) {
 				svc_set_state(svc, SVC_DEAD_STATE);
 			} else if (svc_is_conflict(svc)) {
@@ -2712,7 +3131,7 @@ restart:
 		break;
 
 	case SVC_STOPPING_STATE:
-		if (!svc->pid) {
+		if (!svc->pid && !service_script_busy(svc, "stop")) {
 			char condstr[MAX_COND_LEN];
 
 			dbg("%s: stopped, cleaning up timers and conditions ...", svc_ident(svc, NULL, 0));
@@ -2781,7 +3200,7 @@ restart:
 	case SVC_WAITING_STATE:
 		if (!enabled) {
 			svc_set_state(svc, SVC_HALTED_STATE);
-		} else if (cond_get_agg(svc->cond) == COND_ON) {
+		} else if (cond_get_agg_svc(svc) == COND_ON) {
 			/* wait until all processes have been stopped before continuing... */
 			if (sm_in_reload())
 				break;
@@ -2799,13 +3218,22 @@ restart:
 				break;
 			}
 
+			/* Socket activated, wait for first connection, see sock.c */
+			if (sock_defer(svc))
+				break;
+
+			/* Wait for a start slot, see graph.c */
+			if (graph_defer(svc))
+				break;
+
 			if (svc_has_pre(svc)) {
 				svc_set_state(svc, SVC_SETUP_STATE);
 				service_pre_script(svc);
 				break;
 			}
 			svc_set_state(svc, SVC_STARTING_STATE);
-		}
+		} else
+			graph_cancel(svc);
 		break;
 
 	case SVC_STARTING_STATE:
@@ -2839,6 +3267,13 @@ restart:
 		}
 
 		if (!svc->pid) {
+			/* Socket activated and done, wait for next connection */
+			if (svc_is_sockact(svc) && WIFEXITED(svc->status) && !WEXITSTATUS(svc->status)) {
+				dbg("%s exited, waiting for next connection", svc_ident(svc, NULL, 0));
+				svc_set_state(svc, SVC_HALTED_STATE);
+				break;
+			}
+
 			if (svc_is_daemon(svc) || svc_is_tty(svc)) {
 				svc_restarting(svc); /* BLOCK_RESTARTING */
 				svc_set_state(svc, SVC_HALTED_STATE);
@@ -2868,14 +3303,14 @@ restart:
 		}
 		service_timeout_cancel(svc);
 
-		cond = cond_get_agg(svc->cond);
+		cond = cond_get_agg_svc(svc);
 		switch (cond) {
 		case COND_OFF:
 			service_stop(svc);
 			break;
 
 		case COND_FLUX:
-			kill(svc->pid, SIGSTOP);
+			svc_kill(svc, SIGSTOP);
 			svc_set_state(svc, SVC_PAUSED_STATE);
 			break;
 
@@ -2908,7 +3343,7 @@ restart:
 
 	case SVC_PAUSED_STATE:
 		if (!enabled) {
-			kill(svc->pid, SIGCONT);
+			svc_kill(svc, SIGCONT);
 			service_stop(svc);
 			break;
 		}
@@ -2919,10 +3354,10 @@ restart:
 			break;
 		}
 
-		cond = cond_get_agg(svc->cond);
+		cond = cond_get_agg_svc(svc);
 		switch (cond) {
 		case COND_ON:
-			kill(svc->pid, SIGCONT);
+			svc_kill(svc, SIGCONT);
 			svc_set_state(svc, SVC_RUNNING_STATE);
 			/* Reassert condition if we go from waiting and no change */
 			if (!svc_is_changed(svc)) {
@@ -2931,7 +3366,7 @@ restart:
 
 					mkcond(svc, name, sizeof(name));
 					dbg("Reassert condition %s", name);
-					cond_set_path(cond_path(name), COND_ON);
+					cond_set_noupdate(name);
 				}
 
 				dbg("Reassert %s ready condition", svc_ident(svc, NULL, 0));
@@ -2941,7 +3376,7 @@ restart:
 
 		case COND_OFF:
 			dbg("Condition for %s is off, sending SIGCONT + SIGTERM", svc_ident(svc, NULL, 0));
-			kill(svc->pid, SIGCONT);
+			svc_kill(svc, SIGCONT);
 			service_stop(svc);
 			break;
 
@@ -2976,6 +3411,19 @@ void service_step_all(int types)
 	svc_foreach_type(types, service_step);
 }
 
+/**
+ * service_stop_all - Step all services on runlevel change
+ *
+ * Services not allowed in the new runlevel are signaled to stop in
+ * reverse dependency order, and share one deadline before SIGKILL.
+ * The caller calls graph_stop_end() when all have been collected.
+ */
+void service_stop_all(void)
+{
+	graph_stop_begin(service_kill);
+	graph_stop_all(service_step);
+}
+
 void service_worker(void *unused)
 {
 	(void)unused;
@@ -3035,8 +3483,7 @@ int service_completed(svc_t **svcp)
 		if (svc_conflicts(svc))
 			continue;
 
-		if (strstr(svc->cond, plugin_hook_str(HOOK_SVC_UP)) ||
-		    strstr(svc->cond, plugin_hook_str(HOOK_SYSTEM_UP))) {
+		if (svc->cond_hooks & ((1 << HOOK_SVC_UP) | (1 << HOOK_SYSTEM_UP))) {
 			dbg("Skipping %s(%s), post-strap hook", svc->desc, svc_ident(svc, NULL, 0));
 			continue;
 		}
@@ -3076,15 +3523,160 @@ void service_notify_reconf(void)
 	}
 }
 
+/* Check if @pid is the main process of @svc, or one of its descendants */
+static int notify_descendant(svc_t *svc, pid_t pid)
+{
+	int depth = 0;
+
+	while (pid > 1 && depth++ < 32) {
+		if (pid == svc->pid)
+			return 1;
+		pid = pid_get_ppid(pid);
+	}
+
+	return 0;
+}
+
+/*
+ * Notifications are accepted from root, or from the main process of the
+ * service and its child processes, e.g., systemd-notify in a script.
+ * The PID and UID are from SCM_CREDENTIALS, verified by the kernel.
+ */
+static int notify_allowed(svc_t *svc, struct ucred *cred)
+{
+	if (cred->uid == 0)
+		return 1;
+
+	return notify_descendant(svc, cred->pid);
+}
+
+/*
+ * The new main PID must belong to the service, we signal it on stop.
+ * Either a descendant of the current main process, or, e.g., when a
+ * daemon has forked and its parent exited, a process in the cgroup of
+ * the service.  Services in the root or init/ group can only use the
+ * first.
+ */
+static int notify_mainpid(svc_t *svc, pid_t pid)
+{
+	char grnam[80];
+
+	if (!pid_alive(pid))
+		return 0;
+	if (notify_descendant(svc, pid))
+		return 1;
+
+	return cgroup_service_has(group_name(svc, grnam, sizeof(grnam)), &svc->cgroup, pid);
+}
+
+/* Read one sd_notify() datagram with sender credentials */
+static ssize_t notify_recv(int sd, char *buf, size_t len, struct ucred *cred)
+{
+	union {
+		struct cmsghdr cmh;
+		char   control[CMSG_SPACE(sizeof(struct ucred))];
+	} u;
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = u.control,
+		.msg_controllen = sizeof(u.control),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t num;
+
+	num = recvmsg(sd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (num <= 0)
+		return num;
+
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+			memcpy(cred, CMSG_DATA(cmsg), sizeof(*cred));
+			return num;
+		}
+	}
+
+	errno = EPERM;		/* no credentials, should not happen */
+	return -1;
+}
+
+/*
+ * Handle one sd_notify() message, newline separated VAR=value, see the
+ * sd_notify(3) man page.  Unsupported variables are ignored.
+ */
+static int service_notify_systemd(svc_t *svc, char *buf, struct ucred *cred)
+{
+	char *id = svc_ident(svc, NULL, 0);
+	int ready = 0;
+	char *token;
+
+	for (token = strtok(buf, "\n"); token; token = strtok(NULL, "\n")) {
+		long long val;
+
+		if (!strcmp(token, "READY=1")) {
+			ready = 1;
+		} else if (!strcmp(token, "RELOADING=1")) {
+			dbg("%s: reloading", id);
+			svc_starting(svc);
+			service_ready(svc, 0);
+		} else if (!strcmp(token, "STOPPING=1")) {
+			dbg("%s: stopping", id);
+			service_watchdog_stop(svc);
+			service_ready(svc, 0);
+		} else if (!strcmp(token, "WATCHDOG=1")) {
+			service_watchdog_kick(svc);
+		} else if (!strcmp(token, "WATCHDOG=trigger")) {
+			service_watchdog_stop(svc);
+			service_watchdog_cb(&svc->watchdog_timer, svc, 0);
+		} else if (!strncmp(token, "WATCHDOG_USEC=", 14)) {
+			val = strtonum(&token[14], 1000, 3600000000LL, NULL);
+			if (val && svc->watchdog) {
+				svc->watchdog_tmo = (int)(val / 1000);
+				service_watchdog_kick(svc);
+			}
+		} else if (!strncmp(token, "STATUS=", 7)) {
+			if (svc_set_str(&svc->notify_status, &token[7]) < 0)
+				dbg("%s: out of memory saving status", id);
+		} else if (!strncmp(token, "MAINPID=", 8)) {
+			val = strtonum(&token[8], 2, INT32_MAX, NULL);
+			if (!val || (cred->uid != 0 && cred->pid != svc->pid) || !notify_mainpid(svc, val)) {
+				dbg("%s: ignoring %s from PID %d", id, token, cred->pid);
+				continue;
+			}
+			if (val != svc->pid) {
+				dbg("%s: main PID changed from %d to %lld", id, svc->pid, val);
+				svc_set_pid(svc, (pid_t)val);
+			}
+		} else if (!strncmp(token, "EXTEND_TIMEOUT_USEC=", 20)) {
+			/* Finit has no start timeout, only extend kill delay */
+			val = strtonum(&token[20], 1, 3600000000LL, NULL);
+			if (val && svc->state == SVC_STOPPING_STATE && svc->timer_cb == service_kill) {
+				service_timeout_cancel(svc);
+				service_timeout_after(svc, (int)(val / 1000) + 1, service_kill);
+			}
+		}
+	}
+
+	return ready;
+}
+
 /*
  * Called when a service sends readiness notification, or when
  * the service closes its end of the IPC connection.
  */
 static void service_notify_cb(uev_t *w, void *arg, int events)
 {
+	static char buf[NOTIFY_MAX + 1];
 	svc_t *svc = (svc_t *)arg;
+	struct ucred cred;
 	int ready = 0;
-	char buf[32];
 	ssize_t len;
 
 	if (UEV_ERROR == events) {
@@ -3093,8 +3685,13 @@ static void service_notify_cb(uev_t *w, void *arg, int events)
 		return;
 	}
 
-	len = read(w->fd, buf, sizeof(buf) - 1);
+	if (svc->notify == SVC_NOTIFY_SYSTEMD)
+		len = notify_recv(w->fd, buf, sizeof(buf) - 1, &cred);
+	else
+		len = read(w->fd, buf, sizeof(buf) - 1);
 	if (len <= 0) {
+		if (len == -1 && errno == EAGAIN)
+			return;
 		warn("Failed reading notification from %s", svc_ident(svc, NULL, 0));
 		return;
 	}
@@ -3102,15 +3699,12 @@ static void service_notify_cb(uev_t *w, void *arg, int events)
 
 	/* Check for systemd READY=1 or s6 newline termination */
 	if (svc->notify == SVC_NOTIFY_SYSTEMD) {
-		char *token = strtok(buf, "\n");
-
-		while (token) {
-			if (!strcmp(token, "READY=1")) {
-				ready = 1;
-				break;
-			}
-			token = strtok(NULL, "\n");
+		if (!notify_allowed(svc, &cred)) {
+			logit(LOG_WARNING, "%s: ignoring notification from PID %d, UID %d",
+			      svc_ident(svc, NULL, 0), cred.pid, cred.uid);
+			return;
 		}
+		ready = service_notify_systemd(svc, buf, &cred);
 	} else if (svc->notify == SVC_NOTIFY_S6 && buf[len - 1] == '\n') {
 		ready = 1;
 	}
@@ -3182,6 +3776,15 @@ static void service_interval_cb(uev_t *w, void *arg, int events)
 	service_init(NULL);
 }
 
+/*
+ * Called when a socket activated service with idle:SEC has not had any
+ * new connections for a while.  It goes back to waiting, see sock.c
+ */
+static void service_idle(svc_t *svc)
+{
+	service_stop(svc);
+}
+
 /*
  * The service_interval may change (conf) between invocations, so we
  * periodically reset the one-shot timer instead of using a periodic.
@@ -3191,9 +3794,12 @@ void service_init(uev_ctx_t *ctx)
 	static int initialized = 0;
 	static uev_t watcher;
 
-	if (!initialized)
+	if (!initialized) {
 		uev_timer_init(ctx, &watcher, service_interval_cb, NULL, service_interval, 0);
-	else
+		svc_pidfd_init(ctx, service_pidfd_exit);
+		sock_init(ctx, service_step, service_idle, service_spawn);
+		logmux_init();
+	} else
 		uev_timer_set(&watcher, service_interval, 0);
 
 	initialized = 1;
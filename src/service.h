@@ -45,6 +45,7 @@ void      service_ready          (svc_t *svc, int ready);
 int       service_stop           (svc_t *svc);
 int       service_step           (svc_t *svc);
 void      service_step_all       (int types);
+void      service_stop_all       (void);
 void      service_worker         (void *unused);
 
 int       service_completed      (svc_t **svc);
@@ -86,6 +86,7 @@
 #endif
 
 #include "finit.h"
+#include "cgroup.h"
 #include "cond.h"
 #include "conf.h"
 #include "config.h"
@@ -194,6 +195,11 @@ static void fs_swapoff(void)
 	endmntent(fp);
 }
 
+struct iter {
+	int (*cb)(int, void *);
+	void *data;
+};
+
 /*
  * Kernel threads have no cmdline so fgets() returns NULL for them.  We
  * also skip "special" processes, e.g. mdadm/mdmon or watchdogd that must
@@ -201,48 +207,60 @@ static void fs_swapoff(void)
  *
  * https://www.freedesktop.org/wiki/Software/systemd/RootStorageDaemons/
  */
+static int iterate_one(int pid, void *arg)
+{
+	struct iter *it = (struct iter *)arg;
+	char file[LINE_SIZE] = "";
+	int rc = 0;
+	FILE *fp;
+
+	if (pid <= 1)
+		return 0;
+
+	snprintf(file, sizeof(file), "/proc/%d/cmdline", pid);
+	fp = fopen(file, "r");
+	if (!fp)
+		return 0;
+
+	if (fgets(file, sizeof(file), fp)) {
+		if (strstr(file, "gdbserver"))
+			dbg("Skipping %s ...", file);
+		else if (file[0] == '@')
+			dbg("Skipping %s ...", &file[1]);
+		else if (strstr(file, "initctl"))
+			dbg("Skipping %s ...", file);
+		else if ((rc = it->cb(pid, it->data)))
+			dbg("PID %d is still alive (%s)", pid, file);
+	}
+	fclose(fp);
+
+	return rc;
+}
+
+/*
+ * Remaining processes are found from cgroup.procs of all our cgroups,
+ * including the root group, falling back to scanning all of /proc if
+ * cgroups are not in use.  Kernel threads and PID 1 are skipped by
+ * iterate_one() in both cases.
+ */
 void do_iterate_proc(int (*cb)(int, void *), void *data)
 {
+	struct iter it = { cb, data };
 	DIR *dirp;
 
+	if (cgroup_foreach_pid(iterate_one, &it) >= 0)
+		return;
+
 	dirp = opendir("/proc");
 	if (dirp) {
 		struct dirent *d;
 
 		while ((d = readdir(dirp))) {
-			int pid;
-			FILE *fp;
-			char file[LINE_SIZE] = "";
-
 			if (d->d_type != DT_DIR)
 				continue;
 
-			pid = atoi(d->d_name);
-			if (!pid)
-				continue;
-			if (pid == 1)
-				continue;
-
-			snprintf(file, sizeof(file), "/proc/%s/cmdline", d->d_name);
-			fp = fopen(file, "r");
-			if (!fp)
-				continue;
-
-			if (fgets(file, sizeof(file), fp)) {
-				if (strstr(file, "gdbserver"))
-					dbg("Skipping %s ...", file);
-				else if (file[0] == '@')
-					dbg("Skipping %s ...", &file[1]);
-				else if (strstr(file, "initctl"))
-					dbg("Skipping %s ...", file);
-				else
-					if (cb(pid, data)) {
-						dbg("PID %d is still alive (%s)", pid, file);
-						fclose(fp);
-						break;
-					}
-			}
-			fclose(fp);
+			if (iterate_one(atoi(d->d_name), &it))
+				break;
 		}
 		closedir(dirp);
 	}
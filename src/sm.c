@@ -29,12 +29,14 @@
 #include "finit.h"
 #include "cond.h"
 #include "conf.h"
+#include "graph.h"
 #include "log.h"
 #include "helpers.h"
 #include "private.h"
 #include "schedule.h"
 #include "service.h"
 #include "sig.h"
+#include "trace.h"
 #include "tty.h"
 #include "sm.h"
 #include "utmp-api.h"
@@ -184,6 +186,7 @@ void sm_init(void)
 	sm.newlevel = -1;
 	sm.reload = 0;
 	sm.in_reload = 0;
+	trace_sm(sm_status(sm.state));
 
 	dbg("Starting bootstrap finalize timer ...");
 	schedule_work(&work);
@@ -196,6 +199,7 @@ void sm_step(void)
 
 restart:
 	old_state = sm.state;
+	trace_sm(sm_status(sm.state));
 
 	dbg("state: %s, runlevel: %c, newlevel: %d, teardown: %d, reload: %d",
 	    sm_status(sm.state), sm_rl2ch(runlevel), sm.newlevel, sm.in_reload, sm.reload);
@@ -297,7 +301,7 @@ restart:
 
 		dbg("Stopping services not allowed in new runlevel ...");
 		sm.in_reload = 1;
-		service_step_all(SVC_TYPE_ANY);
+		service_stop_all();
 
 		sm.state = SM_RUNLEVEL_WAIT_STATE;
 		break;
@@ -312,6 +316,7 @@ restart:
 			dbg("Waiting to collect %s, cmd %s(%d) ...", svc_ident(svc, NULL, 0), svc->cmd, svc->pid);
 			break;
 		}
+		graph_stop_end();
 
 		/* Prev runlevel services stopped, call hooks before starting new runlevel ... */
 		dbg("All services have been stopped, calling runlevel change hooks ...");
@@ -0,0 +1,1026 @@
+/* Socket activation, listening sockets held on behalf of services
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A service with socket:SPEC[,SPEC] is not started when its conditions
+ * are satisfied.  Instead we bind its listening sockets, and wait for
+ * the first connection, or datagram, before we let it proceed.  The
+ * sockets are handed over as fd 3 and up, with LISTEN_FDS and LISTEN_PID
+ * set, like systemd does.  We keep our copies, so the service can exit,
+ * or be stopped when idle, and be started again on the next connection
+ * without any being lost.
+ *
+ * SPEC is one of:
+ *
+ *   tcp:[ADDR:]PORT    stream socket
+ *   udp:[ADDR:]PORT    datagram socket
+ *   unix:/path         stream socket, unix:@name for abstract namespace
+ *   fifo:/path         named pipe, created if missing
+ *
+ * ADDR is a numeric IPv4 or IPv6 address, the latter in brackets, e.g.,
+ * tcp:[::1]:80.  Without ADDR the socket accepts both IPv4 and IPv6.
+ *
+ * With idle:SEC the service is stopped when there has been no new
+ * connection, or datagram, for SEC seconds.  Traffic on connections the
+ * service has already accepted is not visible to us.
+ *
+ * With accept[:MAX], inetd style, we accept connections ourselves and
+ * start one instance of the service per connection, with the connection
+ * as its stdin, stdout and stderr.  The service itself stays waiting,
+ * the instances are only counted children, not svc_t, so short lived
+ * connections cost us a small struct each.  At most MAX instances may
+ * run at the same time, and with rate:NUM[/SEC] each source address may
+ * connect at most NUM times per SEC seconds.  Further connections are
+ * closed directly.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>		/* offsetof() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+
+#include "finit.h"
+#include "log.h"
+#include "sock.h"
+
+#define SOCK_RETRY       2000	/* msec, retry bind() after failure */
+#define SOCK_BURST       16	/* Max accept() per event, be fair to others */
+#define SOCK_RATE_SLOTS  256	/* Source addresses tracked per service */
+#define SOCK_RATE_PROBE  8
+#define SOCK_INST_HASH   256
+
+enum {
+	SOCK_TCP,
+	SOCK_UDP,
+	SOCK_UNIX,
+	SOCK_FIFO,
+};
+
+enum {
+	SOCK_WATCH_OFF = 0,
+	SOCK_WATCH_LEVEL,	/* Waiting for first connection */
+	SOCK_WATCH_EDGE,	/* Service running, only for idle:SEC */
+};
+
+struct sock_ent {
+	int       type;
+	char     *spec;		/* For log messages, points into svc_sock.spec */
+	int       any;		/* No ADDR, dual-stack */
+	socklen_t len;
+	struct sockaddr_storage ss;
+	int       fd;
+	uev_t     watcher;
+};
+
+/* Connections from one source address in the current period */
+struct sock_rate {
+	struct in6_addr addr;	/* IPv4 as v4-mapped */
+	unsigned int    period;	/* Number of period, 0: unused */
+	unsigned int    count;
+};
+
+/* One per connection instance of an accept service */
+struct sock_inst {
+	LIST_ENTRY(sock_inst) link;	/* inst_hash[], by PID */
+	LIST_ENTRY(sock_inst) node;	/* svc_sock.inst */
+	struct svc_sock *s;		/* NULL if service has been removed */
+	pid_t     pid;
+};
+
+struct svc_sock {
+	svc_t    *svc;
+	char     *spec;		/* Copy of svc->socket, split at ',' */
+	int       idle;		/* msec, 0: never stop */
+	char      mode;		/* SOCK_WATCH_* */
+	char      pending;	/* Connection waiting, let service start */
+	char      armed;
+	uev_t     timer;	/* Idle timeout, or bind() retry */
+
+	int       accept;	/* Max instances, 0: pass sockets to service */
+	int       ninst;
+	char      full;		/* Max instances reached, logged */
+	char      nofd;		/* Out of descriptors, logged */
+	int       rate;		/* Max connections per source and period */
+	int       period;	/* sec */
+	struct sock_rate *rtab;
+	LIST_HEAD(, sock_inst) inst;
+
+	int       num;
+	struct sock_ent ent[SOCK_MAX];
+};
+
+/* Set by sock_init() */
+static uev_ctx_t *sock_ctx;
+static int      (*activate_cb)(svc_t *svc);
+static void     (*idle_cb)(svc_t *svc);
+static pid_t    (*spawn_cb)(svc_t *svc, int sd, char *const env[]);
+
+static LIST_HEAD(, sock_inst) inst_hash[SOCK_INST_HASH];
+
+static void sock_watch(struct svc_sock *s, int mode);
+static void sock_accept(struct svc_sock *s, int sd);
+
+static void sock_timer_cb(uev_t *w, void *arg, int events)
+{
+	struct svc_sock *s = arg;
+	svc_t *svc = s->svc;
+
+	s->armed = 0;
+	if (UEV_ERROR == events) {
+		dbg("%s: spurious problem with socket timer", svc_ident(svc, NULL, 0));
+		return;
+	}
+
+	switch (svc->state) {
+	case SVC_RUNNING_STATE:
+		logit(LOG_NOTICE, "%s: idle for %d sec, stopping.",
+		      svc_ident(svc, NULL, 0), s->idle / 1000);
+		idle_cb(svc);
+		break;
+
+	case SVC_WAITING_STATE:
+		activate_cb(svc);	/* retry bind(), or accept() */
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void sock_timer(struct svc_sock *s, int msec)
+{
+	if (s->armed) {
+		uev_timer_stop(&s->timer);
+		s->armed = 0;
+	}
+
+	if (!msec)
+		return;
+
+	if (uev_timer_init(sock_ctx, &s->timer, sock_timer_cb, s, msec, 0))
+		err(1, "%s: failed starting socket timer", svc_ident(s->svc, NULL, 0));
+	else
+		s->armed = 1;
+}
+
+static void sock_cb(uev_t *w, void *arg, int events)
+{
+	struct svc_sock *s = arg;
+	svc_t *svc = s->svc;
+
+	if (UEV_ERROR == events)
+		dbg("%s: socket %d invalid.", svc_ident(svc, NULL, 0), w->fd);
+
+	/* New connection while running, push idle timeout forward */
+	if (s->mode == SOCK_WATCH_EDGE) {
+		if (svc->state == SVC_RUNNING_STATE && s->idle)
+			sock_timer(s, s->idle);
+		return;
+	}
+
+	if (s->accept) {
+		sock_accept(s, w->fd);
+		return;
+	}
+
+	dbg("%s: activity on socket %d, starting.", svc_ident(svc, NULL, 0), w->fd);
+	s->pending = 1;
+	sock_watch(s, SOCK_WATCH_OFF);
+	activate_cb(svc);
+}
+
+static void sock_watch(struct svc_sock *s, int mode)
+{
+	int events = UEV_READ;
+	int i;
+
+	if (s->mode == mode)
+		return;
+
+	if (mode == SOCK_WATCH_EDGE)
+		events |= UEV_EDGE;
+
+	for (i = 0; i < s->num; i++) {
+		struct sock_ent *e = &s->ent[i];
+
+		if (e->fd < 0)
+			continue;
+
+		if (s->mode != SOCK_WATCH_OFF)
+			uev_io_stop(&e->watcher);
+		if (mode == SOCK_WATCH_OFF)
+			continue;
+
+		if (uev_io_init(sock_ctx, &e->watcher, sock_cb, s, e->fd, events))
+			err(1, "%s: failed watching %s", svc_ident(s->svc, NULL, 0), e->spec);
+	}
+
+	s->mode = mode;
+}
+
+static int sock_open(struct sock_ent *e, int nonblock)
+{
+	struct sockaddr *sa = (struct sockaddr *)&e->ss;
+	int type = SOCK_STREAM;
+	int sd, saved;
+
+	switch (e->type) {
+	case SOCK_FIFO:
+		if (mkfifo(e->spec + 5, 0666) && errno != EEXIST)
+			return -1;
+
+		/* Read-write, so open() does not block and we never see EOF */
+		sd = open(e->spec + 5, O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (sd != -1)
+			fchmod(sd, 0666);
+		return sd;
+
+	case SOCK_UNIX:
+		if (((struct sockaddr_un *)sa)->sun_path[0])
+			(void)remove(((struct sockaddr_un *)sa)->sun_path);
+		break;
+
+	case SOCK_UDP:
+		type = SOCK_DGRAM;
+		break;
+	}
+
+	/* We only accept() on our own sockets, and must never block */
+	if (nonblock)
+		type |= SOCK_NONBLOCK;
+
+	sd = socket(sa->sa_family, type | SOCK_CLOEXEC, 0);
+	if (sd == -1 && e->any && errno == EAFNOSUPPORT) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)sa;
+		struct sockaddr_in sin = {
+			.sin_family      = AF_INET,
+			.sin_port        = sin6->sin6_port,
+			.sin_addr.s_addr = htonl(INADDR_ANY),
+		};
+
+		/* No IPv6 in kernel, fall back to IPv4 only */
+		memcpy(&e->ss, &sin, sizeof(sin));
+		e->len = sizeof(sin);
+		e->any = 0;
+		sd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+	}
+	if (sd == -1)
+		return -1;
+
+	if (sa->sa_family != AF_UNIX)
+		setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+	if (e->any)
+		setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &(int){ 0 }, sizeof(int));
+
+	if (bind(sd, sa, e->len))
+		goto fail;
+
+	if (e->type == SOCK_UNIX && ((struct sockaddr_un *)sa)->sun_path[0])
+		chmod(((struct sockaddr_un *)sa)->sun_path, 0666);
+
+	if (e->type != SOCK_UDP && listen(sd, SOMAXCONN))
+		goto fail;
+
+	return sd;
+fail:
+	saved = errno;
+	close(sd);
+	errno = saved;
+	return -1;
+}
+
+/*
+ * Bind all sockets not already bound.  A socket that fails, e.g., if
+ * the address is still in use, is retried later.
+ */
+static int sock_bind(struct svc_sock *s)
+{
+	int rc = 0;
+	int i;
+
+	for (i = 0; i < s->num; i++) {
+		struct sock_ent *e = &s->ent[i];
+
+		if (e->fd >= 0)
+			continue;
+
+		e->fd = sock_open(e, s->accept);
+		if (e->fd < 0) {
+			logit(LOG_WARNING, "%s: failed binding %s: %s", svc_ident(s->svc, NULL, 0),
+			      e->spec, strerror(errno));
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
+
+/* Format source address for log and the environment of an instance */
+static const char *sock_ntop(struct sockaddr_storage *ss, char *buf, size_t len, int *port)
+{
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+	struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+
+	switch (ss->ss_family) {
+	case AF_INET:
+		*port = ntohs(sin->sin_port);
+		return inet_ntop(AF_INET, &sin->sin_addr, buf, len);
+
+	case AF_INET6:
+		*port = ntohs(sin6->sin6_port);
+		if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+			return inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], buf, len);
+		return inet_ntop(AF_INET6, &sin6->sin6_addr, buf, len);
+	}
+
+	return NULL;
+}
+
+/*
+ * Check if the source address of a new connection has exceeded the
+ * rate:NUM[/SEC] of the service.  Addresses are tracked in a small
+ * open addressing table, entries from a previous period are reused.
+ * If the table is full, e.g., during a distributed flood, we let the
+ * connection through, max instances still apply.
+ */
+static int sock_limit(struct svc_sock *s, struct sockaddr_storage *ss, const char *addr)
+{
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+	struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+	struct sock_rate *r, *slot = NULL;
+	struct in6_addr key = { 0 };
+	unsigned int hash = 2166136261u;
+	struct timespec now;
+	unsigned int period;
+	size_t i;
+
+	if (!s->rate || !s->rtab)
+		return 0;
+
+	switch (ss->ss_family) {
+	case AF_INET:
+		key.s6_addr[10] = 0xff;
+		key.s6_addr[11] = 0xff;
+		memcpy(&key.s6_addr[12], &sin->sin_addr, 4);
+		break;
+
+	case AF_INET6:
+		key = sin6->sin6_addr;
+		break;
+
+	default:
+		return 0;	/* UNIX socket, no source address */
+	}
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(key.s6_addr); i++)
+		hash = (hash ^ key.s6_addr[i]) * 16777619u;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	period = (unsigned int)(now.tv_sec / s->period) + 1;
+
+	for (i = 0; i < SOCK_RATE_PROBE; i++) {
+		r = &s->rtab[(hash + i) % SOCK_RATE_SLOTS];
+		if (r->period != period) {
+			if (!slot)
+				slot = r;
+			continue;
+		}
+
+		if (!memcmp(&r->addr, &key, sizeof(key))) {
+			slot = r;
+			goto found;
+		}
+	}
+	if (!slot)
+		return 0;
+
+	slot->addr   = key;
+	slot->period = period;
+	slot->count  = 0;
+found:
+	if (++slot->count <= (unsigned int)s->rate)
+		return 0;
+
+	if (slot->count == (unsigned int)s->rate + 1)
+		logit(LOG_WARNING, "%s: %s exceeds %d connections per %d sec, refusing.",
+		      svc_ident(s->svc, NULL, 0), addr ?: "peer", s->rate, s->period);
+
+	return 1;
+}
+
+static void sock_inst_add(struct svc_sock *s, pid_t pid)
+{
+	struct sock_inst *i;
+
+	i = malloc(sizeof(*i));
+	if (!i) {
+		/* Cannot track it, collected as an unknown PID */
+		err(1, "%s: failed tracking instance PID %d", svc_ident(s->svc, NULL, 0), pid);
+		return;
+	}
+
+	i->s   = s;
+	i->pid = pid;
+	LIST_INSERT_HEAD(&inst_hash[pid % SOCK_INST_HASH], i, link);
+	LIST_INSERT_HEAD(&s->inst, i, node);
+	s->ninst++;
+}
+
+/*
+ * Accept new connections on a socket of an accept service, start one
+ * instance per connection.  At most SOCK_BURST per event, the rest are
+ * picked up in the next loop iteration.  If we run out of descriptors,
+ * or memory, the connection stays in the backlog and our level watcher
+ * would fire again immediately, so we stop watching for SOCK_RETRY and
+ * let sock_timer_cb() arm the watchers again.
+ */
+static void sock_accept(struct svc_sock *s, int sd)
+{
+	char str[INET6_ADDRSTRLEN + 12], prt[20];
+	char *env[3] = { NULL };
+	struct sockaddr_storage ss;
+	const char *addr;
+	socklen_t len;
+	int i, port;
+	pid_t pid;
+
+	for (i = 0; i < SOCK_BURST; i++) {
+		int conn;
+
+		len = sizeof(ss);
+		conn = accept4(sd, (struct sockaddr *)&ss, &len, SOCK_CLOEXEC);
+		if (conn == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				if (!s->nofd)
+					logit(LOG_WARNING, "%s: failed accept(): %s, retrying.",
+					      svc_ident(s->svc, NULL, 0), strerror(errno));
+				s->nofd = 1;
+				sock_watch(s, SOCK_WATCH_OFF);
+				sock_timer(s, SOCK_RETRY);
+				break;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				logit(LOG_WARNING, "%s: failed accept(): %s",
+				      svc_ident(s->svc, NULL, 0), strerror(errno));
+			break;
+		}
+		s->nofd = 0;
+
+		strlcpy(str, "REMOTE_ADDR=", sizeof(str));
+		addr = sock_ntop(&ss, &str[12], sizeof(str) - 12, &port);
+
+		if (s->ninst >= s->accept) {
+			if (!s->full)
+				logit(LOG_WARNING, "%s: max %d instances reached, refusing connections.",
+				      svc_ident(s->svc, NULL, 0), s->accept);
+			s->full = 1;
+			close(conn);
+			continue;
+		}
+
+		if (sock_limit(s, &ss, addr)) {
+			close(conn);
+			continue;
+		}
+
+		if (addr) {
+			snprintf(prt, sizeof(prt), "REMOTE_PORT=%d", port);
+			env[0] = str;
+			env[1] = prt;
+		} else
+			env[0] = NULL;
+
+		pid = spawn_cb(s->svc, conn, env);
+		close(conn);
+		if (pid <= 0) {
+			err(1, "%s: failed starting instance", svc_ident(s->svc, NULL, 0));
+			continue;
+		}
+
+		dbg("%s: connection from %s, started PID %d", svc_ident(s->svc, NULL, 0),
+		    addr ?: "peer", pid);
+		sock_inst_add(s, pid);
+	}
+}
+
+static int parse_inet(struct sock_ent *e, char *arg)
+{
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&e->ss;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&e->ss;
+	char *addr = NULL, *port;
+	const char *errstr;
+	long long num;
+
+	if (arg[0] == '[') {
+		addr = &arg[1];
+		port = strchr(addr, ']');
+		if (!port || port[1] != ':')
+			return -1;
+		*port = 0;
+		port += 2;
+	} else if ((port = strrchr(arg, ':'))) {
+		*port++ = 0;
+		addr = arg;
+	} else
+		port = arg;
+
+	num = strtonum(port, 1, 65535, &errstr);
+	if (errstr)
+		return -1;
+
+	if (!addr || !addr[0]) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr   = in6addr_any;
+		sin6->sin6_port   = htons(num);
+		e->len = sizeof(*sin6);
+		e->any = 1;
+	} else if (inet_pton(AF_INET, addr, &sin->sin_addr) == 1) {
+		sin->sin_family   = AF_INET;
+		sin->sin_port     = htons(num);
+		e->len = sizeof(*sin);
+	} else if (inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port   = htons(num);
+		e->len = sizeof(*sin6);
+	} else
+		return -1;
+
+	return 0;
+}
+
+static int parse_unix(struct sock_ent *e, char *path)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *)&e->ss;
+	size_t len = strlen(path);
+
+	if (!len || len >= sizeof(sun->sun_path))
+		return -1;
+
+	sun->sun_family = AF_UNIX;
+	memcpy(sun->sun_path, path, len);
+	if (path[0] == '@')
+		sun->sun_path[0] = 0;
+	else if (path[0] != '/')
+		return -1;
+	e->len = offsetof(struct sockaddr_un, sun_path) + len + 1;
+	if (path[0] == '@')
+		e->len--;	/* abstract name is not NUL terminated */
+
+	return 0;
+}
+
+static int parse_spec(struct sock_ent *e, char *spec)
+{
+	char *arg = strdupa(spec);
+
+	memset(e, 0, sizeof(*e));
+	e->spec = spec;
+	e->fd   = -1;
+
+	if (!strncmp(arg, "tcp:", 4)) {
+		e->type = SOCK_TCP;
+		return parse_inet(e, arg + 4);
+	}
+	if (!strncmp(arg, "udp:", 4)) {
+		e->type = SOCK_UDP;
+		return parse_inet(e, arg + 4);
+	}
+	if (!strncmp(arg, "unix:", 5)) {
+		e->type = SOCK_UNIX;
+		return parse_unix(e, arg + 5);
+	}
+	if (!strncmp(arg, "fifo:", 5) && arg[5] == '/') {
+		e->type = SOCK_FIFO;
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * sock_init - Set up socket activation
+ * @ctx:      Event context to register socket watchers with
+ * @activate: Called when a socket of a waiting service has activity
+ * @idle:     Called when a running service has been idle for idle:SEC
+ * @spawn:    Start an instance of an accept service for connection @sd
+ */
+void sock_init(uev_ctx_t *ctx, int (*activate)(svc_t *svc), void (*idle)(svc_t *svc),
+	       pid_t (*spawn)(svc_t *svc, int sd, char *const env[]))
+{
+	sock_ctx    = ctx;
+	activate_cb = activate;
+	idle_cb     = idle;
+	spawn_cb    = spawn;
+}
+
+/* accept[:MAX], returns max instances, or 0 */
+static int parse_accept(svc_t *svc, char *arg)
+{
+	const char *errstr;
+	long long num;
+
+	if (!arg)
+		return 0;
+	if (!arg[0])
+		return SOCK_ACCEPT_MAX;
+
+	num = arg[0] == ':' ? strtonum(&arg[1], 1, 65535, &errstr) : 0;
+	if (!num) {
+		logit(LOG_WARNING, "%s: invalid accept%s, using default %d instances.",
+		      svc_ident(svc, NULL, 0), arg, SOCK_ACCEPT_MAX);
+		return SOCK_ACCEPT_MAX;
+	}
+
+	return (int)num;
+}
+
+/* rate:NUM[/SEC], default SEC is 60 */
+static void parse_rate(svc_t *svc, char *arg, int *rate, int *period)
+{
+	const char *errstr = NULL;
+	char *sec;
+
+	*rate   = 0;
+	*period = 60;
+	if (!arg)
+		return;
+
+	arg = strdupa(arg);
+	sec = strchr(arg, '/');
+	if (sec) {
+		*sec++ = 0;
+		*period = (int)strtonum(sec, 1, 86400, &errstr);
+	}
+	if (!errstr)
+		*rate = (int)strtonum(arg, 0, 65535, &errstr);
+	if (errstr) {
+		logit(LOG_WARNING, "%s: invalid rate:%s, ignoring.", svc_ident(svc, NULL, 0), arg);
+		*rate   = 0;
+		*period = 60;
+	}
+}
+
+/* Limits can be changed without restarting the service */
+static void sock_limits(struct svc_sock *s, int idle, int accept, int rate, int period)
+{
+	s->idle   = idle;
+	s->accept = accept;
+	s->period = period;
+	s->rate   = rate;
+
+	if (!s->rate) {
+		free(s->rtab);
+		s->rtab = NULL;
+		return;
+	}
+
+	if (!s->rtab) {
+		s->rtab = calloc(SOCK_RATE_SLOTS, sizeof(struct sock_rate));
+		if (!s->rtab)
+			err(1, "%s: failed allocating rate limit", svc_ident(s->svc, NULL, 0));
+	}
+}
+
+/**
+ * sock_parse - Parse socket:SPEC[,SPEC] and related options of a service
+ * @svc:    Service being registered
+ * @spec:   Value of socket:, or %NULL
+ * @idle:   Value of idle:, or %NULL
+ * @accept: What follows accept, i.e., "" or ":MAX", or %NULL
+ * @rate:   Value of rate:, or %NULL
+ *
+ * Sockets are not bound here, but when the service is about to start,
+ * see sock_defer().  If @spec is the same as before, e.g., on reload,
+ * any bound sockets are kept as-is.
+ *
+ * Returns:
+ * 1 if the sockets changed and the service needs to be restarted,
+ * otherwise 0.
+ */
+int sock_parse(svc_t *svc, char *spec, char *idle, char *accept, char *rate)
+{
+	int num, msec = 0, max, limit, period;
+	struct svc_sock *s;
+	const char *errstr;
+	char *ptr, *tok;
+	int changed;
+
+	if (idle) {
+		msec = (int)strtonum(idle, 0, 86400, &errstr) * 1000;
+		if (errstr) {
+			errx(1, "%s: idle %s is %s (0-86400)", svc_ident(svc, NULL, 0), idle, errstr);
+			msec = 0;
+		}
+	}
+	max = parse_accept(svc, accept);
+	parse_rate(svc, rate, &limit, &period);
+
+	if (spec && !svc_is_daemon(svc)) {
+		logit(LOG_WARNING, "%s: socket:%s only supported for services, ignoring.",
+		      svc_ident(svc, NULL, 0), spec);
+		spec = NULL;
+	}
+	if (!spec) {
+		if (msec || max || limit)
+			logit(LOG_WARNING, "%s: idle:, accept, and rate: require socket:, ignoring.",
+			      svc_ident(svc, NULL, 0));
+		changed = svc_is_sockact(svc);
+		sock_del(svc);
+		return changed;
+	}
+	if (max && msec) {
+		logit(LOG_WARNING, "%s: idle:%s not supported with accept, ignoring.",
+		      svc_ident(svc, NULL, 0), idle);
+		msec = 0;
+	}
+	if (!max && limit) {
+		logit(LOG_WARNING, "%s: rate:%s requires accept, ignoring.",
+		      svc_ident(svc, NULL, 0), rate);
+		limit = 0;
+	}
+
+	/* Same sockets, and same mode, keep them and any instances */
+	if (svc->sock && !strcmp(svc->socket, spec) && !svc->sock->accept == !max) {
+		sock_limits(svc->sock, msec, max, limit, period);
+		return 0;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s || !(s->spec = strdup(spec))) {
+		err(1, "%s: failed allocating sockets", svc_ident(svc, NULL, 0));
+		free(s);
+		return 0;
+	}
+	s->svc = svc;
+	LIST_INIT(&s->inst);
+	sock_limits(s, msec, max, limit, period);
+
+	for (tok = strtok_r(s->spec, ",", &ptr); tok; tok = strtok_r(NULL, ",", &ptr)) {
+		struct sock_ent *e = &s->ent[s->num];
+
+		if (s->num >= SOCK_MAX) {
+			logit(LOG_WARNING, "%s: too many sockets, max %d, skipping %s.",
+			      svc_ident(svc, NULL, 0), SOCK_MAX, tok);
+			continue;
+		}
+
+		if (parse_spec(e, tok)) {
+			logit(LOG_WARNING, "%s: invalid socket:%s, skipping.",
+			      svc_ident(svc, NULL, 0), tok);
+			continue;
+		}
+
+		/* Only connection oriented sockets can be accepted */
+		if (s->accept && (e->type == SOCK_UDP || e->type == SOCK_FIFO)) {
+			logit(LOG_WARNING, "%s: socket:%s cannot be used with accept, skipping.",
+			      svc_ident(svc, NULL, 0), tok);
+			continue;
+		}
+		s->num++;
+	}
+
+	num = s->num;
+	sock_del(svc);
+	if (!num) {
+		free(s->rtab);
+		free(s->spec);
+		free(s);
+		return 1;
+	}
+
+	svc_set_str(&svc->socket, spec);
+	svc->sock = s;
+
+	return 1;
+}
+
+/**
+ * sock_close - Close all sockets of a service
+ * @svc: Service that is no longer enabled
+ *
+ * The sockets are bound again the next time the service is enabled.
+ * Any running instances of an accept service are stopped.
+ */
+void sock_close(svc_t *svc)
+{
+	struct svc_sock *s = svc->sock;
+	struct sock_inst *inst;
+	int i;
+
+	if (!s)
+		return;
+
+	sock_timer(s, 0);
+	sock_watch(s, SOCK_WATCH_OFF);
+	s->pending = 0;
+
+	LIST_FOREACH(inst, &s->inst, node)
+		kill(inst->pid, SIGTERM);
+
+	for (i = 0; i < s->num; i++) {
+		if (s->ent[i].fd < 0)
+			continue;
+
+		close(s->ent[i].fd);
+		s->ent[i].fd = -1;
+	}
+}
+
+/**
+ * sock_del - Close and free all sockets of a service
+ * @svc: Service being removed, or with no socket: anymore
+ */
+void sock_del(svc_t *svc)
+{
+	struct svc_sock *s = svc->sock;
+
+	svc_set_str(&svc->socket, NULL);
+	if (!s)
+		return;
+
+	sock_close(svc);
+	svc->sock = NULL;
+
+	/* Instances are collected later, as orphans */
+	while (!LIST_EMPTY(&s->inst)) {
+		struct sock_inst *inst = LIST_FIRST(&s->inst);
+
+		LIST_REMOVE(inst, node);
+		inst->s = NULL;
+	}
+
+	free(s->rtab);
+	free(s->spec);
+	free(s);
+}
+
+/**
+ * sock_reap - Collect an instance of an accept service
+ * @pid:    Process that has exited
+ * @status: Exit status from waitpid()
+ *
+ * Returns:
+ * 1 if @pid was an instance, otherwise 0.
+ */
+int sock_reap(pid_t pid, int status)
+{
+	struct sock_inst *inst;
+	struct svc_sock *s;
+
+	LIST_FOREACH(inst, &inst_hash[pid % SOCK_INST_HASH], link) {
+		if (inst->pid == pid)
+			break;
+	}
+	if (!inst)
+		return 0;
+
+	s = inst->s;
+	if (s) {
+		dbg("%s: collected instance PID %d, status %d", svc_ident(s->svc, NULL, 0), pid, status);
+		LIST_REMOVE(inst, node);
+		s->ninst--;
+		s->full = 0;
+	}
+
+	LIST_REMOVE(inst, link);
+	free(inst);
+
+	return 1;
+}
+
+/**
+ * sock_defer - Check if a service should wait for a connection
+ * @svc: Service with all conditions satisfied, about to start
+ *
+ * Binds the sockets of @svc, if not already bound, and starts watching
+ * them.  Activity on any of them calls the activate callback, which is
+ * expected to step @svc again, this time we let it start.
+ *
+ * Returns:
+ * 1 if the start of @svc is deferred, 0 if it may start now.
+ */
+int sock_defer(svc_t *svc)
+{
+	struct svc_sock *s = svc->sock;
+
+	if (!s || s->pending)
+		return 0;
+
+	sock_timer(s, 0);
+	if (sock_bind(s)) {
+		sock_watch(s, SOCK_WATCH_OFF);
+		sock_timer(s, SOCK_RETRY);
+		return 1;
+	}
+
+	sock_watch(s, SOCK_WATCH_LEVEL);
+
+	return 1;
+}
+
+/**
+ * sock_started - A socket activated service has been started
+ * @svc: Service that was just started
+ *
+ * The service now handles the sockets, we only watch them, with edge
+ * triggered watchers, if we need to know when it has been idle.
+ */
+void sock_started(svc_t *svc)
+{
+	struct svc_sock *s = svc->sock;
+
+	if (!s)
+		return;
+
+	s->pending = 0;
+	if (!s->idle) {
+		sock_watch(s, SOCK_WATCH_OFF);
+		return;
+	}
+
+	sock_watch(s, SOCK_WATCH_EDGE);
+	sock_timer(s, s->idle);
+}
+
+/**
+ * sock_child - Pass sockets to a service
+ * @svc: Service being started, called in the child before exec
+ *
+ * The sockets are passed as fd 3 and up, in the order they are listed
+ * in socket:, with LISTEN_FDS, LISTEN_PID, and LISTEN_FDNAMES set, see
+ * sd_listen_fds(3).
+ */
+void sock_child(svc_t *svc)
+{
+	struct svc_sock *s = svc->sock;
+	char names[SOCK_MAX * (MAX_ARG_LEN + 1)] = "";
+	char str[16];
+	int i;
+
+	if (!s)
+		return;
+
+	/* Move out of the way first, we may already have fds in the range */
+	for (i = 0; i < s->num; i++) {
+		s->ent[i].fd = fcntl(s->ent[i].fd, F_DUPFD_CLOEXEC, SOCK_FDS_START + s->num);
+		if (s->ent[i].fd == -1)
+			_exit(1);
+	}
+
+	for (i = 0; i < s->num; i++) {
+		if (dup2(s->ent[i].fd, SOCK_FDS_START + i) == -1)
+			_exit(1);
+
+		if (i)
+			strlcat(names, ":", sizeof(names));
+		strlcat(names, svc->name, sizeof(names));
+	}
+
+	snprintf(str, sizeof(str), "%d", s->num);
+	setenv("LISTEN_FDS", str, 1);
+	snprintf(str, sizeof(str), "%d", getpid());
+	setenv("LISTEN_PID", str, 1);
+	setenv("LISTEN_FDNAMES", names, 1);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
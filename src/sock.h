@@ -0,0 +1,53 @@
+/* Socket activation, listening sockets held on behalf of services
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_SOCK_H_
+#define FINIT_SOCK_H_
+
+#include <uev/uev.h>
+#include "svc.h"
+
+#define SOCK_MAX        8		/* Max sockets per service */
+#define SOCK_FDS_START  3		/* SD_LISTEN_FDS_START */
+#define SOCK_ACCEPT_MAX 64		/* Default max instances, accept */
+
+void sock_init   (uev_ctx_t *ctx, int (*activate)(svc_t *svc), void (*idle)(svc_t *svc),
+		  pid_t (*spawn)(svc_t *svc, int sd, char *const env[]));
+
+int  sock_parse  (svc_t *svc, char *spec, char *idle, char *accept, char *rate);
+void sock_del    (svc_t *svc);
+void sock_close  (svc_t *svc);
+
+int  sock_defer  (svc_t *svc);
+void sock_started(svc_t *svc);
+void sock_child  (svc_t *svc);
+int  sock_reap   (pid_t pid, int status);
+
+#endif /* FINIT_SOCK_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
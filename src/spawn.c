@@ -0,0 +1,297 @@
+/* Lightweight process spawner, vfork() style
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <paths.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "spawn.h"
+
+/*
+ * There is no C library wrapper for clone3() that runs a function on a
+ * new stack, like clone() does, so we need a few lines of assembler,
+ * only available for x86_64.  Other architectures always use clone()
+ * and join the cgroup from the child before execve().
+ */
+#if defined(__NR_clone3) && defined(__x86_64__)
+#define SPAWN_CLONE3
+#endif
+
+/*
+ * The child runs on this stack until execve(), the parent is suspended
+ * meanwhile (CLONE_VFORK), so one is enough as long as we are single
+ * threaded.  Nothing in the child needs more than a PATH_MAX buffer.
+ */
+static char stack[32768] __attribute__((aligned(16)));
+
+/* Set when the child was created in its cgroup by clone3() */
+static int in_cgroup;
+
+static void fail(struct spawn *sp, const char *step)
+{
+	sp->failed = step;
+	sp->error  = errno;
+}
+
+static void __attribute__((noreturn)) fatal(struct spawn *sp, const char *step)
+{
+	fail(sp, step);
+	_exit(1);
+}
+
+static const char *getpath(char *const env[])
+{
+	size_t i;
+
+	for (i = 0; env && env[i]; i++) {
+		if (!strncmp(env[i], "PATH=", 5))
+			return &env[i][5];
+	}
+
+	return _PATH_DEFPATH;
+}
+
+/* Like execvpe(), but PATH from the new environment, not ours */
+static int spawn_exec(struct spawn *sp)
+{
+	size_t len = strlen(sp->cmd);
+	char buf[PATH_MAX];
+	int error = ENOENT;
+	const char *path;
+
+	if (strchr(sp->cmd, '/'))
+		return execve(sp->cmd, sp->argv, sp->env);
+
+	for (path = getpath(sp->env); *path; path++) {
+		const char *end = strchrnul(path, ':');
+		size_t dlen = end - path;
+
+		if (dlen + len + 3 <= sizeof(buf)) {
+			if (dlen)
+				memcpy(buf, path, dlen);
+			else
+				buf[dlen++] = '.';
+			buf[dlen++] = '/';
+			memcpy(&buf[dlen], sp->cmd, len + 1);
+
+			execve(buf, sp->argv, sp->env);
+			if (errno != ENOENT && errno != ENOTDIR)
+				error = errno;
+		}
+
+		if (!*end)
+			break;
+		path = end;
+	}
+
+	errno = error;
+	return -1;
+}
+
+static int spawn_child(void *arg)
+{
+	struct spawn *sp = arg;
+	struct sigaction sa;
+	sigset_t mask;
+	int fd, i;
+
+	/* Our handlers must never run here, we share memory with PID 1 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	for (i = 1; i < NSIG; i++)
+		sigaction(i, &sa, NULL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	/* Not fatal, same as cgroup_move() after a plain fork() */
+	if (sp->cgfd >= 0 && !in_cgroup) {
+		fd = openat(sp->cgfd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+		if (fd == -1 || write(fd, "0", 1) != 1)
+			fail(sp, "joining cgroup");
+		if (fd != -1)
+			close(fd);
+	}
+
+	for (i = 0; sp->rlimit && i < RLIMIT_NLIMITS; i++) {
+		if (setrlimit(i, &sp->rlimit[i]) == -1)
+			fail(sp, "setting rlimit");
+	}
+
+	if (sp->gid >= 0 && setgid(sp->gid))
+		fatal(sp, "setgid()");
+	if (sp->uid >= 0 && setuid(sp->uid))
+		fatal(sp, "setuid()");
+	if (sp->cwd && chdir(sp->cwd) && chdir("/"))
+		fatal(sp, "chdir()");
+
+	if (sp->input >= 0) {
+		dup2(sp->input, STDIN_FILENO);
+	} else {
+		fd = open("/dev/null", O_RDONLY);
+		if (fd != -1) {
+			dup2(fd, STDIN_FILENO);
+			close(fd);
+		}
+	}
+	if (sp->output >= 0) {
+		dup2(sp->output, STDOUT_FILENO);
+		dup2(sp->output, STDERR_FILENO);
+	}
+
+	if (setsid() < 1)
+		fail(sp, "setsid()");
+
+	spawn_exec(sp);
+	fatal(sp, "execve()");
+}
+
+#ifdef SPAWN_CLONE3
+/*
+ * Like clone(), returns in the parent, the child calls spawn_child() on
+ * the stack given in @args and exits with its return value.  Registers
+ * other than %rax, %rcx and %r11 are preserved by the syscall, in the
+ * child too, so the function and its argument are kept in %r12/%r13.
+ */
+static long spawn_clone3(struct spawn_clone_args *args, struct spawn *sp)
+{
+	register long   ret  asm("rax") = __NR_clone3;
+	register void  *a1   asm("rdi") = args;
+	register size_t a2   asm("rsi") = sizeof(*args);
+	register void  *fn   asm("r12") = spawn_child;
+	register void  *arg  asm("r13") = sp;
+
+	__asm__ __volatile__(
+		"syscall\n\t"
+		"test %%rax, %%rax\n\t"
+		"jnz 1f\n\t"
+		"xor %%ebp, %%ebp\n\t"	/* child, outermost frame */
+		"mov %%r13, %%rdi\n\t"
+		"call *%%r12\n\t"
+		"mov %%eax, %%edi\n\t"
+		"mov %[nr_exit], %%eax\n\t"
+		"syscall\n\t"
+		"hlt\n"
+		"1:"
+		: "+r"(ret)
+		: "r"(a1), "r"(a2), "r"(fn), "r"(arg), [nr_exit] "i"(__NR_exit)
+		: "rcx", "r11", "memory");
+
+	return ret;
+}
+
+/*
+ * Start child directly in its cgroup, no cgroup.procs write needed.
+ * Returns -1 on error, then the caller falls back to clone(), like
+ * cgroup_fork() falls back to fork(), e.g., for a cgroup that is not
+ * a leaf.  If clone3() or %CLONE_INTO_CGROUP is not supported we do
+ * not try again.
+ */
+static pid_t spawn_cgroup(struct spawn *sp)
+{
+	static int nosys = 0;
+	struct spawn_clone_args args = {
+		.flags       = CLONE_VM | CLONE_VFORK | CLONE_INTO_CGROUP,
+		.exit_signal = SIGCHLD,
+		.stack       = (uintptr_t)stack,
+		.stack_size  = sizeof(stack),
+		.cgroup      = sp->cgfd,
+	};
+	long rc;
+
+	if (nosys) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	in_cgroup = 1;
+	rc = spawn_clone3(&args, sp);
+	in_cgroup = 0;
+	if (rc >= 0)
+		return rc;
+
+	/* No clone3(), or it does not know about .cgroup */
+	if (rc == -ENOSYS || rc == -E2BIG)
+		nosys = 1;
+
+	errno = -rc;
+	return -1;
+}
+#endif
+
+/**
+ * spawn - Start a process without copying our page tables
+ * @sp: What to start and how, see struct spawn
+ *
+ * Like posix_spawn(), this uses clone() with %CLONE_VM | %CLONE_VFORK,
+ * so the cost of starting a process does not grow with our heap, but
+ * unlike posix_spawn() it can also drop privileges, set rlimits, and
+ * start in a cgroup.  Anything else, like sourcing an env file, must be
+ * done in a proper fork() child.
+ *
+ * With @sp->cgfd the child is created directly in the cgroup, using
+ * clone3() with %CLONE_INTO_CGROUP, same as cgroup_fork().  If that is
+ * not supported, or fails, the child joins the cgroup itself.
+ *
+ * We are suspended until the child has called execve() or exited, so
+ * when this function returns @sp->failed and @sp->error tell if any
+ * step in the child failed.  All but joining the cgroup and setting
+ * rlimits are fatal, then the child has exited with status 1 and must
+ * be collected like any other process.
+ *
+ * Returns:
+ * PID of the child, or -1 with errno set if clone() failed.
+ */
+pid_t spawn(struct spawn *sp)
+{
+	sigset_t all, omask;
+	pid_t pid = -1;
+
+	sp->failed = NULL;
+	sp->error  = 0;
+
+	/* Block all signals until the child has reset the handlers */
+	sigfillset(&all);
+	sigprocmask(SIG_BLOCK, &all, &omask);
+#ifdef SPAWN_CLONE3
+	if (sp->cgfd >= 0)
+		pid = spawn_cgroup(sp);
+	if (pid == -1)
+#endif
+		pid = clone(spawn_child, &stack[sizeof(stack)], CLONE_VM | CLONE_VFORK | SIGCHLD, sp);
+	sigprocmask(SIG_SETMASK, &omask, NULL);
+
+	return pid;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,81 @@
+/* Lightweight process spawner, vfork() style
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_SPAWN_H_
+#define FINIT_SPAWN_H_
+
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL /* Linux 5.7 */
+#endif
+
+/* struct clone_args, up to and including .cgroup, CLONE_ARGS_SIZE_VER2 */
+struct spawn_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+	uint64_t cgroup;
+};
+
+/*
+ * Everything the child does between clone() and execve() is described
+ * here, resolved by the caller.  The child shares memory with us until
+ * it has called execve(), so it must not allocate or modify anything.
+ */
+struct spawn {
+	const char          *cmd;	/* Searched for in PATH from env */
+	char *const         *argv;
+	char *const         *env;
+
+	const struct rlimit *rlimit;	/* RLIMIT_NLIMITS entries, or NULL */
+	int                  uid;	/* Skipped if < 0 */
+	int                  gid;	/* Skipped if < 0 */
+	const char          *cwd;	/* Falls back to /, or NULL */
+	int                  input;	/* stdin, or -1 for /dev/null */
+	int                  output;	/* stdout+stderr, or -1 to inherit */
+	int                  cgfd;	/* Leaf cgroup to join, or -1 */
+
+	const char          *failed;	/* Step that failed in the child */
+	int                  error;	/* errno from that step */
+};
+
+pid_t spawn(struct spawn *sp);
+
+#endif /* FINIT_SPAWN_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
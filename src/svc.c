@@ -25,6 +25,7 @@
 #include "config.h"		/* Generated by configure script */
 
 #include <ctype.h>		/* isdigit() */
+#include <stddef.h>		/* offsetof() */
 #include <time.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -43,13 +44,302 @@
 #include "pid.h"
 #include "util.h"
 #include "cond.h"
+#include "graph.h"
 #include "schedule.h"
 
+/* Initial number of buckets in each lookup index, must be power of two */
+#define SVC_HASH_MIN 64
+
 /* Each svc_t needs a unique job# */
 static int jobcounter = 1;
+static unsigned int seqcounter = 1;
 static TAILQ_HEAD(, svc) svc_list = TAILQ_HEAD_INITIALIZER(svc_list);
 static TAILQ_HEAD(, svc) gc_list  = TAILQ_HEAD_INITIALIZER(gc_list);
 
+/*
+ * Lookup indexes for everything in svc_list, i.e., not for services
+ * waiting to be garbage collected.  Each index is a chained hash table
+ * that doubles in size when the load factor exceeds one.
+ */
+LIST_HEAD(svc_bucket, svc);
+static struct svc_hash {
+	struct svc_bucket *bucket;
+	size_t             size;
+	size_t             count;
+} svc_hash[SVC_HASH_MAX];
+
+static unsigned int hash_ident(const char *name, const char *id)
+{
+	return hash_str(hash_str(HASH_SEED, name) ^ ':', id);
+}
+
+/* PID file without the leading '!' of files Finit does not manage */
+static const char *svc_pidfile(svc_t *svc)
+{
+	if (svc->pidfile[0] == '!')
+		return &svc->pidfile[1];
+
+	return svc->pidfile;
+}
+
+static unsigned int svc_hash_key(svc_t *svc, svc_hash_t idx)
+{
+	switch (idx) {
+	case SVC_HASH_NAME:
+		return hash_ident(svc->name, svc->id);
+	case SVC_HASH_PID:
+		return hash_int(svc->pid);
+	case SVC_HASH_JOB:
+		return hash_int(svc->job);
+	case SVC_HASH_TTY:
+		return hash_str(HASH_SEED, svc->dev);
+	case SVC_HASH_PIDFILE:
+		return hash_str(HASH_SEED, svc_pidfile(svc));
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct svc_bucket *svc_hash_bucket(svc_hash_t idx, unsigned int key)
+{
+	struct svc_hash *h = &svc_hash[idx];
+
+	if (!h->size)
+		return NULL;
+
+	return &h->bucket[key & (h->size - 1)];
+}
+
+static int svc_hash_grow(svc_hash_t idx)
+{
+	struct svc_hash *h = &svc_hash[idx];
+	struct svc_bucket *bucket;
+	size_t size, i;
+
+	size = h->size ? h->size * 2 : SVC_HASH_MIN;
+	bucket = calloc(size, sizeof(*bucket));
+	if (!bucket)
+		return -1;
+
+	for (i = 0; i < h->size; i++) {
+		svc_t *svc;
+
+		while ((svc = LIST_FIRST(&h->bucket[i]))) {
+			LIST_REMOVE(svc, hash[idx]);
+			LIST_INSERT_HEAD(&bucket[svc_hash_key(svc, idx) & (size - 1)], svc, hash[idx]);
+		}
+	}
+
+	free(h->bucket);
+	h->bucket = bucket;
+	h->size   = size;
+
+	return 0;
+}
+
+static int svc_hash_add(svc_t *svc, svc_hash_t idx)
+{
+	struct svc_hash *h = &svc_hash[idx];
+
+	/* on failure to grow we can still use the old, smaller, table */
+	if (h->count >= h->size && svc_hash_grow(idx) && !h->size)
+		return -1;
+
+	LIST_INSERT_HEAD(svc_hash_bucket(idx, svc_hash_key(svc, idx)), svc, hash[idx]);
+	h->count++;
+
+	return 0;
+}
+
+static void svc_hash_del(svc_t *svc, svc_hash_t idx)
+{
+	if (!svc->hash[idx].le_prev)
+		return;		/* not indexed */
+
+	LIST_REMOVE(svc, hash[idx]);
+	svc->hash[idx].le_prev = NULL;
+	svc_hash[idx].count--;
+}
+
+/* Only services in svc_list are indexed, they always have a name:id */
+static int svc_hash_active(svc_t *svc)
+{
+	return svc->hash[SVC_HASH_NAME].le_prev != NULL;
+}
+
+/*
+ * Pool of reference counted strings for svc_t members that are rarely
+ * set, e.g., scripts and pidfile.  Services from the same .conf file,
+ * or multiple instances of a template, share the same copy.  Empty
+ * strings are not pooled, all unset members point to the same "".
+ */
+#define STR_POOL_SIZE 64
+
+struct svc_str {
+	LIST_ENTRY(svc_str) link;
+	unsigned int        refcnt;
+	char                str[];
+};
+
+static LIST_HEAD(, svc_str) str_pool[STR_POOL_SIZE];
+
+/*
+ * Limits are mostly the global defaults from finit.conf, or from the
+ * same .conf file, so services share a reference counted copy.
+ */
+struct svc_rlimit {
+	LIST_ENTRY(svc_rlimit) link;
+	unsigned int           refcnt;
+	struct rlimit          rlimit[RLIMIT_NLIMITS];
+};
+
+static LIST_HEAD(, svc_rlimit) rlimit_pool = LIST_HEAD_INITIALIZER(rlimit_pool);
+
+/* Shared empty argv until svc_set_args() is called */
+static char *no_args[] = { NULL };
+
+/* Set by svc_pidfd_init() */
+static uev_ctx_t *pidfd_ctx;
+static void     (*pidfd_exit_cb)(svc_t *svc);
+
+static const char *str_get(const char *val)
+{
+	struct svc_str *s;
+	unsigned int key;
+	size_t len;
+
+	if (!val[0])
+		return "";
+
+	key = hash_str(HASH_SEED, val) % STR_POOL_SIZE;
+	LIST_FOREACH(s, &str_pool[key], link) {
+		if (!strcmp(s->str, val)) {
+			s->refcnt++;
+			return s->str;
+		}
+	}
+
+	len = strlen(val) + 1;
+	s = malloc(sizeof(*s) + len);
+	if (!s)
+		return NULL;
+
+	s->refcnt = 1;
+	memcpy(s->str, val, len);
+	LIST_INSERT_HEAD(&str_pool[key], s, link);
+
+	return s->str;
+}
+
+static void str_put(const char *str)
+{
+	struct svc_str *s;
+
+	if (!str || !str[0])
+		return;
+
+	s = (struct svc_str *)(str - offsetof(struct svc_str, str));
+	if (--s->refcnt > 0)
+		return;
+
+	LIST_REMOVE(s, link);
+	free(s);
+}
+
+static void rlimit_put(const struct rlimit *rlimit)
+{
+	struct svc_rlimit *r;
+
+	if (!rlimit)
+		return;
+
+	r = (struct svc_rlimit *)((char *)rlimit - offsetof(struct svc_rlimit, rlimit));
+	if (--r->refcnt > 0)
+		return;
+
+	LIST_REMOVE(r, link);
+	free(r);
+}
+
+/* Release everything svc_set_*() has allocated */
+static void svc_free(svc_t *svc)
+{
+	str_put(svc->pidfile);
+	str_put(svc->env);
+	str_put(svc->notify_status);
+	str_put(svc->socket);
+	str_put(svc->pre_script);
+	str_put(svc->post_script);
+	str_put(svc->ready_script);
+	str_put(svc->cleanup_script);
+	str_put(svc->reload_script);
+	str_put(svc->stop_script);
+	rlimit_put(svc->rlimit);
+	if (svc->args != no_args)
+		free(svc->args);
+	free(svc);
+}
+
+static void svc_pidfd_close(svc_t *svc)
+{
+	if (svc->pidfd < 0)
+		return;
+
+	uev_io_stop(&svc->pidfd_watcher);
+	close(svc->pidfd);
+	svc->pidfd = -1;
+}
+
+static void svc_pidfd_cb(uev_t *w, void *arg, int events)
+{
+	svc_t *svc = (svc_t *)arg;
+
+	/* Stale event, pidfd closed or replaced by previous callback */
+	if (svc->pidfd != w->fd)
+		return;
+
+	if (UEV_ERROR == events) {
+		dbg("%s: error on pidfd, falling back to SIGCHLD", svc_ident(svc, NULL, 0));
+		svc_pidfd_close(svc);
+		return;
+	}
+
+	pidfd_exit_cb(svc);
+}
+
+static void svc_pidfd_open(svc_t *svc)
+{
+	static int nofd = 0;
+	int fd;
+
+	if (!pidfd_ctx || svc->pidfd >= 0)
+		return;
+
+	fd = pid_fd_open(svc->pid);
+	if (fd == -1) {
+		/* Out of descriptors, falls back to PID, log once */
+		if (errno == EMFILE || errno == ENFILE) {
+			if (!nofd)
+				logit(LOG_WARNING, "%s: failed pidfd_open(%d): %s, using PID.",
+				      svc_ident(svc, NULL, 0), svc->pid, strerror(errno));
+			nofd = 1;
+		} else if (errno != ENOSYS) {
+			dbg("%s: failed pidfd_open(%d): %s", svc_ident(svc, NULL, 0),
+			    svc->pid, strerror(errno));
+		}
+		return;
+	}
+	nofd = 0;
+
+	if (uev_io_init(pidfd_ctx, &svc->pidfd_watcher, svc_pidfd_cb, svc, fd, UEV_READ)) {
+		close(fd);
+		return;
+	}
+	svc->pidfd = fd;
+}
+
 /*
  * Before gc removal of svc, make sure we don't clear an active
  * condition of a new instance of the svc.
@@ -97,7 +387,7 @@ static void svc_gc(void *arg)
 
 		TAILQ_REMOVE(&gc_list, svc, link);
 		maybe_clear_cond(svc);
-		free(svc);
+		svc_free(svc);
 	}
 
 	if (!TAILQ_EMPTY(&gc_list))
@@ -135,6 +425,7 @@ svc_t *svc_new(char *cmd, char *name, char *id, int type)
 
 	svc->type = type;
 	svc->job  = job;
+	svc->seq  = seqcounter++;
 	if (name)
 		strlcpy(svc->name, name, sizeof(svc->name));
 	if (id && id[0])
@@ -145,6 +436,19 @@ svc_t *svc_new(char *cmd, char *name, char *id, int type)
 	/* Default description, if missing */
 	strlcpy(svc->desc, svc->name, sizeof(svc->desc));
 
+	/* Pooled strings and args are never NULL */
+	svc->pidfile        = "";
+	svc->env            = "";
+	svc->pre_script     = "";
+	svc->post_script    = "";
+	svc->ready_script   = "";
+	svc->cleanup_script = "";
+	svc->reload_script  = "";
+	svc->stop_script    = "";
+	svc->notify_status  = "";
+	svc->socket         = "";
+	svc->args           = no_args;
+
 	/* Default HALT signal to send */
 	if (svc_is_tty(svc))
 		svc->sighalt = SIGHUP;
@@ -154,6 +458,19 @@ svc_t *svc_new(char *cmd, char *name, char *id, int type)
 	/* Default delay between SIGTERM and SIGKILL */
 	svc->killdelay = SVC_TERM_TIMEOUT;
 
+	/* No process yet */
+	svc->pidfd = -1;
+
+	if (svc_hash_add(svc, SVC_HASH_NAME)) {
+		svc_free(svc);
+		return NULL;
+	}
+	if (svc_hash_add(svc, SVC_HASH_JOB)) {
+		svc_hash_del(svc, SVC_HASH_NAME);
+		svc_free(svc);
+		return NULL;
+	}
+
 	TAILQ_INSERT_TAIL(&svc_list, svc, link);
 
 	return svc;
@@ -173,6 +490,14 @@ static struct wq work = {
  */
 int svc_del(svc_t *svc)
 {
+	int i;
+
+	for (i = 0; i < SVC_HASH_MAX; i++)
+		svc_hash_del(svc, i);
+	svc_pidfd_close(svc);
+	cond_deps_del(svc);
+	graph_cancel(svc);
+
 	TAILQ_REMOVE(&svc_list, svc, link);
 	TAILQ_INSERT_TAIL(&gc_list, svc, link);
 
@@ -182,6 +507,250 @@ int svc_del(svc_t *svc)
 	return 0;
 }
 
+/**
+ * svc_pidfd_init - Enable pidfd tracking of service processes
+ * @ctx: Event context to register pidfd watchers with
+ * @cb:  Called with the owning &svc_t when svc->pid has exited
+ *
+ * After this, svc_set_pid() opens a pidfd for each new svc->pid, which
+ * is used by svc_kill() and to get exit notifications without a PID
+ * lookup.  Without pidfd support in the kernel, or before this call,
+ * services are only tracked by PID.
+ */
+void svc_pidfd_init(uev_ctx_t *ctx, void (*cb)(svc_t *svc))
+{
+	pidfd_ctx     = ctx;
+	pidfd_exit_cb = cb;
+}
+
+/**
+ * svc_set_pid - Update PID of a service object
+ * @svc: Pointer to an &svc_t object
+ * @pid: New PID, or zero when the process has been collected
+ *
+ * All changes to svc->pid must go through this function to keep the
+ * lookup index used by svc_find_by_pid(), and svc->pidfd, current.
+ */
+void svc_set_pid(svc_t *svc, pid_t pid)
+{
+	if (!svc)
+		return;
+
+	if (svc->pid != pid)
+		svc_pidfd_close(svc);
+
+	svc_hash_del(svc, SVC_HASH_PID);
+	*((pid_t *)&svc->pid) = pid;
+
+	if (pid > 0 && svc_hash_active(svc)) {
+		svc_hash_add(svc, SVC_HASH_PID);
+		svc_pidfd_open(svc);
+	}
+}
+
+/**
+ * svc_kill - Send signal to the process of a service object
+ * @svc:   Pointer to an &svc_t object
+ * @signo: Signal to send
+ *
+ * Uses svc->pidfd, when available, so a recycled PID is never signaled.
+ * The pidfd does not cover process groups, use kill(-svc->pid) for that.
+ *
+ * Returns:
+ * Same as kill(2), POSIX OK(0) on success, otherwise -1 with errno set.
+ */
+int svc_kill(svc_t *svc, int signo)
+{
+	if (svc->pid <= 1) {
+		errno = ESRCH;
+		return -1;
+	}
+
+	if (svc->pidfd >= 0) {
+		int rc;
+
+		rc = pid_fd_kill(svc->pidfd, signo);
+		if (rc == 0 || errno != ENOSYS)
+			return rc;
+	}
+
+	return kill(svc->pid, signo);
+}
+
+/**
+ * svc_set_dev - Update TTY device of a TTY service object
+ * @svc: Pointer to an &svc_t object
+ * @dev: TTY device, or %NULL to only refresh lookup index
+ *
+ * Like svc_set_pid(), but for svc->dev, used by svc_find_by_tty().  Non
+ * TTY services are dropped from the index since svc->dev is in a union.
+ */
+void svc_set_dev(svc_t *svc, const char *dev)
+{
+	if (!svc)
+		return;
+
+	svc_hash_del(svc, SVC_HASH_TTY);
+	if (!svc_is_tty(svc))
+		return;
+
+	if (dev)
+		strlcpy(svc->dev, dev, sizeof(svc->dev));
+
+	if (svc->dev[0] && svc_hash_active(svc))
+		svc_hash_add(svc, SVC_HASH_TTY);
+}
+
+/**
+ * svc_set_pidfile - Update PID file of a service object
+ * @svc:  Pointer to an &svc_t object
+ * @file: New PID file, optionally prefixed with '!', or %NULL to clear
+ *
+ * Like svc_set_dev(), but for svc->pidfile, used by svc_find_by_pidfile()
+ * so the pidfile plugin only has to look at PID files of services.
+ *
+ * Returns:
+ * Same as svc_set_str().
+ */
+int svc_set_pidfile(svc_t *svc, const char *file)
+{
+	int rc;
+
+	if (!svc)
+		return -1;
+
+	svc_hash_del(svc, SVC_HASH_PIDFILE);
+	rc = svc_set_str(&svc->pidfile, file);
+
+	if (svc_pidfile(svc)[0] && svc_hash_active(svc))
+		svc_hash_add(svc, SVC_HASH_PIDFILE);
+
+	return rc;
+}
+
+/**
+ * svc_set_str - Update a pooled string member of a service object
+ * @str: Pointer to member, e.g., &svc->pre_script
+ * @val: New value, or %NULL to clear
+ *
+ * Members like scripts and pidfile are read-only strings shared with
+ * other services, they must only be changed using this function.
+ *
+ * Returns:
+ * 1 if the value changed, 0 if unmodified, or -1 if out of memory, in
+ * which case the member is left untouched.
+ */
+int svc_set_str(const char **str, const char *val)
+{
+	const char *new;
+
+	if (!val)
+		val = "";
+	if (*str && !strcmp(*str, val))
+		return 0;
+
+	new = str_get(val);
+	if (!new)
+		return -1;
+
+	str_put(*str);
+	*str = new;
+
+	return 1;
+}
+
+/**
+ * svc_set_args - Update command line arguments of a service object
+ * @svc:  Pointer to an &svc_t object
+ * @argv: New arguments, @argv[0] is the command
+ * @argc: Number of arguments in @argv
+ *
+ * The arguments are copied to a single heap allocated block, sized to
+ * fit, and svc->args is %NULL terminated.
+ *
+ * Returns:
+ * 1 if the arguments changed, 0 if unmodified, or -1 if out of memory,
+ * in which case the arguments are left untouched.
+ */
+int svc_set_args(svc_t *svc, char *argv[], int argc)
+{
+	size_t len = 0;
+	char **args;
+	char *ptr;
+	int i;
+
+	for (i = 0; i < argc && svc->args[i]; i++) {
+		if (strcmp(svc->args[i], argv[i]))
+			break;
+	}
+	if (i == argc && !svc->args[i])
+		return 0;
+
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+
+	args = malloc((argc + 1) * sizeof(char *) + len);
+	if (!args)
+		return -1;
+
+	ptr = (char *)&args[argc + 1];
+	for (i = 0; i < argc; i++) {
+		len = strlen(argv[i]) + 1;
+		memcpy(ptr, argv[i], len);
+		args[i] = ptr;
+		ptr += len;
+	}
+	args[i] = NULL;
+
+	if (svc->args != no_args)
+		free(svc->args);
+	svc->args = args;
+
+	return 1;
+}
+
+/**
+ * svc_set_rlimit - Update resource limits of a service object
+ * @svc:    Pointer to an &svc_t object
+ * @rlimit: Array of %RLIMIT_NLIMITS limits
+ *
+ * Services with identical limits share the same read-only copy.
+ *
+ * Returns:
+ * 1 if the limits changed, 0 if unmodified, or -1 if out of memory, in
+ * which case the limits are left untouched.
+ */
+int svc_set_rlimit(svc_t *svc, const struct rlimit rlimit[])
+{
+	const size_t len = sizeof(struct rlimit) * RLIMIT_NLIMITS;
+	struct svc_rlimit *r;
+
+	if (svc->rlimit && !memcmp(svc->rlimit, rlimit, len))
+		return 0;
+
+	LIST_FOREACH(r, &rlimit_pool, link) {
+		if (!memcmp(r->rlimit, rlimit, len))
+			break;
+	}
+
+	if (r) {
+		r->refcnt++;
+	} else {
+		r = malloc(sizeof(*r));
+		if (!r)
+			return -1;
+
+		r->refcnt = 1;
+		memcpy(r->rlimit, rlimit, len);
+		LIST_INSERT_HEAD(&rlimit_pool, r, link);
+	}
+
+	rlimit_put(svc->rlimit);
+	svc->rlimit = r->rlimit;
+
+	return 1;
+}
+
 /**
  * svc_validate - Check if service asserts same condition as another service
  * @svc: Pointer to an &svc_t object
@@ -215,6 +784,74 @@ void svc_validate(svc_t *svc)
 	}
 }
 
+struct svc_cond {
+	svc_t *svc;
+	int    pos;
+	char   cond[MAX_COND_LEN];
+};
+
+static int svc_cond_cmp(const void *a, const void *b)
+{
+	const struct svc_cond *x = a, *y = b;
+	int rc;
+
+	rc = strcmp(x->cond, y->cond);
+	if (rc)
+		return rc;
+
+	return x->pos - y->pos;
+}
+
+/**
+ * svc_validate_all - Check all services for the same condition
+ *
+ * Same check as svc_validate(), but once for each pair of services in
+ * the table.  Used when replaying the .conf snapshot at boot, instead
+ * of comparing every service with all others the conditions are sorted.
+ */
+void svc_validate_all(void)
+{
+	svc_t *svc, *iter = NULL;
+	struct svc_cond *arr;
+	int i, j, k, num = 0;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0))
+		num++;
+
+	arr = calloc(num, sizeof(*arr));
+	if (!arr) {
+		for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0))
+			svc_validate(svc);
+		return;
+	}
+
+	for (num = 0, svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->removed)
+			continue;
+
+		arr[num].svc = svc;
+		arr[num].pos = num;
+		mkcond(svc, arr[num].cond, sizeof(arr[num].cond));
+		num++;
+	}
+	qsort(arr, num, sizeof(*arr), svc_cond_cmp);
+
+	for (i = 0; i < num; i = j) {
+		for (j = i + 1; j < num && !strcmp(arr[i].cond, arr[j].cond); j++) {
+			char ident[MAX_IDENT_LEN];
+
+			svc = arr[j].svc;
+			svc_ident(svc, ident, sizeof(ident));
+			for (k = i; k < j; k++)
+				logit(LOG_WARNING, "%s (%s) asserts the same condition as %s (%s) => %s",
+				      svc->cmd, ident, arr[k].svc->cmd,
+				      svc_ident(arr[k].svc, NULL, 0), arr[k].cond);
+		}
+	}
+
+	free(arr);
+}
+
 /**
  * svc_iterator - Naive iterator over all registered services.
  * @iter:  Iterator, must be a valid pointer
@@ -396,12 +1033,17 @@ svc_t *svc_clean_completed(void)
  */
 svc_t *svc_find(char *name, char *id)
 {
-	svc_t *svc, *iter = NULL;
+	struct svc_bucket *bucket;
+	svc_t *svc;
 
 	if (!id)
 		id = "";
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	bucket = svc_hash_bucket(SVC_HASH_NAME, hash_ident(name, id));
+	if (!bucket)
+		return NULL;
+
+	LIST_FOREACH(svc, bucket, hash[SVC_HASH_NAME]) {
 		if (!strcmp(svc->name, name) && !strcmp(svc->id, id))
 			return svc;
 	}
@@ -444,9 +1086,17 @@ svc_t *svc_find_by_str(const char *str)
  */
 svc_t *svc_find_by_pid(pid_t pid)
 {
-	svc_t *svc, *iter = NULL;
+	struct svc_bucket *bucket;
+	svc_t *svc;
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	if (pid <= 0)
+		return NULL;
+
+	bucket = svc_hash_bucket(SVC_HASH_PID, hash_int(pid));
+	if (!bucket)
+		return NULL;
+
+	LIST_FOREACH(svc, bucket, hash[SVC_HASH_PID]) {
 		if (svc->pid == pid)
 			return svc;
 	}
@@ -463,17 +1113,22 @@ svc_t *svc_find_by_pid(pid_t pid)
  */
 svc_t *svc_find_by_cond(const char *cond)
 {
-	svc_t *svc, *iter = NULL;
+	char buf[MAX_COND_LEN];
+	svc_t *svc;
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		char buf[MAX_COND_LEN];
+	if (!cond || strncmp(cond, "pid/", 4))
+		return NULL;
 
-		mkcond(svc, buf, sizeof(buf));
-		if (string_compare(buf, cond))
-			return svc;
-	}
+	svc = svc_find_by_str(&cond[4]);
+	if (!svc)
+		return NULL;
 
-	return NULL;
+	/* "pid/foo:" is not the same as "pid/foo" */
+	mkcond(svc, buf, sizeof(buf));
+	if (!string_compare(buf, cond))
+		return NULL;
+
+	return svc;
 }
 
 /**
@@ -486,12 +1141,17 @@ svc_t *svc_find_by_cond(const char *cond)
  */
 svc_t *svc_find_by_jobid(int job, char *id)
 {
-	svc_t *svc, *iter = NULL;
+	struct svc_bucket *bucket;
+	svc_t *svc;
 
 	if (!id)
 		id = "";
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	bucket = svc_hash_bucket(SVC_HASH_JOB, hash_int(job));
+	if (!bucket)
+		return NULL;
+
+	LIST_FOREACH(svc, bucket, hash[SVC_HASH_JOB]) {
 		if (svc->job == job && !strcmp(svc->id, id))
 			return svc;
 	}
@@ -499,15 +1159,27 @@ svc_t *svc_find_by_jobid(int job, char *id)
 	return NULL;
 }
 
+/**
+ * svc_find_by_tty - Find a TTY service object by its device
+ * @dev: TTY device, as set by svc_set_dev()
+ *
+ * Returns:
+ * A pointer to an &svc_t object, or %NULL if not found.
+ */
 svc_t *svc_find_by_tty(char *dev)
 {
-	svc_t *svc, *iter = NULL;
+	struct svc_bucket *bucket;
+	svc_t *svc;
 
 	/* rescue (notty) shells have no device node */
 	if (!dev)
 		return NULL;
 
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+	bucket = svc_hash_bucket(SVC_HASH_TTY, hash_str(HASH_SEED, dev));
+	if (!bucket)
+		return NULL;
+
+	LIST_FOREACH(svc, bucket, hash[SVC_HASH_TTY]) {
 		if (!svc_is_tty(svc))
 			continue;
 
@@ -519,48 +1191,57 @@ svc_t *svc_find_by_tty(char *dev)
 }
 
 /**
- * svc_find_by_plidfile - Find a service by its PID file
- * @fn: PID file, can be absolute path or relative to /run
+ * svc_find_by_pidfile - Find a service by its PID file
+ * @fn: Absolute path to PID file
  *
  * This function is primarily used by the pidfile plugin to track the
  * conditions and dependencies of services.
  *
- * Note, the PID file is assumed to exist so the contents can be
- * compared to the the PID of a located service.  There may be several
- * services, in many runlevels, that use the same name for the PID file.
- * So we won't know for sure until the PID is compared.
+ * There may be several services, in many runlevels, that use the same
+ * name for the PID file.  So if more than one match, the contents is
+ * compared to the PID of each service.  A PID file that no service has
+ * declared is only read to find services that have not set pid:, their
+ * PID file is learned by the pidfile plugin the first time it is seen.
  *
  * Returns:
  * A pointer to an &svc_t object, or %NULL if not found.
  */
 svc_t *svc_find_by_pidfile(char *fn)
 {
-	svc_t *svc, *iter = NULL;
+	struct svc_bucket *bucket;
+	svc_t *svc, *found = NULL;
+	int num = 0;
 	pid_t pid;
 
-	pid = pid_file_read(fn);
-	if (pid > 1) {
-		svc = svc_find_by_pid(pid);
-		if (svc)
-			return svc;
+	bucket = svc_hash_bucket(SVC_HASH_PIDFILE, hash_str(HASH_SEED, fn));
+	if (bucket) {
+		LIST_FOREACH(svc, bucket, hash[SVC_HASH_PIDFILE]) {
+			if (strcmp(svc_pidfile(svc), fn))
+				continue;
+
+			if (!found)
+				found = svc;
+			num++;
+		}
 	}
 
-	/*
-	 * No PID in file, or a sysv service.  So it has probably forked
-	 * off a chiled that we don't know about.  See if we can match
-	 * the PID file to a service instead.
-	 */
-	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
-		int v = 0;
+	if (num == 1)
+		return found;
 
-		if (svc->pidfile[0] == '!')
-			v = 1;
-		if (strcmp(&svc->pidfile[v], fn))
-			continue;
+	pid = pid_file_read(fn);
+	if (found) {
+		LIST_FOREACH(svc, bucket, hash[SVC_HASH_PIDFILE]) {
+			if (pid > 1 && svc->pid == pid && !strcmp(svc_pidfile(svc), fn))
+				return svc;
+		}
 
-		return svc;
+		return found;
 	}
 
+	svc = svc_find_by_pid(pid);
+	if (svc && !svc->pidfile[0])
+		return svc;
+
 	return NULL;
 }
 
@@ -633,7 +1314,7 @@ void svc_clean_dynamic(void (*cb)(svc_t *))
 int svc_clean_bootstrap(svc_t *svc)
 {
 	if (!ISOTHER(svc->runlevels, INIT_LEVEL)) {
-		svc->pid = 0;
+		svc_set_pid(svc, 0);
 		svc_del(svc);
 		return 1;
 	}
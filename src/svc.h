@@ -25,6 +25,7 @@
 #ifndef FINIT_SVC_H_
 #define FINIT_SVC_H_
 
+#include <stdint.h>
 #include <sys/ipc.h>		/* IPC_CREAT */
 #include <sys/resource.h>
 #include <sys/types.h>		/* pid_t */
@@ -42,6 +43,8 @@
 
 typedef int svc_cmd_t;
 
+struct cond_dep;
+
 typedef enum {
 	SVC_TYPE_FREE       = 0,	/* Free to allocate */
 	SVC_TYPE_SERVICE    = 1,	/* Monitored, will be respawned */
@@ -110,6 +113,16 @@ typedef enum {
 /* Prevent endless respawn of faulty services. */
 #define SVC_RESPAWN_MAX  10
 
+/* Lookup indexes, see svc_find*() */
+typedef enum {
+	SVC_HASH_NAME = 0,	/* name:id */
+	SVC_HASH_PID,		/* svc->pid, only when > 0 */
+	SVC_HASH_JOB,		/* job number */
+	SVC_HASH_TTY,		/* TTY device, only for TTY services */
+	SVC_HASH_PIDFILE,	/* PID file, only when set */
+	SVC_HASH_MAX
+} svc_hash_t;
+
 /*
  * Default enable for all services, can be stopped by means
  * of issuing an initctl call. E.g.
@@ -118,19 +131,23 @@ typedef enum {
  */
 typedef struct svc {
 	TAILQ_ENTRY(svc) link;
+	LIST_ENTRY(svc)  hash[SVC_HASH_MAX];
 
 	/* Origin of service */
 	char           file[MAX_ARG_LEN];
 
-	/* Limits and scoping */
-	struct rlimit  rlimit[RLIMIT_NLIMITS];
+	/* Limits and scoping, shared profile, see svc_set_rlimit() */
+	const struct rlimit *rlimit;
 	struct cgroup  cgroup;
 
 	/* Service details */
 	int            sighalt;        /* Signal to stop process, default: SIGTERM */
 	int            killdelay;      /* Delay in msec before sending SIGKILL */
-	pid_t          oldpid, pid;
-	char           pidfile[MAX_CMD_LEN];
+	pid_t          oldpid;
+	const pid_t    pid;	       /* Use svc_set_pid() to keep lookup index in sync */
+	int            pidfd;	       /* pidfd of svc->pid, or -1, managed by svc_set_pid() */
+	uev_t          pidfd_watcher;  /* Process exit, see svc_pidfd_init() */
+	const char    *pidfile;	       /* Pooled string, see svc_set_str() */
 	long           start_time;     /* Start time, as seconds since boot, from sysinfo() */
 	int            started;	       /* Set for run/task/sysv to track if started */
 	int            status;	       /* From waitpid() when process is collected */
@@ -147,9 +164,12 @@ typedef struct svc {
 	int	       forking;	       /* This is a service/sysv daemon that forks, wait for it ... */
 	svc_block_t    block;	       /* Reason that this service is currently stopped */
 	char           cond[MAX_COND_LEN];
+	struct cond_dep *cond_deps;    /* Compiled svc->cond, see cond_deps_add() */
+	unsigned int   cond_hooks;     /* Bitmask of hook/ conditions in svc->cond */
 
 	/* Instance specifics */
 	int            job;	       /* For internal use only, canonical ref is NAME:ID */
+	unsigned int   seq;	       /* Registration order, same as svc_iterator() */
 	char           name[MAX_ARG_LEN];
 	char           id[MAX_ID_LEN]; /* :ID */
 	char           ifstmt[MAX_IDENT_LEN];
@@ -170,6 +190,7 @@ typedef struct svc {
 			char  enabled;
 			char  null;
 			char  console;
+			char  store;
 			char  file[64];
 			char  prio[20];
 			char  ident[20];
@@ -194,29 +215,32 @@ typedef struct svc {
 
 	/* Command, arguments and service description */
 	char	       cmd[MAX_CMD_LEN];
-	char	       args[MAX_NUM_SVC_ARGS][MAX_CMD_LEN];
+	char	     **args;	       /* NULL terminated, args[0] is cmd, see svc_set_args() */
 	int            args_dirty;
 	char           conflict[MAX_ARG_LEN];
 	char	       desc[MAX_STR_LEN];
-	char	       env[MAX_CMD_LEN];
+	const char    *env;
 
-	char	       pre_script[MAX_CMD_LEN];
+	/* Scripts are pooled strings, never NULL, see svc_set_str() */
+	const char    *pre_script;
 	int	       pre_tmo;
 
-	char	       post_script[MAX_CMD_LEN];
+	const char    *post_script;
 	int	       post_tmo;
 
-	char	       ready_script[MAX_CMD_LEN];
+	const char    *ready_script;
 	int	       ready_tmo;
 
-	char	       cleanup_script[MAX_CMD_LEN];
+	const char    *cleanup_script;
 	int	       cleanup_tmo;
 
 	/* When set, used instead of SIGHUP or stop-start */
-	char	       reload_script[MAX_CMD_LEN];
+	const char    *reload_script;
+	int	       reload_tmo;
 
 	/* When set, used instead of SIGTERM or sysv 'stop' */
-	char	       stop_script[MAX_CMD_LEN];
+	const char    *stop_script;
+	int	       stop_tmo;
 
 	/*
 	 * Used to forcefully kill services that won't shutdown on
@@ -230,14 +254,90 @@ typedef struct svc {
 	 */
 	svc_notify_t   notify;
 	uev_t	       notify_watcher; /* i/o watcher */
+	const char    *notify_status;  /* Pooled string, last STATUS= message */
+
+	/*
+	 * Software watchdog, for notify:systemd services.  The timer is
+	 * restarted by each WATCHDOG=1, on timeout the service is killed.
+	 */
+	int            watchdog;       /* Timeout in msec, from watchdog:SEC, 0: off */
+	int            watchdog_tmo;   /* Current timeout, may be changed by WATCHDOG_USEC= */
+	char           watchdog_armed;
+	uev_t          watchdog_timer;
+
+	/*
+	 * Socket activation, see sock.c.  The listening sockets are
+	 * bound by us and the service is started on first connection.
+	 */
+	const char    *socket;	       /* Pooled string, socket:SPEC[,SPEC] */
+	struct svc_sock *sock;	       /* NULL if not socket activated */
+
+	/*
+	 * Start scheduling and dependency graph, see graph.c.  Times
+	 * are in usec, CLOCK_MONOTONIC, of the last start attempt.
+	 */
+	struct {
+		TAILQ_ENTRY(svc) link;
+		int      rank;	       /* Longest chain of dependents */
+		char     queued;       /* 1: waiting for slot, 2: slot reserved */
+		char     inflight;     /* Holds a start slot */
+		int64_t  slot;	       /* When slot was taken */
+		int64_t  eligible;     /* Conditions satisfied */
+		int64_t  start;	       /* Process started */
+		int64_t  ready;	       /* Service ready, or run/task done */
+	} graph;
 
 	/* time at svc_del(), used by gc timer */
 	struct timespec gc;
 } svc_t;
 
+/*
+ * Compact service status record, streamed by INIT_CMD_SVC_STATUS, one
+ * per message.  The fixed part is followed by NUL terminated strings,
+ * in order: name, id, desc, cgroup, file, pidfile, username, group,
+ * cond, env, notify_status, cmd, and then nargs arguments.  Bump the
+ * version when the layout changes, clients must ignore records of other
+ * versions.
+ */
+#define SVC_RECORD_VERSION 2
+
+#define SVC_RECORD_FORKING 0x01
+#define SVC_RECORD_MANUAL  0x02
+#define SVC_RECORD_STARTED 0x04
+
+struct svc_record {
+	uint16_t       version;
+	uint16_t       len;	       /* Total length, including strings[] */
+	uint8_t        type;
+	uint8_t        state;
+	uint8_t        block;
+	uint8_t        flags;
+	int32_t        pid;
+	int32_t        status;
+	int32_t        runlevels;
+	int32_t        once;
+	uint32_t       restart_tot;
+	int32_t        restart_cnt;
+	int32_t        restart_max;
+	int32_t        watchdog;
+	uint32_t       nargs;
+	int64_t        start_time;
+	char           strings[];
+};
+
 svc_t      *svc_new                (char *cmd, char *name, char *id, int type);
 int	    svc_del	           (svc_t *svc);
 void	    svc_validate	   (svc_t *svc);
+void	    svc_validate_all	   (void);
+
+void        svc_set_pid            (svc_t *svc, pid_t pid);
+void        svc_pidfd_init         (uev_ctx_t *ctx, void (*cb)(svc_t *svc));
+int         svc_kill               (svc_t *svc, int signo);
+void        svc_set_dev            (svc_t *svc, const char *dev);
+int         svc_set_pidfile        (svc_t *svc, const char *file);
+int         svc_set_str            (const char **str, const char *val);
+int         svc_set_args           (svc_t *svc, char *argv[], int argc);
+int         svc_set_rlimit         (svc_t *svc, const struct rlimit rlimit[]);
 
 svc_t	   *svc_find	           (char *name, char *id);
 svc_t	   *svc_find_by_str        (const char *str);
@@ -278,6 +378,7 @@ static inline int svc_is_tty       (svc_t *svc) { return svc && SVC_TYPE_TTY
 static inline int svc_is_runtask   (svc_t *svc) { return svc && (SVC_TYPE_RUNTASK & svc->type);}
 static inline int svc_is_forking   (svc_t *svc) { return svc && svc->forking; }
 static inline int svc_is_manual    (svc_t *svc) { return svc && svc->manual; }
+static inline int svc_is_sockact   (svc_t *svc) { return svc && svc->sock; }
 static inline int svc_is_noreload  (svc_t *svc) { return svc && (0 == svc->sighup && 0 == svc->reload_script[0]); }
 
 static inline int svc_in_runlevel  (svc_t *svc, int runlevel) { return svc && ISSET(svc->runlevels, runlevel); }
@@ -503,7 +604,7 @@ static inline char *svc_jobid(svc_t *svc, char *buf, size_t len)
 /*
  * non-zero env, no checking if file exists or not
  */
-static inline char *svc_getenv(svc_t *svc)
+static inline const char *svc_getenv(svc_t *svc)
 {
 	int v = 0;
 
@@ -523,7 +624,7 @@ static inline char *svc_getenv(svc_t *svc)
  */
 static inline int svc_checkenv(svc_t *svc)
 {
-	char *env = svc_getenv(svc);
+	const char *env = svc_getenv(svc);
 
 	if (!env || svc->env[0] == '-')
 		return 1;
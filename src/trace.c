@@ -0,0 +1,194 @@
+/* Boot timeline tracer, in-memory ring of service, hook, and condition events
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "finit.h"
+#include "conf.h"
+#include "private.h"
+#include "trace.h"
+
+/*
+ * Events during boot are appended to an array that grows with the
+ * number of services, nothing is overwritten.  When boot completes it
+ * is frozen and later events go to a fixed size ring, in .bss, so only
+ * pages actually written to use any memory.  When the ring is full, the
+ * oldest events are overwritten.
+ */
+static struct trace_event *boot;
+static unsigned int        boot_num;
+static unsigned int        boot_len;
+static int                 frozen;
+
+static struct trace_event  ring[TRACE_MAX];
+static unsigned int        head;	/* Total number of events in ring */
+
+static const char         *sm_last;
+
+int64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Slot for the next event: in the boot array, growing it until it
+ * reaches TRACE_BOOT_MAX, or in the ring when boot has completed.  If
+ * the boot array is full, or we run out of memory, boot events go to
+ * the ring as well, the first ones are kept.
+ */
+static struct trace_event *trace_slot(void)
+{
+	if (bootstrap) {
+		if (boot_num == boot_len && boot_len < TRACE_BOOT_MAX) {
+			unsigned int len = boot_len ? boot_len * 2 : TRACE_MAX;
+			struct trace_event *ev;
+
+			ev = realloc(boot, len * sizeof(*ev));
+			if (ev) {
+				boot = ev;
+				boot_len = len;
+			}
+		}
+
+		if (boot_num < boot_len)
+			return &boot[boot_num++];
+	} else if (!frozen) {
+		struct trace_event *ev;
+
+		/* Give back what boot did not use */
+		if (boot_num) {
+			ev = realloc(boot, boot_num * sizeof(*ev));
+			if (ev)
+				boot = ev;
+		}
+		frozen = 1;
+	}
+
+	return &ring[head++ % TRACE_MAX];
+}
+
+static struct trace_event *trace_add(int type, int64_t ts, const char *name, const char *state)
+{
+	struct trace_event *ev = trace_slot();
+
+	memset(ev, 0, sizeof(*ev));
+	ev->ts    = ts;
+	ev->type  = type;
+	ev->level = runlevel == INIT_LEVEL ? 'S' : '0' + runlevel;
+	strlcpy(ev->name, name, sizeof(ev->name));
+	if (state)
+		strlcpy(ev->state, state, sizeof(ev->state));
+
+	return ev;
+}
+
+/* Called on every state change of @svc */
+void trace_svc(svc_t *svc)
+{
+	trace_add(TRACE_SVC, trace_now(), svc_ident(svc, NULL, 0), svc_status(svc));
+}
+
+/* Called when all plugins of hook @no have run, @start from trace_now() */
+void trace_hook(hook_point_t no, int64_t start)
+{
+	const char *name = plugin_hook_str(no);
+	struct trace_event *ev;
+	int64_t now;
+
+	/* Hooks without condition, see plugin.h */
+	if (no == HOOK_SVC_RECONF)
+		name = "hook/svc/reconf";
+	else if (no == HOOK_RUNLEVEL_CHANGE)
+		name = "hook/sys/runlevel";
+
+	now = trace_now();
+	ev = trace_add(TRACE_HOOK, start, name, NULL);
+	ev->dur = now - start;
+}
+
+/* Called when condition @name changes state */
+void trace_cond(const char *name, const char *state)
+{
+	trace_add(TRACE_COND, trace_now(), name, state);
+}
+
+/* Called on every step of the runlevel state machine, only changes are recorded */
+void trace_sm(const char *state)
+{
+	if (sm_last && !strcmp(sm_last, state))
+		return;
+	sm_last = state;
+
+	trace_add(TRACE_SM, trace_now(), state, NULL);
+}
+
+/**
+ * trace_foreach - Iterate over all recorded events, oldest first
+ * @cb:  Callback, with up to %TRACE_BATCH events at a time
+ * @arg: Optional argument to @cb
+ *
+ * All events from boot are listed first, followed by the ring.
+ *
+ * Returns:
+ * Non-zero if @cb stopped the iteration.
+ */
+int trace_foreach(int (*cb)(struct trace_event *ev, size_t num, void *arg), void *arg)
+{
+	struct trace_event batch[TRACE_BATCH];
+	unsigned int first = 0, total, i;
+	size_t num = 0;
+
+	if (head > TRACE_MAX)
+		first = head - TRACE_MAX;
+	total = boot_num + head - first;
+
+	for (i = 0; i < total; i++) {
+		if (i < boot_num)
+			batch[num++] = boot[i];
+		else
+			batch[num++] = ring[(first + i - boot_num) % TRACE_MAX];
+		if (num < TRACE_BATCH && i + 1 < total)
+			continue;
+
+		if (cb(batch, num, arg))
+			return 1;
+		num = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
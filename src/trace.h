@@ -0,0 +1,76 @@
+/* Boot timeline tracer
+ *
+ * Copyright (c) 2025  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_TRACE_H_
+#define FINIT_TRACE_H_
+
+#include <stdint.h>
+
+#include "finit.h"
+#include "plugin.h"
+#include "svc.h"
+
+#define TRACE_MAX      1024	/* Events in ring buffer after boot */
+#define TRACE_BOOT_MAX 16384	/* Max events kept from boot */
+
+enum {
+	TRACE_SVC = 1,		/* Service state change */
+	TRACE_HOOK,		/* Plugin hook, with duration */
+	TRACE_COND,		/* Condition state change */
+	TRACE_SM,		/* Runlevel state machine step */
+};
+
+/*
+ * Trace event, streamed by INIT_CMD_TRACE in batches of TRACE_BATCH.
+ * Times are in usec, CLOCK_MONOTONIC, i.e., since boot.  The name is
+ * large enough for both service identities and condition names.
+ */
+struct trace_event {
+	int64_t        ts;
+	uint32_t       dur;		/* Only for TRACE_HOOK */
+	uint8_t        type;
+	char           level;		/* Runlevel: S, 0-9 */
+	char           state[10];	/* New state, e.g. running, or on */
+	char           name[MAX_COND_LEN]; /* Identity, hook, or condition */
+};
+
+/* Events per INIT_CMD_TRACE message, must fit client read buffer */
+#define TRACE_BATCH    (sizeof(struct init_request) / sizeof(struct trace_event))
+
+int64_t trace_now  (void);
+
+void    trace_svc  (svc_t *svc);
+void    trace_hook (hook_point_t no, int64_t start);
+void    trace_cond (const char *name, const char *state);
+void    trace_sm   (const char *state);
+
+int     trace_foreach(int (*cb)(struct trace_event *ev, size_t num, void *arg), void *arg);
+
+#endif /* FINIT_TRACE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -310,12 +310,8 @@ int tty_exec(svc_t *svc)
 	}
 
 	dbg("%s: Starting %s ...", dev, svc->cmd);
-	for (i = 1, j = 0; i < MAX_NUM_SVC_ARGS; i++) {
-		if (!svc->args[i][0])
-			break;
-
+	for (i = 1, j = 0; i < MAX_NUM_SVC_ARGS - 1 && svc->args[0] && svc->args[i]; i++)
 		args[j++] = svc->args[i];
-	}
 	args[j++] = NULL;
 
 	return run_getty(dev, svc->cmd, args, svc->noclear, svc->nowait, svc->rlimit);
@@ -161,6 +161,24 @@ static inline char *strterm(char *str, size_t len)
 	return str;
 }
 
+/* FNV-1a string hash, use HASH_SEED as @hash for new hashes */
+#define HASH_SEED 2166136261u
+static inline unsigned int hash_str(unsigned int hash, const char *str)
+{
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+/* Knuth's multiplicative method */
+static inline unsigned int hash_int(unsigned int val)
+{
+	return val * 2654435761u;
+}
+
 /* paste dir/file into buf */
 static inline int paste(char *buf, size_t len, const char *dir, const char *file)
 {
@@ -34,14 +34,13 @@
 
 #include "finit.h"
 #include "helpers.h"
+#include "logrotate.h"
 #include "util.h"
 #include "utmp-api.h"
 
 #define MAX_NO 5
 #define MAX_SZ 100 * 1024
 
-extern int logrotate(char *file, int num, off_t sz);
-
 
 static void utmp_strncpy(char *dst, const char *src, size_t dlen)
 {
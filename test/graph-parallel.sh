@@ -0,0 +1,49 @@
+#!/bin/sh
+# Verify that the 'parallel N' setting limits the number of run/task/
+# services starting at the same time, that the rest are started when
+# a slot is freed, and that the dependency graph is ranked.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+    run "initctl reload"
+}
+
+# Number of par:N tasks in a given state
+num_par()
+{
+    texec initctl -p -t status | awk -v state="$1" '$2 ~ /^par:/ && $3 == state' | wc -l
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Limit to two parallel starts, add five tasks, one depending on par:1"
+run "echo 'parallel 2' > $FINIT_CONF"
+for i in $(seq 1 4); do
+    run "echo 'task [2345] name:par :$i sleep 2 -- Parallel $i' >> $FINIT_CONF"
+done
+run "echo 'task [2345] name:par :5 <task/par:1/success> sleep 1 -- Parallel 5' >> $FINIT_CONF"
+run "cat $FINIT_CONF"
+
+say 'Reload Finit'
+run "initctl reload"
+
+retry 'assert "Two tasks running" "$(num_par running)" -eq 2'
+for _ in $(seq 1 10); do
+    assert "At most two tasks running" "$(num_par running)" -le 2
+    sleep 0.5
+done
+retry 'assert "All tasks done" "$(num_par done)" -eq 5' 50 0.2
+
+sep
+run "initctl graph"
+run "initctl graph critical par:5"
+assert "par:1 is ranked above par:2" \
+       "$(texec initctl -j graph par:1 | jq '.[0].rank')" -gt \
+       "$(texec initctl -j graph par:2 | jq '.[0].rank')"
+assert "par:5 depends on par:1" "$(texec initctl -j graph par:5 | jq -r '.[0].depends[0]')" = "par:1"
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Verify that unrelated file churn in /run is cheap for PID 1.  Writes
+# 10k files, some of them *.pid files no service has declared, to a
+# watched directory and checks the CPU time used by PID 1.  Then check
+# that PID files of services are still tracked.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+FILES=10000
+MAXCPU=100		# clock ticks, usually 1 sec
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -rf $FINIT_CONF /run/churn"
+    run "initctl reload"
+}
+
+# Sum of utime and stime of PID 1, in clock ticks
+cputime()
+{
+    texec cat /proc/1/stat | awk '{ print $14 + $15 }'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add service with declared PID file, and one without"
+run "mkdir -p /run/churn"
+run "echo 'service name:decl pid:/run/churn/decl.pid serv -n -p -P /run/churn/decl.pid -- Declared' > $FINIT_CONF"
+run "echo 'service name:serv serv -np -- Learned' >> $FINIT_CONF"
+run "initctl reload"
+retry 'assert_cond "pid/decl"'
+retry 'assert_cond "pid/serv"'
+
+sep "Write $FILES unrelated files to /run/churn"
+before=$(cputime)
+run "i=0; while [ \$i -lt $FILES ]; do
+       case \$i in *0) f=f\$i.pid ;; *5) f=f\$i.sock ;; *) f=f\$i ;; esac
+       echo \$i > /run/churn/\$f; i=\$((i + 1))
+     done"
+sleep 1
+after=$(cputime)
+used=$((after - before))
+assert "PID 1 CPU time $used ticks, max $MAXCPU" "$used" -le "$MAXCPU"
+
+sep "Verify PID files of services are still tracked"
+assert_status "decl" "running"
+assert_status "serv" "running"
+run "initctl restart decl"
+retry 'assert_cond "pid/decl"'
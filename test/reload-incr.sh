@@ -0,0 +1,52 @@
+#!/bin/sh
+# Verify that an incremental reload, where only added, changed, and
+# removed .conf files are reparsed, results in the same set of services
+# as a full reload of all .conf files.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF $FINIT_RCSD/incr-*.conf"
+    run "initctl reload"
+}
+
+snapshot()
+{
+    texec initctl -j status | jq -cS '[.[] | {identity, description, type, origin, command, condition, runlevels}]'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add 20 .conf files to $FINIT_RCSD"
+for i in $(seq 1 20); do
+    run "echo 'task [9] name:incr :$i <pid/incr:$((i - 1))> serv -- Incr $i' > $FINIT_RCSD/incr-$i.conf"
+done
+run "echo 'task [9] name:dep if:incr:7 serv -- Depends on incr:7' > $FINIT_RCSD/incr-dep.conf"
+
+say 'Reload Finit'
+run "initctl reload"
+retry 'assert_num_services 20 incr'
+
+say "Change one, add one, and remove two .conf files"
+run "echo 'task [8] name:incr :5 serv -a -- Incr 5 changed' > $FINIT_RCSD/incr-5.conf"
+run "echo 'task [9] name:incr :21 serv -- Incr 21' > $FINIT_RCSD/incr-21.conf"
+run "rm $FINIT_RCSD/incr-7.conf $FINIT_RCSD/incr-12.conf"
+
+say 'Reload Finit, incremental'
+run "initctl reload"
+retry 'assert_num_services 19 incr'
+retry 'assert_num_services 0 dep'
+assert_desc "Incr 5 changed" incr:5
+incr=$(snapshot)
+
+say "Touch $FINIT_CONF to force a full reload"
+run "touch $FINIT_CONF"
+run "initctl reload"
+retry 'assert_num_services 19 incr'
+full=$(snapshot)
+
+assert "Incremental and full reload result in the same services" "$incr" = "$full"
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Verify inetd style accept services.  Each connection is handled by its
+# own instance, with the connection as stdin and stdout, up to the max
+# number of instances, and limited per source address.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+    run "initctl reload"
+}
+
+# Send hello, print reply, if any
+hello()
+{
+    texec sh -c 'echo hello | nc -w 1 127.0.0.1 2323' || true
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add echo service, max 2 instances, 3 connections per source and minute"
+run "ip link set lo up"
+run "echo 'service socket:tcp:127.0.0.1:2323 accept:2 rate:3 cat -- Echo server' > $FINIT_CONF"
+run "initctl reload"
+retry 'assert_status "cat" "waiting"'
+
+sep "Verify connection is handled by an instance"
+assert "Echo reply" "$(hello)" = "hello"
+retry 'assert_num_children 0 cat'
+
+sep "Verify max instances"
+run "(sleep 3 | nc 127.0.0.1 2323 >/dev/null) &"
+run "(sleep 3 | nc 127.0.0.1 2323 >/dev/null) &"
+retry 'assert_num_children 2 cat'
+assert "Refused at max instances" "$(hello)" = ""
+retry 'assert_num_children 0 cat' 50 0.2
+
+sep "Verify rate limit, three connections so far"
+assert "Refused by rate limit" "$(hello)" = ""
+assert_status "cat" "waiting"
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Verify socket activation.  The service is not started until there is
+# activity on its FIFO, which it gets as fd 3 with LISTEN_FDS set, and
+# it is stopped again when it has been idle for a while.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF /tmp/serv.fifo"
+    run "initctl reload"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+if ! "$TEST_DIR/src/serv" -C | grep -q "libsystemd"; then
+    skip "serv built without libsystemd support"
+fi
+
+say "Add socket activated service, stopped after 2 sec idle"
+run "echo 'service log:stdout socket:fifo:/tmp/serv.fifo idle:2 serv -n -l -e LISTEN_FDS:1 -e LISTEN_FDNAMES:serv -- Socket activated' > $FINIT_CONF"
+run "initctl reload"
+retry 'assert_status "serv" "waiting"'
+assert "FIFO created" "$(texec sh -c '[ -p /tmp/serv.fifo ] && echo yes')" = "yes"
+sleep 1
+assert_status "serv" "waiting"
+assert_nopid "serv"
+
+sep "Verify service is started on first write to FIFO"
+run "echo hello > /tmp/serv.fifo"
+retry 'assert_status "serv" "running"'
+assert_norestart "serv"
+
+sep "Verify service is stopped when idle, and started again"
+retry 'assert_status "serv" "waiting"' 50 0.2
+run "echo again > /tmp/serv.fifo"
+retry 'assert_status "serv" "running"'
+assert_norestart "serv"
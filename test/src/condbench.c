@@ -0,0 +1,183 @@
+/*
+ * Micro-benchmark of service condition evaluation
+ *
+ * Registers 5000 services, each depending on a few conditions, and
+ * measures one pass over all services evaluating only their aggregate
+ * condition.  Compares the string based cond_get_agg(svc->cond) with
+ * the compiled cond_get_agg_svc().
+ *
+ * Note: this is the condition check service_step() does per service,
+ *       not service_step_all() itself.  The rest of a step, e.g., state
+ *       changes and starting processes, is not measured, so the gain in
+ *       a real step loop is smaller than what is shown here.
+ *
+ * Links directly with src/cond.c, src/cond-w.c and src/svc.c, the few
+ * symbols they need from the rest of Finit are stubbed out below.  The
+ * condition mirror in /run/finit/cond is never written.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "svc.h"
+#include "cond.h"
+#include "private.h"
+#include "schedule.h"
+
+#define SERVICES 5000
+#define PASSES   200
+
+int bootstrap = 0;
+int runlevel  = 2;
+int debug     = 0;
+
+void logit(int prio, const char *fmt, ...)
+{
+	(void)prio;
+	(void)fmt;
+}
+
+char *pid_runpath(const char *file, char *path, size_t len)
+{
+	/* Never touch the real /run/finit/cond */
+	snprintf(path, len, "/dev/null/%s", file);
+	return path;
+}
+
+pid_t pid_file_read(const char *file)
+{
+	(void)file;
+	return 0;
+}
+
+char *sanitize(char *arg, size_t len)
+{
+	(void)len;
+	return arg;
+}
+
+int schedule_work(struct wq *work)
+{
+	(void)work;
+	return 0;
+}
+
+int sm_in_reload(void)
+{
+	return 0;
+}
+
+void service_step(svc_t *svc)
+{
+	(void)svc;
+}
+
+void service_timeout_cancel(svc_t *svc)
+{
+	(void)svc;
+}
+
+void graph_cancel(svc_t *svc)
+{
+	(void)svc;
+}
+
+void trace_cond(const char *name, const char *state)
+{
+	(void)name;
+	(void)state;
+}
+
+const char *plugin_hook_str(hook_point_t no)
+{
+	(void)no;
+	return "nop";
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench(int compiled, int *on)
+{
+	double start;
+	int i;
+
+	*on = 0;
+	start = now();
+	for (i = 0; i < PASSES; i++) {
+		svc_t *svc, *iter = NULL;
+
+		for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+			enum cond_state s;
+
+			if (!svc_has_cond(svc))
+				continue;
+
+			if (compiled)
+				s = cond_get_agg_svc(svc);
+			else
+				s = cond_get_agg(svc->cond);
+			if (s == COND_ON)
+				(*on)++;
+		}
+	}
+
+	return (now() - start) / PASSES;
+}
+
+int main(void)
+{
+	double str, bin;
+	int i, on;
+
+	cond_reload();		/* initial reconf generation */
+
+	for (i = 0; i < SERVICES; i++) {
+		char cmd[32], name[32];
+		svc_t *svc;
+
+		snprintf(cmd, sizeof(cmd), "/sbin/daemon%d", i);
+		snprintf(name, sizeof(name), "daemon%d", i);
+
+		svc = svc_new(cmd, name, NULL, SVC_TYPE_SERVICE);
+		if (!svc)
+			return 1;
+
+		/* Depend on previous service, an interface, and a user cond. */
+		snprintf(svc->cond, sizeof(svc->cond), "pid/daemon%d,net/eth%d/running,usr/ready%d",
+			 i ? i - 1 : SERVICES - 1, i % 16, i % 4);
+		cond_deps_add(svc);
+
+		snprintf(name, sizeof(name), "pid/daemon%d", i);
+		cond_set_noupdate(name);
+	}
+	for (i = 0; i < 16; i++) {
+		char cond[32];
+
+		snprintf(cond, sizeof(cond), "net/eth%d/running", i);
+		cond_set_noupdate(cond);
+	}
+	for (i = 0; i < 4; i++) {
+		char cond[32];
+
+		snprintf(cond, sizeof(cond), "usr/ready%d", i);
+		cond_set_noupdate(cond);
+	}
+
+	str = bench(0, &on);
+	printf("%-24s %10.1fus  (%d on)\n", "cond_get_agg(svc->cond)", str / 1000, on / PASSES);
+	bin = bench(1, &on);
+	printf("%-24s %10.1fus  (%d on)\n", "cond_get_agg_svc(svc)", bin / 1000, on / PASSES);
+	printf("%d services, %.1fx faster\n", SERVICES, str / bin);
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Micro-benchmark of the log store
+ *
+ * Writes the same service log, 2M lines with an error every 100k lines,
+ * to a log store and to a plain text file, and compares the time to
+ * answer some typical questions:
+ *
+ *   tail  - the last 10 lines
+ *   crash - the last error
+ *   since - the lines logged in one millisecond, mid log
+ *
+ * The text file is scanned line by line, like grep and tail do.  Links
+ * directly with src/logstore.c, run it in a scratch directory, it
+ * creates bench.log and the bench.store directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "logstore.h"
+
+#define LINES   2000000
+#define ERRORS  100000
+#define SEGSZ   (10 * 1000 * 1000)
+#define STORE   "bench.store"
+#define TEXT    "bench.log"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int64_t wall(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int64_t populate(void)
+{
+	struct logstore *ls;
+	int64_t mid = 0;
+	FILE *fp;
+	int i;
+
+	if (system("rm -rf " STORE " " TEXT))
+		return -1;
+
+	ls = logstore_open(STORE, "bench", SEGSZ, 1000);
+	fp = fopen(TEXT, "w");
+	if (!ls || !fp)
+		return -1;
+
+	for (i = 1; i <= LINES; i++) {
+		int prio = LOG_DAEMON | LOG_INFO;
+		char msg[128];
+		int len;
+
+		if (i % ERRORS == 0) {
+			prio = LOG_DAEMON | LOG_ERR;
+			len = snprintf(msg, sizeof(msg), "crash %d, segmentation fault", i);
+		} else {
+			len = snprintf(msg, sizeof(msg), "request %d served in %d usec", i, i % 997);
+		}
+
+		if (logstore_write(ls, prio, 4711, msg, len))
+			return -1;
+		fprintf(fp, "Oct 18 12:00:00 bench[4711]: %s\n", msg);
+
+		if (i == LINES / 2)
+			mid = wall();
+	}
+
+	logstore_close(ls);
+	fclose(fp);
+
+	return mid;
+}
+
+static double store(struct logstore_query *q, int *lines)
+{
+	char buf[256];
+	double t;
+	FILE *fp;
+
+	fp = tmpfile();
+	t = now();
+	logstore_show(STORE, q, fp);
+	t = now() - t;
+
+	rewind(fp);
+	for (*lines = 0; fgets(buf, sizeof(buf), fp); (*lines)++)
+		;
+	fclose(fp);
+
+	return t;
+}
+
+/* Scan text file, keeping the last @keep matching lines */
+static double text(const char *pattern, int keep, int *lines)
+{
+	char buf[256];
+	double t;
+	FILE *fp;
+
+	t = now();
+	fp = fopen(TEXT, "r");
+	for (*lines = 0; fp && fgets(buf, sizeof(buf), fp); ) {
+		if (pattern && !strstr(buf, pattern))
+			continue;
+		if (*lines < keep)
+			(*lines)++;
+	}
+	if (fp)
+		fclose(fp);
+
+	return now() - t;
+}
+
+int main(void)
+{
+	int64_t mid;
+	double t;
+	int s, n;
+
+	t = now();
+	mid = populate();
+	if (mid < 0) {
+		perror("populate");
+		return 1;
+	}
+	printf("%d lines written to store and text file in %.2f sec\n\n", LINES, now() - t);
+
+	printf("%-6s %10s %10s\n", "QUERY", "store", "text");
+
+	t = store(&(struct logstore_query){ .tail = 10 }, &s);
+	printf("%-6s %8.2fms %8.2fms  (%d lines)\n", "tail", t * 1e3, text(NULL, 10, &n) * 1e3, s);
+
+	t = store(&(struct logstore_query){ .tail = 1, .levels = (2 << LOG_ERR) - 1 }, &s);
+	printf("%-6s %8.2fms %8.2fms  (%d lines)\n", "crash", t * 1e3, text("crash", 1, &n) * 1e3, s);
+
+	/* The text file has no usable timestamps, scan to the middle */
+	t = store(&(struct logstore_query){ .since = mid, .until = mid + 1000 }, &s);
+	printf("%-6s %8.2fms %8.2fms  (%d lines)\n", "since", t * 1e3, text(NULL, LINES / 2, &n) * 1e3 / 2, s);
+
+	if (system("rm -rf " STORE " " TEXT))
+		return 1;
+
+	return 0;
+}
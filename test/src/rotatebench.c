@@ -0,0 +1,142 @@
+/*
+ * Micro-benchmark of log rotation stall
+ *
+ * Writes log lines, in batches like the log multiplexer reads them, as
+ * fast as possible to a file that is rotated at 10 MB, and reports the
+ * longest time the writer is blocked in a single batch, as well as the
+ * total time spent in logrotate().  Run for each compression mode:
+ *
+ *   sync - compress .2 in logrotate(), the default
+ *   incr - one chunk per batch with logrotate_work(), as PID 1 does
+ *   bg   - low priority background process, as logit -c does
+ *
+ * Links directly with src/logrotate.c, so without zlib the sync mode
+ * measures the cost of calling gzip(1).  Run it in a scratch directory,
+ * it creates bench.log and its rotated files.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logrotate.h"
+
+#define LINES   500000
+#define BATCH   32
+#define SIZE    (10 * 1000 * 1000)
+#define NUM     4
+#define LOG     "bench.log"
+
+static int compressing;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void queued(void)
+{
+	compressing = 1;
+}
+
+static void cleanup(void)
+{
+	char file[sizeof(LOG) + 10];
+	int i;
+
+	unlink(LOG);
+	for (i = 1; i <= NUM; i++) {
+		snprintf(file, sizeof(file), "%s.%d", LOG, i);
+		unlink(file);
+		strcat(file, ".gz");
+		unlink(file);
+	}
+}
+
+static int bench(const char *name, enum logrotate_mode mode)
+{
+	double begin, worst = 0, total = 0;
+	int fd, i, rotations = 0;
+	off_t size = 0;
+
+	cleanup();
+	compressing = 0;
+	logrotate_mode(mode, queued);
+
+	fd = open(LOG, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd == -1)
+		return 1;
+
+	begin = now();
+	for (i = 0; i < LINES; i += BATCH) {
+		double t = now(), d;
+		int j;
+
+		for (j = i; j < i + BATCH; j++) {
+			char line[128];
+			int len;
+
+			len = snprintf(line, sizeof(line), "Oct 18 12:00:00 bench[%d]: "
+				       "line %d, some padding to look like a log message\n",
+				       getpid(), j);
+			if (write(fd, line, len) != len)
+				return 1;
+			size += len;
+		}
+
+		if (size > SIZE) {
+			double r = now();
+
+			close(fd);
+			logrotate(LOG, NUM, SIZE);
+			fd = open(LOG, O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if (fd == -1)
+				return 1;
+			size = 0;
+			total += now() - r;
+			rotations++;
+		}
+
+		if (compressing)
+			compressing = logrotate_work(LOGROTATE_CHUNK);
+
+		d = now() - t;
+		if (d > worst)
+			worst = d;
+	}
+	close(fd);
+
+	printf("%-5s %8.0f lines/sec %3d rotations %8.2f ms max stall %8.2f ms in logrotate()\n",
+	       name, LINES / (now() - begin), rotations, worst * 1e3, total * 1e3);
+
+	/* Let a background worker finish before the next round */
+	while (compressing)
+		compressing = logrotate_work(LOGROTATE_CHUNK);
+	logrotate_mode(LOGROTATE_SYNC, NULL);
+
+	return 0;
+}
+
+int main(void)
+{
+	signal(SIGCHLD, SIG_IGN);
+
+	if (bench("sync", LOGROTATE_SYNC) ||
+	    bench("incr", LOGROTATE_INCR) ||
+	    bench("bg",   LOGROTATE_BG)) {
+		perror("bench");
+		return 1;
+	}
+	sleep(1);
+	cleanup();
+
+	return 0;
+}
@@ -152,6 +152,31 @@ static void pidfile(char *pidfn)
 	}
 }
 
+#ifdef HAVE_LIBSYSTEMD
+/* Accept connections and read data on sockets from socket activation */
+static void drain(int num)
+{
+	char buf[256];
+	int fd, sd;
+
+	for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + num; fd++) {
+		socklen_t len = sizeof(int);
+		int acc = 0;
+
+		if (!getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &acc, &len) && acc) {
+			while ((sd = accept(fd, NULL, NULL)) != -1) {
+				inf("Accepted connection on socket %d", fd);
+				close(sd);
+			}
+			continue;
+		}
+
+		while (read(fd, buf, sizeof(buf)) > 0)
+			inf("Read data from socket %d", fd);
+	}
+}
+#endif
+
 static int capabilities(void)
 {
 #ifdef HAVE_LIBSYSTEMD
@@ -177,11 +202,13 @@ static int usage(int rc)
 		" -F FILE  Where to look spice ...\n"
 		" -h       Show help text (this)\n"
 		" -i IDENT Change process identity, incl. logs, pidfile, etc.\n"
+		" -l       Drain sockets passed with LISTEN_FDS (socket activation)\n"
 		" -n       Run in foreground\n"
 		" -N SOCK  Send '\\n' on SOCK (integer), for s6 readiness\n"
 		" -p       Create PID file despite running in foreground\n"
 		" -P FILE  Create PID file using FILE\n"
 		" -r SVC   Call initctl to restart service SVC (self)\n"
+		" -w SEC   Send watchdog keep-alive for SEC seconds, then hang\n"
 		"\n"
 		"By default this program daemonizes itself to the background, and,\n"
 		"when it's done setting up its signal handler(s), creates a PID file\n"
@@ -205,6 +232,8 @@ int main(int argc, char *argv[])
 	int do_restart = 0;
 	int do_notify = 0;
 	int do_crash = 0;
+	int watchdog = -1;
+	int nsock = 0;
 	int vanish = 0;
 	char *pidfn = NULL;
 	char *melange = NULL;
@@ -212,7 +241,7 @@ int main(int argc, char *argv[])
 	char cmd[80];
 	int c;
 
-	while ((c = getopt(argc, argv, "cCe:E:f:F:hi:nN:pP:r:")) != EOF) {
+	while ((c = getopt(argc, argv, "cCe:E:f:F:hi:lnN:pP:r:w:")) != EOF) {
 		switch (c) {
 		case 'c':
 			do_crash = 1;
@@ -236,6 +265,9 @@ int main(int argc, char *argv[])
 		case 'i':
 			ident = optarg;
 			break;
+		case 'l':
+			nsock = 1;
+			break;
 		case 'n':
 			do_background = 0;
 			do_pidfile--;
@@ -255,6 +287,9 @@ int main(int argc, char *argv[])
 			snprintf(cmd, sizeof(cmd), "initctl restart %s", optarg);
 			do_restart = 1;
 			break;
+		case 'w':
+			watchdog = atoi(optarg);
+			break;
 		default:
 			return usage(1);
 		}
@@ -286,6 +321,17 @@ int main(int argc, char *argv[])
 	else
 		inf("No notify socket ...");
 
+#ifdef HAVE_LIBSYSTEMD
+	if (nsock) {
+		int fd;
+
+		nsock = sd_listen_fds(0);
+		inf("Got %d sockets from LISTEN_FDS", nsock);
+		for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + nsock; fd++)
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+#endif
+
 	if (do_crash) {
 		inf("Simulating crash, exiting with code %d", EX_SOFTWARE);
 		exit(EX_SOFTWARE);
@@ -331,6 +377,15 @@ int main(int argc, char *argv[])
 		}
 
 		sleep(1);
+#ifdef HAVE_LIBSYSTEMD
+		if (nsock > 0)
+			drain(nsock);
+		if (watchdog > 0 && sd_watchdog_enabled(0, NULL) > 0) {
+			sd_notifyf(0, "WATCHDOG=1\nSTATUS=Watchdog kick, %d left", --watchdog);
+			if (!watchdog)
+				inf("Hanging, no more watchdog kicks ...");
+		}
+#endif
 		if (do_restart) {
 			inc_restarts();
 			if (system(cmd))
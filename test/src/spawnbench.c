@@ -0,0 +1,133 @@
+/*
+ * Micro-benchmark of process start engines
+ *
+ * Starts /bin/true over and over, waiting for each to exit, and reports
+ * tasks started per second with fork() + execve(), as service_fork()
+ * does, and with spawn() from src/spawn.c.  Also reported is the time
+ * the parent is blocked per start, which for PID 1 is what matters.
+ *
+ * The cost of fork() grows with the page tables of the parent, so this
+ * is repeated with increasingly large, touched, allocations to mimic a
+ * PID 1 that has been running for a while with many services.  Like a
+ * fragmented heap, these are mapped with 4 kiB pages, not huge pages.
+ *
+ * Links directly with src/spawn.c, no privileges are dropped and no
+ * cgroup is joined, so it can be run as a regular user.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+
+#define TASKS 2000
+#define MiB   (1024 * 1024)
+
+extern char **environ;
+
+static char *argv[] = { "true", NULL };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t start_fork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		execve("/bin/true", argv, environ);
+		_exit(1);
+	}
+
+	return pid;
+}
+
+static pid_t start_spawn(void)
+{
+	struct spawn sp = {
+		.cmd    = "/bin/true",
+		.argv   = argv,
+		.env    = environ,
+		.uid    = -1,
+		.gid    = -1,
+		.input  = -1,
+		.output = -1,
+		.cgfd   = -1,
+	};
+	pid_t pid;
+
+	pid = spawn(&sp);
+	if (pid > 0 && sp.failed) {
+		fprintf(stderr, "spawn() failed %s\n", sp.failed);
+		exit(1);
+	}
+
+	return pid;
+}
+
+static double bench(pid_t (*start)(void), double *blocked)
+{
+	double begin;
+	int i;
+
+	*blocked = 0;
+	begin = now();
+	for (i = 0; i < TASKS; i++) {
+		double t = now();
+		int status;
+		pid_t pid;
+
+		pid = start();
+		*blocked += now() - t;
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "Failed starting task %d\n", i);
+			exit(1);
+		}
+	}
+
+	*blocked = *blocked * 1e6 / TASKS;
+
+	return TASKS / (now() - begin);
+}
+
+int main(void)
+{
+	size_t sizes[] = { 0, 16, 64, 256 };
+	size_t i;
+
+	printf("%8s %20s %20s\n", "HEAP", "fork()", "spawn()");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t len = sizes[i] * MiB;
+		double f, s, fb, sb;
+		char *heap;
+
+		if (len) {
+			heap = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (heap == MAP_FAILED)
+				return 1;
+			madvise(heap, len, MADV_NOHUGEPAGE);
+			memset(heap, 1, len);	/* populate page tables */
+		}
+
+		f = bench(start_fork, &fb);
+		s = bench(start_spawn, &sb);
+		printf("%5zu MiB %6.0f/sec %6.0fus %6.0f/sec %6.0fus\n", sizes[i], f, fb, s, sb);
+
+		if (len)
+			munmap(heap, len);
+	}
+
+	return 0;
+}
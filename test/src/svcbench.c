@@ -0,0 +1,171 @@
+/*
+ * Micro-benchmark of svc_t lookups
+ *
+ * Registers an increasing number of services and measures the average
+ * cost of svc_find(), svc_find_by_pid(), svc_find_by_jobid(),
+ * svc_find_by_tty() and svc_find_by_pidfile().  With the lookup indexes
+ * in svc.c the cost should stay flat regardless of the number of
+ * services.
+ *
+ * Links directly with src/svc.c, the few symbols it needs from the rest
+ * of Finit are stubbed out below.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "svc.h"
+#include "cond.h"
+#include "schedule.h"
+
+#define LOOKUPS 1000000
+
+int bootstrap = 0;
+int runlevel  = 2;
+int debug     = 0;
+
+void logit(int prio, const char *fmt, ...)
+{
+	(void)prio;
+	(void)fmt;
+}
+
+char *mkcond(svc_t *svc, char *buf, size_t len)
+{
+	snprintf(buf, len, "pid/%s", svc_ident(svc, NULL, 0));
+	return buf;
+}
+
+void cond_clear(const char *cond)
+{
+	(void)cond;
+}
+
+void cond_deps_del(svc_t *svc)
+{
+	(void)svc;
+}
+
+void graph_cancel(svc_t *svc)
+{
+	(void)svc;
+}
+
+enum cond_state cond_get(const char *cond)
+{
+	(void)cond;
+	return COND_ON;
+}
+
+pid_t pid_file_read(const char *file)
+{
+	(void)file;
+	return 0;
+}
+
+char *sanitize(char *arg, size_t len)
+{
+	(void)len;
+	return arg;
+}
+
+int schedule_work(struct wq *work)
+{
+	(void)work;
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench(int num, svc_t **list, int type)
+{
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		svc_t *svc = list[(i * 7919u) % num];
+		svc_t *found = NULL;
+
+		switch (type) {
+		case 0:
+			found = svc_find(svc->name, svc->id);
+			break;
+		case 1:
+			found = svc_find_by_pid(svc->pid);
+			break;
+		case 2:
+			found = svc_find_by_jobid(svc->job, svc->id);
+			break;
+		case 3:
+			found = svc_find_by_tty(svc->dev);
+			break;
+		case 4:
+			found = svc_find_by_pidfile((char *)&svc->pidfile[1]);
+			break;
+		}
+
+		if (found != svc) {
+			fprintf(stderr, "Lookup %d of %s failed!\n", type, svc_ident(svc, NULL, 0));
+			exit(1);
+		}
+	}
+
+	return (now() - start) / LOOKUPS;
+}
+
+int main(void)
+{
+	int sizes[] = { 10, 100, 1000, 10000 };
+	size_t i;
+
+	printf("%8s %10s %10s %10s %10s %10s\n", "SERVICES", "NAME:ID", "PID", "JOB:ID", "TTY", "PIDFILE");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		int num = sizes[i];
+		svc_t **list;
+		int j;
+
+		list = calloc(num, sizeof(svc_t *));
+		if (!list)
+			return 1;
+
+		for (j = 0; j < num; j++) {
+			char cmd[32], name[32], id[8], dev[32], pidfile[64];
+
+			snprintf(cmd, sizeof(cmd), "/sbin/daemon%d", j / 4);
+			snprintf(name, sizeof(name), "daemon%d", j / 4);
+			snprintf(id, sizeof(id), "%d", j % 4);
+			snprintf(dev, sizeof(dev), "/dev/ttyS%d", j);
+			snprintf(pidfile, sizeof(pidfile), "!/run/%s-%s.pid", name, id);
+
+			list[j] = svc_new(cmd, name, id, SVC_TYPE_TTY);
+			if (!list[j])
+				return 1;
+
+			svc_set_pid(list[j], 1000 + j);
+			svc_set_dev(list[j], dev);
+			svc_set_pidfile(list[j], pidfile);
+		}
+
+		printf("%8d %8.1fns %8.1fns %8.1fns %8.1fns %8.1fns\n", num,
+		       bench(num, list, 0), bench(num, list, 1),
+		       bench(num, list, 2), bench(num, list, 3),
+		       bench(num, list, 4));
+
+		for (j = 0; j < num; j++)
+			svc_del(list[j]);
+		free(list);
+	}
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Verify that services are stopped in parallel on runlevel change.  The
+# services ignore their stop signal, so they are only collected after
+# SIGKILL.  With one shared deadline the runlevel change takes about one
+# kill delay, stopping them one by one would take the sum of them.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+    run "initctl reload"
+    run "initctl runlevel 2"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add chain of services that ignore their stop signal"
+run "echo \"service [2] name:a halt:SIGCONT kill:4 sleep 100 -- Service A\" > $FINIT_CONF"
+run "echo \"service [2] name:b halt:SIGCONT kill:4 <pid/a> sleep 100 -- Service B\" >> $FINIT_CONF"
+run "echo \"service [2] name:c halt:SIGCONT kill:4 <pid/b> sleep 100 -- Service C\" >> $FINIT_CONF"
+run "cat $FINIT_CONF"
+
+say 'Reload Finit'
+run "initctl reload"
+retry 'assert_status "a" "running"'
+retry 'assert_status "b" "running"'
+retry 'assert_status "c" "running"'
+
+sep 'Change runlevel, all services should be killed at the same time'
+start=$(date +%s)
+run "initctl runlevel 3"
+retry 'assert_status "a" "stopped"' 100 0.2
+retry 'assert_status "b" "stopped"' 100 0.2
+retry 'assert_status "c" "stopped"' 100 0.2
+elapsed=$(($(date +%s) - start))
+assert "Runlevel change within one kill delay ($elapsed sec)" "$elapsed" -lt 8
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Verify that stop:scripts run in the background, the service stays in
+# stopping state until the script is done, and Finit keeps responding.
+# A stop:script that does not complete in time is killed, along with
+# the service.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+    run "initctl reload"
+}
+
+state()
+{
+    texec initctl -p -t status | awk -v name="$1" '$2 == name { print $3 }'
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add services with slow, and hanging, stop:scripts"
+run "echo \"service [2345] name:slow stop:'sleep 3; kill \\\$MAINPID' sleep 100 -- Slow stop\" > $FINIT_CONF"
+run "echo \"service [2345] name:hang stop:2,'sleep 100' sleep 100 -- Hanging stop\" >> $FINIT_CONF"
+run "cat $FINIT_CONF"
+
+say 'Reload Finit'
+run "initctl reload"
+retry 'assert_status "slow" "running"'
+retry 'assert_status "hang" "running"'
+
+sep 'Stop slow service, Finit must respond while stop:script runs'
+run "initctl stop slow"
+assert "slow is stopping" "$(state slow)" = "stopping"
+assert "Finit responds" "$(texec initctl -p -t status | wc -l)" -gt 0
+sleep 1
+assert "slow still stopping" "$(state slow)" = "stopping"
+retry 'assert "slow is stopped" "$(state slow)" = "stopped"' 50 0.2
+
+sep 'Stop hanging service, stop:script is killed after 2 sec'
+run "initctl stop hang"
+assert "hang is stopping" "$(state hang)" = "stopping"
+retry 'assert "hang is stopped" "$(state hang)" = "stopped"' 50 0.2
+assert "stop:script killed" "$(texec pgrep -f 'sleep 100' | wc -l)" -eq 0
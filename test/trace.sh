@@ -0,0 +1,38 @@
+#!/bin/sh
+# Verify that service state changes are recorded in the boot timeline,
+# and that it can be exported as Chrome trace-event JSON and as SVG.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+    run "initctl reload"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+say "Add a service to trace"
+run "echo 'service [2345] name:traced sleep 100 -- Traced service' > $FINIT_CONF"
+
+say 'Reload Finit'
+run "initctl reload"
+retry 'assert_status "traced" "running"'
+
+sep
+run "initctl trace show traced"
+assert "traced start is recorded" \
+       "$(texec initctl -p trace show traced | awk '$4 == "traced" && $5 == "running"' | wc -l)" -ge 1
+
+json=$(texec initctl trace json)
+tid=$(echo "$json" | jq '.traceEvents[] | select(.name == "thread_name" and .args.name == "traced") | .tid')
+assert "traced has a timeline row" -n "$tid"
+assert "traced has a running span" \
+       "$(echo "$json" | jq "[.traceEvents[] | select(.tid == $tid and .ph == \"X\" and .name == \"running\")] | length")" -ge 1
+assert "runlevel changes are recorded" \
+       "$(echo "$json" | jq '[.traceEvents[] | select(.cat == "runlevel")] | length')" -ge 1
+
+assert "SVG output" "$(texec initctl trace svg | grep -c '<svg')" -eq 1
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Verify sd_notify() STATUS= and the software watchdog.  The service
+# sends WATCHDOG=1 and STATUS= for a few seconds, then hangs, so Finit
+# should kill and restart it.
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+test_teardown()
+{
+    say "Running test teardown."
+    run "rm -f $FINIT_CONF"
+    run "initctl reload"
+}
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/lib/setup.sh"
+
+if ! "$TEST_DIR/src/serv" -C | grep -q "libsystemd"; then
+    skip "serv built without libsystemd support"
+fi
+
+say "Add service with watchdog, hangs after 4 keep-alive messages"
+run "echo 'service log:stdout notify:systemd watchdog:2 serv -n -w 4 -- Watchdog' > $FINIT_CONF"
+run "initctl reload"
+retry 'assert_status "serv" "running"'
+retry 'assert_cond "service/serv/ready"'
+
+sep "Verify STATUS= and watchdog timeout are shown"
+retry 'assert "Status message" "$(texec initctl status serv | grep -c "Watchdog kick")" -eq 1'
+assert "Watchdog timeout" "$(texec initctl status serv | awk '/Watchdog :/{print $3}')" = "2"
+
+sep "Verify hung service is restarted by watchdog"
+pid=$(texec initctl status serv | awk '/PID :/{print $3}')
+retry 'assert_restarts 1 serv' 50 0.2
+retry 'assert_status "serv" "running"'
+assert "New PID" "$(texec initctl status serv | awk '/PID :/{print $3}')" != "$pid"